@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+#
+# This script builds the token database used by tokenized logging (LOG_TOKENIZED build flag).
+# It scans the sources for RINFO/RERROR log statements, reconstructs the complete format string
+# exactly as the log.h macros do, and computes the same FNV-1a hash that log_token_hash()
+# computes at compile time.  The database is written next to firmware.elf so it can be published
+# with each release in docs/firmware, and used by detokenize.py or the web UI to turn tokenized
+# log lines back into text.  A compressed copy is written into the web content build, so the
+# device serves the database for its own firmware at /logtokens.json, self-built images included.
+#
+# GPLv3 License
+#
+import os
+import re
+import sys
+import json
+import gzip
+
+# Paths are relative to the project directory, not to wherever the script is run from
+try:
+    Import("env")
+    projectdir = env.subst("$PROJECT_DIR")
+except NameError:
+    projectdir = os.path.dirname(os.path.abspath(__file__))
+
+sourcepaths = ["src", "lib/ratgdo"]
+webcontentpath = "src/www/build"
+
+# Must match the macros in lib/ratgdo/log.h
+prefixes = {
+    "RINFO": ">>> [%7d] RATGDO: ",
+    "RERROR": "!!! [%7d] RATGDO: ",
+}
+suffix = "\r\n"
+
+statement = re.compile(r'\b(RINFO|RERROR)\s*\(\s*((?:"(?:[^"\\\n]|\\.)*"\s*)+)')
+literal = re.compile(r'"((?:[^"\\\n]|\\.)*)"')
+
+
+def unescape(s):
+    return s.encode("latin-1").decode("unicode_escape")
+
+
+def fnv1a(s):
+    h = 0x811C9DC5
+    for b in s.encode("latin-1"):
+        h ^= b
+        h = (h * 0x01000193) & 0xFFFFFFFF
+    return h
+
+
+def build_tokens():
+    tokens = {}
+    for path in sourcepaths:
+        for root, dirs, files in os.walk(os.path.join(projectdir, path)):
+            # skip generated web content
+            dirs[:] = [d for d in dirs if d != "www"]
+            for file in files:
+                if not file.endswith((".c", ".cpp", ".h")):
+                    continue
+                with open(os.path.join(root, file), "r", encoding="utf-8") as f:
+                    text = f.read()
+                for m in statement.finditer(text):
+                    message = "".join(unescape(l) for l in literal.findall(m.group(2)))
+                    fmt = prefixes[m.group(1)] + message + suffix
+                    token = "%08X" % fnv1a(fmt)
+                    if token in tokens and tokens[token] != fmt:
+                        sys.exit("Log token collision between:\n  %r\n  %r" % (tokens[token], fmt))
+                    tokens[token] = fmt
+    return tokens
+
+
+def get_version():
+    with open(os.path.join(projectdir, "docs/manifest.json")) as f:
+        return json.load(f)["version"]
+
+
+def write_database(filename):
+    tokens = build_tokens()
+    database = {"version": get_version(), "hash": "fnv1a32", "tokens": tokens}
+    with open(filename, "w") as f:
+        json.dump(database, f, indent=1, sort_keys=True)
+    print("Log token database: %d tokens written to %s" % (len(tokens), filename))
+    return database
+
+
+# The database as a gzip'd PROGMEM array, served by web.cpp at /logtokens.json
+def write_web_content(database):
+    target = os.path.join(projectdir, webcontentpath)
+    os.makedirs(target, exist_ok=True)
+    data = gzip.compress(json.dumps(database, separators=(",", ":"), sort_keys=True).encode())
+    with open(os.path.join(target, "logtokens.h"), "w") as wf:
+        wf.write("/**************************************\n")
+        wf.write(" * Autogenerated DO NOT EDIT\n")
+        wf.write(" **************************************/\n")
+        wf.write("const unsigned char logtokens_json_gz[] PROGMEM = {\n")
+        for i in range(0, len(data), 12):
+            wf.write("  " + "".join("0x%02X," % b for b in data[i : i + 12]) + "\n")
+        wf.write("};\n")
+        wf.write("const unsigned int logtokens_json_gz_len = %d;\n" % len(data))
+    print("Log token database: %d bytes compressed into %s/logtokens.h" % (len(data), webcontentpath))
+
+
+try:
+    Import("env")
+    builddir = env.subst("$BUILD_DIR")
+    os.makedirs(builddir, exist_ok=True)
+    write_web_content(write_database(os.path.join(builddir, "firmware.tokens.json")))
+except NameError:
+    # Run standalone, e.g. python3 build_log_tokens.py firmware.tokens.json
+    if __name__ == "__main__":
+        write_database(sys.argv[1] if len(sys.argv) > 1 else "firmware.tokens.json")
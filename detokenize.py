@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+#
+# Convert tokenized log lines (firmware built with LOG_TOKENIZED) back into text.
+#
+# Reads log text from files or stdin, e.g. serial monitor output, viewlog.sh, /showlog,
+# /showrebootlog or /crashlog, and replaces each line starting with '$' with the original
+# log message.  Other lines are passed through unchanged.  The token database is the
+# firmware.tokens.json written by build_log_tokens.py, published with each release in
+# docs/firmware as homekit-ratgdo-<version>.tokens.json
+#
+#   ./viewlog.sh <ip-address> | ./detokenize.py -d docs/firmware/homekit-ratgdo-v1.6.0.tokens.json
+#   curl -s http://<ip-address>/crashlog | ./detokenize.py -d firmware.tokens.json
+#
+# GPLv3 License
+#
+import re
+import sys
+import json
+import struct
+import base64
+import argparse
+
+spec = re.compile(r"%([-+ #0]*)(\d+)?(?:\.(\d+))?(hh|h|ll|l|z|j|t|L)?([diouxXeEfgGcsp%])")
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def varint(self):
+        value = 0
+        shift = 0
+        while True:
+            b = self.data[self.pos]
+            self.pos += 1
+            value |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                return value
+
+    def float(self):
+        value = struct.unpack_from("<f", self.data, self.pos)[0]
+        self.pos += 4
+        return value
+
+    def string(self):
+        n = self.varint()
+        value = self.data[self.pos:self.pos + n].decode("utf-8", "replace")
+        self.pos += n
+        return value
+
+
+def format_record(fmt, args):
+    out = []
+    last = 0
+    for m in spec.finditer(fmt):
+        out.append(fmt[last:m.start()])
+        last = m.end()
+        flags, width, precision, length, conv = m.groups()
+        if conv == "%":
+            out.append("%")
+            continue
+        pyfmt = "%" + flags + (width or "") + ("." + precision if precision else "")
+        if conv == "s":
+            out.append((pyfmt + "s") % args.string())
+        elif conv in "eEfgG":
+            out.append((pyfmt + conv) % args.float())
+        else:
+            bits = 64 if length in ("ll", "j") else 32
+            value = args.varint() & ((1 << bits) - 1)
+            if conv in "di" and value >> (bits - 1):
+                value -= 1 << bits
+            if conv == "c":
+                out.append((pyfmt + "c") % chr(value))
+            elif conv == "p":
+                out.append("0x%08x" % value)
+            else:
+                out.append((pyfmt + ("d" if conv in "diu" else conv)) % value)
+    out.append(fmt[last:])
+    return "".join(out)
+
+
+def detokenize(line, tokens):
+    stripped = line.rstrip("\r\n")
+    if not stripped.startswith("$"):
+        return line
+    try:
+        record = base64.b64decode(stripped[1:], validate=True)
+        token = "%08X" % struct.unpack_from("<I", record)[0]
+        if token not in tokens:
+            return "[unknown log token %s] %s\n" % (token, stripped)
+        return format_record(tokens[token], Reader(record[4:])).rstrip("\r\n") + "\n"
+    except (ValueError, IndexError, struct.error):
+        return line
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert tokenized ratgdo log lines back into text")
+    parser.add_argument("-d", "--database", required=True, help="token database (firmware.tokens.json)")
+    parser.add_argument("files", nargs="*", help="log files to convert (default stdin)")
+    args = parser.parse_args()
+
+    with open(args.database) as f:
+        tokens = json.load(f)["tokens"]
+
+    files = [open(name, errors="replace") for name in args.files] or [sys.stdin]
+    for f in files:
+        for line in f:
+            sys.stdout.write(detokenize(line, tokens))
+            sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
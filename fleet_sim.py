@@ -0,0 +1,836 @@
+#!/usr/bin/env python3
+#
+# Fleet simulator.
+#
+# Runs hundreds of simulated ratgdo devices on one host, to test fleet tooling, SSE aggregation and
+# anything else that has to cope with many doors at once. Each device is a virtual Security+ 2.0
+# opener on its own pty, paired with a firmware instance on its own loopback TCP port. Door, light,
+# lock, motion and obstruction activity is driven from a script, or at random, on a virtual clock
+# that can run many times faster than real time.
+#
+#   ./fleet_sim.py --devices 500 --speed 60 --duration 86400 --cycles-per-day 8
+#   ./fleet_sim.py --devices 50 --script fleet.txt --base-port 9000 -v
+#   ./fleet_sim.py --devices 20 --firmware "./ratgdo_native --serial {pty} --port {port} --speed {speed}"
+#
+# There is no native build of the firmware yet, so by default each opener is paired with a stand-in
+# that speaks the firmware's side of the wire protocol and serves the parts of its web API that
+# fleet tooling uses: /status.json, /setgdo and SSE events from /rest/events/subscribe, in the same
+# format. With --firmware, the given command is run once per device instead, with {pty}, {port},
+# {index} and {speed} filled in.
+#
+# Devices are spread over one worker process per core, each running one event loop for all of its
+# devices. A script has one action per line:
+#
+#   # time(s)  devices  action
+#   10         all      open
+#   40         0-99     web:close
+#   60         10%      motion
+#
+# Devices are all, one index, a range or a random percentage. Actions are open, close, toggle,
+# stop, light_on, light_off, light_toggle, lock, unlock, motion, obstruct and clear, done at the
+# opener as a wall button or sensor would. With a web: prefix (open, close, light_on, light_off,
+# lock, unlock) they are posted to /setgdo instead, and the time until the opener sees the command
+# is reported.
+#
+import os
+import sys
+import time
+import tty
+import json
+import shlex
+import random
+import asyncio
+import argparse
+import resource
+import selectors
+import statistics
+import multiprocessing
+import urllib.parse
+
+PREAMBLE = b"\x55\x01\x00"
+CODE_LEN = 19
+
+# PacketCommand
+CMD_GET_STATUS = 0x080
+CMD_STATUS = 0x081
+CMD_LOCK = 0x18C
+CMD_DOOR_ACTION = 0x280
+CMD_LIGHT = 0x281
+CMD_MOTOR_ON = 0x284
+CMD_MOTION = 0x285
+CMD_GET_OPENINGS = 0x48B
+CMD_OPENINGS = 0x48C
+
+# DoorState on the wire
+DOOR_UNKNOWN = 0
+DOOR_OPEN = 1
+DOOR_CLOSED = 2
+DOOR_STOPPED = 3
+DOOR_OPENING = 4
+DOOR_CLOSING = 5
+
+# DoorAction, LightState and LockState
+ACTION_CLOSE = 0
+ACTION_OPEN = 1
+ACTION_TOGGLE = 2
+ACTION_STOP = 3
+SET_OFF = 0
+SET_ON = 1
+
+# As status.json reports them, HomeKit current door state order
+DOOR_NAMES = {DOOR_OPEN: "Open", DOOR_CLOSED: "Closed", DOOR_OPENING: "Opening", DOOR_CLOSING: "Closing",
+              DOOR_STOPPED: "Stopped"}
+
+OPENER_REPLY = 0.05         # s, opener answers a command or poll
+OPENER_STEP = 0.5           # s, door position update while moving
+LIGHT_TIMEOUT = 270         # s, the light goes off after the door moves
+MOTION_CLEAR = 5            # s, the firmware clears motion after the last message
+SSE_MAX_CHANNELS = 4
+SSE_HEARTBEAT = 1.0         # s
+DEFAULT_TRAVEL = 12.0       # s, fully open to fully closed
+
+OPENER_ACTIONS = ("open", "close", "toggle", "stop", "light_on", "light_off", "light_toggle", "lock", "unlock",
+                  "motion", "obstruct", "clear")
+WEB_ACTIONS = {"open": ("garageDoorState", "1"), "close": ("garageDoorState", "0"),
+               "light_on": ("garageLightOn", "1"), "light_off": ("garageLightOn", "0"),
+               "lock": ("garageLockState", "1"), "unlock": ("garageLockState", "0")}
+WEB_COMMANDS = {"garageDoorState": CMD_DOOR_ACTION, "garageLightOn": CMD_LIGHT, "garageLockState": CMD_LOCK}
+
+
+# Security+ 2.0 wireline codec, the same as the secplus library
+
+# indexed by the first two (order) and last two (invert) trits of a half's first byte
+SECPLUS2_ORDER = ((0, 2, 1), (2, 0, 1), (0, 1, 2), (1, 2, 0), (1, 0, 2), (2, 1, 0), (1, 2, 0), (2, 1, 0), (0, 1, 2))
+SECPLUS2_INVERT = ((1, 1, 0), (0, 1, 0), (0, 0, 1), (1, 1, 1), (1, 0, 1), (0, 1, 1), (1, 0, 0), (0, 0, 0), (1, 0, 1))
+
+
+def reverse28(v):
+    return int("{:028b}".format(v)[::-1], 2)
+
+
+def decode_half(h):
+    trits = [(h[0] >> (6 - 2 * i)) & 3 for i in range(4)]
+    if max(trits) > 2:
+        return None
+    order = SECPLUS2_ORDER[trits[0] * 3 + trits[1]]
+    invert = SECPLUS2_INVERT[trits[2] * 3 + trits[3]]
+    bits = int.from_bytes(h[1:8], "big")
+    streams = [0, 0, 0]
+    for i in range(54):
+        streams[i % 3] = (streams[i % 3] << 1) | ((bits >> (53 - i)) & 1)
+    parts = [0, 0, 0]
+    for i in range(3):
+        parts[order[i]] = streams[i] ^ 0x3FFFF if invert[i] else streams[i]
+    if parts[2] & 0xFF != h[0]:
+        return None
+    trits += [(parts[2] >> (16 - 2 * i)) & 3 for i in range(5)]
+    if 3 in trits:
+        return None
+    fixed = ((parts[0] >> 8) << 10) | (parts[1] >> 8)
+    data = ((parts[0] & 0xFF) << 8) | (parts[1] & 0xFF)
+    return trits, fixed, data
+
+
+def encode_half(trits, fixed, data):
+    header = (trits[0] << 6) | (trits[1] << 4) | (trits[2] << 2) | trits[3]
+    order = SECPLUS2_ORDER[trits[0] * 3 + trits[1]]
+    invert = SECPLUS2_INVERT[trits[2] * 3 + trits[3]]
+    parts = [((fixed >> 10) << 8) | (data >> 8), ((fixed & 0x3FF) << 8) | (data & 0xFF), header]
+    for i in range(5):
+        parts[2] |= trits[4 + i] << (16 - 2 * i)
+    streams = [parts[order[i]] ^ 0x3FFFF if invert[i] else parts[order[i]] for i in range(3)]
+    bits = 0
+    for i in range(54):
+        bits = (bits << 1) | ((streams[i % 3] >> (17 - i // 3)) & 1)
+    return bytes([header]) + bits.to_bytes(7, "big")
+
+
+def decode_wireline(buf):
+    if buf[:3] != PREAMBLE:
+        return None
+    first = decode_half(buf[3:11])
+    second = decode_half(buf[11:19])
+    if not first or not second:
+        return None
+    r1, f1, d1 = first
+    r2, f2, d2 = second
+    digits = [r2[8], r1[8], r2[4], r2[5], r2[6], r2[7], r1[4], r1[5], r1[6], r1[7],
+              r2[0], r2[1], r2[2], r2[3], r1[0], r1[1], r1[2], r1[3]]
+    v = 0
+    for d in digits:
+        v = v * 3 + d
+    if v >= 1 << 28:
+        return None
+    return reverse28(v), (f1 << 20) | f2, (d1 << 16) | d2
+
+
+def encode_wireline(rolling, fixed, data):
+    v = reverse28(rolling & 0xFFFFFFF)
+    d = [0] * 18
+    for i in range(17, -1, -1):
+        d[i] = v % 3
+        v //= 3
+    r2 = [d[10], d[11], d[12], d[13], d[2], d[3], d[4], d[5], d[0]]
+    r1 = [d[14], d[15], d[16], d[17], d[6], d[7], d[8], d[9], d[1]]
+    return PREAMBLE + encode_half(r1, fixed >> 20, data >> 16) + encode_half(r2, fixed & 0xFFFFF, data & 0xFFFF)
+
+
+def encode_packet(cmd, data, remote_id, rolling):
+    fixed = ((cmd & ~0xFF) << 24) | (remote_id & 0xFFFFFF)
+    return encode_wireline(rolling, fixed, (data & ~0xFF) | (cmd & 0xFF))
+
+
+# Returns (cmd, data, remote id, rolling), data without the command byte
+def decode_packet(buf):
+    decoded = decode_wireline(buf)
+    if not decoded:
+        return None
+    rolling, fixed, data = decoded
+    cmd = ((fixed >> 24) & 0xF00) | (data & 0xFF)
+    return cmd, data & 0xFFFFFF00, fixed & 0xFFFFFF, rolling
+
+
+def selftest():
+    # from test/test_packet
+    status = bytes([0x55, 0x01, 0x00, 0xA5, 0x2F, 0xB3, 0xDB, 0xCE, 0x8F, 0x5B, 0x0C, 0x40, 0x34, 0xB9, 0x71, 0x96,
+                    0x73, 0xFD, 0xBA])
+    cmd, data, remote, rolling = decode_packet(status)
+    assert (cmd, remote, rolling) == (CMD_STATUS, 0x52402A, 0x17702), (hex(cmd), hex(remote), hex(rolling))
+    assert (data >> 8) & 0xF == DOOR_CLOSED and (data >> 22) & 1 and (data >> 25) & 1 and not (data >> 24) & 1
+    door_action = bytes([0x55, 0x01, 0x00, 0xA0, 0x37, 0xDF, 0x77, 0xB6, 0xFB, 0xED, 0xB0, 0x88, 0x22, 0x91, 0x05,
+                         0x21, 0x72, 0x4D, 0x2C])
+    data = (ACTION_TOGGLE << 8) | (0b1000 << 12) | (1 << 16) | (1 << 24)
+    assert encode_packet(CMD_DOOR_ACTION, data, 0x539, 0x48) == door_action
+    for rolling in (0, 1, 0x48, 0xABCDEF, 0xFFFFFFF):
+        assert decode_packet(encode_packet(CMD_LIGHT, 0x12345600, 0xABCDEF, rolling)) == (CMD_LIGHT, 0x12345600, 0xABCDEF, rolling)
+    print("codec ok")
+
+
+class SimClock:
+    """Simulated seconds since the run started, `speed` times real time"""
+
+    def __init__(self, speed, epoch):
+        self.speed = speed
+        self.epoch = epoch      # time.time() at simulated 0, the same in every worker
+
+    def now(self):
+        return (time.time() - self.epoch) * self.speed
+
+    async def sleep(self, seconds):
+        await asyncio.sleep(max(0, seconds) / self.speed)
+
+    async def sleep_until(self, t):
+        await self.sleep(t - self.now())
+
+    def call_later(self, seconds, callback, *args):
+        return asyncio.get_running_loop().call_later(max(0, seconds) / self.speed, callback, *args)
+
+
+class Stats:
+    COUNTERS = ("opener_rx", "opener_tx", "device_rx", "device_tx", "bad_packets", "pty_dropped", "status_changes",
+                "sse_events", "sse_bytes", "http_requests", "actions", "web_failures", "door_cycles")
+
+    def __init__(self):
+        for c in self.COUNTERS:
+            setattr(self, c, 0)
+        self.command_ms = []        # simulated, /setgdo to the opener seeing the command
+        self.lag_ms = 0.0           # real, worst event loop lag
+
+    def result(self):
+        r = {c: getattr(self, c) for c in self.COUNTERS}
+        r["command_ms"] = self.command_ms
+        r["lag_ms"] = self.lag_ms
+        return r
+
+
+class PtyLink:
+    """Security+ 2.0 packets over one end of a pty"""
+
+    def __init__(self, fd, remote_id, on_packet, stats, rx, tx):
+        self.fd = fd
+        self.remote_id = remote_id
+        self.rolling = random.randrange(1 << 20)
+        self.on_packet = on_packet
+        self.stats = stats
+        self.rx, self.tx = rx, tx
+        self.window = b""
+        self.buf = None
+        os.set_blocking(fd, False)
+        asyncio.get_running_loop().add_reader(fd, self.readable)
+
+    def readable(self):
+        try:
+            data = os.read(self.fd, 1024)
+        except (BlockingIOError, InterruptedError):
+            return
+        except OSError:
+            self.close()
+            return
+        for b in data:
+            # the same framing as SecPlus2Reader, scan for the preamble then take 16 bytes
+            if self.buf is None:
+                self.window = (self.window + bytes([b]))[-3:]
+                if self.window == PREAMBLE:
+                    self.buf = bytearray(PREAMBLE)
+                continue
+            self.buf.append(b)
+            if len(self.buf) == CODE_LEN:
+                pkt = decode_packet(bytes(self.buf))
+                self.buf = None
+                self.window = b""
+                if pkt:
+                    setattr(self.stats, self.rx, getattr(self.stats, self.rx) + 1)
+                    self.on_packet(*pkt)
+                else:
+                    self.stats.bad_packets += 1
+
+    def send(self, cmd, data=0):
+        self.rolling = (self.rolling + 1) & 0xFFFFFFF
+        try:
+            os.write(self.fd, encode_packet(cmd, data, self.remote_id, self.rolling))
+            setattr(self.stats, self.tx, getattr(self.stats, self.tx) + 1)
+        except (BlockingIOError, OSError):
+            self.stats.pty_dropped += 1
+
+    def close(self):
+        asyncio.get_running_loop().remove_reader(self.fd)
+
+
+class VirtualOpener:
+    """A Security+ 2.0 opener: door travel, light, lock, motion and obstruction"""
+
+    def __init__(self, index, sim, fd, travel, stats):
+        self.index = index
+        self.sim = sim
+        self.travel = travel
+        self.stats = stats
+        self.link = PtyLink(fd, random.randrange(1 << 24), self.on_packet, stats, "opener_rx", "opener_tx")
+        self.door = DOOR_CLOSED
+        self.position = 0.0         # 0 closed, 1 open
+        self.last_direction = -1
+        self.light = False
+        self.lock = False
+        self.obstructed = False
+        self.openings = random.randrange(1000)
+        self.moving = None
+        self.light_timer = None
+        self.expect = []            # (command, simulated time posted) from web actions
+
+    def status_data(self):
+        return ((self.door << 8) | (int(self.obstructed) << 22) | (int(self.lock) << 24) |
+                (int(self.light) << 25))
+
+    def send_status(self):
+        self.link.send(CMD_STATUS, self.status_data())
+
+    def reply(self, cmd, data=0):
+        self.sim.call_later(OPENER_REPLY, self.link.send, cmd, data)
+
+    def on_packet(self, cmd, data, remote, rolling):
+        for i, (want, t0) in enumerate(self.expect):
+            if want == cmd:
+                self.stats.command_ms.append((self.sim.now() - t0) * 1000)
+                del self.expect[i]
+                break
+        arg = (data >> 8) & 0x3
+        if cmd == CMD_GET_STATUS:
+            self.reply(CMD_STATUS, self.status_data())
+        elif cmd == CMD_GET_OPENINGS:
+            self.reply(CMD_OPENINGS, ((self.openings >> 8) << 16) | ((self.openings & 0xFF) << 24))
+        elif cmd == CMD_DOOR_ACTION:
+            # the button press, not its release
+            if (data >> 16) & 1:
+                self.sim.call_later(OPENER_REPLY, self.door_action, arg)
+        elif cmd == CMD_LIGHT:
+            self.sim.call_later(OPENER_REPLY, self.set_light, arg)
+        elif cmd == CMD_LOCK:
+            self.sim.call_later(OPENER_REPLY, self.set_lock, arg)
+
+    def door_action(self, action):
+        if action == ACTION_TOGGLE:
+            if self.moving:
+                action = ACTION_STOP
+            elif self.door == DOOR_CLOSED:
+                action = ACTION_OPEN
+            elif self.door == DOOR_OPEN:
+                action = ACTION_CLOSE
+            else:
+                action = ACTION_CLOSE if self.last_direction > 0 else ACTION_OPEN
+        if action == ACTION_STOP:
+            if self.moving:
+                self.moving.cancel()
+                self.moving = None
+                self.door = DOOR_STOPPED
+                self.send_status()
+            return
+        direction = 1 if action == ACTION_OPEN else -1
+        if (direction > 0 and self.door == DOOR_OPEN) or (direction < 0 and self.door == DOOR_CLOSED):
+            self.send_status()
+            return
+        if direction < 0 and self.obstructed:
+            # won't close with the beam broken
+            return
+        if self.moving:
+            self.moving.cancel()
+        self.moving = asyncio.get_running_loop().create_task(self.move(direction))
+
+    async def move(self, direction):
+        self.last_direction = direction
+        self.door = DOOR_OPENING if direction > 0 else DOOR_CLOSING
+        self.link.send(CMD_MOTOR_ON)
+        self.travel_light()
+        self.send_status()
+        while True:
+            await self.sim.sleep(OPENER_STEP)
+            if direction < 0 and self.obstructed:
+                # reverse back to open
+                direction = 1
+                self.last_direction = direction
+                self.door = DOOR_OPENING
+                self.send_status()
+            self.position = min(1.0, max(0.0, self.position + direction * OPENER_STEP / self.travel))
+            if self.position in (0.0, 1.0):
+                break
+        self.door = DOOR_OPEN if direction > 0 else DOOR_CLOSED
+        if direction > 0:
+            self.openings += 1
+        else:
+            self.stats.door_cycles += 1
+        self.moving = None
+        self.send_status()
+
+    def travel_light(self):
+        if not self.light:
+            self.light = True
+            if self.light_timer:
+                self.light_timer.cancel()
+            self.light_timer = self.sim.call_later(LIGHT_TIMEOUT, self.light_off)
+
+    def light_off(self):
+        self.light_timer = None
+        if self.light:
+            self.light = False
+            self.send_status()
+
+    def set_light(self, arg):
+        if self.light_timer:
+            self.light_timer.cancel()
+            self.light_timer = None
+        self.light = not self.light if arg > SET_ON else arg == SET_ON
+        self.send_status()
+
+    def set_lock(self, arg):
+        self.lock = not self.lock if arg > SET_ON else arg == SET_ON
+        self.send_status()
+
+    # An action at the opener itself, a wall button, remote or sensor
+    def act(self, action):
+        if action in ("open", "close", "toggle", "stop"):
+            self.door_action({"open": ACTION_OPEN, "close": ACTION_CLOSE, "toggle": ACTION_TOGGLE,
+                              "stop": ACTION_STOP}[action])
+        elif action.startswith("light_"):
+            self.set_light({"light_on": SET_ON, "light_off": SET_OFF, "light_toggle": ACTION_TOGGLE}[action])
+        elif action in ("lock", "unlock"):
+            self.set_lock(SET_ON if action == "lock" else SET_OFF)
+        elif action == "motion":
+            self.link.send(CMD_MOTION)
+            if not self.light:
+                self.travel_light()
+                self.send_status()
+        elif action in ("obstruct", "clear"):
+            self.obstructed = action == "obstruct"
+            self.send_status()
+
+    def close(self):
+        if self.moving:
+            self.moving.cancel()
+        self.link.close()
+
+
+class DeviceModel:
+    """Stands in for a firmware instance: the firmware's side of the wire, status.json, setgdo and SSE"""
+
+    def __init__(self, index, sim, fd, port, stats):
+        self.index = index
+        self.sim = sim
+        self.port = port
+        self.stats = stats
+        self.link = PtyLink(fd, random.randrange(1 << 24), self.on_packet, stats, "device_rx", "device_tx")
+        self.status = {"door": None, "light": None, "lock": None, "obstructed": None}
+        self.motion = False
+        self.motion_timer = None
+        self.channels = [None] * SSE_MAX_CHANNELS      # client id, or None
+        self.listeners = {}                             # channel -> queue
+        self.server = None
+
+    async def start(self):
+        self.server = await asyncio.start_server(self.handle_http, "127.0.0.1", self.port)
+        self.link.send(CMD_GET_STATUS)
+
+    def fields(self):
+        s = self.status
+        return {"deviceName": "ratgdo-sim-%04d" % self.index, "upTime": int(self.sim.now() * 1000),
+                "garageDoorState": DOOR_NAMES.get(s["door"], "Unknown"),
+                "garageLockState": "Unknown" if s["lock"] is None else ("Secured" if s["lock"] else "Unsecured"),
+                "garageLightOn": bool(s["light"]), "garageMotion": self.motion, "garageObstructed": bool(s["obstructed"])}
+
+    def broadcast(self, changed):
+        if not self.listeners:
+            return
+        changed["upTime"] = int(self.sim.now() * 1000)
+        msg = ("event: message\nretry: 15000\ndata: %s\n\n" % json.dumps(changed)).encode()
+        for q in self.listeners.values():
+            q.put_nowait(msg)
+
+    def on_packet(self, cmd, data, remote, rolling):
+        if cmd == CMD_STATUS:
+            new = {"door": (data >> 8) & 0xF, "light": bool((data >> 25) & 1), "lock": bool((data >> 24) & 1),
+                   "obstructed": bool((data >> 22) & 1)}
+            if new != self.status:
+                self.stats.status_changes += 1
+                before = self.fields()
+                self.status = new
+                after = self.fields()
+                self.broadcast({k: v for k, v in after.items() if before[k] != v})
+        elif cmd == CMD_MOTION:
+            if self.motion_timer:
+                self.motion_timer.cancel()
+            self.motion_timer = self.sim.call_later(MOTION_CLEAR, self.clear_motion)
+            if not self.motion:
+                self.motion = True
+                self.broadcast({"garageMotion": True})
+            self.link.send(CMD_GET_STATUS)
+
+    def clear_motion(self):
+        self.motion_timer = None
+        self.motion = False
+        self.broadcast({"garageMotion": False})
+
+    def setgdo(self, key, value):
+        if key == "garageDoorState":
+            action = (ACTION_OPEN if value == "1" else ACTION_CLOSE) << 8
+            self.link.send(CMD_DOOR_ACTION, action | (1 << 16) | (1 << 24))
+            self.sim.call_later(0.25, self.link.send, CMD_DOOR_ACTION, action | (1 << 24))
+        elif key == "garageLightOn":
+            self.link.send(CMD_LIGHT, (SET_ON if value == "1" else SET_OFF) << 8)
+        elif key == "garageLockState":
+            self.link.send(CMD_LOCK, (SET_ON if value == "1" else SET_OFF) << 8)
+        else:
+            return False
+        self.sim.call_later(0.5, self.link.send, CMD_GET_STATUS)
+        return True
+
+    async def handle_http(self, reader, writer):
+        self.stats.http_requests += 1
+        try:
+            request = await reader.readline()
+            method, target, _ = request.decode().split(" ", 2)
+            length = 0
+            while True:
+                line = await reader.readline()
+                if line in (b"\r\n", b"\n", b""):
+                    break
+                name, _, value = line.decode().partition(":")
+                if name.strip().lower() == "content-length":
+                    length = int(value)
+            body = (await reader.readexactly(length)).decode() if length else ""
+            path, _, query = target.partition("?")
+            args = urllib.parse.parse_qs(query)
+            if method == "GET" and path == "/status.json":
+                await self.respond(writer, 200, "application/json", json.dumps(self.fields()))
+            elif method == "POST" and path == "/setgdo":
+                ok = all(self.setgdo(k, v[0]) for k, v in urllib.parse.parse_qs(body).items())
+                await self.respond(writer, 200 if ok else 400, "text/plain", "OK" if ok else "Bad request")
+            elif method == "GET" and path == "/rest/events/subscribe" and "id" in args:
+                await self.subscribe(writer, args["id"][0])
+            elif method == "GET" and path.startswith("/rest/events/"):
+                await self.listen(writer, path[len("/rest/events/"):])
+                return
+            else:
+                await self.respond(writer, 404, "text/plain", "Not found")
+        except (ValueError, ConnectionError, asyncio.IncompleteReadError):
+            pass
+        finally:
+            writer.close()
+
+    async def respond(self, writer, code, content_type, body):
+        body = body.encode()
+        writer.write(b"HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %d\r\nConnection: close\r\n\r\n" %
+                     (code, b"OK" if code == 200 else b"Error", content_type.encode(), len(body)) + body)
+        await writer.drain()
+
+    async def subscribe(self, writer, client_id):
+        if client_id in self.channels:
+            channel = self.channels.index(client_id)
+        elif None in self.channels:
+            channel = self.channels.index(None)
+            self.channels[channel] = client_id
+        else:
+            await self.respond(writer, 404, "text/plain", "Not found")
+            return
+        await self.respond(writer, 200, "text/plain", "/rest/events/%d" % channel)
+
+    async def listen(self, writer, channel):
+        if not channel.isdigit() or int(channel) >= SSE_MAX_CHANNELS or self.channels[int(channel)] is None:
+            await self.respond(writer, 404, "text/plain", "Not found")
+            writer.close()
+            return
+        channel = int(channel)
+        q = asyncio.Queue()
+        self.listeners[channel] = q
+        heartbeat = asyncio.get_running_loop().create_task(self.heartbeat(q))
+        try:
+            writer.write(b"HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n\r\n")
+            while True:
+                msg = await q.get()
+                writer.write(msg)
+                await writer.drain()
+                self.stats.sse_events += 1
+                self.stats.sse_bytes += len(msg)
+        except ConnectionError:
+            pass
+        finally:
+            heartbeat.cancel()
+            if self.listeners.get(channel) is q:
+                del self.listeners[channel]
+                self.channels[channel] = None
+            writer.close()
+
+    async def heartbeat(self, q):
+        while True:
+            await self.sim.sleep(SSE_HEARTBEAT)
+            q.put_nowait(("event: message\nretry: 15000\ndata: %s\n\n" %
+                          json.dumps({"upTime": int(self.sim.now() * 1000)})).encode())
+
+    def close(self):
+        self.link.close()
+        if self.server:
+            self.server.close()
+
+
+async def post_setgdo(port, key, value):
+    body = urllib.parse.urlencode({key: value}).encode()
+    reader, writer = await asyncio.open_connection("127.0.0.1", port)
+    try:
+        writer.write(b"POST /setgdo HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+                     b"Content-Length: %d\r\nConnection: close\r\n\r\n" % len(body) + body)
+        await writer.drain()
+        status = await reader.readline()
+        return status.split(b" ")[1] == b"200"
+    finally:
+        writer.close()
+
+
+def parse_script(path):
+    actions = []
+    with open(path) as f:
+        for n, line in enumerate(f, 1):
+            line = line.split("#", 1)[0].strip()
+            if not line:
+                continue
+            try:
+                t, devices, action = line.split()
+                t = float(t)
+            except ValueError:
+                sys.exit("%s:%d: expected <time> <devices> <action>" % (path, n))
+            name = action[4:] if action.startswith("web:") else action
+            if name not in (WEB_ACTIONS if action.startswith("web:") else OPENER_ACTIONS):
+                sys.exit("%s:%d: unknown action %s" % (path, n, action))
+            actions.append((t, devices, action))
+    return sorted(actions)
+
+
+def select_devices(spec, indexes, rng):
+    if spec in ("all", "*"):
+        return indexes
+    if spec.endswith("%"):
+        pct = float(spec[:-1])
+        return [i for i in indexes if rng.random() * 100 < pct]
+    if "-" in spec:
+        lo, hi = spec.split("-")
+        return [i for i in indexes if int(lo) <= i <= int(hi)]
+    return [i for i in indexes if i == int(spec)]
+
+
+class Worker:
+    """The devices of one worker process, on one event loop"""
+
+    def __init__(self, number, args, epoch):
+        self.number = number
+        self.args = args
+        self.sim = SimClock(args.speed, epoch)
+        self.stats = Stats()
+        self.openers = {}
+        self.devices = {}
+        self.procs = []
+        self.rng = random.Random(args.seed * 1000 + number)
+
+    async def setup(self):
+        for i in range(self.number, self.args.devices, self.args.workers):
+            master, slave = os.openpty()
+            tty.setraw(slave)
+            port = self.args.base_port + i
+            self.openers[i] = VirtualOpener(i, self.sim, master, self.args.travel, self.stats)
+            if self.args.firmware:
+                cmd = self.args.firmware.format(pty=os.ttyname(slave), port=port, index=i, speed=self.args.speed)
+                self.procs.append(await asyncio.create_subprocess_exec(*shlex.split(cmd)))
+            else:
+                self.devices[i] = DeviceModel(i, self.sim, slave, port, self.stats)
+                await self.devices[i].start()
+            if self.args.verbose:
+                print("device %d: port %d, pty %s" % (i, port, os.ttyname(slave)))
+
+    async def do(self, i, action):
+        self.stats.actions += 1
+        if not action.startswith("web:"):
+            self.openers[i].act(action)
+            return
+        key, value = WEB_ACTIONS[action[4:]]
+        self.openers[i].expect.append((WEB_COMMANDS[key], self.sim.now()))
+        try:
+            if not await post_setgdo(self.args.base_port + i, key, value):
+                self.stats.web_failures += 1
+        except OSError:
+            self.stats.web_failures += 1
+
+    async def run_script(self, script):
+        loop = asyncio.get_running_loop()
+        for t, spec, action in script:
+            await self.sim.sleep_until(t)
+            for i in select_devices(spec, list(self.openers), self.rng):
+                loop.create_task(self.do(i, action))
+
+    async def random_activity(self, i):
+        # door cycles and motion at random, with the door left open for a few minutes
+        day = 86400.0
+        while True:
+            rates = [(self.args.cycles_per_day, "cycle"), (self.args.motion_per_day, "motion")]
+            total = sum(r for r, _ in rates)
+            if not total:
+                return
+            await self.sim.sleep(self.rng.expovariate(total / day))
+            pick = self.rng.random() * total
+            kind = rates[0][1] if pick < rates[0][0] else rates[1][1]
+            if kind == "motion":
+                await self.do(i, "motion")
+                continue
+            web = self.rng.random() < self.args.web_fraction
+            await self.do(i, "web:open" if web else "open")
+            await self.sim.sleep(self.args.travel + self.rng.uniform(30, 600))
+            await self.do(i, "web:close" if web else "close")
+
+    async def watch_lag(self):
+        # how late the event loop runs a callback, in real time
+        while True:
+            t0 = time.monotonic()
+            await asyncio.sleep(0.05)
+            self.stats.lag_ms = max(self.stats.lag_ms, (time.monotonic() - t0 - 0.05) * 1000)
+
+    async def run(self, script):
+        await self.setup()
+        if self.sim.now() > 0:
+            print("worker %d started its devices %.1f s late, raise --setup" % (self.number, self.sim.now() / self.sim.speed))
+        await self.sim.sleep_until(0)
+        loop = asyncio.get_running_loop()
+        tasks = [loop.create_task(self.watch_lag())]
+        if script:
+            tasks.append(loop.create_task(self.run_script(script)))
+        else:
+            tasks += [loop.create_task(self.random_activity(i)) for i in self.openers]
+        await self.sim.sleep_until(self.args.duration)
+        for t in tasks:
+            t.cancel()
+        for o in self.openers.values():
+            o.close()
+        for d in self.devices.values():
+            d.close()
+        for p in self.procs:
+            p.terminate()
+            await p.wait()
+        return self.stats.result()
+
+
+def run_worker(number, args, epoch, script, results):
+    # every device needs a pty pair and a socket or two
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+    random.seed(args.seed * 1000 + number)
+    if sys.platform == "darwin":
+        # kqueue does not support ptys on macOS
+        loop = asyncio.SelectorEventLoop(selectors.SelectSelector())
+    else:
+        loop = asyncio.new_event_loop()
+    try:
+        results.put(loop.run_until_complete(Worker(number, args, epoch).run(script)))
+    finally:
+        loop.close()
+
+
+def percentile(values, pct):
+    if not values:
+        return float("nan")
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * pct / 100))]
+
+
+def report(args, results, elapsed):
+    total = {c: sum(r[c] for r in results) for c in Stats.COUNTERS}
+    command_ms = [ms for r in results for ms in r["command_ms"]]
+    print("%d devices on %d workers, %.0f s simulated at %gx in %.1f s" % (args.devices, args.workers, args.duration,
+                                                                        args.speed, elapsed))
+    print("actions %d, door cycles %d, status changes %d" % (total["actions"], total["door_cycles"],
+                                                             total["status_changes"]))
+    print("packets: opener rx %d tx %d, device rx %d tx %d, bad %d, dropped %d" % (
+        total["opener_rx"], total["opener_tx"], total["device_rx"], total["device_tx"], total["bad_packets"],
+        total["pty_dropped"]))
+    print("web: %d requests, %d failed, SSE %d events %d bytes" % (total["http_requests"], total["web_failures"],
+                                                                   total["sse_events"], total["sse_bytes"]))
+    if command_ms:
+        print("setgdo to opener, simulated ms: p50 %.0f p90 %.0f p99 %.0f max %.0f (%d commands)" % (
+            percentile(command_ms, 50), percentile(command_ms, 90), percentile(command_ms, 99), max(command_ms),
+            len(command_ms)))
+    lag = [r["lag_ms"] for r in results]
+    print("event loop lag, real ms: mean %.1f worst %.1f" % (statistics.mean(lag), max(lag)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Fleet simulator, many virtual openers and devices on one host")
+    parser.add_argument("--devices", type=int, default=100, help="number of devices (default: 100)")
+    parser.add_argument("--workers", type=int, default=os.cpu_count(), help="worker processes (default: one per core)")
+    parser.add_argument("--speed", type=float, default=1.0, help="simulated seconds per real second (default: 1)")
+    parser.add_argument("--duration", type=float, help="simulated seconds to run (default: 600, or to the end of the script)")
+    parser.add_argument("--base-port", type=int, default=8100, help="device N listens on this + N (default: 8100)")
+    parser.add_argument("--script", help="scripted actions, otherwise random activity")
+    parser.add_argument("--cycles-per-day", type=float, default=8, help="random door cycles per device per day")
+    parser.add_argument("--motion-per-day", type=float, default=40, help="random motion events per device per day")
+    parser.add_argument("--web-fraction", type=float, default=0.5, help="share of random door cycles done through setgdo")
+    parser.add_argument("--travel", type=float, default=DEFAULT_TRAVEL, help="door travel time in seconds")
+    parser.add_argument("--firmware", help="command to run per device instead of the built-in stand-in")
+    parser.add_argument("--setup", type=float, default=3.0, help="real seconds allowed to start all devices")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--selftest", action="store_true", help="check the packet codec and exit")
+    parser.add_argument("-v", "--verbose", action="store_true", help="list each device's port and pty")
+    args = parser.parse_args()
+
+    if args.selftest:
+        selftest()
+        return
+    args.workers = max(1, min(args.workers, args.devices))
+    script = parse_script(args.script) if args.script else None
+    if args.duration is None:
+        args.duration = script[-1][0] + args.travel * 2 if script else 600
+
+    epoch = time.time() + args.setup
+    results = multiprocessing.Queue()
+    workers = [multiprocessing.Process(target=run_worker, args=(n, args, epoch, script, results))
+               for n in range(args.workers)]
+    for w in workers:
+        w.start()
+    collected = [results.get() for _ in workers]
+    for w in workers:
+        w.join()
+    report(args, collected, time.time() - epoch)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,597 @@
+#!/usr/bin/env python3
+#
+# HomeKit controller load simulator.
+#
+# Acts as one or more HomeKit controllers against the ratgdo HAP server (or any HAP accessory):
+# pair-setup once, then open many concurrent pair-verified sessions that subscribe to door, light
+# and lock events. Each step of the ramp reports pair-verify latency, the latency from a
+# characteristic write on one session to the event arriving on every other session, and the free
+# heap reported by /status.json, so that the session count where verification fails, events go
+# missing or the heap runs low can be found.
+#
+#   ./hap_load.py pair <ip-address> 251-02-023            # once, saves hap_load.json
+#   ./hap_load.py load <ip-address> --sessions 1,2,4,8 --events 10
+#   ./hap_load.py unpair <ip-address>
+#
+# Extra controllers are added with --controllers (as the admin, like sharing a home) so that the
+# sessions come from distinct pairings, and are removed again at the end of the run.
+#
+# Needs the python cryptography package (pip install cryptography).
+#
+import os
+import sys
+import json
+import time
+import queue
+import socket
+import struct
+import hashlib
+import argparse
+import threading
+import statistics
+import urllib.request
+
+from cryptography.hazmat.primitives import hashes
+from cryptography.hazmat.primitives.kdf.hkdf import HKDF
+from cryptography.hazmat.primitives.ciphers.aead import ChaCha20Poly1305
+from cryptography.hazmat.primitives.asymmetric import ed25519, x25519
+from cryptography.hazmat.primitives import serialization
+
+HAP_PORT = 5556
+
+# TLV8 types
+TLV_METHOD = 0x00
+TLV_IDENTIFIER = 0x01
+TLV_SALT = 0x02
+TLV_PUBLIC_KEY = 0x03
+TLV_PROOF = 0x04
+TLV_ENCRYPTED_DATA = 0x05
+TLV_STATE = 0x06
+TLV_ERROR = 0x07
+TLV_SIGNATURE = 0x0A
+TLV_PERMISSIONS = 0x0B
+
+METHOD_PAIR_SETUP = 0
+METHOD_ADD_PAIRING = 3
+METHOD_REMOVE_PAIRING = 4
+
+# Characteristics we subscribe to, by short HAP type
+CHAR_CURRENT_DOOR = "E"
+CHAR_TARGET_DOOR = "32"
+CHAR_LIGHT_ON = "25"
+CHAR_LOCK_CURRENT = "1D"
+SUBSCRIBE = (CHAR_CURRENT_DOOR, CHAR_TARGET_DOOR, CHAR_LIGHT_ON, CHAR_LOCK_CURRENT)
+
+# SRP-6a 3072 bit group from RFC 5054, generator 5, SHA-512
+SRP_N = int(
+    "FFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74020BBEA63B139B22514A08798E3404DD"
+    "EF9519B3CD3A431B302B0A6DF25F14374FE1356D6D51C245E485B576625E7EC6F44C42E9A637ED6B0BFF5CB6F406B7ED"
+    "EE386BFB5A899FA5AE9F24117C4B1FE649286651ECE45B3DC2007CB8A163BF0598DA48361C55D39A69163FA8FD24CF5F"
+    "83655D23DCA3AD961C62F356208552BB9ED529077096966D670C354E4ABC9804F1746C08CA18217C32905E462E36CE3B"
+    "E39E772C180E86039B2783A2EC07A28FB5C55DF06F4C52C9DE2BCBF6955817183995497CEA956AE515D2261898FA0510"
+    "15728E5A8AAAC42DAD33170D04507A33A85521ABDF1CBA64ECFB850458DBEF0A8AEA71575D060C7DB3970F85A6E1E4C7"
+    "ABF5AE8CDB0933D71E8C94E04A25619DCEE3D2261AD2EE6BF12FFA06D98A0864D87602733EC86A64521F2B18177B200C"
+    "BBE117577A615D6C770988C0BAD946E208E24FA074E5AB3143DB5BFCE0FD108E4B82D120A93AD2CAFFFFFFFFFFFFFFFF", 16)
+SRP_G = 5
+SRP_LEN = 384
+
+
+def tlv_encode(items):
+    out = bytearray()
+    for t, v in items:
+        if isinstance(v, int):
+            v = bytes([v])
+        if not v:
+            out += bytes([t, 0])
+        for i in range(0, len(v), 255):
+            chunk = v[i:i + 255]
+            out += bytes([t, len(chunk)]) + chunk
+    return bytes(out)
+
+
+def tlv_decode(data):
+    items = {}
+    pos = 0
+    last = None
+    while pos + 2 <= len(data):
+        t, n = data[pos], data[pos + 1]
+        v = data[pos + 2:pos + 2 + n]
+        pos += 2 + n
+        # consecutive items of the same type are fragments of one value
+        if t == last and t in items:
+            items[t] += v
+        else:
+            items[t] = v
+        last = t
+    return items
+
+
+def to_bytes(n, length=None):
+    b = n.to_bytes((n.bit_length() + 7) // 8 or 1, "big")
+    return b.rjust(length, b"\0") if length else b
+
+
+def sha512(*parts):
+    h = hashlib.sha512()
+    for p in parts:
+        h.update(p)
+    return h.digest()
+
+
+def hkdf(key, salt, info):
+    return HKDF(algorithm=hashes.SHA512(), length=32, salt=salt, info=info).derive(key)
+
+
+def nonce(label):
+    return b"\0\0\0\0" + label
+
+
+class SrpClient:
+    def __init__(self, password, username=b"Pair-Setup"):
+        self.username = username
+        self.password = password
+        self.a = int.from_bytes(os.urandom(32), "big")
+        self.A = pow(SRP_G, self.a, SRP_N)
+
+    def process(self, salt, B_bytes):
+        B = int.from_bytes(B_bytes, "big")
+        if B % SRP_N == 0:
+            raise RuntimeError("bad SRP public key from accessory")
+        k = int.from_bytes(sha512(to_bytes(SRP_N), to_bytes(SRP_G, SRP_LEN)), "big")
+        u = int.from_bytes(sha512(to_bytes(self.A, SRP_LEN), to_bytes(B, SRP_LEN)), "big")
+        x = int.from_bytes(sha512(salt, sha512(self.username + b":" + self.password)), "big")
+        S = pow(B - k * pow(SRP_G, x, SRP_N), self.a + u * x, SRP_N)
+        self.K = sha512(to_bytes(S))
+        hng = bytes(a ^ b for a, b in zip(sha512(to_bytes(SRP_N)), sha512(to_bytes(SRP_G))))
+        self.M1 = sha512(hng, sha512(self.username), salt, to_bytes(self.A), B_bytes, self.K)
+        self.M2 = sha512(to_bytes(self.A), self.M1, self.K)
+        return to_bytes(self.A), self.M1
+
+
+class Controller:
+    """A pairing: our identity and the accessory's long term public key."""
+
+    def __init__(self, pairing_id, private_key, accessory_id=None, accessory_ltpk=None):
+        self.pairing_id = pairing_id
+        self.key = private_key
+        self.accessory_id = accessory_id
+        self.accessory_ltpk = accessory_ltpk
+
+    @classmethod
+    def new(cls):
+        return cls(("hap-load-" + os.urandom(4).hex()).encode(), ed25519.Ed25519PrivateKey.generate())
+
+    @property
+    def ltpk(self):
+        return self.key.public_key().public_bytes(serialization.Encoding.Raw, serialization.PublicFormat.Raw)
+
+    def to_json(self):
+        return {
+            "pairing_id": self.pairing_id.decode(),
+            "private_key": self.key.private_bytes(serialization.Encoding.Raw, serialization.PrivateFormat.Raw,
+                                                  serialization.NoEncryption()).hex(),
+            "accessory_id": self.accessory_id.decode(),
+            "accessory_ltpk": self.accessory_ltpk.hex(),
+        }
+
+    @classmethod
+    def from_json(cls, j):
+        return cls(j["pairing_id"].encode(), ed25519.Ed25519PrivateKey.from_private_bytes(bytes.fromhex(j["private_key"])),
+                   j["accessory_id"].encode(), bytes.fromhex(j["accessory_ltpk"]))
+
+
+class HttpReader:
+    """Incremental HTTP/1.1 message parser (Content-Length or chunked), for responses and EVENTs."""
+
+    def __init__(self):
+        self.buf = b""
+
+    def feed(self, data):
+        self.buf += data
+        messages = []
+        while True:
+            end = self.buf.find(b"\r\n\r\n")
+            if end < 0:
+                return messages
+            head = self.buf[:end].decode("latin-1").split("\r\n")
+            headers = {}
+            for line in head[1:]:
+                k, _, v = line.partition(":")
+                headers[k.strip().lower()] = v.strip()
+            rest = self.buf[end + 4:]
+            if headers.get("transfer-encoding", "").lower() == "chunked":
+                body = b""
+                pos = 0
+                while True:
+                    eol = rest.find(b"\r\n", pos)
+                    if eol < 0:
+                        return messages
+                    size = int(rest[pos:eol].split(b";")[0], 16)
+                    if len(rest) < eol + 2 + size + 2:
+                        return messages
+                    body += rest[eol + 2:eol + 2 + size]
+                    pos = eol + 2 + size + 2
+                    if size == 0:
+                        break
+                self.buf = rest[pos:]
+            else:
+                n = int(headers.get("content-length", "0"))
+                if len(rest) < n:
+                    return messages
+                body = rest[:n]
+                self.buf = rest[n:]
+            messages.append((head[0], headers, body))
+
+
+class Session:
+    """One HAP connection. Plain HTTP until pair-verify completes, then encrypted."""
+
+    def __init__(self, host, port, timeout=10):
+        self.host = host
+        self.sock = socket.create_connection((host, port), timeout=timeout)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.reader = HttpReader()
+        self.write_key = None
+        self.read_key = None
+        self.write_count = 0
+        self.read_count = 0
+        self.raw = b""
+        self.responses = queue.Queue()
+        self.events = queue.Queue()
+        self.thread = None
+        self.closed = False
+
+    def close(self):
+        self.closed = True
+        try:
+            self.sock.shutdown(socket.SHUT_RDWR)
+        except OSError:
+            pass
+        self.sock.close()
+
+    # --- framing
+
+    def _send(self, data):
+        if not self.write_key:
+            self.sock.sendall(data)
+            return
+        out = b""
+        for i in range(0, len(data), 1024):
+            chunk = data[i:i + 1024]
+            aad = struct.pack("<H", len(chunk))
+            n = b"\0\0\0\0" + struct.pack("<Q", self.write_count)
+            self.write_count += 1
+            out += aad + ChaCha20Poly1305(self.write_key).encrypt(n, chunk, aad)
+        self.sock.sendall(out)
+
+    def _recv(self):
+        data = self.sock.recv(4096)
+        if not data:
+            raise ConnectionError("connection closed by accessory")
+        if not self.read_key:
+            return data
+        self.raw += data
+        out = b""
+        while len(self.raw) >= 2:
+            n = struct.unpack("<H", self.raw[:2])[0]
+            if len(self.raw) < 2 + n + 16:
+                break
+            aad = self.raw[:2]
+            nn = b"\0\0\0\0" + struct.pack("<Q", self.read_count)
+            self.read_count += 1
+            out += ChaCha20Poly1305(self.read_key).decrypt(nn, self.raw[2:2 + n + 16], aad)
+            self.raw = self.raw[2 + n + 16:]
+        return out
+
+    def _dispatch(self, data):
+        for msg in self.reader.feed(data):
+            if msg[0].startswith("EVENT/"):
+                self.events.put((time.monotonic(), json.loads(msg[2] or b"{}")))
+            else:
+                self.responses.put(msg)
+
+    def _reader_loop(self):
+        try:
+            while not self.closed:
+                self._dispatch(self._recv())
+        except (OSError, ConnectionError, ValueError) as e:
+            if not self.closed:
+                self.responses.put(("ERROR", {}, str(e).encode()))
+
+    def request(self, method, path, body=b"", content_type=None, timeout=10):
+        head = "%s %s HTTP/1.1\r\nHost: %s\r\n" % (method, path, self.host)
+        if content_type:
+            head += "Content-Type: %s\r\n" % content_type
+        head += "Content-Length: %d\r\n\r\n" % len(body)
+        self._send(head.encode() + body)
+        if self.thread:
+            status, headers, rbody = self.responses.get(timeout=timeout)
+        else:
+            while True:
+                msgs = self.reader.feed(self._recv())
+                if msgs:
+                    status, headers, rbody = msgs[0]
+                    break
+        if status == "ERROR":
+            raise ConnectionError(rbody.decode())
+        code = int(status.split(" ")[1])
+        return code, rbody
+
+    def tlv(self, path, items):
+        code, body = self.request("POST", path, tlv_encode(items), "application/pairing+tlv8")
+        r = tlv_decode(body)
+        if code >= 300 or TLV_ERROR in r:
+            raise RuntimeError("%s failed: HTTP %d, TLV error %s" % (path, code, r.get(TLV_ERROR, b"").hex()))
+        return r
+
+    # --- pairing
+
+    def pair_setup(self, setup_code):
+        controller = Controller.new()
+        r = self.tlv("/pair-setup", [(TLV_STATE, 1), (TLV_METHOD, METHOD_PAIR_SETUP)])
+        srp = SrpClient(setup_code.encode())
+        A, M1 = srp.process(r[TLV_SALT], r[TLV_PUBLIC_KEY])
+        r = self.tlv("/pair-setup", [(TLV_STATE, 3), (TLV_PUBLIC_KEY, A), (TLV_PROOF, M1)])
+        if r[TLV_PROOF] != srp.M2:
+            raise RuntimeError("accessory SRP proof mismatch")
+
+        key = hkdf(srp.K, b"Pair-Setup-Encrypt-Salt", b"Pair-Setup-Encrypt-Info")
+        x = hkdf(srp.K, b"Pair-Setup-Controller-Sign-Salt", b"Pair-Setup-Controller-Sign-Info")
+        sig = controller.key.sign(x + controller.pairing_id + controller.ltpk)
+        sub = tlv_encode([(TLV_IDENTIFIER, controller.pairing_id), (TLV_PUBLIC_KEY, controller.ltpk),
+                          (TLV_SIGNATURE, sig)])
+        enc = ChaCha20Poly1305(key).encrypt(nonce(b"PS-Msg05"), sub, None)
+        r = self.tlv("/pair-setup", [(TLV_STATE, 5), (TLV_ENCRYPTED_DATA, enc)])
+
+        sub = tlv_decode(ChaCha20Poly1305(key).decrypt(nonce(b"PS-Msg06"), r[TLV_ENCRYPTED_DATA], None))
+        controller.accessory_id = sub[TLV_IDENTIFIER]
+        controller.accessory_ltpk = sub[TLV_PUBLIC_KEY]
+        x = hkdf(srp.K, b"Pair-Setup-Accessory-Sign-Salt", b"Pair-Setup-Accessory-Sign-Info")
+        ed25519.Ed25519PublicKey.from_public_bytes(controller.accessory_ltpk).verify(
+            sub[TLV_SIGNATURE], x + controller.accessory_id + controller.accessory_ltpk)
+        return controller
+
+    def pair_verify(self, controller):
+        eph = x25519.X25519PrivateKey.generate()
+        pub = eph.public_key().public_bytes(serialization.Encoding.Raw, serialization.PublicFormat.Raw)
+        r = self.tlv("/pair-verify", [(TLV_STATE, 1), (TLV_PUBLIC_KEY, pub)])
+        acc_pub = r[TLV_PUBLIC_KEY]
+        shared = eph.exchange(x25519.X25519PublicKey.from_public_bytes(acc_pub))
+        key = hkdf(shared, b"Pair-Verify-Encrypt-Salt", b"Pair-Verify-Encrypt-Info")
+
+        sub = tlv_decode(ChaCha20Poly1305(key).decrypt(nonce(b"PV-Msg02"), r[TLV_ENCRYPTED_DATA], None))
+        if sub[TLV_IDENTIFIER] != controller.accessory_id:
+            raise RuntimeError("pair-verify: unexpected accessory %s" % sub[TLV_IDENTIFIER])
+        ed25519.Ed25519PublicKey.from_public_bytes(controller.accessory_ltpk).verify(
+            sub[TLV_SIGNATURE], acc_pub + controller.accessory_id + pub)
+
+        sig = controller.key.sign(pub + controller.pairing_id + acc_pub)
+        sub = tlv_encode([(TLV_IDENTIFIER, controller.pairing_id), (TLV_SIGNATURE, sig)])
+        enc = ChaCha20Poly1305(key).encrypt(nonce(b"PV-Msg03"), sub, None)
+        self.tlv("/pair-verify", [(TLV_STATE, 3), (TLV_ENCRYPTED_DATA, enc)])
+
+        self.write_key = hkdf(shared, b"Control-Salt", b"Control-Write-Encryption-Key")
+        self.read_key = hkdf(shared, b"Control-Salt", b"Control-Read-Encryption-Key")
+        self.thread = threading.Thread(target=self._reader_loop, daemon=True)
+        self.thread.start()
+
+    def pairing(self, method, controller, admin=False):
+        items = [(TLV_STATE, 1), (TLV_METHOD, method), (TLV_IDENTIFIER, controller.pairing_id)]
+        if method == METHOD_ADD_PAIRING:
+            items += [(TLV_PUBLIC_KEY, controller.ltpk), (TLV_PERMISSIONS, 1 if admin else 0)]
+        self.tlv("/pairings", items)
+
+    # --- characteristics
+
+    def accessories(self):
+        code, body = self.request("GET", "/accessories")
+        if code != 200:
+            raise RuntimeError("GET /accessories: HTTP %d" % code)
+        return json.loads(body)
+
+    def put_characteristics(self, chars):
+        code, body = self.request("PUT", "/characteristics", json.dumps({"characteristics": chars}).encode(),
+                                  "application/hap+json")
+        if code not in (200, 204, 207):
+            raise RuntimeError("PUT /characteristics: HTTP %d %s" % (code, body))
+
+
+def short_type(t):
+    # "00000025-0000-1000-8000-0026BB765291" -> "25"
+    return t.split("-")[0].lstrip("0").upper() if "-" in t else t.upper()
+
+
+def find_characteristics(accessories):
+    found = {}
+    for acc in accessories["accessories"]:
+        for svc in acc["services"]:
+            for c in svc["characteristics"]:
+                t = short_type(c["type"])
+                if t in SUBSCRIBE and t not in found:
+                    found[t] = (acc["aid"], c["iid"], c.get("value"))
+    return found
+
+
+def device_heap(host):
+    try:
+        with urllib.request.urlopen("http://%s/status.json" % host, timeout=5) as r:
+            status = json.loads(r.read())
+        return status.get("freeHeap"), status.get("minHeap")
+    except (OSError, ValueError):
+        return None, None
+
+
+def percentile(values, pct):
+    if not values:
+        return float("nan")
+    values = sorted(values)
+    return values[min(len(values) - 1, int(round(pct / 100 * (len(values) - 1))))]
+
+
+def load_pairings(path):
+    with open(path) as f:
+        return Controller.from_json(json.load(f))
+
+
+def cmd_pair(args):
+    s = Session(args.host, args.port)
+    controller = s.pair_setup(args.setup_code)
+    s.close()
+    with open(args.file, "w") as f:
+        json.dump(controller.to_json(), f, indent=2)
+    print("paired with %s, saved to %s" % (controller.accessory_id.decode(), args.file))
+
+
+def cmd_unpair(args):
+    admin = load_pairings(args.file)
+    s = Session(args.host, args.port)
+    s.pair_verify(admin)
+    s.pairing(METHOD_REMOVE_PAIRING, admin)
+    s.close()
+    os.remove(args.file)
+    print("unpaired")
+
+
+def open_session(args, controller, result):
+    t0 = time.monotonic()
+    try:
+        s = Session(args.host, args.port, timeout=args.timeout)
+        s.pair_verify(controller)
+        result["verify_ms"] = (time.monotonic() - t0) * 1000
+        result["session"] = s
+    except Exception as e:  # noqa: BLE001 - any failure is a data point
+        result["error"] = "%s: %s" % (type(e).__name__, e)
+
+
+def cmd_load(args):
+    admin = load_pairings(args.file)
+
+    # extra controllers, so sessions don't all share one pairing
+    controllers = [admin]
+    if args.controllers > 1:
+        s = Session(args.host, args.port)
+        s.pair_verify(admin)
+        for _ in range(args.controllers - 1):
+            c = Controller.new()
+            c.accessory_id, c.accessory_ltpk = admin.accessory_id, admin.accessory_ltpk
+            s.pairing(METHOD_ADD_PAIRING, c)
+            controllers.append(c)
+        s.close()
+
+    # a control session writes the light to generate events
+    control = Session(args.host, args.port)
+    control.pair_verify(admin)
+    chars = find_characteristics(control.accessories())
+    if CHAR_LIGHT_ON not in chars:
+        sys.exit("no light characteristic found to generate events with")
+    light_aid, light_iid, light = chars[CHAR_LIGHT_ON]
+    light = bool(light)
+
+    print("%8s %8s %8s %8s %8s %8s %8s %8s %9s %8s" % ("sessions", "failed", "verify50", "verify90", "verifymx",
+                                                       "event50", "event90", "lost", "freeHeap", "minHeap"))
+    sessions = []
+    broken = None
+    try:
+        for target in [int(n) for n in args.sessions.split(",")]:
+            # open the new sessions all at once
+            results = [{} for _ in range(target - len(sessions))]
+            threads = [threading.Thread(target=open_session, args=(args, controllers[(len(sessions) + i) % len(controllers)], r))
+                       for i, r in enumerate(results)]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+            failed = [r["error"] for r in results if "error" in r]
+            verify = [r["verify_ms"] for r in results if "verify_ms" in r]
+            new = [r["session"] for r in results if "session" in r]
+            for s in new:
+                s.put_characteristics([{"aid": aid, "iid": iid, "ev": True} for aid, iid, _ in chars.values()])
+            sessions += new
+
+            # event latency: toggle the light from the control session, time each session's event
+            latencies = []
+            lost = 0
+            for _ in range(args.events):
+                for s in sessions:
+                    while not s.events.empty():
+                        s.events.get_nowait()
+                light = not light
+                t0 = time.monotonic()
+                control.put_characteristics([{"aid": light_aid, "iid": light_iid, "value": light}])
+                deadline = t0 + args.event_timeout
+                for s in sessions:
+                    got = None
+                    while got is None:
+                        try:
+                            ts, ev = s.events.get(timeout=max(0, deadline - time.monotonic()))
+                        except queue.Empty:
+                            break
+                        for c in ev.get("characteristics", []):
+                            if c.get("iid") == light_iid and c.get("aid") == light_aid and bool(c.get("value")) == light:
+                                got = ts
+                    if got is None:
+                        lost += 1
+                    else:
+                        latencies.append((got - t0) * 1000)
+                time.sleep(args.interval)
+
+            free_heap, min_heap = device_heap(args.host)
+            print("%8d %8d %8.0f %8.0f %8.0f %8.0f %8.0f %8d %9s %8s" % (
+                len(sessions), len(failed), percentile(verify, 50), percentile(verify, 90),
+                max(verify) if verify else float("nan"), percentile(latencies, 50), percentile(latencies, 90),
+                lost, free_heap, min_heap))
+            for e in sorted(set(failed)):
+                print("         %s" % e)
+
+            if failed or lost or (free_heap is not None and free_heap < args.min_heap):
+                broken = target
+                break
+    finally:
+        for s in sessions:
+            s.close()
+        control.close()
+        if len(controllers) > 1:
+            s = Session(args.host, args.port)
+            s.pair_verify(admin)
+            for c in controllers[1:]:
+                s.pairing(METHOD_REMOVE_PAIRING, c)
+            s.close()
+
+    if broken:
+        print("broke at %d sessions" % broken)
+    else:
+        print("no failures up to %d sessions" % len(sessions))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="HomeKit controller load simulator")
+    parser.add_argument("-f", "--file", default="hap_load.json", help="pairing file (default: hap_load.json)")
+    parser.add_argument("-p", "--port", type=int, default=HAP_PORT, help="HAP port (default: %d)" % HAP_PORT)
+    sub = parser.add_subparsers(dest="cmd", required=True)
+
+    p = sub.add_parser("pair", help="pair-setup as a new admin controller")
+    p.add_argument("host")
+    p.add_argument("setup_code", help="setup code, e.g. 251-02-023")
+    p.set_defaults(func=cmd_pair)
+
+    p = sub.add_parser("unpair", help="remove our pairing from the accessory")
+    p.add_argument("host")
+    p.set_defaults(func=cmd_unpair)
+
+    p = sub.add_parser("load", help="ramp up concurrent sessions")
+    p.add_argument("host")
+    p.add_argument("--sessions", default="1,2,4,6,8,12,16", help="session counts to ramp through")
+    p.add_argument("--controllers", type=int, default=1, help="distinct controller pairings to use")
+    p.add_argument("--events", type=int, default=5, help="light toggles per step")
+    p.add_argument("--interval", type=float, default=1.0, help="seconds between toggles")
+    p.add_argument("--event-timeout", type=float, default=10.0, help="seconds to wait for each event")
+    p.add_argument("--timeout", type=float, default=30.0, help="socket timeout for pair-verify")
+    p.add_argument("--min-heap", type=int, default=8000, help="stop when free heap drops below this")
+    p.set_defaults(func=cmd_load)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,149 @@
+// GPLv3 License
+
+#ifndef _BIT_FIELD_H
+#define _BIT_FIELD_H
+
+#include <stdint.h>
+#include <type_traits>
+
+// Bit layouts of packet data words.
+//
+// A field is a run of bits in a 32-bit word, `BitField<Shift, Width, T>`. A layout binds fields to
+// the members of a struct, and decoding, encoding, comparison and compact packing are generated
+// from that one list:
+//
+//   struct LockCommandData {
+//       LockState lock;
+//       uint8_t parity;
+//
+//       typedef BitLayout<LockCommandData,
+//           Bits<BitField<8, 2, LockState>, &LockCommandData::lock>,
+//           Bits<ParityField, &LockCommandData::parity>> Layout;
+//   };
+//
+// Fields may not overlap, which is checked at compile time. Everything is constexpr and folds down
+// to the same shifts and masks that would be written by hand. As with those, values put into a
+// field aren't clipped to its width, a value that doesn't fit spills into the bits above.
+//
+// `compact()` packs the fields back to back in the order they are listed, so a word with a few
+// fields spread across it becomes a small number, which varint encodes (tokenized logging) in one
+// or two bytes. `expand()` undoes it.
+
+// `Width` bits from bit `Shift`, as a T
+template <uint8_t Shift, uint8_t Width, typename T>
+struct BitField {
+    static_assert(Width > 0 && Shift + Width <= 32, "field must fit in 32 bits");
+
+    typedef T type;
+    static constexpr uint8_t shift = Shift;
+    static constexpr uint8_t width = Width;
+    static constexpr uint32_t bits = Width == 32 ? 0xFFFFFFFF : (1u << Width) - 1;
+    static constexpr uint32_t mask = bits << Shift;
+
+    static constexpr T get(uint32_t data) {
+        return static_cast<T>((data >> Shift) & bits);
+    }
+
+    static constexpr uint32_t put(T value) {
+        return static_cast<uint32_t>(value) << Shift;
+    }
+};
+
+// A 16-bit value sent high byte first, the high byte at `Shift` and the low byte above it
+template <uint8_t Shift, typename T>
+struct SwappedBitField {
+    static_assert(Shift + 16 <= 32, "field must fit in 32 bits");
+
+    typedef T type;
+    static constexpr uint8_t shift = Shift;
+    static constexpr uint8_t width = 16;
+    static constexpr uint32_t bits = 0xFFFF;
+    static constexpr uint32_t mask = bits << Shift;
+
+    static constexpr T get(uint32_t data) {
+        return static_cast<T>(((data >> Shift) & 0xFF) << 8 | ((data >> (Shift + 8)) & 0xFF));
+    }
+
+    static constexpr uint32_t put(T value) {
+        uint32_t v = static_cast<uint32_t>(value);
+        return ((v >> 8) & 0xFF) << Shift | (v & 0xFF) << (Shift + 8);
+    }
+};
+
+// Parity is applicable to all incoming packets; outgoing packets leave this unset
+typedef BitField<12, 4, uint8_t> ParityField;
+
+template <typename M>
+struct member_of;
+
+template <typename S, typename T>
+struct member_of<T S::*> {
+    typedef S owner;
+    typedef T type;
+};
+
+// A field stored in `Member`
+template <typename Field, auto Member>
+struct Bits {
+    typedef Field field;
+    typedef typename member_of<decltype(Member)>::owner owner;
+    static_assert(std::is_same<typename Field::type, typename member_of<decltype(Member)>::type>::value,
+                  "field and member types differ");
+
+    static constexpr auto member = Member;
+
+    static constexpr uint32_t put(const owner& s) { return Field::put(s.*Member); }
+    static constexpr void get(owner& s, uint32_t data) { s.*Member = Field::get(data); }
+};
+
+template <typename... Fs>
+constexpr bool bit_fields_disjoint() {
+    uint32_t seen = 0;
+    bool disjoint = true;
+    ((disjoint = disjoint && !(seen & Fs::field::mask), seen |= Fs::field::mask), ...);
+    return disjoint;
+}
+
+template <typename S, typename... Fs>
+struct BitLayout {
+    static_assert(sizeof...(Fs) <= 32, "too many fields");
+    static_assert(bit_fields_disjoint<Fs...>(), "fields overlap");
+
+    // every bit covered by a field
+    static constexpr uint32_t mask = (Fs::field::mask | ... | 0);
+
+    static constexpr void decode(S& s, uint32_t data) {
+        (Fs::get(s, data), ...);
+    }
+
+    static constexpr uint32_t encode(const S& s) {
+        return (Fs::put(s) | ... | 0);
+    }
+
+    // Equal as sent
+    static constexpr bool equal(const S& a, const S& b) {
+        return encode(a) == encode(b);
+    }
+
+    // Bit n set if the nth field differs
+    static constexpr uint32_t diff(const S& a, const S& b) {
+        uint32_t changed = 0;
+        uint8_t n = 0;
+        ((changed |= static_cast<uint32_t>(Fs::put(a) != Fs::put(b)) << n, n++), ...);
+        return changed;
+    }
+
+    static constexpr uint32_t compact(const S& s) {
+        uint32_t packed = 0;
+        uint8_t pos = 0;
+        ((packed |= (Fs::put(s) >> Fs::field::shift) << pos, pos += Fs::field::width), ...);
+        return packed;
+    }
+
+    static constexpr void expand(S& s, uint32_t packed) {
+        uint8_t pos = 0;
+        ((Fs::get(s, ((packed >> pos) & Fs::field::bits) << Fs::field::shift), pos += Fs::field::width), ...);
+    }
+};
+
+#endif // _BIT_FIELD_H
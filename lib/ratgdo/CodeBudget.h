@@ -0,0 +1,199 @@
+// GPLv3 License
+
+#ifndef _CODE_BUDGET_H
+#define _CODE_BUDGET_H
+
+#include <stdint.h>
+#include "Packet.h"
+
+// Outbound rolling code budget.
+//
+// Every Security+ 2.0 packet we send uses up a rolling code, and every few codes the rolling code
+// is written to flash. Bursts of internal activity (motion storms that each ask for status, the
+// time-to-close light flashing, repeated HomeKit sets) can burn through codes quickly, so outbound
+// packets draw from a token bucket. Door commands are never held back. Other commands wait for a
+// token, and status requests are dropped when the bucket runs low, since another one is always
+// close behind.
+//
+// A command waiting for a token waits at the head of the transmit queue, so two things keep the
+// queue moving. A door command queued behind it goes first (promote_critical), and a light command
+// made while another is still waiting changes that one rather than queueing a second, or drops it
+// when the light is already that way, so no code is spent on a no-op (merge_light).
+// The time-to-close warning flashes then slow to the refill rate instead of piling up ahead of the
+// door closing.
+
+#define CODE_BUDGET_CAPACITY 20     // burst size
+#define CODE_BUDGET_REFILL 1000     // ms per token
+#define CODE_BUDGET_RESERVE 5       // tokens kept back from status requests for commands
+
+enum class CodeClass : uint8_t {
+    Critical,       // door control, always sent
+    Command,        // light and lock, deferred when over budget
+    Background,     // status polls, dropped when over budget
+};
+
+enum class CodeDecision : uint8_t {
+    Send,
+    Defer,
+    Drop,
+};
+
+class CodeBudget {
+    private:
+        uint32_t m_tokens = CODE_BUDGET_CAPACITY;
+        uint32_t m_refill_time = 0;     // time of the last token added
+
+        // codes used per minute, exponentially weighted over about 8 minutes, in 1/16ths
+        uint32_t m_rate = 0;
+        uint32_t m_window_start = 0;
+        uint32_t m_window_count = 0;
+
+        void update(uint32_t now) {
+            uint32_t refills = (now - m_refill_time) / CODE_BUDGET_REFILL;
+            if (refills) {
+                m_tokens = (m_tokens + refills < CODE_BUDGET_CAPACITY) ? m_tokens + refills : CODE_BUDGET_CAPACITY;
+                m_refill_time += refills * CODE_BUDGET_REFILL;
+            }
+
+            uint32_t windows = (now - m_window_start) / 60000;
+            if (windows > 64) {
+                // idle long enough for the average to have decayed away
+                m_rate = 0;
+                m_window_count = 0;
+                m_window_start = now;
+            } else {
+                for (uint32_t i = 0; i < windows; i++) {
+                    m_rate = m_rate - m_rate / 8 + m_window_count * 2;
+                    m_window_count = 0;
+                    m_window_start += 60000;
+                }
+            }
+        }
+
+    public:
+        uint32_t used = 0;
+        uint32_t dropped = 0;
+
+        CodeBudget() = default;
+
+        void begin(uint32_t now) {
+            m_tokens = CODE_BUDGET_CAPACITY;
+            m_refill_time = now;
+            m_window_start = now;
+        }
+
+        static CodeClass classify(PacketCommand cmd) {
+            switch (cmd) {
+                case PacketCommand::DoorAction:
+                    return CodeClass::Critical;
+                case PacketCommand::GetStatus:
+                case PacketCommand::GetOpenings:
+                    return CodeClass::Background;
+                default:
+                    return CodeClass::Command;
+            }
+        }
+
+        // Whether a packet of class `cls` can go out now. Defer means try again later.
+        CodeDecision check(CodeClass cls, uint32_t now) {
+            update(now);
+            uint32_t needed = (cls == CodeClass::Background) ? CODE_BUDGET_RESERVE + 1 : 1;
+            if (cls == CodeClass::Critical || m_tokens >= needed) {
+                return CodeDecision::Send;
+            }
+            if (cls == CodeClass::Background) {
+                dropped++;
+                return CodeDecision::Drop;
+            }
+            return CodeDecision::Defer;
+        }
+
+        // A rolling code was used
+        void spend(uint32_t now) {
+            update(now);
+            if (m_tokens) {
+                m_tokens--;
+            }
+            used++;
+            m_window_count++;
+        }
+
+        // Moves the first door command behind the head of `acts` (queued packets, oldest first),
+        // along with the packets batched after it, to the front. False if there is none, or the head
+        // is one.
+        template<typename Action>
+        static bool promote_critical(Action* acts, uint8_t count) {
+            if (!count || classify(acts[0].pkt.m_pkt_cmd) == CodeClass::Critical) {
+                return false;
+            }
+            uint8_t first = 1;
+            while (first < count && classify(acts[first].pkt.m_pkt_cmd) != CodeClass::Critical) {
+                first++;
+            }
+            if (first == count) {
+                return false;
+            }
+            uint8_t last = first;
+            while (last + 1 < count && acts[last].batch) {
+                last++;
+            }
+            // rotate [0, last] so that [first, last] comes before [0, first)
+            for (uint8_t n = first; n > 0; n--) {
+                Action held = acts[0];
+                for (uint8_t i = 0; i < last; i++) {
+                    acts[i] = acts[i + 1];
+                }
+                acts[last] = held;
+            }
+            return true;
+        }
+
+        // Sets the light state of a light command in `acts` not yet sent, or removes it if `light`
+        // is what the light already is, `current`. False if there is none.
+        template<typename Action>
+        static bool merge_light(Action* acts, uint8_t& count, LightState light, bool current) {
+            for (uint8_t i = 0; i < count; i++) {
+                if (acts[i].pkt.m_pkt_cmd == PacketCommand::Light) {
+                    if ((light == LightState::On) == current) {
+                        for (count--; i < count; i++) {
+                            acts[i] = acts[i + 1];
+                        }
+                    } else {
+                        acts[i].pkt.m_data.value.light.light = light;
+                    }
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Position of the packet to make way for a door command in a full queue: the newest that
+        // is not one. `count` if every packet is a door command.
+        template<typename Action>
+        static uint8_t evict(const Action* acts, uint8_t count) {
+            for (uint8_t i = count; i > 0; i--) {
+                if (classify(acts[i - 1].pkt.m_pkt_cmd) != CodeClass::Critical) {
+                    return i - 1;
+                }
+            }
+            return count;
+        }
+
+        uint32_t tokens(uint32_t now) {
+            update(now);
+            return m_tokens;
+        }
+
+        uint32_t codes_per_hour(uint32_t now) {
+            update(now);
+            return m_rate * 60 / 16;
+        }
+
+        // Flash writes per day at the current rate, when the rolling code is saved every
+        // `codes_per_write` codes
+        uint32_t flash_writes_per_day(uint32_t now, uint32_t codes_per_write) {
+            return codes_per_hour(now) * 24 / codes_per_write;
+        }
+};
+
+#endif // _CODE_BUDGET_H
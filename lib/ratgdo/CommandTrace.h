@@ -0,0 +1,253 @@
+// GPLv3 License
+
+#ifndef _COMMAND_TRACE_H
+#define _COMMAND_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// End to end command tracing.
+//
+// A command (open the door, turn on the light...) is given a trace ID where it starts: HomeKit, a
+// web request or the time-to-close timer. The ID rides along in each PacketAction the command
+// queues, and we record when the first of its packets is queued, dequeued and sent, when the next
+// Status comes back from the opener and when that Status has been pushed out to HomeKit. Recent
+// traces are kept in a fixed ring, and the latency of each hop goes into a histogram so that
+// percentiles can be reported without keeping samples.
+
+#define CMD_TRACE_SIZE 16           // traces kept
+#define CMD_TRACE_BUCKETS 17        // histogram buckets: 0, 1, 2-3, 4-7 ... 32768+ ms
+#define CMD_TRACE_NONE 0xFFFF       // hop not reached
+
+enum class TraceOrigin : uint8_t {
+    None,
+    HomeKit,
+    Web,
+    TTC,
+};
+
+enum TraceHop : uint8_t {
+    TRACE_QUEUED,
+    TRACE_DEQUEUED,
+    TRACE_SENT,
+    TRACE_ACKED,        // next Status from the opener
+    TRACE_NOTIFIED,     // Status pushed to HomeKit
+    TRACE_HOPS,
+};
+
+struct CommandTraceRecord {
+    uint16_t id;
+    TraceOrigin origin;
+    uint8_t retries;                // failed transmits, e.g. collisions
+    uint16_t cmd;                   // PacketCommand of the first packet
+    uint32_t start;                 // ms
+    uint16_t at[TRACE_HOPS];        // ms after start
+};
+
+class CommandTrace {
+    private:
+        CommandTraceRecord m_trace[CMD_TRACE_SIZE];
+        uint16_t m_next_id = 1;
+        uint16_t m_current = 0;
+        uint16_t m_hist[TRACE_HOPS + 1][CMD_TRACE_BUCKETS] = {};   // each hop, then the total
+
+        CommandTraceRecord* find(uint16_t id) {
+            if (!id) {
+                return nullptr;
+            }
+            CommandTraceRecord* t = &m_trace[id % CMD_TRACE_SIZE];
+            return (t->id == id) ? t : nullptr;
+        }
+
+        static uint8_t bucket(uint32_t ms) {
+            uint8_t b = 0;
+            while (ms && b < CMD_TRACE_BUCKETS - 1) {
+                ms >>= 1;
+                b++;
+            }
+            return b;
+        }
+
+        void sample(uint8_t hist, uint32_t ms) {
+            uint16_t* h = m_hist[hist];
+            uint8_t b = bucket(ms);
+            if (h[b] == UINT16_MAX) {
+                // halve everything rather than saturate, keeps the shape
+                for (uint8_t i = 0; i < CMD_TRACE_BUCKETS; i++) {
+                    h[i] /= 2;
+                }
+            }
+            h[b]++;
+        }
+
+        // Record the hop, and its latency from the hop before, if it hasn't been reached yet
+        void mark(CommandTraceRecord* t, TraceHop hop, uint32_t now) {
+            if (t->at[hop] != CMD_TRACE_NONE) {
+                return;
+            }
+            uint32_t elapsed = now - t->start;
+            t->at[hop] = (elapsed < CMD_TRACE_NONE) ? elapsed : CMD_TRACE_NONE - 1;
+            // measure from the last hop reached
+            uint16_t prev = 0;
+            for (int8_t h = hop - 1; h >= 0; h--) {
+                if (t->at[h] != CMD_TRACE_NONE) {
+                    prev = t->at[h];
+                    break;
+                }
+            }
+            sample(hop, t->at[hop] - prev);
+            if (hop == TRACE_NOTIFIED) {
+                sample(TRACE_HOPS, t->at[hop]);
+            }
+        }
+
+    public:
+        CommandTrace() {
+            for (uint8_t i = 0; i < CMD_TRACE_SIZE; i++) {
+                m_trace[i].id = 0;
+            }
+        }
+
+        // Start a trace. Packets queued until end() carry its ID.
+        uint16_t start(TraceOrigin origin, uint32_t now) {
+            uint16_t id = m_next_id++;
+            if (!m_next_id) {
+                m_next_id = 1;
+            }
+            CommandTraceRecord* t = &m_trace[id % CMD_TRACE_SIZE];
+            t->id = id;
+            t->origin = origin;
+            t->retries = 0;
+            t->cmd = 0;
+            t->start = now;
+            for (uint8_t h = 0; h < TRACE_HOPS; h++) {
+                t->at[h] = CMD_TRACE_NONE;
+            }
+            m_current = id;
+            return id;
+        }
+
+        void end() { m_current = 0; }
+
+        uint16_t current() const { return m_current; }
+
+        void queued(uint16_t id, uint16_t cmd, uint32_t now) {
+            CommandTraceRecord* t = find(id);
+            if (t) {
+                if (t->at[TRACE_QUEUED] == CMD_TRACE_NONE) {
+                    t->cmd = cmd;
+                }
+                mark(t, TRACE_QUEUED, now);
+            }
+        }
+
+        void dequeued(uint16_t id, uint32_t now) {
+            CommandTraceRecord* t = find(id);
+            if (t) {
+                mark(t, TRACE_DEQUEUED, now);
+            }
+        }
+
+        void sent(uint16_t id, uint32_t now) {
+            CommandTraceRecord* t = find(id);
+            if (t) {
+                mark(t, TRACE_SENT, now);
+            }
+        }
+
+        void retry(uint16_t id) {
+            CommandTraceRecord* t = find(id);
+            if (t && t->retries < UINT8_MAX) {
+                t->retries++;
+            }
+        }
+
+        // A Status came in, or was pushed to HomeKit. Applies to every trace that has been sent
+        // and is waiting for this hop.
+        void status(TraceHop hop, uint32_t now) {
+            for (uint8_t i = 0; i < CMD_TRACE_SIZE; i++) {
+                CommandTraceRecord* t = &m_trace[i];
+                if (t->id && t->at[TRACE_SENT] != CMD_TRACE_NONE && t->at[hop] == CMD_TRACE_NONE &&
+                    (hop == TRACE_ACKED || t->at[TRACE_ACKED] != CMD_TRACE_NONE)) {
+                    mark(t, hop, now);
+                }
+            }
+        }
+
+        // Latency of `hop` from the hop before it (TRACE_HOPS for start to notified) at
+        // percentile `pct`, as the upper bound of its histogram bucket in ms.
+        uint32_t percentile(uint8_t hop, uint8_t pct) const {
+            const uint16_t* h = m_hist[hop];
+            uint32_t total = 0;
+            for (uint8_t i = 0; i < CMD_TRACE_BUCKETS; i++) {
+                total += h[i];
+            }
+            if (!total) {
+                return 0;
+            }
+            uint32_t want = (total * pct + 99) / 100;
+            uint32_t seen = 0;
+            for (uint8_t i = 0; i < CMD_TRACE_BUCKETS; i++) {
+                seen += h[i];
+                if (seen >= want) {
+                    return i ? (1u << i) - 1 : 0;
+                }
+            }
+            return UINT32_MAX;
+        }
+
+        // Most recent first, nullptr past the last one
+        const CommandTraceRecord* recent(uint8_t n) const {
+            if (n >= CMD_TRACE_SIZE) {
+                return nullptr;
+            }
+            uint16_t id = m_next_id - 1 - n;
+            const CommandTraceRecord* t = &m_trace[id % CMD_TRACE_SIZE];
+            return (id && t->id == id) ? t : nullptr;
+        }
+
+        static const char* hop_name(uint8_t hop) {
+            static const char* names[] = {"queued", "dequeued", "sent", "acked", "notified", "total"};
+            return (hop <= TRACE_HOPS) ? names[hop] : "?";
+        }
+
+        static const char* origin_name(TraceOrigin origin) {
+            switch (origin) {
+                case TraceOrigin::HomeKit:
+                    return "HomeKit";
+                case TraceOrigin::Web:
+                    return "Web";
+                case TraceOrigin::TTC:
+                    return "TTC";
+                default:
+                    return "None";
+            }
+        }
+
+        // One line per trace, hops in ms after the start or "-" if not reached
+        static void to_string(const CommandTraceRecord* t, char* buf, size_t buflen) {
+            int n = snprintf(buf, buflen, "#%u %s cmd 0x%03X at %lu retries %u:", t->id, origin_name(t->origin),
+                             t->cmd, (unsigned long)t->start, t->retries);
+            for (uint8_t h = 0; h < TRACE_HOPS && n > 0 && (size_t)n < buflen; h++) {
+                if (t->at[h] == CMD_TRACE_NONE) {
+                    n += snprintf(buf + n, buflen - n, " %s -", hop_name(h));
+                } else {
+                    n += snprintf(buf + n, buflen - n, " %s %u", hop_name(h), t->at[h]);
+                }
+            }
+        }
+};
+
+// Trace the commands queued within a scope
+class CommandTraceScope {
+    private:
+        CommandTrace& m_trace;
+
+    public:
+        CommandTraceScope(CommandTrace& trace, TraceOrigin origin, uint32_t now) : m_trace(trace) {
+            m_trace.start(origin, now);
+        }
+        ~CommandTraceScope() { m_trace.end(); }
+};
+
+#endif // _COMMAND_TRACE_H
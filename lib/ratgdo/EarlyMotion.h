@@ -0,0 +1,104 @@
+// GPLv3 License
+
+#ifndef _EARLY_MOTION_H
+#define _EARLY_MOTION_H
+
+#include <stdint.h>
+#include "Packet.h"
+
+// Early door motion detection.
+//
+// When the door is started from the wall button or a remote, the opener broadcasts MotorOn as the
+// motor starts (and the wall button's DoorAction is seen on the bus), but the Opening/Closing
+// Status can follow much later. Either packet is taken as evidence that the door is about to move:
+// a GetStatus is requested straight away, and from the last reported state we can usually tell
+// which way it is going, so a provisional Opening/Closing state can be shown until the opener
+// answers. The answer always wins, a wrong guess is corrected by the next Status.
+//
+// Our own DoorAction commands are read back off the bus too. Those are not a button press, and
+// taking them as one would spend a rolling code on a GetStatus that tells us nothing new.
+
+#define EARLY_MOTION_QUERY_HOLDOFF 500   // ms, at most one GetStatus per burst of packets
+#define EARLY_MOTION_ECHO_WINDOW 100     // ms after we transmit, a DoorAction seen may be our own
+
+class EarlyMotion {
+    private:
+        DoorState m_state = DoorState::Unknown;       // from the last Status packet
+        DoorState m_last_travel = DoorState::Unknown; // last Opening or Closing seen
+        bool m_queried = false;
+        uint32_t m_query_time = 0;
+
+        // Where a button press takes the door from its last reported state. From Stopped the
+        // opener reverses its last direction of travel.
+        DoorState toggle() const {
+            switch (m_state) {
+                case DoorState::Closed:
+                    return DoorState::Opening;
+                case DoorState::Open:
+                    return DoorState::Closing;
+                case DoorState::Stopped:
+                    if (m_last_travel == DoorState::Opening) {
+                        return DoorState::Closing;
+                    }
+                    if (m_last_travel == DoorState::Closing) {
+                        return DoorState::Opening;
+                    }
+                    return DoorState::Unknown;
+                default:
+                    // already moving, a press stops or reverses it depending on the opener
+                    return DoorState::Unknown;
+            }
+        }
+
+    public:
+        EarlyMotion() = default;
+
+        void status(DoorState door) {
+            m_state = door;
+            if (door == DoorState::Opening || door == DoorState::Closing) {
+                m_last_travel = door;
+            }
+            m_queried = false;
+        }
+
+        // Both return the provisional state (Opening or Closing), or Unknown if there is no
+        // good guess.
+        DoorState motor_on() const {
+            return toggle();
+        }
+
+        DoorState door_action(const DoorActionCommandData& action) const {
+            if (!action.pressed) {
+                return DoorState::Unknown;
+            }
+            switch (action.action) {
+                case DoorAction::Open:
+                    return (m_state == DoorState::Closed || m_state == DoorState::Stopped) ? DoorState::Opening : DoorState::Unknown;
+                case DoorAction::Close:
+                    return (m_state == DoorState::Open || m_state == DoorState::Stopped) ? DoorState::Closing : DoorState::Unknown;
+                case DoorAction::Toggle:
+                    return toggle();
+                default:
+                    return DoorState::Unknown;
+            }
+        }
+
+        // Whether a DoorAction received at `now` is our own transmit read back: sent with our ID, or
+        // seen so soon after we transmitted that it can't be told apart from it.
+        static bool echo(uint32_t now, uint32_t last_tx, uint32_t remote_id, uint32_t our_id) {
+            return remote_id == our_id || (now - last_tx) < EARLY_MOTION_ECHO_WINDOW;
+        }
+
+        // True if a GetStatus should be sent now. Cleared by the next Status, or after the holdoff
+        // in case the query or its answer was lost.
+        bool query(uint32_t now) {
+            if (m_queried && (now - m_query_time) < EARLY_MOTION_QUERY_HOLDOFF) {
+                return false;
+            }
+            m_queried = true;
+            m_query_time = now;
+            return true;
+        }
+};
+
+#endif // _EARLY_MOTION_H
@@ -0,0 +1,231 @@
+// GPLv3 License
+
+#ifndef _EDGE_UART_H
+#define _EDGE_UART_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Edge timestamp UART receiver.
+//
+// The pin change ISR does nothing but record the cycle counter and the new pin level into
+// EdgeRing. The main loop hands those edges to EdgeUartDecoder, which rebuilds bytes from the
+// intervals between them.
+//
+// An ISR that runs late (WiFi, flash access) makes an edge timestamp late, never early. Sampling
+// at mid-bit from the start edge, like SoftwareSerial does, breaks as soon as two edges of a
+// character are serviced more than half a bit apart. Instead the decoder waits until it has every
+// edge of a character. Each edge sits on a bit boundary, so its offset from the start edge modulo
+// one bit is its latency relative to the start edge. The decoder picks the grid that needs the
+// least total latency to explain those offsets, and numbers the edges against it. Edges within
+// half a bit of each other always decode. When most edges of a character are serviced promptly,
+// one edge (the start bit included) can be up to almost a full bit late.
+
+#define EDGE_RING_SIZE 256   // must be a power of two, a Sec+2 packet is at most 190 edges
+#define EDGE_UART_FIFO_SIZE 64
+
+// Single producer (ISR) single consumer (main loop) ring of edge timestamps. Bit 0 of each entry
+// holds the pin level after the edge, costing one cycle of resolution.
+class EdgeRing {
+    private:
+        volatile uint32_t m_buf[EDGE_RING_SIZE];
+        volatile uint16_t m_head = 0;   // only written by push()
+        volatile uint16_t m_tail = 0;   // only written by pop()
+
+    public:
+        volatile uint32_t m_overruns = 0;
+
+        // Called from the ISR
+        inline __attribute__((always_inline)) void push(uint32_t cycles, bool level) {
+            uint16_t head = m_head;
+            uint16_t next = (head + 1) & (EDGE_RING_SIZE - 1);
+            if (next == m_tail) {
+                m_overruns = m_overruns + 1;
+                return;
+            }
+            m_buf[head] = (cycles & ~1u) | (level ? 1 : 0);
+            m_head = next;
+        }
+
+        bool pop(uint32_t* cycles, bool* level) {
+            uint16_t tail = m_tail;
+            if (tail == m_head) {
+                return false;
+            }
+            uint32_t entry = m_buf[tail];
+            m_tail = (tail + 1) & (EDGE_RING_SIZE - 1);
+            *cycles = entry & ~1u;
+            *level = entry & 1;
+            return true;
+        }
+
+        bool empty() const { return m_tail == m_head; }
+
+        void clear() { m_tail = m_head; }
+};
+
+class EdgeUartDecoder {
+    private:
+        uint32_t m_bit_cycles = 0;
+        uint8_t m_frame_bits = 10;      // start + data + parity + stop
+        bool m_even_parity = false;
+        bool m_invert = false;
+
+        bool m_in_frame = false;
+        uint32_t m_start = 0;           // timestamp of the start edge
+        uint8_t m_edge_count = 0;
+        uint32_t m_edge_time[12];       // edges within the current character, after the start edge
+        bool m_edge_level[12];
+
+        uint8_t m_fifo[EDGE_UART_FIFO_SIZE];
+        uint8_t m_fifo_head = 0;
+        uint8_t m_fifo_tail = 0;
+
+        void fifo_put(uint8_t b) {
+            uint8_t next = (m_fifo_head + 1) % EDGE_UART_FIFO_SIZE;
+            if (next == m_fifo_tail) {
+                overruns++;
+                return;
+            }
+            m_fifo[m_fifo_head] = b;
+            m_fifo_head = next;
+        }
+
+        // Start of the bit grid, see the comment at the top of this file. Grids that would put two
+        // edges on one boundary, or end the start bit early, can't be right and are skipped.
+        uint32_t anchor() const {
+            uint32_t offset[13];
+            uint8_t n = m_edge_count + 1;
+            offset[0] = 0;
+            for (uint8_t i = 0; i < m_edge_count; i++) {
+                offset[i + 1] = (m_edge_time[i] - m_start) % m_bit_cycles;
+            }
+
+            uint32_t best = m_start;
+            uint32_t best_cost = UINT32_MAX;
+            for (uint8_t c = 0; c < n; c++) {
+                // offset[c] == 0 means the start edge itself was on time
+                uint32_t grid = offset[c] ? m_start + offset[c] - m_bit_cycles : m_start;
+                uint32_t cost = 0;
+                uint32_t prev = 0;
+                bool valid = true;
+                for (uint8_t i = 0; i < m_edge_count; i++) {
+                    uint32_t k = (m_edge_time[i] - grid) / m_bit_cycles;
+                    if (k <= prev || k >= m_frame_bits) {
+                        valid = false;
+                        break;
+                    }
+                    prev = k;
+                    cost += (m_edge_time[i] - grid) - k * m_bit_cycles;
+                }
+                cost += m_start - grid;
+                if (valid && cost < best_cost) {
+                    best_cost = cost;
+                    best = grid;
+                }
+            }
+            return best;
+        }
+
+        void finish_frame() {
+            m_in_frame = false;
+
+            // level of each bit, from the edges that fall on or before its leading boundary
+            uint32_t grid = anchor();
+            uint16_t bits = 0;
+            bool level = false;   // start bit
+            uint8_t e = 0;
+            for (uint8_t n = 0; n < m_frame_bits; n++) {
+                while (e < m_edge_count && (m_edge_time[e] - grid) / m_bit_cycles <= n) {
+                    level = m_edge_level[e++];
+                }
+                bits |= (uint16_t)level << n;
+            }
+
+            uint8_t data = (bits >> 1) & 0xFF;
+            if ((bits & 1) || !(bits >> (m_frame_bits - 1))) {
+                framing_errors++;
+                return;
+            }
+            if (m_even_parity && (__builtin_parity(data) != ((bits >> 9) & 1))) {
+                parity_errors++;
+                return;
+            }
+            bytes++;
+            fifo_put(data);
+        }
+
+    public:
+        uint32_t bytes = 0;
+        uint32_t framing_errors = 0;
+        uint32_t parity_errors = 0;
+        uint32_t overruns = 0;
+
+        EdgeUartDecoder() = default;
+
+        void begin(uint32_t bit_cycles, bool even_parity, bool invert) {
+            m_bit_cycles = bit_cycles;
+            m_even_parity = even_parity;
+            m_frame_bits = even_parity ? 11 : 10;
+            m_invert = invert;
+            reset();
+        }
+
+        void reset() {
+            m_in_frame = false;
+            m_fifo_head = m_fifo_tail = 0;
+        }
+
+        // Feed one edge, in time order. `pin_level` is the raw pin level after the edge.
+        void edge(uint32_t t, bool pin_level) {
+            bool level = pin_level ^ m_invert;
+
+            if (m_in_frame) {
+                // Within a character the last falling edge is on boundary frame_bits - 2 and the
+                // last rising edge on frame_bits - 1. With less than a bit of latency, anything
+                // later belongs to the next character.
+                uint32_t elapsed = t - m_start;
+                if (elapsed >= m_frame_bits * m_bit_cycles ||
+                    (!level && elapsed >= (uint32_t)(m_frame_bits - 1) * m_bit_cycles)) {
+                    finish_frame();
+                } else if (m_edge_count < sizeof(m_edge_time) / sizeof(m_edge_time[0])) {
+                    m_edge_time[m_edge_count] = t;
+                    m_edge_level[m_edge_count++] = level;
+                    return;
+                } else {
+                    // more edges than a character can hold, noise on the line
+                    framing_errors++;
+                    m_in_frame = false;
+                }
+            }
+
+            if (!level) {
+                m_in_frame = true;
+                m_start = t;
+                m_edge_count = 0;
+            }
+        }
+
+        // Complete the last character once no more of its edges can arrive. `now` must be read
+        // before the ring is drained, so that every edge stamped before it has been fed in.
+        void idle(uint32_t now) {
+            if (m_in_frame && (now - m_start) >= m_frame_bits * m_bit_cycles) {
+                finish_frame();
+            }
+        }
+
+        int available() const {
+            return (m_fifo_head + EDGE_UART_FIFO_SIZE - m_fifo_tail) % EDGE_UART_FIFO_SIZE;
+        }
+
+        int read() {
+            if (m_fifo_head == m_fifo_tail) {
+                return -1;
+            }
+            uint8_t b = m_fifo[m_fifo_tail];
+            m_fifo_tail = (m_fifo_tail + 1) % EDGE_UART_FIFO_SIZE;
+            return b;
+        }
+};
+
+#endif // _EDGE_UART_H
@@ -0,0 +1,131 @@
+// GPLv3 License
+
+#ifndef _HEAP_HEALTH_H
+#define _HEAP_HEALTH_H
+
+#include <stdint.h>
+
+// Heap health, to restart when the heap has actually degraded rather than on a fixed timer.
+//
+// Sampled every HEAP_SAMPLE_INTERVAL. The heap counts as degraded when any of:
+//   - an allocation has failed
+//   - the largest free block has been small, or a small share of free heap, for a minute
+//   - free heap has been below HEAP_MIN_FREE for a minute
+//   - the hourly low water mark is falling fast enough to reach HEAP_MIN_FREE within
+//     HEAP_TREND_HOURS
+// A minute of consecutive bad samples rides out short dips, e.g. while a page is being served.
+
+#define HEAP_SAMPLE_INTERVAL 10000  // ms
+#define HEAP_BAD_SAMPLES 6          // consecutive bad samples before degraded
+#define HEAP_MIN_FREE 6000          // bytes
+#define HEAP_MIN_BLOCK 3000         // bytes, enough for a HomeKit session to be set up
+#define HEAP_MIN_BLOCK_PERCENT 30   // largest block as a share of free heap
+#define HEAP_TREND_HOURS 2
+#define HEAP_TREND_SLOTS 6          // hours of low water marks kept
+
+enum class HeapState : uint8_t {
+    OK,
+    OutOfMemory,
+    Fragmented,
+    Low,
+    Falling,
+};
+
+class HeapHealth {
+    private:
+        uint32_t m_last_sample = 0;
+        bool m_sampled = false;
+        uint32_t m_oom_base = 0;
+        uint8_t m_fragmented = 0;   // consecutive fragmented samples
+        uint8_t m_low = 0;          // consecutive low samples
+
+        // low water mark of each of the last few hours, [0] is the current hour
+        uint32_t m_hour_low[HEAP_TREND_SLOTS];
+        uint8_t m_hours = 0;        // completed hours
+        uint32_t m_hour_start = 0;
+
+        HeapState m_state = HeapState::OK;
+
+        bool falling() const {
+            if (m_hours < 2) {
+                return false;
+            }
+            uint8_t n = (m_hours < HEAP_TREND_SLOTS - 1) ? m_hours : HEAP_TREND_SLOTS - 1;
+            uint32_t oldest = m_hour_low[n];
+            uint32_t newest = m_hour_low[0];
+            if (newest >= oldest || newest <= HEAP_MIN_FREE) {
+                return false;
+            }
+            uint32_t per_hour = (oldest - newest) / n;
+            return (newest - HEAP_MIN_FREE) < per_hour * HEAP_TREND_HOURS;
+        }
+
+    public:
+        HeapHealth() = default;
+
+        // Feed one sample. Returns true if it was taken (HEAP_SAMPLE_INTERVAL since the last).
+        bool sample(uint32_t now, uint32_t free_heap, uint32_t max_block, uint32_t oom_count) {
+            if (m_sampled && (now - m_last_sample) < HEAP_SAMPLE_INTERVAL) {
+                return false;
+            }
+            if (!m_sampled) {
+                m_oom_base = oom_count;
+                m_hour_start = now;
+                m_hour_low[0] = free_heap;
+            }
+            m_sampled = true;
+            m_last_sample = now;
+
+            bool fragmented = (max_block < HEAP_MIN_BLOCK) ||
+                              (max_block * 100 < free_heap * HEAP_MIN_BLOCK_PERCENT);
+            m_fragmented = fragmented ? (m_fragmented < UINT8_MAX ? m_fragmented + 1 : m_fragmented) : 0;
+            m_low = (free_heap < HEAP_MIN_FREE) ? (m_low < UINT8_MAX ? m_low + 1 : m_low) : 0;
+
+            if ((now - m_hour_start) >= 3600000) {
+                for (uint8_t i = HEAP_TREND_SLOTS - 1; i > 0; i--) {
+                    m_hour_low[i] = m_hour_low[i - 1];
+                }
+                m_hour_low[0] = free_heap;
+                m_hour_start = now;
+                if (m_hours < UINT8_MAX) {
+                    m_hours++;
+                }
+            } else if (free_heap < m_hour_low[0]) {
+                m_hour_low[0] = free_heap;
+            }
+
+            if (oom_count != m_oom_base) {
+                m_state = HeapState::OutOfMemory;
+            } else if (m_fragmented >= HEAP_BAD_SAMPLES) {
+                m_state = HeapState::Fragmented;
+            } else if (m_low >= HEAP_BAD_SAMPLES) {
+                m_state = HeapState::Low;
+            } else if (falling()) {
+                m_state = HeapState::Falling;
+            } else {
+                m_state = HeapState::OK;
+            }
+            return true;
+        }
+
+        HeapState state() const { return m_state; }
+
+        bool degraded() const { return m_state != HeapState::OK; }
+
+        static const char* to_string(HeapState state) {
+            switch (state) {
+                case HeapState::OutOfMemory:
+                    return "OutOfMemory";
+                case HeapState::Fragmented:
+                    return "Fragmented";
+                case HeapState::Low:
+                    return "Low";
+                case HeapState::Falling:
+                    return "Falling";
+                default:
+                    return "OK";
+            }
+        }
+};
+
+#endif // _HEAP_HEALTH_H
@@ -0,0 +1,283 @@
+// GPLv3 License
+
+#ifndef _IMPROV_CODEC_H
+#define _IMPROV_CODEC_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Improv WiFi serial protocol (https://www.improv-wifi.com/serial/), without heap allocation.
+//
+// Every frame is
+//   "IMPROV" | version | type | length | data[length] | checksum
+// where the checksum is the low byte of the sum of all the bytes before it. RPC commands carry
+//   command | length | data[length]
+// and RPC responses
+//   command | length | (string length | string bytes)...
+//
+// Provisioning happens when heap is tight, right after a WiFi scan, so frames are decoded into and
+// encoded from fixed buffers, and the checksum is kept as bytes go in rather than by a second pass.
+
+#define IMPROV_VERSION 1
+#define IMPROV_HEADER_LEN 9             // "IMPROV", version, type, length
+#define IMPROV_MAX_FRAME (IMPROV_HEADER_LEN + 255 + 1)
+#define IMPROV_MAX_SSID 32
+#define IMPROV_MAX_PASSWORD 64
+
+enum ImprovType : uint8_t {
+    IMPROV_TYPE_CURRENT_STATE = 0x01,
+    IMPROV_TYPE_ERROR_STATE = 0x02,
+    IMPROV_TYPE_RPC = 0x03,
+    IMPROV_TYPE_RPC_RESPONSE = 0x04,
+};
+
+enum ImprovState : uint8_t {
+    IMPROV_STATE_STOPPED = 0x00,
+    IMPROV_STATE_AWAITING_AUTHORIZATION = 0x01,
+    IMPROV_STATE_AUTHORIZED = 0x02,
+    IMPROV_STATE_PROVISIONING = 0x03,
+    IMPROV_STATE_PROVISIONED = 0x04,
+};
+
+enum ImprovError : uint8_t {
+    IMPROV_ERROR_NONE = 0x00,
+    IMPROV_ERROR_INVALID_RPC = 0x01,
+    IMPROV_ERROR_UNKNOWN_RPC = 0x02,
+    IMPROV_ERROR_UNABLE_TO_CONNECT = 0x03,
+    IMPROV_ERROR_NOT_AUTHORIZED = 0x04,
+    IMPROV_ERROR_UNKNOWN = 0xFF,
+};
+
+enum ImprovCommand : uint8_t {
+    IMPROV_CMD_WIFI_SETTINGS = 0x01,
+    IMPROV_CMD_GET_CURRENT_STATE = 0x02,
+    IMPROV_CMD_GET_DEVICE_INFO = 0x03,
+    IMPROV_CMD_GET_WIFI_NETWORKS = 0x04,
+};
+
+enum class ImprovResult : uint8_t {
+    None,       // need more bytes
+    Command,    // an RPC command is ready
+    Error,      // a frame failed its checksum or didn't make sense, see error()
+};
+
+class ImprovDecoder {
+    private:
+        uint8_t m_buf[IMPROV_MAX_FRAME];
+        uint16_t m_pos = 0;
+        uint8_t m_sum = 0;
+        ImprovError m_error = IMPROV_ERROR_NONE;
+        ImprovCommand m_command;
+        char m_ssid[IMPROV_MAX_SSID + 1];
+        char m_password[IMPROV_MAX_PASSWORD + 1];
+
+        ImprovResult reset(ImprovResult result, ImprovError error = IMPROV_ERROR_NONE) {
+            m_error = error;
+            m_pos = 0;
+            m_sum = 0;
+            return result;
+        }
+
+        // RPC payload at m_buf[IMPROV_HEADER_LEN]
+        bool parse_rpc(uint8_t len) {
+            const uint8_t* rpc = m_buf + IMPROV_HEADER_LEN;
+            if (len < 2 || rpc[1] != len - 2) {
+                return false;
+            }
+            m_command = (ImprovCommand)rpc[0];
+            m_ssid[0] = 0;
+            m_password[0] = 0;
+            if (m_command == IMPROV_CMD_WIFI_SETTINGS) {
+                // ssid length | ssid | password length | password
+                const uint8_t* p = rpc + 2;
+                const uint8_t* end = p + rpc[1];
+                if (p >= end || *p > IMPROV_MAX_SSID || p + 1 + *p >= end) {
+                    return false;
+                }
+                uint8_t ssid_len = *p++;
+                memcpy(m_ssid, p, ssid_len);
+                m_ssid[ssid_len] = 0;
+                p += ssid_len;
+                uint8_t pass_len = *p++;
+                if (pass_len > IMPROV_MAX_PASSWORD || p + pass_len > end) {
+                    return false;
+                }
+                memcpy(m_password, p, pass_len);
+                m_password[pass_len] = 0;
+            }
+            return true;
+        }
+
+    public:
+        ImprovDecoder() = default;
+
+        // Feed one byte from the serial port
+        ImprovResult push_byte(uint8_t b) {
+            static const char header[] = "IMPROV";
+            if (m_pos < 6) {
+                if (b != (uint8_t)header[m_pos]) {
+                    // a mismatch might be the start of the next frame
+                    reset(ImprovResult::None);
+                    if (b != 'I') {
+                        return ImprovResult::None;
+                    }
+                }
+            } else if (m_pos == 6 && b != IMPROV_VERSION) {
+                return reset(ImprovResult::None);
+            } else if (m_pos >= IMPROV_HEADER_LEN && m_pos == IMPROV_HEADER_LEN + m_buf[8]) {
+                // checksum byte
+                // a corrupted packet is an invalid RPC, while one that checks out but can't be
+                // parsed is reported as an unknown command, as the Improv library did
+                if (b != m_sum) {
+                    return reset(ImprovResult::Error, IMPROV_ERROR_INVALID_RPC);
+                }
+                if (m_buf[7] != IMPROV_TYPE_RPC) {
+                    return reset(ImprovResult::None);
+                }
+                if (!parse_rpc(m_buf[8])) {
+                    return reset(ImprovResult::Error, IMPROV_ERROR_UNKNOWN_RPC);
+                }
+                return reset(ImprovResult::Command);
+            }
+            m_buf[m_pos++] = b;
+            m_sum += b;
+            return ImprovResult::None;
+        }
+
+        ImprovCommand command() const { return m_command; }
+        ImprovError error() const { return m_error; }
+        const char* ssid() const { return m_ssid; }
+        const char* password() const { return m_password; }
+};
+
+class ImprovEncoder {
+    private:
+        uint8_t m_buf[IMPROV_MAX_FRAME];
+        uint16_t m_len = 0;
+        uint8_t m_sum = 0;
+        bool m_overflow = false;
+
+        void put(uint8_t b) {
+            if (m_len >= IMPROV_MAX_FRAME - 1) {
+                m_overflow = true;
+                return;
+            }
+            m_buf[m_len++] = b;
+            m_sum += b;
+        }
+
+        void begin(ImprovType type) {
+            m_len = 0;
+            m_sum = 0;
+            m_overflow = false;
+            for (const char* h = "IMPROV"; *h; h++) {
+                put(*h);
+            }
+            put(IMPROV_VERSION);
+            put(type);
+            put(0);     // length, filled in by end()
+        }
+
+        // Set a length byte that was written as 0, keeping the checksum
+        void patch(uint16_t at, uint8_t value) {
+            m_buf[at] = value;
+            m_sum += value;
+        }
+
+        void end() {
+            if (m_len > IMPROV_MAX_FRAME - 1 || m_len - IMPROV_HEADER_LEN > 255) {
+                m_overflow = true;
+            }
+            if (m_overflow) {
+                return;
+            }
+            patch(8, m_len - IMPROV_HEADER_LEN);
+            m_buf[m_len++] = m_sum;
+        }
+
+    public:
+        ImprovEncoder() = default;
+
+        const uint8_t* data() const { return m_buf; }
+
+        // 0 if the frame didn't fit
+        uint16_t size() const { return m_overflow ? 0 : m_len; }
+
+        void state(ImprovState state) {
+            begin(IMPROV_TYPE_CURRENT_STATE);
+            put(state);
+            end();
+        }
+
+        void error(ImprovError error) {
+            begin(IMPROV_TYPE_ERROR_STATE);
+            put(error);
+            end();
+        }
+
+        // An RPC response is rpc_begin(), rpc_string() for each string, then rpc_end()
+        void rpc_begin(ImprovCommand command) {
+            begin(IMPROV_TYPE_RPC_RESPONSE);
+            put(command);
+            put(0);     // length of the strings, filled in by rpc_end()
+        }
+
+        void rpc_string(const char* s, size_t len) {
+            if (len > 255) {
+                m_overflow = true;
+                return;
+            }
+            put(len);
+            for (size_t i = 0; i < len; i++) {
+                put(s[i]);
+            }
+        }
+
+        void rpc_string(const char* s) { rpc_string(s, strlen(s)); }
+
+        void rpc_end() {
+            uint16_t strings = m_len - (IMPROV_HEADER_LEN + 2);
+            if (strings > 255) {
+                m_overflow = true;
+                return;
+            }
+            patch(IMPROV_HEADER_LEN + 1, strings);
+            end();
+        }
+};
+
+// A scan result, pointing into the scan results rather than copying them
+struct ImprovNetwork {
+    const char* ssid;
+    uint8_t ssid_len;
+    int8_t rssi;
+    bool secure;
+};
+
+// Sort networks by RSSI, strongest first, and drop repeats of an SSID (keeping the strongest) in
+// place. Returns how many are left.
+static inline uint8_t improv_sort_networks(ImprovNetwork* nets, uint8_t n) {
+    // insertion sort, stable and there are only a few dozen at most
+    for (uint8_t i = 1; i < n; i++) {
+        ImprovNetwork net = nets[i];
+        uint8_t j = i;
+        while (j > 0 && nets[j - 1].rssi < net.rssi) {
+            nets[j] = nets[j - 1];
+            j--;
+        }
+        nets[j] = net;
+    }
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < n; i++) {
+        bool dup = false;
+        for (uint8_t k = 0; k < kept && !dup; k++) {
+            dup = nets[k].ssid_len == nets[i].ssid_len && !memcmp(nets[k].ssid, nets[i].ssid, nets[i].ssid_len);
+        }
+        if (!dup) {
+            nets[kept++] = nets[i];
+        }
+    }
+    return kept;
+}
+
+#endif // _IMPROV_CODEC_H
@@ -0,0 +1,592 @@
+// GPLv3 License
+
+#include <stdio.h>
+#include "MdnsGuard.h"
+
+// What a question asks for
+enum : uint8_t {
+    WANT_PTR = 1,
+    WANT_SRV = 2,
+    WANT_TXT = 4,
+    WANT_A = 8,
+};
+
+// Which of our names
+enum : uint8_t {
+    NAME_INSTANCE = 1,
+    NAME_HOST = 2,
+};
+
+static uint16_t get16(const uint8_t* p) {
+    return (p[0] << 8) | p[1];
+}
+
+static uint8_t* put16(uint8_t* p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+    return p + 2;
+}
+
+static uint8_t* put_record(uint8_t* p, uint16_t type, uint16_t cls, uint32_t ttl) {
+    p = put16(p, type);
+    p = put16(p, cls);
+    p = put16(p, ttl >> 16);
+    return put16(p, ttl);
+}
+
+static uint8_t* put_label(uint8_t* p, const char* label) {
+    size_t n = strnlen(label, MDNS_LABEL_SIZE - 1);
+    *p++ = n;
+    memcpy(p, label, n);
+    return p + n;
+}
+
+static size_t name_len(const uint8_t* name) {
+    size_t n = 0;
+    while (name[n]) {
+        n += name[n] + 1;
+    }
+    return n + 1;
+}
+
+// `base` with `fmt` of `n` after it, cut short to leave room for it
+static void suffix(char* out, const char* base, const char* fmt, uint8_t n) {
+    char s[8];
+    size_t l = snprintf(s, sizeof(s), fmt, (unsigned)n);
+    size_t keep = strnlen(base, MDNS_LABEL_SIZE - 1);
+    if (keep > MDNS_LABEL_SIZE - 1 - l) {
+        keep = MDNS_LABEL_SIZE - 1 - l;
+    }
+    memcpy(out, base, keep);
+    memcpy(out + keep, s, l + 1);
+}
+
+static void lower_name(uint8_t* out, const char* const* labels) {
+    size_t n = 0;
+    for (; *labels; labels++) {
+        size_t l = strnlen(*labels, MDNS_LABEL_SIZE - 1);
+        out[n++] = l;
+        for (size_t i = 0; i < l; i++) {
+            char c = (*labels)[i];
+            out[n++] = (c >= 'A' && c <= 'Z') ? c + 'a' - 'A' : c;
+        }
+    }
+    out[n] = 0;
+}
+
+// The record at `off`, its owner in `name`. Moves `off` past it. False if it is malformed.
+static bool record(const uint8_t* pkt, size_t len, size_t& off, uint8_t* name, uint16_t& type, size_t& rdata,
+                   uint16_t& rdlen) {
+    if (!MdnsGuard::read_name(pkt, len, off, name) || off + 10 > len) {
+        return false;
+    }
+    type = get16(pkt + off);
+    rdlen = get16(pkt + off + 8);
+    rdata = off + 10;
+    off = rdata + rdlen;
+    return off <= len;
+}
+
+bool MdnsService::add_txt(const char* key, const char* value) {
+    size_t k = strlen(key);
+    size_t v = strlen(value);
+    if (k + 1 + v > 255 || txt_len + 1 + k + 1 + v > sizeof(txt)) {
+        return false;
+    }
+    txt[txt_len++] = k + 1 + v;
+    memcpy(txt + txt_len, key, k);
+    txt[txt_len + k] = '=';
+    memcpy(txt + txt_len + k + 1, value, v);
+    txt_len += k + 1 + v;
+    return true;
+}
+
+bool MdnsService::operator==(const MdnsService& other) const {
+    return !strcmp(instance, other.instance) && !strcmp(host, other.host) && ip == other.ip &&
+           port == other.port && txt_len == other.txt_len && !memcmp(txt, other.txt, txt_len);
+}
+
+// What is advertised, with the suffixes of any names taken by other hosts
+void MdnsGuard::apply() {
+    m_service = m_wanted;
+    if (m_instance_n > 1) {
+        suffix(m_service.instance, m_wanted.instance, " (%u)", m_instance_n);
+    }
+    if (m_host_n > 1) {
+        suffix(m_service.host, m_wanted.host, "-%u", m_host_n);
+    }
+}
+
+// SRV, TXT and A, the records no other host may hold. The instance name is at `instance_at`
+// and "local" at `local_at`. The host name is written in SRV unless it is at `host_at`.
+uint8_t* MdnsGuard::put_unique(uint8_t* p, const uint8_t* base, uint16_t instance_at, uint16_t local_at, uint16_t host_at,
+                                  uint16_t cls) const {
+    p = put16(p, 0xC000 | instance_at);
+    p = put_record(p, MDNS_TYPE_SRV, cls, MDNS_TTL_HOST);
+    p = put16(p, 6 + (host_at ? 2 : 1 + strnlen(m_service.host, MDNS_LABEL_SIZE - 1) + 2));
+    p = put16(p, 0);                    // priority
+    p = put16(p, 0);                    // weight
+    p = put16(p, m_service.port);
+    if (host_at) {
+        p = put16(p, 0xC000 | host_at);
+    } else {
+        host_at = p - base;
+        p = put_label(p, m_service.host);
+        p = put16(p, 0xC000 | local_at);
+    }
+
+    p = put16(p, 0xC000 | instance_at);
+    p = put_record(p, MDNS_TYPE_TXT, cls, MDNS_TTL_SERVICE);
+    if (m_service.txt_len) {
+        p = put16(p, m_service.txt_len);
+        memcpy(p, m_service.txt, m_service.txt_len);
+        p += m_service.txt_len;
+    } else {
+        // an empty TXT record is one empty string
+        p = put16(p, 1);
+        *p++ = 0;
+    }
+
+    p = put16(p, 0xC000 | host_at);
+    p = put_record(p, MDNS_TYPE_A, cls, MDNS_TTL_HOST);
+    p = put16(p, 4);
+    for (uint8_t i = 0; i < 4; i++) {
+        *p++ = m_service.ip >> (8 * i);
+    }
+    return p;
+}
+
+// The response, serialized once with names compressed:
+// PTR _hap._tcp.local -> instance, then SRV, TXT of the instance and A of the host.
+// And the probe, ANY questions for the instance and host names asking for a unicast answer,
+// with SRV, TXT and A in the authority section (RFC 6762 section 8.1).
+void MdnsGuard::build() {
+    const char* service[] = {"_hap", "_tcp", "local", nullptr};
+    const char* instance[] = {m_service.instance, "_hap", "_tcp", "local", nullptr};
+    const char* host[] = {m_service.host, "local", nullptr};
+    lower_name(m_service_name, service);
+    lower_name(m_instance_name, instance);
+    lower_name(m_host_name, host);
+
+    uint8_t* p = m_answer;
+    p = put16(p, 0);                    // id
+    p = put16(p, 0x8400);               // response, authoritative
+    p = put16(p, 0);
+    p = put16(p, 4);
+    p = put16(p, 0);
+    p = put16(p, 0);
+
+    // the service name, at 12, with "local" at 22
+    static const uint8_t service_name[] = "\x04_hap\x04_tcp\x05local";
+    const uint16_t service_at = 12;
+    const uint16_t local_at = 22;
+    memcpy(p, service_name, sizeof(service_name));
+    p += sizeof(service_name);
+
+    p = put_record(p, MDNS_TYPE_PTR, MDNS_CLASS_IN, MDNS_TTL_SERVICE);
+    uint16_t instance_at = p + 2 - m_answer;
+    p = put16(p, 1 + strnlen(m_service.instance, MDNS_LABEL_SIZE - 1) + 2);
+    p = put_label(p, m_service.instance);
+    p = put16(p, 0xC000 | service_at);
+
+    p = put_unique(p, m_answer, instance_at, local_at, 0, MDNS_CLASS_IN | MDNS_CACHE_FLUSH);
+    m_answer_len = p - m_answer;
+
+    p = m_probe_pkt;
+    p = put16(p, 0);                    // id
+    p = put16(p, 0);                    // query
+    p = put16(p, 2);
+    p = put16(p, 0);
+    p = put16(p, 3);
+    p = put16(p, 0);
+
+    // the instance name, at 12
+    p = put_label(p, m_service.instance);
+    uint16_t probe_local_at = p - m_probe_pkt + 10;
+    memcpy(p, service_name, sizeof(service_name));
+    p += sizeof(service_name);
+    p = put16(p, MDNS_TYPE_ANY);
+    p = put16(p, MDNS_CLASS_IN | MDNS_UNICAST_RESPONSE);
+    uint16_t host_at = p - m_probe_pkt;
+    p = put_label(p, m_service.host);
+    p = put16(p, 0xC000 | probe_local_at);
+    p = put16(p, MDNS_TYPE_ANY);
+    p = put16(p, MDNS_CLASS_IN | MDNS_UNICAST_RESPONSE);
+
+    // no cache flush bit in a probe
+    p = put_unique(p, m_probe_pkt, 12, probe_local_at, host_at, MDNS_CLASS_IN);
+    m_probe_len = p - m_probe_pkt;
+}
+
+// Probes for the names, from `at`. Nothing is announced or answered until that is done.
+void MdnsGuard::probe_from(uint32_t at) {
+    m_probe = MDNS_PROBES + 1;
+    m_probe_at = at;
+    m_announce = 0;
+    m_multicast = false;
+}
+
+// Which of our names a record of `type` owned by `name` claims, 0 if none
+uint8_t MdnsGuard::owner(const uint8_t* name, uint16_t type) const {
+    if ((type == MDNS_TYPE_SRV || type == MDNS_TYPE_TXT) && same_name(name, m_instance_name)) {
+        return NAME_INSTANCE;
+    }
+    if (type == MDNS_TYPE_A && same_name(name, m_host_name)) {
+        return NAME_HOST;
+    }
+    return 0;
+}
+
+// Orders another host's record against ours of the same type, as RFC 6762 section 8.2
+// does: rdata byte by byte with names uncompressed, then the longer later. Names compare
+// in lower case. `name` is room for one. 0 if they are the same, or theirs is malformed.
+int MdnsGuard::compare(const uint8_t* pkt, size_t len, size_t rdata, uint16_t rdlen, uint16_t type, uint8_t* name) const {
+    uint8_t own[6];
+    const uint8_t* mine = own;
+    size_t mine_len;
+    const uint8_t* theirs = pkt + rdata;
+    size_t theirs_len = rdlen;
+    if (type == MDNS_TYPE_SRV) {
+        put16(put16(put16(own, 0), 0), m_service.port);
+        if (rdlen < 7) {
+            return 0;
+        }
+        int c = memcmp(theirs, own, 6);
+        size_t target = rdata + 6;
+        if (c || !read_name(pkt, len, target, name)) {
+            return c;
+        }
+        theirs = name;
+        theirs_len = name_len(name);
+        mine = m_host_name;
+        mine_len = name_len(m_host_name);
+    } else if (type == MDNS_TYPE_TXT) {
+        static const uint8_t empty = 0;
+        mine = m_service.txt_len ? m_service.txt : &empty;
+        mine_len = m_service.txt_len ? m_service.txt_len : 1;
+    } else {
+        for (uint8_t i = 0; i < 4; i++) {
+            own[i] = m_service.ip >> (8 * i);
+        }
+        mine_len = 4;
+    }
+    int c = memcmp(theirs, mine, theirs_len < mine_len ? theirs_len : mine_len);
+    return c ? c : (int)theirs_len - (int)mine_len;
+}
+
+// Another host holds `names`. While probing they are given up for the next ones, once
+// they are ours they are probed for again. Past a burst of conflicts probing slows down.
+void MdnsGuard::conflict(uint32_t now, uint8_t names) {
+    conflicts++;
+    if (now - m_burst_at >= MDNS_CONFLICT_WINDOW) {
+        m_burst_at = now;
+        m_burst = 0;
+    }
+    if (m_burst < MDNS_CONFLICT_BURST) {
+        m_burst++;
+    }
+    if (m_probe) {
+        if ((names & NAME_INSTANCE) && m_instance_n < 255) {
+            m_instance_n++;
+        }
+        if ((names & NAME_HOST) && m_host_n < 255) {
+            m_host_n++;
+        }
+        apply();
+        build();
+        rebuilds++;
+    }
+    probe_from(now + (m_burst >= MDNS_CONFLICT_BURST ? MDNS_CONFLICT_WAIT : 0));
+}
+
+// A response from another host, a conflict if it has records of its own for our names
+void MdnsGuard::check_response(uint32_t now, const uint8_t* pkt, size_t len) {
+    uint16_t questions = get16(pkt + 4);
+    uint32_t records = get16(pkt + 6) + get16(pkt + 8) + get16(pkt + 10);
+    uint8_t name[MDNS_NAME_WIRE];
+    size_t off = 12;
+    for (uint16_t q = 0; q < questions; q++) {
+        if (!read_name(pkt, len, off, name) || off + 4 > len) {
+            return;
+        }
+        off += 4;
+    }
+    uint8_t names = 0;
+    uint16_t type;
+    uint16_t rdlen;
+    size_t rdata;
+    for (uint32_t r = 0; r < records && record(pkt, len, off, name, type, rdata, rdlen); r++) {
+        uint8_t mine = owner(name, type);
+        if (mine && compare(pkt, len, rdata, rdlen, type, name)) {
+            names |= mine;
+        }
+    }
+    if (names) {
+        conflict(now, names);
+    }
+}
+
+// A probe from another host for our names while we probe too. The first of its records
+// that differs from ours decides, and if its is later we wait and probe again.
+void MdnsGuard::tie_break(uint32_t now, const uint8_t* pkt, size_t len, size_t off) {
+    uint16_t answers = get16(pkt + 6);
+    uint16_t authority = get16(pkt + 8);
+    uint8_t name[MDNS_NAME_WIRE];
+    uint16_t type;
+    uint16_t rdlen;
+    size_t rdata;
+    for (uint32_t r = 0; r < (uint32_t)answers + authority && record(pkt, len, off, name, type, rdata, rdlen); r++) {
+        if (r < answers || !owner(name, type)) {
+            continue;
+        }
+        int c = compare(pkt, len, rdata, rdlen, type, name);
+        if (c > 0) {
+            probe_from(now + MDNS_PROBE_DEFER);
+        }
+        if (c) {
+            return;
+        }
+    }
+}
+
+// Takes an answer from `ip`'s bucket, false if there is none
+bool MdnsGuard::take(uint32_t now, uint32_t ip) {
+    Querier* q = nullptr;
+    Querier* oldest = &m_queriers[0];
+    for (uint8_t i = 0; i < MDNS_QUERIERS; i++) {
+        Querier& c = m_queriers[i];
+        if (c.used && c.ip == ip) {
+            q = &c;
+            break;
+        }
+        // a free entry, otherwise the least recently seen
+        if (!c.used) {
+            if (oldest->used) {
+                oldest = &c;
+            }
+        } else if (oldest->used && (int32_t)(c.seen - oldest->seen) < 0) {
+            oldest = &c;
+        }
+    }
+    if (!q) {
+        q = oldest;
+        q->used = true;
+        q->ip = ip;
+        q->tokens = MDNS_QUERIER_BURST;
+        q->refilled = now;
+    }
+    q->seen = now;
+
+    uint32_t refills = (now - q->refilled) / MDNS_QUERIER_REFILL;
+    if (refills) {
+        q->refilled += refills * MDNS_QUERIER_REFILL;
+        q->tokens = refills >= (uint32_t)(MDNS_QUERIER_BURST - q->tokens) ? MDNS_QUERIER_BURST : q->tokens + refills;
+    }
+    if (q->tokens == MDNS_QUERIER_BURST) {
+        // a full bucket doesn't save up
+        q->refilled = now;
+    }
+    if (!q->tokens) {
+        return false;
+    }
+    q->tokens--;
+    return true;
+}
+
+bool MdnsGuard::read_name(const uint8_t* pkt, size_t len, size_t& off, uint8_t* out) {
+    size_t pos = off;
+    size_t n = 0;
+    bool jumped = false;
+    for (uint8_t hops = 0; hops < 16;) {
+        if (pos >= len) {
+            return false;
+        }
+        uint8_t l = pkt[pos];
+        if ((l & 0xC0) == 0xC0) {
+            if (pos + 1 >= len) {
+                return false;
+            }
+            if (!jumped) {
+                off = pos + 2;
+                jumped = true;
+            }
+            pos = ((l & 0x3F) << 8) | pkt[pos + 1];
+            hops++;
+            continue;
+        }
+        if (l & 0xC0 || pos + 1 + l > len || n + 1 + l >= MDNS_NAME_WIRE) {
+            return false;
+        }
+        out[n++] = l;
+        if (!l) {
+            if (!jumped) {
+                off = pos + 1;
+            }
+            return true;
+        }
+        for (uint8_t i = 0; i < l; i++) {
+            uint8_t c = pkt[pos + 1 + i];
+            out[n++] = (c >= 'A' && c <= 'Z') ? c + 'a' - 'A' : c;
+        }
+        pos += 1 + l;
+    }
+    return false;
+}
+
+bool MdnsGuard::same_name(const uint8_t* a, const uint8_t* b) {
+    return !memcmp(a, b, name_len(a));
+}
+
+bool MdnsGuard::set(uint32_t now, const MdnsService& service) {
+    if (m_ready && service == m_wanted) {
+        return false;
+    }
+    bool renamed = !m_ready || strcmp(service.instance, m_wanted.instance) || strcmp(service.host, m_wanted.host);
+    bool moved = renamed || service.ip != m_wanted.ip;
+    if (renamed) {
+        m_instance_n = 1;
+        m_host_n = 1;
+    }
+    m_wanted = service;
+    apply();
+    build();
+    m_ready = true;
+    rebuilds++;
+    if (moved) {
+        probe_from(now);
+    } else if (!m_probe) {
+        m_multicast = false;
+        m_announce = MDNS_ANNOUNCE;
+        m_announce_at = now;
+    }
+    return true;
+}
+
+bool MdnsGuard::probe(uint32_t now, MdnsReply& out) {
+    if (!m_probe || (int32_t)(now - m_probe_at) < 0) {
+        return false;
+    }
+    if (!--m_probe) {
+        m_announce = MDNS_ANNOUNCE;
+        m_announce_at = now;
+        return false;
+    }
+    m_probe_at = now + MDNS_PROBE_INTERVAL;
+    probes++;
+    out = {m_probe_pkt, m_probe_len, false};
+    return true;
+}
+
+bool MdnsGuard::announcement(uint32_t now, MdnsReply& out) {
+    if (!m_announce || (int32_t)(now - m_announce_at) < 0) {
+        return false;
+    }
+    m_announce--;
+    m_announce_at = now + MDNS_REPEAT;
+    m_multicast_at = now;
+    m_multicast = true;
+    out = {m_answer, m_answer_len, false};
+    return true;
+}
+
+bool MdnsGuard::query(uint32_t now, uint32_t ip, uint16_t port, const uint8_t* pkt, size_t len, MdnsReply& out) {
+    queries++;
+    // standard opcode
+    if (!m_ready || len < 12 || (pkt[2] & 0x78)) {
+        ignored++;
+        return false;
+    }
+    if (pkt[2] & 0x80) {
+        // a response, which is only read for our names, and not our own
+        if (ip != m_service.ip) {
+            check_response(now, pkt, len);
+        }
+        ignored++;
+        return false;
+    }
+    uint16_t questions = (pkt[4] << 8) | pkt[5];
+    uint16_t answers = (pkt[6] << 8) | pkt[7];
+
+    uint8_t name[MDNS_NAME_WIRE];
+    size_t off = 12;
+    uint8_t want = 0;
+    bool unicast = port != MDNS_PORT;
+    for (uint16_t q = 0; q < questions; q++) {
+        if (!read_name(pkt, len, off, name) || off + 4 > len) {
+            ignored++;
+            return false;
+        }
+        uint16_t type = (pkt[off] << 8) | pkt[off + 1];
+        uint16_t cls = (pkt[off + 2] << 8) | pkt[off + 3];
+        off += 4;
+        uint8_t asked = 0;
+        bool any = type == MDNS_TYPE_ANY;
+        if (same_name(name, m_service_name)) {
+            asked = (any || type == MDNS_TYPE_PTR) ? WANT_PTR : 0;
+        } else if (same_name(name, m_instance_name)) {
+            asked = (any || type == MDNS_TYPE_SRV) ? WANT_SRV : 0;
+            asked |= (any || type == MDNS_TYPE_TXT) ? WANT_TXT : 0;
+        } else if (same_name(name, m_host_name)) {
+            asked = (any || type == MDNS_TYPE_A) ? WANT_A : 0;
+        }
+        if (asked && (cls & MDNS_UNICAST_RESPONSE)) {
+            unicast = true;
+        }
+        want |= asked;
+    }
+    if (!want) {
+        ignored++;
+        return false;
+    }
+    if (m_probe) {
+        tie_break(now, pkt, len, off);
+        held++;
+        return false;
+    }
+
+    // known answers, our PTR with at least half its TTL left
+    uint8_t target[MDNS_NAME_WIRE];
+    for (uint16_t a = 0; a < answers && (want & WANT_PTR); a++) {
+        if (!read_name(pkt, len, off, name) || off + 10 > len) {
+            break;
+        }
+        uint16_t type = (pkt[off] << 8) | pkt[off + 1];
+        uint32_t ttl = ((uint32_t)pkt[off + 4] << 24) | (pkt[off + 5] << 16) | (pkt[off + 6] << 8) | pkt[off + 7];
+        uint16_t rdlen = (pkt[off + 8] << 8) | pkt[off + 9];
+        size_t rdata = off + 10;
+        off = rdata + rdlen;
+        if (type == MDNS_TYPE_PTR && ttl >= MDNS_TTL_SERVICE / 2 && same_name(name, m_service_name) &&
+            read_name(pkt, len, rdata, target) && same_name(target, m_instance_name)) {
+            want &= ~WANT_PTR;
+        }
+    }
+    if (!want) {
+        known++;
+        return false;
+    }
+
+    if (!unicast && m_multicast && now - m_multicast_at < MDNS_REPEAT) {
+        duplicates++;
+        return false;
+    }
+    if (!take(now, ip)) {
+        limited++;
+        return false;
+    }
+
+    answered++;
+    if (port != MDNS_PORT) {
+        // a legacy resolver, which wants its id back
+        memcpy(m_legacy, m_answer, m_answer_len);
+        m_legacy[0] = pkt[0];
+        m_legacy[1] = pkt[1];
+        out = {m_legacy, m_answer_len, true};
+        return true;
+    }
+    if (!unicast) {
+        m_multicast_at = now;
+        m_multicast = true;
+    }
+    out = {m_answer, m_answer_len, unicast};
+    return true;
+}
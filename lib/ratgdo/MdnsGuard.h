@@ -0,0 +1,185 @@
+// GPLv3 License
+
+#ifndef _MDNS_GUARD_H
+#define _MDNS_GUARD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// mDNS responder for the HomeKit service, for busy networks. Built with MDNS_GUARD it replaces the
+// ESP8266 core's LEAmDNS responder for _hap._tcp rather than limiting it: the core's is never started
+// (see src/mdns.cpp), and the records are advertised, probed for and defended from here.
+//
+// Every Apple device in the house browses for _hap._tcp, and along with AirPlay, printers and the
+// rest of Bonjour that makes a steady stream of multicast queries. The responder started for
+// HomeKit parses each one in full and builds each answer from scratch. MdnsGuard answers from a
+// response serialized once, and rebuilt only when the name, IP, port or TXT record (config number,
+// pairing) changes. It doesn't answer:
+//
+//  - a multicast query whose answer went out less than MDNS_REPEAT ago, which every querier on
+//    the link saw (RFC 6762 section 6 limits a record to once a second anyway),
+//  - a query that lists our PTR record with at least half its TTL left, a known answer,
+//  - a querier over its rate, a token bucket per source address.
+//
+// A query is dropped as soon as its questions turn out not to be about us. Nothing is allocated.
+//
+// A new name or address is probed for first (RFC 6762 section 8): three queries for the instance
+// and host names, 250 ms apart, with the records about to be claimed. If another host answers
+// with records of its own for either name, that name is given up for the next one, "Garage Door
+// 1A2B3C (2)" or "Garage-Door-1A2B3C-2", and probed for again. Announcing starts only when no one
+// objected. A conflicting answer seen after that sends the name back to probing (section 9).
+
+#define MDNS_PORT 5353
+#define MDNS_PACKET_SIZE 512
+#define MDNS_LABEL_SIZE 64          // a label and its NUL
+#define MDNS_TXT_SIZE 160
+#define MDNS_NAME_WIRE 256          // a name in wire format
+#define MDNS_TTL_HOST 120           // s, SRV and A
+#define MDNS_TTL_SERVICE 4500       // s, PTR and TXT
+#define MDNS_REPEAT 1000            // ms before the same answer is multicast again
+#define MDNS_ANNOUNCE 2             // unsolicited answers after a change, MDNS_REPEAT apart
+#define MDNS_QUERIERS 8             // rate limited apart, the least recently seen is replaced
+#define MDNS_QUERIER_BURST 4        // answers
+#define MDNS_QUERIER_REFILL 2000    // ms per answer after a burst
+#define MDNS_PROBES 3               // probe queries before announcing
+#define MDNS_PROBE_INTERVAL 250     // ms between them, and after the last one
+#define MDNS_PROBE_DEFER 1000       // ms before probing again after a simultaneous probe won
+#define MDNS_CONFLICT_BURST 15      // conflicts in MDNS_CONFLICT_WINDOW before probing slows down
+#define MDNS_CONFLICT_WINDOW 10000  // ms
+#define MDNS_CONFLICT_WAIT 5000     // ms before each probe attempt after a burst of conflicts
+
+#define MDNS_TYPE_A 1
+#define MDNS_TYPE_PTR 12
+#define MDNS_TYPE_TXT 16
+#define MDNS_TYPE_SRV 33
+#define MDNS_TYPE_ANY 255
+#define MDNS_CLASS_IN 1
+#define MDNS_CACHE_FLUSH 0x8000     // in the class of a unique record
+#define MDNS_UNICAST_RESPONSE 0x8000 // in the class of a question, QU
+
+// What is advertised
+struct MdnsService {
+    char instance[MDNS_LABEL_SIZE];     // "Garage Door 1A2B3C"
+    char host[MDNS_LABEL_SIZE];         // "Garage-Door-1A2B3C", without .local
+    uint32_t ip;                        // as IPAddress holds it, first octet lowest
+    uint16_t port;
+    uint8_t txt[MDNS_TXT_SIZE];         // strings, each after its length
+    uint8_t txt_len;
+
+    MdnsService() {
+        memset(this, 0, sizeof(*this));
+    }
+
+    // Adds "key=value" to the TXT record, false if it is full
+    bool add_txt(const char* key, const char* value);
+
+    bool operator==(const MdnsService& other) const;
+};
+
+struct MdnsReply {
+    const uint8_t* buf;
+    uint16_t len;
+    bool unicast;       // to the querier, otherwise to the group
+};
+
+class MdnsGuard {
+    private:
+        struct Querier {
+            bool used;
+            uint8_t tokens;
+            uint32_t ip;
+            uint32_t seen;
+            uint32_t refilled;
+        };
+
+        MdnsService m_wanted;               // as set, before any renaming
+        MdnsService m_service;              // as advertised
+        bool m_ready = false;
+        uint8_t m_answer[MDNS_PACKET_SIZE];
+        uint16_t m_answer_len = 0;
+        uint8_t m_probe_pkt[MDNS_PACKET_SIZE];
+        uint16_t m_probe_len = 0;
+        uint8_t m_legacy[MDNS_PACKET_SIZE];     // the answer with a legacy query's id
+        // our names in wire format and lower case, to match questions against
+        uint8_t m_service_name[MDNS_NAME_WIRE];
+        uint8_t m_instance_name[MDNS_NAME_WIRE];
+        uint8_t m_host_name[MDNS_NAME_WIRE];
+        uint32_t m_multicast_at = 0;
+        bool m_multicast = false;
+        uint8_t m_announce = 0;
+        uint32_t m_announce_at = 0;
+        uint8_t m_probe = 0;                // probes left to send, and the wait after the last
+        uint32_t m_probe_at = 0;
+        uint8_t m_instance_n = 1;           // suffix for a name taken by another host, 1 for none
+        uint8_t m_host_n = 1;
+        uint8_t m_burst = 0;                // conflicts since m_burst_at
+        uint32_t m_burst_at = 0;
+        Querier m_queriers[MDNS_QUERIERS] = {};
+
+        void apply();
+        uint8_t* put_unique(uint8_t* p, const uint8_t* base, uint16_t instance_at, uint16_t local_at, uint16_t host_at,
+                            uint16_t cls) const;
+        void build();
+        void probe_from(uint32_t at);
+        uint8_t owner(const uint8_t* name, uint16_t type) const;
+        int compare(const uint8_t* pkt, size_t len, size_t rdata, uint16_t rdlen, uint16_t type, uint8_t* name) const;
+        void conflict(uint32_t now, uint8_t names);
+        void check_response(uint32_t now, const uint8_t* pkt, size_t len);
+        void tie_break(uint32_t now, const uint8_t* pkt, size_t len, size_t off);
+        bool take(uint32_t now, uint32_t ip);
+
+    public:
+        uint32_t queries = 0;       // packets seen
+        uint32_t answered = 0;
+        uint32_t ignored = 0;       // not queries, not about us, or malformed
+        uint32_t duplicates = 0;    // answer multicast less than MDNS_REPEAT ago
+        uint32_t known = 0;         // querier already had the answer
+        uint32_t limited = 0;       // querier over its rate
+        uint32_t held = 0;          // about us while probing, answered by the announcement
+        uint32_t rebuilds = 0;
+        uint32_t probes = 0;
+        uint32_t conflicts = 0;     // our names claimed by another host
+
+        MdnsGuard() = default;
+
+        uint32_t suppressed() const {
+            return duplicates + known + limited + held;
+        }
+
+        bool probing() const {
+            return m_probe;
+        }
+
+        // What is advertised, as renamed after any conflicts
+        const MdnsService& advertised() const {
+            return m_service;
+        }
+
+        const uint8_t* response(uint16_t* len) const {
+            *len = m_answer_len;
+            return m_answer;
+        }
+
+        // The name at `off` in wire format and lower case, following compression pointers. Moves
+        // `off` past it. False if it is malformed.
+        static bool read_name(const uint8_t* pkt, size_t len, size_t& off, uint8_t* out);
+
+        static bool same_name(const uint8_t* a, const uint8_t* b);
+
+        // Sets what is advertised. The response is serialized again and announced only when it
+        // changed, true if it did. A new name or address is probed for first.
+        bool set(uint32_t now, const MdnsService& service);
+
+        // A probe that is due. Once the wait after the last one passes without a conflict, the
+        // names are ours and announcing starts.
+        bool probe(uint32_t now, MdnsReply& out);
+
+        // An unsolicited answer that is due, after a change
+        bool announcement(uint32_t now, MdnsReply& out);
+
+        // A packet from `ip`:`port`. True with `out` to send if it is to be answered.
+        bool query(uint32_t now, uint32_t ip, uint16_t port, const uint8_t* pkt, size_t len, MdnsReply& out);
+};
+
+#endif // _MDNS_GUARD_H
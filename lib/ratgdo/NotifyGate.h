@@ -0,0 +1,109 @@
+// GPLv3 License
+
+#ifndef _NOTIFY_GATE_H
+#define _NOTIFY_GATE_H
+
+#include <stdint.h>
+
+// Notification suppression for states we flip ourselves.
+//
+// Some sequences change a field over and over on purpose: the time-to-close delay flashes the
+// light every 0.5s, and Security+1.0 emulates a wall button with a press and two releases. Every
+// change would otherwise go to each HomeKit controller as an encrypted event, out as an SSE frame
+// and into the log. While a field is held, its HomeKit notifications are counted and dropped and
+// SSE leaves it out. When the hold ends the field is notified once, if it ended up different from
+// where it started.
+//
+// A hold is open ended until released, or ends by itself at a given time. A hold on a field that
+// is already held only ever makes it last longer.
+
+#define NOTIFY_SETTLE 1500      // ms after a sequence to wait for the opener's last status
+
+enum NotifyField : uint8_t {
+    NOTIFY_LIGHT = 0,
+    NOTIFY_LOCK = 1,
+    NOTIFY_FIELDS = 2,
+};
+
+class NotifyGate {
+    private:
+        struct Hold {
+            bool active;
+            uint8_t before;     // the value notified before the hold
+            uint16_t held;
+            uint32_t until;     // millis, 0 until released
+        };
+        Hold m_holds[NOTIFY_FIELDS] = {};
+
+    public:
+        uint32_t held = 0;          // notifications dropped
+        uint32_t reconciled = 0;    // holds that ended in a changed value and were notified once
+        uint16_t last_held = 0;     // dropped by the last hold to end
+
+        NotifyGate() = default;
+
+        // Holds `field`, last notified as `value`, until `until` or, with 0, until released
+        void hold(NotifyField field, uint8_t value, uint32_t until = 0) {
+            Hold& h = m_holds[field];
+            if (!h.active) {
+                h.active = true;
+                h.before = value;
+                h.held = 0;
+                h.until = until;
+            } else if (!until || (h.until && (int32_t)(until - h.until) > 0)) {
+                h.until = until;
+            }
+        }
+
+        // An open ended hold ends at `until`
+        void release(NotifyField field, uint32_t until) {
+            Hold& h = m_holds[field];
+            if (h.active && !h.until) {
+                h.until = until;
+            }
+        }
+
+        bool holding(NotifyField field) const {
+            return m_holds[field].active;
+        }
+
+        // From a notify function, false if the notification is to be dropped
+        bool pass(NotifyField field) {
+            Hold& h = m_holds[field];
+            if (!h.active) {
+                return true;
+            }
+            h.held++;
+            held++;
+            return false;
+        }
+
+        // Fields whose hold is over at `now`, bit n for field n
+        uint8_t due(uint32_t now) const {
+            uint8_t fields = 0;
+            for (uint8_t f = 0; f < NOTIFY_FIELDS; f++) {
+                const Hold& h = m_holds[f];
+                if (h.active && h.until && (int32_t)(now - h.until) >= 0) {
+                    fields |= 1 << f;
+                }
+            }
+            return fields;
+        }
+
+        // Ends the hold on `field`, now `value`. True if it is to be notified.
+        bool end(NotifyField field, uint8_t value) {
+            Hold& h = m_holds[field];
+            if (!h.active) {
+                return false;
+            }
+            h.active = false;
+            last_held = h.held;
+            if (value == h.before) {
+                return false;
+            }
+            reconciled++;
+            return true;
+        }
+};
+
+#endif // _NOTIFY_GATE_H
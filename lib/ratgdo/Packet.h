@@ -6,11 +6,12 @@
 
 #include <stdint.h>
 #include "secplus2.h"
-#include <secplus.h>
+#include "secplus2_codec.h"
+#include "BitField.h"
 #include "log.h"
 
 // Chamberlain security+ 2.0 wireline packets (i.e. 0x55, 0x10, 0x00, ...) all decode (using
-// `decode_wireline`) into 16 bytes, split across three values:
+// `secplus2_decode_wireline`) into 16 bytes, split across three values:
 //
 // "rolling" 32 bits - the per-device, 24-bit monotonically incrementing value included with every packet
 // "fixed"   64 bits - the value that includes the device ID, as well as the high nibble of the 12-bit command
@@ -54,7 +55,8 @@
 //
 //   Because C++ is a garbage language, bitfields are broken by design, so the elegant method of
 //   specifying bit layout in order to show which bits do which things doesn't work portably. As
-//   such, we get to use mask-and-shift values.
+//   such, each struct lists its fields as shift-and-width descriptors (see BitField.h), and the
+//   mask-and-shift code to de/serialize them is generated from that list.
 //
 //
 // A note on unknowns:
@@ -79,12 +81,6 @@ enum class PacketDataType {
     Unknown,
 };
 
-// Parity is applicable to all incoming packets; outgoing packets leave this unset
-const uint8_t COMMAND_PARITY_MASK = 0b1111;
-const uint8_t COMMAND_PARITY_SHIFT = 12;
-
-const uint8_t DOOR_ACTION_MASK = 0b11;
-const uint8_t DOOR_ACTION_SHIFT = 8;
 // valid values for DoorActionCommandData
 enum class DoorAction : uint8_t {
     Close = 0,
@@ -93,10 +89,6 @@ enum class DoorAction : uint8_t {
     Stop = 3,
 };
 
-const uint8_t DOOR_ACTION_PRESSED_MASK = 0b1;
-const uint8_t DOOR_ACTION_PRESSED_SHIFT = 16;
-const uint8_t DOOR_ACTION_ID_MASK = 0b11; // total guess
-const uint8_t DOOR_ACTION_ID_SHIFT = 24;
 // data attached to PacketCommand::DoorAction
 struct DoorActionCommandData {
     DoorAction action;
@@ -104,23 +96,23 @@ struct DoorActionCommandData {
     bool pressed;
     uint8_t id;
 
+    typedef BitLayout<DoorActionCommandData,
+        Bits<BitField<8, 2, DoorAction>, &DoorActionCommandData::action>,
+        Bits<ParityField, &DoorActionCommandData::parity>,
+        Bits<BitField<16, 1, bool>, &DoorActionCommandData::pressed>,
+        Bits<BitField<24, 2, uint8_t>, &DoorActionCommandData::id>> Layout; // id width is a total guess
+
     DoorActionCommandData() = default;
     DoorActionCommandData(uint32_t pkt_data) {
-        action = static_cast<DoorAction>((pkt_data >> DOOR_ACTION_SHIFT) & DOOR_ACTION_MASK);
-        parity = ((pkt_data >> COMMAND_PARITY_SHIFT) & COMMAND_PARITY_MASK);
-        pressed = ((pkt_data >> DOOR_ACTION_PRESSED_SHIFT) & DOOR_ACTION_PRESSED_MASK);
-        id = ((pkt_data >> DOOR_ACTION_ID_SHIFT) & DOOR_ACTION_ID_MASK);
+        Layout::decode(*this, pkt_data);
     };
 
-    uint32_t to_data(void) {
-        uint32_t pkt_data = 0;
-        pkt_data |= static_cast<uint32_t>(action) << DOOR_ACTION_SHIFT;
-        pkt_data |= parity << COMMAND_PARITY_SHIFT;
-        pkt_data |= pressed << DOOR_ACTION_PRESSED_SHIFT;
-        pkt_data |= (id & DOOR_ACTION_ID_MASK) << DOOR_ACTION_ID_SHIFT;
-        return pkt_data;
+    uint32_t to_data(void) const {
+        return Layout::encode(*this);
     };
 
+    bool operator==(const DoorActionCommandData& other) const { return Layout::equal(*this, other); }
+
     void to_string(char* buf, size_t buflen) {
         const char* d = "invalid door action";
         switch (action) {
@@ -141,8 +133,6 @@ struct DoorActionCommandData {
     };
 };
 
-const uint8_t LOCK_DATA_MASK   = 0b11;
-const uint8_t LOCK_DATA_SHIFT  = 8;
 //const uint8_t LOCK_DATA_OFF    = 0b00;
 //const uint8_t LOCK_DATA_ON     = 0b01;
 //const uint8_t LOCK_DATA_TOGGLE = 0b10;
@@ -159,19 +149,21 @@ struct LockCommandData {
     uint8_t parity;
     bool pressed;
 
+    typedef BitLayout<LockCommandData,
+        Bits<BitField<8, 2, LockState>, &LockCommandData::lock>,
+        Bits<ParityField, &LockCommandData::parity>> Layout;
+
     LockCommandData() = default;
     LockCommandData(uint32_t pkt_data) {
-        lock = static_cast<LockState>((pkt_data >> LOCK_DATA_SHIFT) & LOCK_DATA_MASK);
-        parity = ((pkt_data >> COMMAND_PARITY_SHIFT) & COMMAND_PARITY_MASK);
+        Layout::decode(*this, pkt_data);
     };
 
-    uint32_t to_data(void) {
-        uint32_t pkt_data = 0;
-        pkt_data |= static_cast<uint32_t>(lock) << LOCK_DATA_SHIFT;
-        pkt_data |= parity << COMMAND_PARITY_SHIFT;
-        return pkt_data;
+    uint32_t to_data(void) const {
+        return Layout::encode(*this);
     };
 
+    bool operator==(const LockCommandData& other) const { return Layout::equal(*this, other); }
+
     void to_string(char* buf, size_t buflen) {
         const char* l = "invalid lock command";
         switch (lock) {
@@ -190,8 +182,6 @@ struct LockCommandData {
 
 };
 
-const uint8_t LIGHT_DATA_MASK   = 0b11;
-const uint8_t LIGHT_DATA_SHIFT  = 8;
 //const uint8_t LIGHT_DATA_OFF    = 0b00;
 //const uint8_t LIGHT_DATA_ON     = 0b01;
 //const uint8_t LIGHT_DATA_TOGGLE = 0b10;
@@ -210,19 +200,21 @@ struct LightCommandData {
     uint8_t parity;
     bool pressed;
 
+    typedef BitLayout<LightCommandData,
+        Bits<BitField<8, 2, LightState>, &LightCommandData::light>,
+        Bits<ParityField, &LightCommandData::parity>> Layout;
+
     LightCommandData() = default;
     LightCommandData(uint32_t pkt_data) {
-        light = static_cast<LightState>((pkt_data >> LIGHT_DATA_SHIFT) & LIGHT_DATA_MASK);
-        parity = ((pkt_data >> COMMAND_PARITY_SHIFT) & COMMAND_PARITY_MASK);
+        Layout::decode(*this, pkt_data);
     };
 
-    uint32_t to_data(void) {
-        uint32_t pkt_data = 0;
-        pkt_data |= static_cast<uint32_t>(light) << LIGHT_DATA_SHIFT;
-        pkt_data |= parity << COMMAND_PARITY_SHIFT;
-        return pkt_data;
+    uint32_t to_data(void) const {
+        return Layout::encode(*this);
     };
 
+    bool operator==(const LightCommandData& other) const { return Layout::equal(*this, other); }
+
     void to_string(char* buf, size_t buflen) {
         const char* l = "invalid light command";
         switch (light) {
@@ -244,8 +236,6 @@ struct LightCommandData {
 
 };
 
-const uint8_t STATUS_DOOR_STATE_MASK = 0b1111;
-const uint8_t STATUS_DOOR_STATE_SHIFT = 8;
 // valid states for doors in StatusCommandData
 enum class DoorState : uint8_t {
     Unknown = 0,
@@ -256,16 +246,6 @@ enum class DoorState : uint8_t {
     Closing = 5,
 };
 
-const uint8_t STATUS_UNKNOWN1_MASK = 0b1;
-const uint8_t STATUS_UNKNOWN1_SHIFT = 21;
-const uint8_t STATUS_OBSTRUCTION_MASK = 0b1;
-const uint8_t STATUS_OBSTRUCTION_SHIFT = 22;
-const uint8_t STATUS_LOCK_STATE_MASK = 0b1;
-const uint8_t STATUS_LOCK_STATE_SHIFT = 24;
-const uint8_t STATUS_LIGHT_STATE_MASK = 0b1;
-const uint8_t STATUS_LIGHT_STATE_SHIFT = 25;
-const uint8_t STATUS_UNKNOWN2_MASK = 0b1;
-const uint8_t STATUS_UNKNOWN2_SHIFT = 30;
 // data attached to PacketCommand::Status
 struct StatusCommandData {
     DoorState door;
@@ -276,30 +256,27 @@ struct StatusCommandData {
     bool light;
     bool unknown2;
 
+    typedef BitLayout<StatusCommandData,
+        Bits<BitField<8, 4, DoorState>, &StatusCommandData::door>,
+        Bits<ParityField, &StatusCommandData::parity>,
+        Bits<BitField<21, 1, bool>, &StatusCommandData::unknown1>,
+        Bits<BitField<22, 1, bool>, &StatusCommandData::obstruction>,
+        Bits<BitField<24, 1, bool>, &StatusCommandData::lock>,
+        Bits<BitField<25, 1, bool>, &StatusCommandData::light>,
+        Bits<BitField<30, 1, bool>, &StatusCommandData::unknown2>> Layout;
+
     StatusCommandData() = default;
 
     StatusCommandData(uint32_t pkt_data) {
-        door = static_cast<DoorState>((pkt_data >> STATUS_DOOR_STATE_SHIFT) & STATUS_DOOR_STATE_MASK);
-        parity = ((pkt_data >> COMMAND_PARITY_SHIFT) & COMMAND_PARITY_MASK);
-        unknown1 = ((pkt_data >> STATUS_UNKNOWN1_SHIFT) & STATUS_UNKNOWN1_MASK);
-        obstruction = ((pkt_data >> STATUS_OBSTRUCTION_SHIFT) & STATUS_OBSTRUCTION_MASK);
-        lock = ((pkt_data >> STATUS_LOCK_STATE_SHIFT) & STATUS_LOCK_STATE_MASK);
-        light = ((pkt_data >> STATUS_LIGHT_STATE_SHIFT) & STATUS_LIGHT_STATE_MASK);
-        unknown2 = ((pkt_data >> STATUS_UNKNOWN2_SHIFT) & STATUS_UNKNOWN2_MASK);
+        Layout::decode(*this, pkt_data);
     };
 
-    uint32_t to_data(void) {
-        uint32_t pkt_data = 0;
-        pkt_data |= static_cast<uint8_t>(door) << STATUS_DOOR_STATE_SHIFT;
-        pkt_data |= parity << COMMAND_PARITY_SHIFT;
-        pkt_data |= unknown1 << STATUS_UNKNOWN1_SHIFT;
-        pkt_data |= obstruction << STATUS_OBSTRUCTION_SHIFT;
-        pkt_data |= lock << STATUS_LOCK_STATE_SHIFT;
-        pkt_data |= light << STATUS_LIGHT_STATE_SHIFT;
-        pkt_data |= unknown2 << STATUS_UNKNOWN2_SHIFT;
-        return pkt_data;
+    uint32_t to_data(void) const {
+        return Layout::encode(*this);
     };
 
+    bool operator==(const StatusCommandData& other) const { return Layout::equal(*this, other); }
+
     void to_string(char* buf, size_t buflen) {
         const char* d = "invalid door state";
         switch (door) {
@@ -327,33 +304,26 @@ struct StatusCommandData {
     };
 };
 
-const uint8_t GET_OPENINGS_LO_BYTE_MASK = 0xFF;
-const uint8_t GET_OPENINGS_LO_BYTE_SHIFT = 24;
-const uint8_t GET_OPENINGS_HI_BYTE_MASK = 0xFF;
-const uint8_t GET_OPENINGS_HI_BYTE_SHIFT = 16;
+// data attached to PacketCommand::Openings, the count high byte first
 struct OpeningsCommandData {
     uint16_t count;
     uint8_t parity;
 
+    typedef BitLayout<OpeningsCommandData,
+        Bits<SwappedBitField<16, uint16_t>, &OpeningsCommandData::count>,
+        Bits<ParityField, &OpeningsCommandData::parity>> Layout;
+
     OpeningsCommandData() = default;
     OpeningsCommandData(uint32_t pkt_data) {
-        uint8_t lo = ((pkt_data >> GET_OPENINGS_LO_BYTE_SHIFT) & GET_OPENINGS_LO_BYTE_MASK);
-        uint8_t hi = ((pkt_data >> GET_OPENINGS_HI_BYTE_SHIFT) & GET_OPENINGS_HI_BYTE_MASK);
-        parity = ((pkt_data >> COMMAND_PARITY_SHIFT) & COMMAND_PARITY_MASK);
-
-        count = hi << 8 | lo;
+        Layout::decode(*this, pkt_data);
     };
 
-    uint32_t to_data(void) {
-        uint32_t pkt_data = 0;
-        uint8_t lo = count & 0xFF;
-        uint8_t hi = count >> 8;
-        pkt_data |= lo << GET_OPENINGS_LO_BYTE_SHIFT;
-        pkt_data |= hi << GET_OPENINGS_HI_BYTE_SHIFT;
-        pkt_data |= parity << COMMAND_PARITY_SHIFT;
-        return pkt_data;
+    uint32_t to_data(void) const {
+        return Layout::encode(*this);
     };
 
+    bool operator==(const OpeningsCommandData& other) const { return Layout::equal(*this, other); }
+
     void to_string(char* buf, size_t buflen) {
         snprintf(buf, buflen, "Openings %02d", count);
     };
@@ -368,13 +338,13 @@ struct NoData {
 
     NoData() = default;
     NoData(uint32_t pkt_data) {
-        no_bits_set = pkt_data & ~(COMMAND_PARITY_MASK << COMMAND_PARITY_SHIFT);
+        no_bits_set = pkt_data & ~ParityField::mask;
         no_bits_set = no_bits_set & ~0xFF; // skip cmd byte
-        parity = ((pkt_data >> COMMAND_PARITY_SHIFT) & COMMAND_PARITY_MASK);
+        parity = ParityField::get(pkt_data);
     };
 
-    uint32_t to_data(void) {
-        return no_bits_set | (parity << COMMAND_PARITY_SHIFT);
+    uint32_t to_data(void) const {
+        return no_bits_set | ParityField::put(parity);
     };
 
     void to_string(char* buf, size_t buflen) {
@@ -583,7 +553,7 @@ struct Packet {
             uint64_t pkt_remote_id = 0; // three bytes
             uint32_t pkt_data = 0;
 
-            decode_wireline(pktbuf, &pkt_rolling, &pkt_remote_id, &pkt_data);
+            secplus2_decode_wireline(pktbuf, &pkt_rolling, &pkt_remote_id, &pkt_data);
             RINFO("DECODED  %08X %016llX %08X", pkt_rolling, pkt_remote_id, pkt_data);
 
             uint16_t cmd = ((pkt_remote_id >> 24) & 0xF00) | (pkt_data & 0xFF);
@@ -749,7 +719,7 @@ struct Packet {
             pkt_data |= (m_pkt_cmd & 0xFF);
 
             RINFO("ENCODING %08X %016llX %08X", m_rolling, fixed, pkt_data);
-            return encode_wireline(m_rolling, fixed, pkt_data, out_pktbuf);
+            return secplus2_encode_wireline(m_rolling, fixed, pkt_data, out_pktbuf);
         }
 
         /*
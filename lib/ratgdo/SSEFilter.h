@@ -0,0 +1,203 @@
+// GPLv3 License
+
+#ifndef _SSE_FILTER_H
+#define _SSE_FILTER_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Per subscriber Server-Sent Event filters.
+//
+// A subscriber asks for the event types it wants (status deltas, log lines, heartbeats, upload
+// progress) and, for status deltas, the fields it wants:
+//
+//   /rest/events/subscribe?id=<uuid>&events=status&fields=garageDoorState,garageObstructed
+//
+// A frame is skipped for a subscriber that doesn't want its event type or any of its fields, and
+// trimmed to the wanted fields otherwise. upTime rides along with any other field but a frame with
+// nothing else left is skipped. Frames are the flat JSON objects built in web.cpp, so trimming
+// works on top level "key": value pairs without a full parser.
+
+enum SSEEvent : uint8_t {
+    SSE_EVENT_STATUS = 0x01,
+    SSE_EVENT_LOG = 0x02,
+    SSE_EVENT_HEARTBEAT = 0x04,
+    SSE_EVENT_UPLOAD = 0x08,
+    SSE_EVENT_ALL = 0x0F,
+};
+
+#define SSE_FIELD_UPTIME 0x0001
+#define SSE_FIELD_OTHER 0x8000          // keys not in the table below
+#define SSE_FIELDS_ALL 0xFFFF
+
+class SSEFilter {
+    private:
+        static const char* const* field_names() {
+            // bit n is field_names()[n]
+            static const char* const names[] = {
+                "upTime",
+                "lastDoorUpdateAt",
+                "paired",
+                "garageDoorState",
+                "garageLockState",
+                "garageLightOn",
+                "garageMotion",
+                "garageObstructed",
+                nullptr,
+            };
+            return names;
+        }
+
+        // Call f(token, len) for each comma separated token of `list`
+        template <typename F>
+        static void each_token(const char* list, F f) {
+            while (list && *list) {
+                const char* end = strchr(list, ',');
+                size_t len = end ? (size_t)(end - list) : strlen(list);
+                if (len) {
+                    f(list, len);
+                }
+                list = end ? end + 1 : nullptr;
+            }
+        }
+
+        static bool token_is(const char* token, size_t len, const char* name) {
+            return strlen(name) == len && !strncmp(token, name, len);
+        }
+
+        // Find the next top level "key": value pair at or after `p`. Sets the key and the extent of
+        // the pair (up to, not including, the following comma or closing brace).
+        static bool next_pair(const char*& p, const char*& key, size_t& key_len, const char*& pair_end) {
+            while (*p && *p != '"') {
+                if (*p == '}') {
+                    return false;
+                }
+                p++;
+            }
+            if (!*p) {
+                return false;
+            }
+            key = ++p;
+            while (*p && *p != '"') {
+                p++;
+            }
+            if (!*p) {
+                return false;
+            }
+            key_len = p - key;
+            p++;
+            // value: a string, possibly with escapes, or a bare literal
+            bool in_string = false;
+            while (*p) {
+                if (in_string) {
+                    if (*p == '\\' && p[1]) {
+                        p++;
+                    } else if (*p == '"') {
+                        in_string = false;
+                    }
+                } else if (*p == '"') {
+                    in_string = true;
+                } else if (*p == ',' || *p == '}') {
+                    break;
+                }
+                p++;
+            }
+            pair_end = p;
+            return true;
+        }
+
+    public:
+        // "status,log,heartbeat,upload", unknown names are ignored
+        static uint8_t parse_events(const char* list) {
+            uint8_t events = 0;
+            each_token(list, [&events](const char* t, size_t len) {
+                if (token_is(t, len, "status")) {
+                    events |= SSE_EVENT_STATUS;
+                } else if (token_is(t, len, "log")) {
+                    events |= SSE_EVENT_LOG;
+                } else if (token_is(t, len, "heartbeat")) {
+                    events |= SSE_EVENT_HEARTBEAT;
+                } else if (token_is(t, len, "upload")) {
+                    events |= SSE_EVENT_UPLOAD;
+                } else if (token_is(t, len, "all")) {
+                    events |= SSE_EVENT_ALL;
+                }
+            });
+            return events;
+        }
+
+        static uint16_t field_bit(const char* key, size_t len) {
+            const char* const* names = field_names();
+            for (uint8_t i = 0; names[i]; i++) {
+                if (token_is(key, len, names[i])) {
+                    return 1 << i;
+                }
+            }
+            return SSE_FIELD_OTHER;
+        }
+
+        // "garageDoorState,garageLightOn", unknown names are ignored
+        static uint16_t parse_fields(const char* list) {
+            uint16_t fields = 0;
+            each_token(list, [&fields](const char* t, size_t len) {
+                uint16_t bit = field_bit(t, len);
+                if (bit != SSE_FIELD_OTHER) {
+                    fields |= bit;
+                }
+            });
+            return fields;
+        }
+
+        // The fields present in a frame
+        static uint16_t frame_fields(const char* json) {
+            uint16_t fields = 0;
+            const char* p = json;
+            const char* key;
+            size_t key_len;
+            const char* pair_end;
+            while (next_pair(p, key, key_len, pair_end)) {
+                fields |= field_bit(key, key_len);
+            }
+            return fields;
+        }
+
+        // Whether a frame with `present` fields is wanted at all by a subscriber of `wanted`
+        static bool wants(uint16_t present, uint16_t wanted) {
+            return (present & wanted & ~SSE_FIELD_UPTIME) != 0;
+        }
+
+        // Copy the wanted fields of `json` to `out`. Returns the length written, or 0 if it would
+        // be too long for `outlen`.
+        static size_t trim(const char* json, uint16_t wanted, char* out, size_t outlen) {
+            size_t n = 0;
+            auto put = [&](const char* s, size_t len) {
+                if (n + len >= outlen) {
+                    return false;
+                }
+                memcpy(out + n, s, len);
+                n += len;
+                out[n] = 0;
+                return true;
+            };
+            if (!put("{", 1)) {
+                return 0;
+            }
+            bool first = true;
+            const char* p = json;
+            const char* key;
+            size_t key_len;
+            const char* pair_end;
+            while (next_pair(p, key, key_len, pair_end)) {
+                if (field_bit(key, key_len) & wanted) {
+                    const char* start = key - 1;
+                    if ((!first && !put(", ", 2)) || !put(start, pair_end - start)) {
+                        return 0;
+                    }
+                    first = false;
+                }
+            }
+            return put("}", 1) ? n : 0;
+        }
+};
+
+#endif // _SSE_FILTER_H
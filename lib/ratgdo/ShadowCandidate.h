@@ -0,0 +1,133 @@
+// GPLv3 License
+
+#ifndef _SHADOW_CANDIDATE_H
+#define _SHADOW_CANDIDATE_H
+
+#include <stdint.h>
+#include "Reader.h"
+#include "Packet.h"
+#include "ShadowDecode.h"
+
+// Candidate parsers run in the shadow of production, see ShadowDecode.h.
+//
+// A candidate takes the received bytes one at a time and returns true with the frame and the
+// state after it when it has decoded a frame. It keeps all of its own state and must not touch
+// anything the firmware acts on. A parser change is tried by making it here first; once the
+// disagreement ring stays empty in the field, it moves into comms.cpp.
+//
+// As shipped, CandidateSecPlus2 is the production reader and decoder. CandidateSecPlus1 is the
+// framing from comms_loop, except that a partial message is dropped when the next byte comes more
+// than SHADOW_SEC1_TIMEOUT after the previous one. Production compares against the time of the
+// byte just read, so its timeout never fires.
+
+#define SHADOW_SEC1_TIMEOUT 100     // ms, a whole message takes ~20ms
+
+class CandidateSecPlus2 {
+    private:
+        SecPlus2Reader m_reader;
+        ShadowState m_state;
+
+    public:
+        CandidateSecPlus2() = default;
+
+        // Frames on the preamble, not on timing, so the time of the byte isn't needed
+        bool push(uint32_t /* now */, uint8_t b, ShadowFrame& frame, ShadowState& state) {
+            if (!m_reader.push_byte(b)) {
+                return false;
+            }
+            Packet pkt = Packet(m_reader.fetch_buf());
+            m_state.apply(pkt);
+            frame = ShadowFrame::from_packet(pkt);
+            state = m_state;
+            return true;
+        }
+};
+
+class CandidateSecPlus1 {
+    private:
+        bool m_reading = false;
+        uint8_t m_key = 0;
+        uint32_t m_last = 0;
+        uint8_t m_prev_door = 0;
+        ShadowState m_state;
+
+        void apply(uint8_t key, uint8_t val) {
+            switch (key) {
+                case 0x38:
+                    // 0x0X moving, 0x5X stopped, anything else is a collision
+                    if ((val & 0xF0) != 0x00 && (val & 0xF0) != 0x50 && (val & 0xF0) != 0xB0) {
+                        return;
+                    }
+                    val &= 0x7;
+                    // the same door state twice in a row before it is believed
+                    if (val != m_prev_door) {
+                        m_prev_door = val;
+                        return;
+                    }
+                    switch (val) {
+                        case 0x00:
+                        case 0x06:
+                            m_state.door = (uint8_t)DoorState::Stopped;
+                            break;
+                        case 0x01:
+                            m_state.door = (uint8_t)DoorState::Opening;
+                            break;
+                        case 0x02:
+                            m_state.door = (uint8_t)DoorState::Open;
+                            break;
+                        case 0x04:
+                            m_state.door = (uint8_t)DoorState::Closing;
+                            break;
+                        case 0x05:
+                            m_state.door = (uint8_t)DoorState::Closed;
+                            break;
+                        default:
+                            m_state.door = (uint8_t)DoorState::Unknown;
+                            break;
+                    }
+                    break;
+                case 0x3A:
+                    if ((val & 0xF0) != 0x50) {
+                        return;
+                    }
+                    m_state.light = (val >> 2) & 1;
+                    m_state.lock = !((val >> 3) & 1);
+                    break;
+            }
+        }
+
+    public:
+        CandidateSecPlus1() = default;
+
+        bool push(uint32_t now, uint8_t b, ShadowFrame& frame, ShadowState& state) {
+            if (m_reading && now - m_last > SHADOW_SEC1_TIMEOUT) {
+                m_reading = false;
+            }
+            m_last = now;
+
+            uint8_t key;
+            uint8_t val = 0;
+            if (m_reading) {
+                key = m_key;
+                val = b;
+                m_reading = false;
+            } else if (b >= 0x30 && b <= 0x37) {
+                // button press or release, a single byte
+                key = b;
+            } else if (b >= 0x38 && b <= 0x3A) {
+                // status poll, the opener answers with the second byte
+                m_key = b;
+                m_reading = true;
+                return false;
+            } else {
+                return false;
+            }
+
+            apply(key, val);
+            frame = ShadowFrame::from_secplus1(key, val);
+            state = m_state;
+            return true;
+        }
+};
+
+#endif // _SHADOW_CANDIDATE_H
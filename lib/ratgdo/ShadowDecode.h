@@ -0,0 +1,235 @@
+// GPLv3 License
+
+#ifndef _SHADOW_DECODE_H
+#define _SHADOW_DECODE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "Packet.h"
+
+// Shadow decoding, to try a parser change in the field without trusting it.
+//
+// With SHADOW_DECODE, every received byte is also fed to a candidate parser (ShadowCandidate.h).
+// The frames each parser decodes, and the door, light, lock and obstruction state that follows
+// from them, are matched up in order and compared. A frame only one parser produced, a frame that
+// differs, or state that differs is a disagreement, kept in a small ring for /showshadow. The
+// candidate's output is never acted on. CPU cycles spent in each parser are counted so a faster
+// candidate can be shown to be faster before it replaces production.
+
+#define SHADOW_RING_SIZE 8
+#define SHADOW_PENDING 4            // frames one parser may be ahead of the other
+#define SHADOW_UNKNOWN 0xFF
+
+// A decoded frame. Security+2.0: command word, data, rolling code and remote id. Security+1.0:
+// the message byte as `cmd` and the opener's answer, if any, as `data`.
+struct ShadowFrame {
+    uint16_t cmd;
+    uint32_t data;
+    uint32_t rolling;
+    uint32_t remote;
+
+    bool operator==(const ShadowFrame& other) const {
+        return cmd == other.cmd && data == other.data && rolling == other.rolling && remote == other.remote;
+    }
+
+    static ShadowFrame from_packet(Packet& pkt) {
+        uint32_t data = 0;
+        switch (pkt.m_data.type) {
+            case PacketDataType::NoData:
+                data = pkt.m_data.value.no_data.to_data();
+                break;
+            case PacketDataType::Status:
+                data = pkt.m_data.value.status.to_data();
+                break;
+            case PacketDataType::Lock:
+                data = pkt.m_data.value.lock.to_data();
+                break;
+            case PacketDataType::Light:
+                data = pkt.m_data.value.light.to_data();
+                break;
+            case PacketDataType::DoorAction:
+                data = pkt.m_data.value.door_action.to_data();
+                break;
+            case PacketDataType::Openings:
+                data = pkt.m_data.value.openings.to_data();
+                break;
+            case PacketDataType::Unknown:
+                data = pkt.m_data.value.cmd;
+                break;
+        }
+        return {(uint16_t)static_cast<PacketCommand::PacketCommandValue>(pkt.m_pkt_cmd), data, pkt.m_rolling, (uint32_t)pkt.m_remote_id};
+    }
+
+    static ShadowFrame from_secplus1(uint8_t key, uint8_t val) {
+        return {key, val, 0, 0};
+    }
+};
+
+// State as the rest of the firmware sees it, SHADOW_UNKNOWN until known
+struct ShadowState {
+    uint8_t door = SHADOW_UNKNOWN;     // DoorState
+    uint8_t light = SHADOW_UNKNOWN;
+    uint8_t lock = SHADOW_UNKNOWN;
+    uint8_t obstruction = SHADOW_UNKNOWN;
+
+    bool operator==(const ShadowState& other) const {
+        return door == other.door && light == other.light && lock == other.lock && obstruction == other.obstruction;
+    }
+
+    // Security+2.0 state follows from Status packets alone
+    void apply(Packet& pkt) {
+        if (pkt.m_pkt_cmd == PacketCommand::Status) {
+            door = (uint8_t)pkt.m_data.value.status.door;
+            light = pkt.m_data.value.status.light;
+            lock = pkt.m_data.value.status.lock;
+            obstruction = pkt.m_data.value.status.obstruction;
+        }
+    }
+};
+
+enum class ShadowMismatch : uint8_t {
+    Frame,              // both decoded a frame, different ones
+    State,              // same frame, different state after it
+    ProductionOnly,     // the candidate missed a frame
+    CandidateOnly,      // the candidate decoded a frame production didn't
+};
+
+struct ShadowRecord {
+    uint32_t time;
+    ShadowMismatch kind;
+    ShadowFrame production;
+    ShadowFrame candidate;
+    ShadowState production_state;
+    ShadowState candidate_state;
+};
+
+class ShadowCompare {
+    private:
+        struct Pending {
+            ShadowFrame frame;
+            ShadowState state;
+        };
+
+        // frames one side has decoded that the other hasn't yet
+        struct Queue {
+            Pending items[SHADOW_PENDING];
+            uint8_t head = 0;
+            uint8_t count = 0;
+
+            void push(const Pending& p) {
+                items[(head + count) % SHADOW_PENDING] = p;
+                count++;
+            }
+
+            Pending pop() {
+                Pending p = items[head];
+                head = (head + 1) % SHADOW_PENDING;
+                count--;
+                return p;
+            }
+        };
+
+        Queue m_production;
+        Queue m_candidate;
+        ShadowRecord m_ring[SHADOW_RING_SIZE];
+        uint32_t m_recorded = 0;
+
+        void record(uint32_t now, ShadowMismatch kind, const Pending* production, const Pending* candidate) {
+            ShadowRecord& r = m_ring[m_recorded++ % SHADOW_RING_SIZE];
+            r = ShadowRecord();
+            r.time = now;
+            r.kind = kind;
+            if (production) {
+                r.production = production->frame;
+                r.production_state = production->state;
+            }
+            if (candidate) {
+                r.candidate = candidate->frame;
+                r.candidate_state = candidate->state;
+            }
+            disagreements++;
+        }
+
+        void compare(uint32_t now, const Pending& production, const Pending& candidate) {
+            frames++;
+            if (!(production.frame == candidate.frame)) {
+                record(now, ShadowMismatch::Frame, &production, &candidate);
+            } else if (!(production.state == candidate.state)) {
+                record(now, ShadowMismatch::State, &production, &candidate);
+            }
+        }
+
+        // A frame from one side, matched with the oldest unmatched frame from the other
+        void decoded(uint32_t now, Queue& mine, Queue& theirs, const Pending& p, bool is_production) {
+            if (theirs.count) {
+                Pending other = theirs.pop();
+                compare(now, is_production ? p : other, is_production ? other : p);
+                return;
+            }
+            if (mine.count == SHADOW_PENDING) {
+                // the other side has fallen too far behind, it missed this one
+                Pending old = mine.pop();
+                record(now, is_production ? ShadowMismatch::ProductionOnly : ShadowMismatch::CandidateOnly,
+                       is_production ? &old : nullptr, is_production ? nullptr : &old);
+            }
+            mine.push(p);
+        }
+
+    public:
+        uint32_t frames = 0;                // compared
+        uint32_t disagreements = 0;
+        uint32_t bytes = 0;
+        uint32_t production_cycles = 0;     // wraps, compare per byte rates
+        uint32_t candidate_cycles = 0;
+
+        ShadowCompare() = default;
+
+        void production(uint32_t now, const ShadowFrame& frame, const ShadowState& state) {
+            decoded(now, m_production, m_candidate, {frame, state}, true);
+        }
+
+        void candidate(uint32_t now, const ShadowFrame& frame, const ShadowState& state) {
+            decoded(now, m_candidate, m_production, {frame, state}, false);
+        }
+
+        // Cycles per received byte
+        uint32_t production_per_byte() const { return bytes ? production_cycles / bytes : 0; }
+        uint32_t candidate_per_byte() const { return bytes ? candidate_cycles / bytes : 0; }
+
+        // Most recent first, nullptr past the last one
+        const ShadowRecord* recent(uint8_t n) const {
+            if (n >= SHADOW_RING_SIZE || n >= m_recorded) {
+                return nullptr;
+            }
+            return &m_ring[(m_recorded - 1 - n) % SHADOW_RING_SIZE];
+        }
+
+        static const char* kind_name(ShadowMismatch kind) {
+            switch (kind) {
+                case ShadowMismatch::Frame:
+                    return "frame";
+                case ShadowMismatch::State:
+                    return "state";
+                case ShadowMismatch::ProductionOnly:
+                    return "production only";
+                case ShadowMismatch::CandidateOnly:
+                    return "candidate only";
+                default:
+                    return "?";
+            }
+        }
+
+        static void to_string(const ShadowRecord* r, char* buf, size_t buflen) {
+            snprintf(buf, buflen, "%lu %s: production %03X %08lX %07lX %06lX door %u light %u lock %u obs %u, "
+                     "candidate %03X %08lX %07lX %06lX door %u light %u lock %u obs %u",
+                     (unsigned long)r->time, kind_name(r->kind),
+                     r->production.cmd, (unsigned long)r->production.data, (unsigned long)r->production.rolling,
+                     (unsigned long)r->production.remote, r->production_state.door, r->production_state.light,
+                     r->production_state.lock, r->production_state.obstruction,
+                     r->candidate.cmd, (unsigned long)r->candidate.data, (unsigned long)r->candidate.rolling,
+                     (unsigned long)r->candidate.remote, r->candidate_state.door, r->candidate_state.light,
+                     r->candidate_state.lock, r->candidate_state.obstruction);
+        }
+};
+
+#endif // _SHADOW_DECODE_H
@@ -0,0 +1,184 @@
+// GPLv3 License
+
+#ifndef _STATSD_H
+#define _STATSD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// StatsD metrics pushed over UDP.
+//
+// Scraping status.json from a fleet means an HTTP connection per device per interval, against a
+// web server that serves one client at a time. With STATSD the device instead pushes its counters
+// and gauges to a collector every interval, as StatsD lines:
+//
+//   ratgdo.<device>.tx.collisions:2|c
+//   ratgdo.<device>.heap.free:24816|g
+//
+// Lines are assembled in a fixed buffer and sent a datagram at a time, STATSD_PACKET_SIZE bytes at
+// most so nothing is fragmented. The counters are the ones status.json reports, which only ever
+// go up; each push sends the increase since the last one.
+
+#define STATSD_PACKET_SIZE 512      // bytes a datagram
+#define STATSD_PREFIX_SIZE 48       // "ratgdo.<device>."
+#define STATSD_LINE_SIZE 96
+#define STATSD_PORT 8125
+#define STATSD_KEYS 12              // packet commands counted apart, the rest go in "other"
+#define STATSD_HIST_BUCKETS 48      // two per power of two
+
+// One datagram being built. `Sink` is called with each full datagram, send(buf, len).
+template <typename Sink>
+class StatsdPacket {
+    private:
+        Sink& m_sink;
+        char m_buf[STATSD_PACKET_SIZE];
+        size_t m_len = 0;
+        char m_prefix[STATSD_PREFIX_SIZE] = "";
+
+        void line(const char* name, const char* value, const char* type) {
+            char l[STATSD_LINE_SIZE];
+            int n = snprintf(l, sizeof(l), "%s%s:%s|%s\n", m_prefix, name, value, type);
+            if (n <= 0 || n >= (int)sizeof(l)) {
+                dropped++;
+                return;
+            }
+            if (m_len + n > sizeof(m_buf)) {
+                flush();
+            }
+            memcpy(m_buf + m_len, l, n);
+            m_len += n;
+            lines++;
+        }
+
+    public:
+        uint32_t packets = 0;
+        uint32_t lines = 0;
+        uint32_t dropped = 0;       // lines too long to send
+
+        StatsdPacket(Sink& sink) : m_sink(sink) {}
+
+        // `ratgdo.<name>.`, with anything StatsD or Graphite would read as structure made a '_'
+        void begin(const char* name) {
+            // as much of the name as leaves room for the '.'
+            const int room = sizeof(m_prefix) - sizeof("ratgdo.") - 1;
+            int n = snprintf(m_prefix, sizeof(m_prefix), "ratgdo.%.*s", room, name);
+            if (n < 0) {
+                n = 0;
+            }
+            for (int i = sizeof("ratgdo.") - 1; i < n; i++) {
+                char c = m_prefix[i];
+                if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-')) {
+                    m_prefix[i] = '_';
+                }
+            }
+            m_prefix[n] = '.';
+            m_prefix[n + 1] = 0;
+        }
+
+        void gauge(const char* name, int32_t value) {
+            char v[12];
+            snprintf(v, sizeof(v), "%d", (int)value);
+            line(name, v, "g");
+        }
+
+        // The increase in `total` since `last`, nothing if none
+        void count(const char* name, uint32_t total, uint32_t& last) {
+            uint32_t delta = total - last;
+            last = total;
+            if (!delta) {
+                return;
+            }
+            char v[12];
+            snprintf(v, sizeof(v), "%u", (unsigned)delta);
+            line(name, v, "c");
+        }
+
+        // Sends what is left
+        void flush() {
+            if (m_len) {
+                m_sink.send(m_buf, m_len);
+                packets++;
+                m_len = 0;
+            }
+        }
+};
+
+// Counts by key, the first STATSD_KEYS keys seen get their own count and the rest share one
+struct StatsdKeyedCounts {
+    uint16_t keys[STATSD_KEYS];
+    uint32_t counts[STATSD_KEYS];
+    uint32_t last[STATSD_KEYS];
+    uint8_t used = 0;
+    uint32_t other = 0;
+    uint32_t other_last = 0;
+
+    void add(uint16_t key) {
+        for (uint8_t i = 0; i < used; i++) {
+            if (keys[i] == key) {
+                counts[i]++;
+                return;
+            }
+        }
+        if (used < STATSD_KEYS) {
+            keys[used] = key;
+            counts[used] = 1;
+            last[used] = 0;
+            used++;
+            return;
+        }
+        other++;
+    }
+};
+
+// Log scale histogram of durations, for percentiles that the moving average and max miss. Bucket
+// 2n covers [2^n, 1.5*2^n) and 2n+1 covers [1.5*2^n, 2^(n+1)), 0 and 1 have buckets of their own.
+struct StatsdHistogram {
+    uint32_t buckets[STATSD_HIST_BUCKETS] = {0};
+    uint32_t samples = 0;
+
+    static uint8_t bucket(uint32_t v) {
+        if (v < 2) {
+            return v;
+        }
+        uint8_t octave = 31 - __builtin_clz(v);
+        uint8_t b = octave * 2 + ((v >> (octave - 1)) & 1);
+        return b < STATSD_HIST_BUCKETS ? b : STATSD_HIST_BUCKETS - 1;
+    }
+
+    // the largest value bucket b holds
+    static uint32_t upper(uint8_t b) {
+        uint8_t octave = b / 2;
+        uint32_t base = 1u << octave;
+        return (b & 1) ? (base << 1) - 1 : base + (base >> 1) - 1;
+    }
+
+    void add(uint32_t v) {
+        buckets[bucket(v)]++;
+        samples++;
+    }
+
+    // Upper bound of the `pct` percentile, 0 with no samples
+    uint32_t percentile(uint8_t pct) const {
+        if (!samples) {
+            return 0;
+        }
+        uint32_t want = (uint64_t)samples * pct / 100;
+        uint32_t seen = 0;
+        for (uint8_t b = 0; b < STATSD_HIST_BUCKETS; b++) {
+            seen += buckets[b];
+            if (seen > want || seen == samples) {
+                return upper(b);
+            }
+        }
+        return upper(STATSD_HIST_BUCKETS - 1);
+    }
+
+    void reset() {
+        memset(buckets, 0, sizeof(buckets));
+        samples = 0;
+    }
+};
+
+#endif // _STATSD_H
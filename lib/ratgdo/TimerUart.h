@@ -0,0 +1,131 @@
+// GPLv3 License
+
+#ifndef _TIMER_UART_H
+#define _TIMER_UART_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Timer driven UART transmitter.
+//
+// With interrupt TX off, SoftwareSerial bit-bangs a whole write with interrupts masked, about 20ms
+// for a Security+2.0 packet. WiFi, the obstruction sensor ISR and Ticker are held off for all of
+// it. With TIMER_UART_TX, hardware timer 1 interrupts at each bit boundary instead and the ISR
+// sets the pin, so interrupts are only masked for the ISR itself. The timer reloads itself, so
+// ISR latency delays a bit edge without moving the ones after it. The level of each bit is worked
+// out one interrupt ahead, so the ISR can set the pin before anything else.
+//
+// The longest an ISR runs goes into `masked_max`, and the longest an ISR starts after its bit
+// boundary goes into `late_max`, both in CPU cycles. An ISR held off for more than a bit loses
+// an interrupt, which is counted in `missed`.
+
+#define TIMER_UART_TX_SIZE 32       // bytes per write, a Security+2.0 packet is 19
+
+class TimerUartTx {
+    private:
+        uint8_t m_buf[TIMER_UART_TX_SIZE];
+        uint8_t m_len = 0;
+        uint8_t m_pos = 0;              // character being sent
+        uint16_t m_frame = 0;           // its bits, LSB first, start bit included
+        uint8_t m_bit = 0;
+        uint8_t m_frame_bits = 10;      // start + data + parity + stop
+        bool m_even_parity = false;
+        bool m_level = true;            // of the next bit, true is mark (idle)
+        volatile bool m_busy = false;
+
+        uint32_t m_bit_cycles = 0;
+        uint32_t m_start = 0;           // cycle count of the first bit boundary
+        uint32_t m_ticks = 0;           // bit boundaries since
+
+        uint16_t frame(uint8_t b) const {
+            uint16_t bits = (uint16_t)b << 1;
+            if (m_even_parity) {
+                bits |= (uint16_t)__builtin_parity(b) << 9;
+            }
+            return bits | (1 << (m_frame_bits - 1));
+        }
+
+    public:
+        uint32_t masked_max = 0;
+        uint32_t late_max = 0;
+        uint32_t missed = 0;            // bit boundaries with no interrupt, the character is garbled
+
+        TimerUartTx() = default;
+
+        void begin(uint32_t bit_cycles, bool even_parity) {
+            m_bit_cycles = bit_cycles;
+            m_even_parity = even_parity;
+            m_frame_bits = even_parity ? 11 : 10;
+            m_busy = false;
+        }
+
+        // Queues a write, false if one is still going or it doesn't fit. The caller then calls
+        // tick() for the first bit and starts the timer.
+        bool start(const uint8_t* buf, size_t len, uint32_t now) {
+            if (m_busy || !len || len > TIMER_UART_TX_SIZE) {
+                return false;
+            }
+            memcpy(m_buf, buf, len);
+            m_len = len;
+            m_pos = 0;
+            m_bit = 0;
+            m_frame = frame(m_buf[0]);
+            m_level = false;
+            m_start = now;
+            m_ticks = 0;
+            m_busy = true;
+            return true;
+        }
+
+        bool busy() const { return m_busy; }
+
+        // At each bit boundary, from the timer ISR. Returns the level of the bit starting now, true
+        // for mark. `done` is set at the end of the last stop bit, when the timer can be stopped.
+        inline __attribute__((always_inline)) bool tick(uint32_t now, bool* done) {
+            uint32_t late = now - (m_start + m_ticks * m_bit_cycles);
+            if (late >= m_bit_cycles) {
+                // a timer interrupt was lost behind something else, the bits from here are late
+                missed++;
+                m_ticks += late / m_bit_cycles;
+                late %= m_bit_cycles;
+            }
+            m_ticks++;
+            if (late > late_max) {
+                late_max = late;
+            }
+
+            bool level = m_level;
+            if (!m_busy || m_pos == m_len) {
+                m_busy = false;
+                *done = true;
+                return true;
+            }
+            *done = false;
+
+            if (++m_bit == m_frame_bits) {
+                m_bit = 0;
+                if (++m_pos == m_len) {
+                    m_level = true;
+                    return level;
+                }
+                m_frame = frame(m_buf[m_pos]);
+            }
+            m_level = (m_frame >> m_bit) & 1;
+            return level;
+        }
+
+        // From the ISR on the way out, with the time it took
+        inline __attribute__((always_inline)) void masked(uint32_t cycles) {
+            if (cycles > masked_max) {
+                masked_max = cycles;
+            }
+        }
+
+        // A write that never finished, the timer stopped
+        void abort() {
+            m_busy = false;
+        }
+};
+
+#endif // _TIMER_UART_H
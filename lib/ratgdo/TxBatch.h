@@ -0,0 +1,66 @@
+// GPLv3 License
+
+#ifndef _TX_BATCH_H
+#define _TX_BATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "secplus2.h"
+
+// Security+2.0 transmit batching.
+//
+// A door command is a DoorAction press, a release and a GetStatus; light and lock are the command
+// and a GetStatus. Sent one packet per pass of comms_loop, each packet needs its own wake pulse and
+// collision check, and the opener is free to start talking between them. Packets queued as one
+// action are instead encoded up front and sent in a single bus claim, back to back with
+// TX_BATCH_GAP of idle line between them. If someone else has the line when the next packet is
+// due, the rest stay queued and are retried like any other failed transmit.
+//
+// Batching is built in with TX_BATCH, and is off by default until it has been validated against
+// real openers. TX_BATCH_GAP is a guess, and the packets after the first go out without a wake
+// pulse of their own, where a wall panel leaves about 200ms between press and release. Without it
+// each packet is still sent through tx_batch() on its own, one per pass of comms_loop.
+//
+// Every transmit goes through tx_batch(), so the counters cover both single packets and batches.
+
+#define TX_BATCH_MAX 3          // packets, a door command
+#define TX_BATCH_GAP 3000       // us of idle line between packets, about 3 byte times
+
+struct TxStats {
+    uint32_t claims = 0;        // wake pulses, each a window for a collision
+    uint32_t collisions = 0;    // line busy at a claim, or between packets of a batch
+    uint32_t packets = 0;
+    uint32_t batches = 0;       // claims that sent more than one packet
+};
+
+// Sends `count` encoded packets in one claim of the line and returns how many went out. Line
+// provides claim() (wake the bus, false if someone else keeps it asserted), busy(),
+// write(buf, len) and wait_us(us).
+template <typename Line>
+uint8_t tx_batch(Line& line, TxStats& stats, const uint8_t (*bufs)[SECPLUS2_CODE_LEN], uint8_t count) {
+    stats.claims++;
+    if (!line.claim()) {
+        stats.collisions++;
+        return 0;
+    }
+
+    uint8_t sent = 0;
+    for (; sent < count; sent++) {
+        if (sent) {
+            line.wait_us(TX_BATCH_GAP);
+            if (line.busy()) {
+                stats.collisions++;
+                break;
+            }
+        }
+        line.write(bufs[sent], SECPLUS2_CODE_LEN);
+    }
+
+    stats.packets += sent;
+    if (sent > 1) {
+        stats.batches++;
+    }
+    return sent;
+}
+
+#endif // _TX_BATCH_H
@@ -0,0 +1,452 @@
+// GPLv3 License
+
+#ifndef _VIRTUAL_OPENER_H
+#define _VIRTUAL_OPENER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Reader.h"
+#include "Packet.h"
+
+// A garage door opener in firmware, for bench testing without one.
+//
+// With VIRTUAL_OPENER, comms.cpp reads and writes the line through this instead of SoftwareSerial.
+// Bytes written are heard back, as on the shared line, and everything the opener sends arrives one
+// byte time after the one before it, at 9600 baud for Security+2.0 and 1200 baud for 1.0.
+//
+// Security+2.0: GetStatus and GetOpenings are answered VOPENER_REPLY after their last byte. Door,
+// light and lock commands are acted on, with a Status packet after each change and a MotorOn when
+// the door starts to move. Security+1.0: polls are answered with the door or light/lock byte, and button
+// presses toggle the door, light or lock.
+//
+// The door takes VOPENER_TRAVEL to open or close and can be stopped part way. It won't close while
+// obstructed, and reverses if obstructed while closing. The light comes on when the door moves or
+// on motion and goes off again after VOPENER_LIGHT_TIMEOUT, unless it was switched on by hand.
+// Wall button presses, motion and obstruction come from outside, see the /vopener endpoint.
+
+#define VOPENER_TRAVEL 12000            // ms, fully closed to fully open
+#define VOPENER_REPLY 40                // ms, command or poll to the opener's answer (Security+2.0)
+#define VOPENER_SEC1_REPLY 5            // ms, after the poll byte (Security+1.0)
+#define VOPENER_LIGHT_TIMEOUT 270000    // ms
+#define VOPENER_SEC2_BYTE_US 1042       // 8N1 at 9600 baud
+#define VOPENER_SEC1_BYTE_US 9167       // 8E1 at 1200 baud
+#define VOPENER_OUT_SIZE 128            // bytes in flight towards the firmware
+#define VOPENER_REMOTE_ID 0x4F7E1       // the opener's own id on the wire
+
+class VirtualOpener {
+    private:
+        uint8_t m_security = 2;
+        uint32_t m_now = 0;
+        uint32_t m_last_update = 0;
+
+        DoorState m_door = DoorState::Closed;
+        int32_t m_position = 0;         // ms of travel from closed
+        int8_t m_direction = 0;         // +1 opening, -1 closing
+        int8_t m_last_direction = -1;
+        bool m_light = false;
+        bool m_light_timed = false;
+        uint32_t m_light_off = 0;
+        bool m_lock = false;
+        bool m_obstructed = false;
+        uint16_t m_openings = 0;
+
+        SecPlus2Reader m_reader;
+        uint32_t m_rolling = 0;
+        bool m_status_pending = false;
+        uint32_t m_status_at = 0;
+        bool m_openings_pending = false;
+        uint32_t m_openings_at = 0;
+        bool m_motor_pending = false;
+        uint32_t m_motor_at = 0;
+
+        // bytes towards the firmware and when each can be read
+        uint8_t m_out[VOPENER_OUT_SIZE];
+        uint32_t m_due[VOPENER_OUT_SIZE];
+        uint16_t m_head = 0;
+        uint16_t m_count = 0;
+        uint64_t m_line_free = 0;       // us, when the last queued byte is off the line
+        uint64_t m_opener_free = 0;     // us, when the opener's own last byte is
+
+        void put(uint32_t now, const uint8_t* buf, size_t len) {
+            uint32_t byte_us = m_security == 1 ? VOPENER_SEC1_BYTE_US : VOPENER_SEC2_BYTE_US;
+            uint64_t t = (uint64_t)now * 1000;
+            if (m_line_free > t) {
+                t = m_line_free;
+            }
+            for (size_t i = 0; i < len; i++) {
+                if (m_count == VOPENER_OUT_SIZE) {
+                    overruns++;
+                    continue;
+                }
+                t += byte_us;
+                uint16_t slot = (m_head + m_count) % VOPENER_OUT_SIZE;
+                m_out[slot] = buf[i];
+                m_due[slot] = (uint32_t)((t + 999) / 1000);
+                m_count++;
+            }
+            m_line_free = t;
+        }
+
+        void send(uint32_t now, PacketCommand cmd, PacketData data) {
+            uint8_t buf[SECPLUS2_CODE_LEN];
+            Packet pkt = Packet(cmd, data, VOPENER_REMOTE_ID);
+            if (pkt.encode(m_rolling, buf) == 0) {
+                put(now, buf, SECPLUS2_CODE_LEN);
+                m_opener_free = m_line_free;
+                packets_tx++;
+            }
+            m_rolling = (m_rolling + 1) & 0xFFFFFFF;
+        }
+
+        void send_status(uint32_t now) {
+            PacketData data;
+            data.type = PacketDataType::Status;
+            data.value.status = StatusCommandData(0);
+            data.value.status.door = m_door;
+            data.value.status.light = m_light;
+            data.value.status.lock = m_lock;
+            data.value.status.obstruction = m_obstructed;
+            send(now, PacketCommand::Status, data);
+        }
+
+        void send_no_data(uint32_t now, PacketCommand cmd) {
+            PacketData data;
+            data.type = PacketDataType::NoData;
+            data.value.no_data = NoData(0);
+            send(now, cmd, data);
+        }
+
+        void status_soon(uint32_t now) {
+            if (!m_status_pending) {
+                m_status_pending = true;
+                m_status_at = now + VOPENER_REPLY;
+            }
+        }
+
+        void light_on_timed(uint32_t now) {
+            if (!m_light) {
+                m_light = true;
+                m_light_timed = true;
+                status_soon(now);
+            }
+            if (m_light_timed) {
+                m_light_off = now + VOPENER_LIGHT_TIMEOUT;
+            }
+        }
+
+        void set_light(uint32_t now, bool on) {
+            m_light_timed = false;
+            m_light = on;
+            status_soon(now);
+        }
+
+        void set_lock(uint32_t now, bool on) {
+            m_lock = on;
+            status_soon(now);
+        }
+
+        void move(uint32_t now, int8_t direction) {
+            if ((direction > 0 && m_door == DoorState::Open) || (direction < 0 && m_door == DoorState::Closed)) {
+                status_soon(now);
+                return;
+            }
+            if (direction < 0 && m_obstructed) {
+                // won't close with the beam broken
+                return;
+            }
+            m_direction = direction;
+            m_last_direction = direction;
+            m_door = direction > 0 ? DoorState::Opening : DoorState::Closing;
+            if (m_security == 2) {
+                m_motor_pending = true;
+                m_motor_at = now + VOPENER_REPLY;
+            }
+            light_on_timed(now);
+            status_soon(now);
+        }
+
+        void stop(uint32_t now) {
+            if (m_direction) {
+                m_direction = 0;
+                m_door = DoorState::Stopped;
+            }
+            status_soon(now);
+        }
+
+        void door_action(uint32_t now, DoorAction action) {
+            switch (action) {
+                case DoorAction::Open:
+                    move(now, 1);
+                    break;
+                case DoorAction::Close:
+                    move(now, -1);
+                    break;
+                case DoorAction::Stop:
+                    stop(now);
+                    break;
+                case DoorAction::Toggle:
+                    if (m_direction) {
+                        stop(now);
+                    } else if (m_door == DoorState::Closed) {
+                        move(now, 1);
+                    } else if (m_door == DoorState::Open) {
+                        move(now, -1);
+                    } else {
+                        move(now, -m_last_direction);
+                    }
+                    break;
+            }
+        }
+
+        // A packet from the firmware
+        void received(uint32_t now, Packet& pkt) {
+            packets_rx++;
+            switch (pkt.m_pkt_cmd) {
+                case PacketCommand::GetStatus:
+                    status_soon(now);
+                    break;
+                case PacketCommand::GetOpenings:
+                    m_openings_pending = true;
+                    m_openings_at = now + VOPENER_REPLY;
+                    break;
+                case PacketCommand::DoorAction:
+                    // the press, not the release
+                    if (pkt.m_data.value.door_action.pressed) {
+                        door_action(now, pkt.m_data.value.door_action.action);
+                    }
+                    break;
+                case PacketCommand::Light:
+                    switch (pkt.m_data.value.light.light) {
+                        case LightState::Off:
+                            set_light(now, false);
+                            break;
+                        case LightState::On:
+                            set_light(now, true);
+                            break;
+                        case LightState::Toggle:
+                        case LightState::Toggle2:
+                            set_light(now, !m_light);
+                            break;
+                    }
+                    break;
+                case PacketCommand::Lock:
+                    switch (pkt.m_data.value.lock.lock) {
+                        case LockState::Off:
+                            set_lock(now, false);
+                            break;
+                        case LockState::On:
+                            set_lock(now, true);
+                            break;
+                        case LockState::Toggle:
+                            set_lock(now, !m_lock);
+                            break;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // A Security+1.0 byte from the firmware, a poll or a button
+        void received_sec1(uint32_t now, uint8_t b) {
+            uint8_t answer;
+            switch (b) {
+                case 0x30:
+                    door_action(now, DoorAction::Toggle);
+                    return;
+                case 0x32:
+                    set_light(now, !m_light);
+                    return;
+                case 0x34:
+                    set_lock(now, !m_lock);
+                    return;
+                case 0x38:
+                    answer = sec1_door();
+                    break;
+                case 0x39:
+                    answer = 0x00;
+                    break;
+                case 0x3A:
+                    // light in bit 2, bit 3 clear when locked
+                    answer = 0x50 | (m_light << 2) | (!m_lock << 3);
+                    break;
+                default:
+                    return;
+            }
+            packets_rx++;
+            packets_tx++;
+            // after the poll itself has been heard back
+            put(now + VOPENER_SEC1_REPLY, &answer, 1);
+            m_opener_free = m_line_free;
+        }
+
+        // 0x5X stopped, 0x0X moving
+        uint8_t sec1_door() const {
+            switch (m_door) {
+                case DoorState::Opening:
+                    return 0x01;
+                case DoorState::Open:
+                    return 0x52;
+                case DoorState::Closing:
+                    return 0x04;
+                case DoorState::Closed:
+                    return 0x55;
+                default:
+                    return 0x50;
+            }
+        }
+
+    public:
+        uint32_t packets_rx = 0;        // commands and polls from the firmware
+        uint32_t packets_tx = 0;
+        uint32_t overruns = 0;          // bytes dropped, the firmware wasn't reading
+
+        VirtualOpener() = default;
+
+        void begin(uint8_t security, uint32_t now) {
+            *this = VirtualOpener();
+            m_security = security;
+            m_now = now;
+            m_last_update = now;
+        }
+
+        // Bytes the firmware puts on the line. The line is shared, the firmware hears them back
+        // unless it has turned its receiver off to send.
+        void write(uint32_t now, const uint8_t* buf, size_t len, bool echo = true) {
+            update(now);
+            if (echo) {
+                put(now, buf, len);
+            }
+            // a packet is acted on once it has all arrived
+            uint32_t end = now + (len * VOPENER_SEC2_BYTE_US + 999) / 1000;
+            for (size_t i = 0; i < len; i++) {
+                if (m_security == 1) {
+                    received_sec1(now, buf[i]);
+                } else if (m_reader.push_byte(buf[i])) {
+                    Packet pkt = Packet(m_reader.fetch_buf());
+                    received(end, pkt);
+                }
+            }
+        }
+
+        void update(uint32_t now) {
+            m_now = now;
+            uint32_t elapsed = now - m_last_update;
+            m_last_update = now;
+
+            if (m_direction < 0 && m_obstructed) {
+                // reverse back to open
+                m_direction = 1;
+                m_last_direction = 1;
+                m_door = DoorState::Opening;
+                status_soon(now);
+            }
+            if (m_direction) {
+                m_position += m_direction * (int32_t)elapsed;
+                if ((m_direction > 0 && m_position >= VOPENER_TRAVEL) || (m_direction < 0 && m_position <= 0)) {
+                    // when it actually got there
+                    uint32_t overshoot = m_direction > 0 ? m_position - VOPENER_TRAVEL : -m_position;
+                    m_position = m_direction > 0 ? VOPENER_TRAVEL : 0;
+                    m_door = m_direction > 0 ? DoorState::Open : DoorState::Closed;
+                    if (m_direction > 0) {
+                        m_openings++;
+                    }
+                    m_direction = 0;
+                    status_soon(now - overshoot);
+                }
+            }
+            if (m_light_timed && m_light && (int32_t)(now - m_light_off) >= 0) {
+                m_light = false;
+                m_light_timed = false;
+                status_soon(m_light_off);
+            }
+
+            if (m_security != 2) {
+                m_status_pending = false;
+                m_openings_pending = false;
+                m_motor_pending = false;
+                return;
+            }
+            if (m_motor_pending && (int32_t)(now - m_motor_at) >= 0) {
+                m_motor_pending = false;
+                send_no_data(m_motor_at, PacketCommand::MotorOn);
+            }
+            if (m_status_pending && (int32_t)(now - m_status_at) >= 0) {
+                m_status_pending = false;
+                // on the line when it was due, however late we are to notice
+                send_status(m_status_at);
+            }
+            if (m_openings_pending && (int32_t)(now - m_openings_at) >= 0) {
+                m_openings_pending = false;
+                PacketData data;
+                data.type = PacketDataType::Openings;
+                data.value.openings = OpeningsCommandData(0);
+                data.value.openings.count = m_openings;
+                send(m_openings_at, PacketCommand::Openings, data);
+            }
+        }
+
+        // Bytes the firmware can read now
+        int available() const {
+            int n = 0;
+            while (n < m_count && (int32_t)(m_now - m_due[(m_head + n) % VOPENER_OUT_SIZE]) >= 0) {
+                n++;
+            }
+            return n;
+        }
+
+        uint8_t read() {
+            if (!available()) {
+                return 0;
+            }
+            uint8_t b = m_out[m_head];
+            m_head = (m_head + 1) % VOPENER_OUT_SIZE;
+            m_count--;
+            return b;
+        }
+
+        // The opener is holding the line. The firmware's own bytes don't count, on the wire they
+        // are off it by the time write() returns.
+        bool sending(uint32_t now) const {
+            return m_opener_free > (uint64_t)now * 1000;
+        }
+
+        // The world outside the opener: wall buttons and remotes, the motion and obstruction sensors
+
+        void door_button(uint32_t now) {
+            update(now);
+            door_action(now, DoorAction::Toggle);
+        }
+
+        void light_button(uint32_t now) {
+            update(now);
+            set_light(now, !m_light);
+        }
+
+        void lock_button(uint32_t now) {
+            update(now);
+            set_lock(now, !m_lock);
+        }
+
+        void motion(uint32_t now) {
+            update(now);
+            if (m_security == 2) {
+                send_no_data(now, PacketCommand::Motion);
+            }
+            light_on_timed(now);
+        }
+
+        void obstruct(uint32_t now, bool blocked) {
+            update(now);
+            m_obstructed = blocked;
+            status_soon(now);
+            update(now);
+        }
+
+        bool obstructed() const { return m_obstructed; }
+        DoorState door() const { return m_door; }
+        bool light() const { return m_light; }
+        bool lock() const { return m_lock; }
+};
+
+#endif // _VIRTUAL_OPENER_H
@@ -0,0 +1,135 @@
+// GPLv3 License
+
+#ifndef _WALL_PANEL_DETECTOR_H
+#define _WALL_PANEL_DETECTOR_H
+
+#include <stdint.h>
+
+// Security+1.0 wall panel detection from the traffic on the line.
+//
+// The opener never speaks unprompted. A wall panel polls it with 0x38 (door), 0x3A (light/lock)
+// and 0x39 in turn every 250ms or so and the opener answers each poll with one byte, so a panel
+// shows up as a run of polls at that cadence which we didn't send. Without one the line is quiet,
+// or carries only the opener's answers to our own polls. An 889LM powering up sends button
+// releases (0x31, 0x33, 0x35) first and polls a few seconds later, so releases hold off the
+// decision for a while.
+//
+// Two polls in a row settle it in about one poll cycle; a quiet line settles it after a few
+// missed cycles. Absent is reversed if polls turn up later, e.g. a panel plugged in or booting
+// after us, and then we stop emulating. Present is never reversed.
+
+#define WALLPANEL_ECHO_WINDOW 20        // ms, our own byte read back off the shared line
+#define WALLPANEL_RESPONSE_WINDOW 60    // ms, the opener answers a poll within ~20ms
+#define WALLPANEL_POLL_GAP 1000         // ms, longest gap between two polls of one run
+#define WALLPANEL_POLLS 2               // polls in a run to decide a panel is there
+#define WALLPANEL_QUIET 1000            // ms without a panel poll to decide there is none
+#define WALLPANEL_BOOT_WAIT 10000       // ms to wait for polls after button releases
+
+enum class WallPanel : uint8_t {
+    Unknown,
+    Present,
+    Absent,
+};
+
+class WallPanelDetector {
+    private:
+        WallPanel m_state = WallPanel::Unknown;
+        uint32_t m_start = 0;
+        uint32_t m_last_tx = 0;
+        uint8_t m_last_tx_byte = 0;
+        bool m_sent = false;
+        uint32_t m_last_poll = 0;       // last poll we didn't send
+        uint8_t m_run = 0;              // polls in the current run
+        uint32_t m_boot = 0;
+        bool m_booting = false;
+        uint32_t m_request = 0;         // last poll, ours or not, awaiting its answer
+        bool m_awaiting = false;
+
+        static bool is_poll(uint8_t b) {
+            return b >= 0x38 && b <= 0x3A;
+        }
+
+        static bool is_button(uint8_t b) {
+            return b >= 0x30 && b <= 0x37;
+        }
+
+    public:
+        uint32_t panel_polls = 0;       // polls from a panel
+        uint32_t opener_bytes = 0;      // answers and anything else that isn't a panel
+
+        WallPanelDetector() = default;
+
+        void begin(uint32_t now) {
+            *this = WallPanelDetector();
+            m_start = now;
+        }
+
+        // A byte we transmitted
+        void tx(uint32_t now, uint8_t b) {
+            m_last_tx = now;
+            m_last_tx_byte = b;
+            m_sent = true;
+            // the answer to our poll is expected whether or not our own byte is read back
+            m_request = now;
+            m_awaiting = is_poll(b);
+        }
+
+        // A byte read off the line
+        void rx(uint32_t now, uint8_t b) {
+            if (m_sent && b == m_last_tx_byte && now - m_last_tx <= WALLPANEL_ECHO_WINDOW) {
+                m_sent = false;
+                return;
+            }
+            if (m_awaiting && now - m_request <= WALLPANEL_RESPONSE_WINDOW) {
+                m_awaiting = false;
+                opener_bytes++;
+                return;
+            }
+            m_awaiting = false;
+
+            if (is_poll(b)) {
+                panel_polls++;
+                if (m_run > 0 && now - m_last_poll <= WALLPANEL_POLL_GAP) {
+                    m_run++;
+                } else {
+                    m_run = 1;
+                }
+                m_last_poll = now;
+                m_request = now;
+                m_awaiting = true;
+                if (m_run >= WALLPANEL_POLLS) {
+                    m_state = WallPanel::Present;
+                }
+            } else if (is_button(b)) {
+                // only a panel sends these
+                if (!m_booting) {
+                    m_booting = true;
+                    m_boot = now;
+                }
+            } else {
+                opener_bytes++;
+            }
+        }
+
+        // The decision so far
+        WallPanel update(uint32_t now) {
+            if (m_state != WallPanel::Unknown) {
+                return m_state;
+            }
+            if (m_booting && now - m_boot < WALLPANEL_BOOT_WAIT) {
+                return m_state;
+            }
+            uint32_t since = now - m_start;
+            if (m_run > 0 && now - m_last_poll < since) {
+                since = now - m_last_poll;
+            }
+            if (since >= WALLPANEL_QUIET) {
+                m_state = WallPanel::Absent;
+            }
+            return m_state;
+        }
+
+        WallPanel state() const { return m_state; }
+};
+
+#endif // _WALL_PANEL_DETECTOR_H
@@ -0,0 +1,207 @@
+// GPLv3 License
+
+#ifndef _WIFI_ROAM_H
+#define _WIFI_ROAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Access point roaming and adaptive transmit power.
+//
+// The SDK only reconnects when the link drops, so a device that came up next to a distant mesh
+// node stays on it however weak it is. While idle we scan the current SSID in the background, and
+// roam to another BSSID when it is heard at least ROAM_MIN_GAIN dB stronger than the current one
+// (compared within the same scan). Scans are more frequent when the link is weak, and roams are
+// held off for a while after the last one so that two similar APs can't ping-pong.
+//
+// Adaptive transmit power is opt-in, built with ADAPTIVE_TX_POWER, otherwise the configured power
+// is left alone. The RSSI we receive says how well we hear the AP, not how well it hears us, so it
+// can't drive power down on its own. The SDK doesn't expose MAC retry counts, so the uplink is
+// judged by our TCP connections instead: power steps down only while the RSSI is strong and enough
+// segments were acknowledged without a retransmission. A retransmission, a weak RSSI or a link
+// error (disconnect, beacon timeout) raises it quickly and holds off stepping down for an hour.
+// It never goes below WIFI_TX_MIN, or above the configured power.
+
+#define ROAM_SAMPLE_INTERVAL 1000       // ms between RSSI samples
+#define ROAM_SCAN_INTERVAL 900000       // ms between scans while the link is fine
+#define ROAM_SCAN_INTERVAL_WEAK 120000  // ms between scans while the link is weak
+#define ROAM_FIRST_SCAN 120000          // ms after connecting before the first scan
+#define ROAM_WEAK_RSSI -70              // dBm
+#define ROAM_MIN_GAIN 8                 // dB a candidate must beat the current AP by
+#define ROAM_HOLDOFF 600000             // ms from one roam to the next
+#define ROAM_CONNECT_TIMEOUT 15000      // ms for a roam to connect before giving up on it
+
+#define WIFI_TX_MIN 15                  // dBm
+#define WIFI_TX_INTERVAL 30000          // ms between power adjustments
+#define WIFI_TX_LOWER_RSSI -58          // dBm, step down above this
+#define WIFI_TX_RAISE_RSSI -68          // dBm, step up below this
+#define WIFI_TX_LOWER_TRAFFIC 10        // samples with TCP traffic and no retransmissions to step down
+#define WIFI_TX_HOLD 3600000            // ms without stepping down after a raise for a bad uplink
+
+struct RoamCandidate {
+    uint8_t bssid[6];
+    int32_t channel;
+    int8_t rssi;
+};
+
+class WifiRoam {
+    private:
+        int16_t m_rssi16 = 0;           // RSSI average, in 1/16 dBm
+        bool m_have_rssi = false;
+        uint32_t m_last_sample = 0;
+        uint32_t m_connected_at = 0;
+        uint32_t m_last_scan = 0;
+        bool m_scanned = false;
+        uint32_t m_last_roam = 0;
+        bool m_roamed = false;
+
+        int8_t m_current_rssi = 0;      // current AP as heard in the last scan
+        bool m_current_seen = false;
+        RoamCandidate m_best;
+        bool m_have_best = false;
+
+        uint8_t m_tx_power = 20;        // dBm
+        uint32_t m_last_tx = 0;
+        uint32_t m_errors_at_tx = 0;
+        uint32_t m_retries_at_tx = 0;
+        uint32_t m_clean = 0;           // samples with traffic and no retransmission since m_last_tx
+        uint32_t m_held_at = 0;
+        bool m_held = false;
+
+    public:
+        uint32_t link_errors = 0;
+        uint32_t uplink_retries = 0;    // samples with a TCP retransmission pending
+        uint32_t scans = 0;
+        uint32_t roams = 0;
+        uint32_t roam_failures = 0;
+
+        WifiRoam() = default;
+
+        // (Re)connected to an AP at the given transmit power
+        void connected(uint32_t now, uint8_t tx_power) {
+            m_connected_at = now;
+            m_scanned = false;
+            m_have_rssi = false;
+            m_tx_power = tx_power;
+            m_last_tx = now;
+            m_errors_at_tx = link_errors;
+            m_retries_at_tx = uplink_retries;
+            m_clean = 0;
+        }
+
+        void link_error() { link_errors++; }
+
+        // The state of our TCP connections, with each RSSI sample: whether any sent segments were
+        // waiting for an ack, and whether any of those had been retransmitted
+        void uplink(bool traffic, bool retransmitting) {
+            if (retransmitting) {
+                uplink_retries++;
+            } else if (traffic) {
+                m_clean++;
+            }
+        }
+
+        // Feed the current RSSI, returns true if it was taken
+        bool sample(uint32_t now, int32_t rssi) {
+            if (rssi >= 0 || (m_have_rssi && (now - m_last_sample) < ROAM_SAMPLE_INTERVAL)) {
+                return false;
+            }
+            m_last_sample = now;
+            if (!m_have_rssi) {
+                m_rssi16 = rssi * 16;
+                m_have_rssi = true;
+            } else {
+                // EWMA, 1/8 weight
+                m_rssi16 += (rssi * 16 - m_rssi16) / 8;
+            }
+            return true;
+        }
+
+        int8_t rssi() const { return m_rssi16 / 16; }
+
+        bool weak() const { return m_have_rssi && rssi() < ROAM_WEAK_RSSI; }
+
+        // Whether a background scan should start now. The caller checks that we are idle.
+        bool scan_due(uint32_t now) const {
+            if (!m_have_rssi || (now - m_connected_at) < ROAM_FIRST_SCAN) {
+                return false;
+            }
+            if (!m_scanned) {
+                return true;
+            }
+            return (now - m_last_scan) >= (weak() ? ROAM_SCAN_INTERVAL_WEAK : ROAM_SCAN_INTERVAL);
+        }
+
+        void scan_started(uint32_t now) {
+            m_last_scan = now;
+            m_scanned = true;
+            m_have_best = false;
+            m_current_seen = false;
+            scans++;
+        }
+
+        // One scan result for our SSID
+        void scan_result(const uint8_t* current_bssid, const uint8_t* bssid, int32_t channel, int32_t rssi) {
+            if (current_bssid && !memcmp(bssid, current_bssid, 6)) {
+                m_current_rssi = rssi;
+                m_current_seen = true;
+                return;
+            }
+            if (!m_have_best || rssi > m_best.rssi) {
+                memcpy(m_best.bssid, bssid, 6);
+                m_best.channel = channel;
+                m_best.rssi = rssi;
+                m_have_best = true;
+            }
+        }
+
+        // After the scan results are in. Returns the AP to roam to, or nullptr to stay.
+        const RoamCandidate* roam_target(uint32_t now) const {
+            if (!m_have_best || (m_roamed && (now - m_last_roam) < ROAM_HOLDOFF)) {
+                return nullptr;
+            }
+            // prefer the current AP as heard in the same scan, the scan and the average can differ
+            int32_t current = m_current_seen ? m_current_rssi : rssi();
+            return (m_best.rssi >= current + ROAM_MIN_GAIN) ? &m_best : nullptr;
+        }
+
+        void roam_started(uint32_t now) {
+            m_last_roam = now;
+            m_roamed = true;
+            roams++;
+        }
+
+        void roam_failed() { roam_failures++; }
+
+        // Adaptive transmit power, returns the power to use (dBm), capped at `max_power`
+        uint8_t tx_power(uint32_t now, uint8_t max_power) {
+            if (m_tx_power > max_power) {
+                m_tx_power = max_power;
+            }
+            if (!m_have_rssi || (now - m_last_tx) < WIFI_TX_INTERVAL) {
+                return m_tx_power;
+            }
+            m_last_tx = now;
+            bool bad_uplink = link_errors != m_errors_at_tx || uplink_retries != m_retries_at_tx;
+            bool clean = m_clean >= WIFI_TX_LOWER_TRAFFIC;
+            m_errors_at_tx = link_errors;
+            m_retries_at_tx = uplink_retries;
+            m_clean = 0;
+            if (m_held && now - m_held_at >= WIFI_TX_HOLD) {
+                m_held = false;
+            }
+            if (bad_uplink || rssi() < WIFI_TX_RAISE_RSSI) {
+                // back up quickly
+                m_tx_power = (m_tx_power + 4 < max_power) ? m_tx_power + 4 : max_power;
+                if (bad_uplink) {
+                    m_held = true;
+                    m_held_at = now;
+                }
+            } else if (clean && !m_held && rssi() > WIFI_TX_LOWER_RSSI && m_tx_power > WIFI_TX_MIN) {
+                m_tx_power--;
+            }
+            return m_tx_power;
+        }
+};
+
+#endif // _WIFI_ROAM_H
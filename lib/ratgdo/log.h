@@ -4,10 +4,12 @@
 #ifndef _LOG_H
 #define _LOG_H
 
+#include "secplus2.h"
+#ifndef UNIT_TEST
 #include <Arduino.h>
 #include <LittleFS.h>
-#include "secplus2.h"
 #include <esp_xpgm.h>
+#endif
 
 void print_packet(uint8_t pkt[SECPLUS2_CODE_LEN]);
 
@@ -36,7 +38,12 @@ void printSavedLog(Print &outDevice = Serial);
 void printMessageLog(Print &outDevice = Serial);
 void crashCallback();
 
+#ifdef LOG_TOKENIZED
+#include "log_token.h"
+#define RATGDO_PRINTF(message, ...) logToken(LOG_TOKEN(message), ##__VA_ARGS__)
+#else
 #define RATGDO_PRINTF(message, ...) logToBuffer_P(PSTR(message), ##__VA_ARGS__)
+#endif
 
 #define RINFO(message, ...) RATGDO_PRINTF(">>> [%7d] RATGDO: " message "\r\n", millis(), ##__VA_ARGS__)
 #define RERROR(message, ...) RATGDO_PRINTF("!!! [%7d] RATGDO: " message "\r\n", millis(), ##__VA_ARGS__)
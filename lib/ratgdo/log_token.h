@@ -0,0 +1,143 @@
+// GPLv3 License
+
+#ifndef _LOG_TOKEN_H
+#define _LOG_TOKEN_H
+
+// Tokenized logging.
+//
+// Instead of formatting log messages on the device, each format string is reduced at compile time
+// to a 32-bit token (FNV-1a hash of the complete format string, including the ">>> [%7d] RATGDO: "
+// prefix).  The format strings themselves are never referenced at runtime so they are not linked
+// into the firmware image.  The device emits the token followed by the arguments, packed as:
+//
+//   integers (<= 32 bits)  varint of the 32-bit two's complement value
+//   integers (64 bits)     varint of the 64-bit two's complement value
+//   float / double         4 bytes little-endian IEEE754 single precision
+//   strings                varint length followed by the bytes (no terminator)
+//   other pointers         varint of the 32-bit address
+//
+// The record is then base64 encoded onto a line that starts with '$', so that it can continue to
+// flow through the text based serial port, message log, crash log and SSE channels unchanged.
+//
+// At build time build_log_tokens.py scans the sources for RINFO/RERROR and writes a token
+// database next to firmware.elf. detokenize.py (or the web UI) uses that to rebuild the text.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+
+#define LOG_TOKEN_MAX_RECORD 120
+#define LOG_TOKEN_PREFIX '$'
+
+extern "C" void logTokenToBuffer(const uint8_t *record, size_t len);
+
+template <size_t N>
+constexpr uint32_t log_token_hash(const char (&fmt)[N])
+{
+    uint32_t hash = 0x811C9DC5;
+    for (size_t i = 0; i < N - 1; i++)
+    {
+        hash ^= static_cast<uint8_t>(fmt[i]);
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+class LogTokenEncoder
+{
+private:
+    uint8_t m_buf[LOG_TOKEN_MAX_RECORD];
+    size_t m_len = 0;
+
+    void put_varint(uint64_t value)
+    {
+        do
+        {
+            if (m_len >= sizeof(m_buf))
+                return;
+            uint8_t b = value & 0x7F;
+            value >>= 7;
+            m_buf[m_len++] = b | ((value) ? 0x80 : 0);
+        } while (value);
+    }
+
+    void put_string(const char *s)
+    {
+        if (!s)
+            s = "(null)";
+        size_t n = strlen(s);
+        // leave room for the length prefix, truncate rather than drop the record
+        size_t room = (m_len + 2 < sizeof(m_buf)) ? sizeof(m_buf) - m_len - 2 : 0;
+        if (n > room)
+            n = room;
+        put_varint(n);
+        memcpy(&m_buf[m_len], s, n);
+        m_len += n;
+    }
+
+    void put_float(float f)
+    {
+        if (m_len + sizeof(f) > sizeof(m_buf))
+            return;
+        memcpy(&m_buf[m_len], &f, sizeof(f));
+        m_len += sizeof(f);
+    }
+
+public:
+    explicit LogTokenEncoder(uint32_t token)
+    {
+        memcpy(m_buf, &token, sizeof(token));
+        m_len = sizeof(token);
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type put(T value)
+    {
+        if (sizeof(T) > sizeof(uint32_t))
+            put_varint(static_cast<uint64_t>(value));
+        else
+            put_varint(static_cast<uint32_t>(value));
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_floating_point<T>::value>::type put(T value)
+    {
+        put_float(static_cast<float>(value));
+    }
+
+    void put(const char *s) { put_string(s); }
+    void put(char *s) { put_string(s); }
+
+    template <typename T>
+    void put(T *ptr)
+    {
+        put_varint(static_cast<uint32_t>(reinterpret_cast<uintptr_t>(ptr)));
+    }
+
+    void encode() {}
+
+    template <typename T, typename... Args>
+    void encode(T value, Args... args)
+    {
+        put(value);
+        encode(args...);
+    }
+
+    const uint8_t *data() const { return m_buf; }
+    size_t length() const { return m_len; }
+};
+
+template <typename... Args>
+inline void logToken(uint32_t token, Args... args)
+{
+    LogTokenEncoder rec(token);
+    rec.encode(args...);
+    logTokenToBuffer(rec.data(), rec.length());
+}
+
+// std::integral_constant forces the hash to be evaluated by the compiler, so the format string
+// literal is never emitted into the image.
+#define LOG_TOKEN(fmt) (std::integral_constant<uint32_t, log_token_hash(fmt)>::value)
+
+#endif // _LOG_TOKEN_H
@@ -0,0 +1,312 @@
+// GPLv3 License
+
+#ifndef _SECPLUS2_CODEC_H
+#define _SECPLUS2_CODEC_H
+
+#include <stdint.h>
+#include "secplus2.h"
+
+// Security+ 2.0 wireline codec.
+//
+// Drop-in replacement for `decode_wireline` / `encode_wireline` from the secplus library, producing
+// bit-identical frames. The reference walks the frame one bit and one ternary digit at a time; this
+// version moves whole words around instead, since it runs in the same loop iteration that has to
+// keep draining SoftwareSerial.
+//
+// A wireline frame is the 3 byte preamble (0x55, 0x01, 0x00) followed by two 8 byte halves. The
+// first half carries fixed[39:20] and data[31:16], the second fixed[19:0] and data[15:0]. Each half
+// is laid out as:
+//
+//   byte 0      four rolling code trits (2 bits each, MSB first)
+//   bytes 1-7   two zero bits then 54 bits made of three 18 bit parts interleaved bit by bit
+//
+//   part 0      fixed_half[19:10] << 8 | data_half[15:8]
+//   part 1      fixed_half[9:0]   << 8 | data_half[7:0]
+//   part 2      five more rolling code trits << 8 | copy of byte 0
+//
+// The first two trits of byte 0 select the order in which the parts are interleaved, the last two
+// select which of the interleaved streams are inverted.
+//
+// The rolling code is bit reversed (28 bits) and written as 18 base-3 digits, spread across the two
+// halves. The digit order, most significant first, is:
+//
+//   h2.p2[1:0], h1.p2[1:0], h2.p2[9:2], h1.p2[9:2], h2.byte0, h1.byte0   (p2 trits only, bits >> 8)
+//
+// Two interleave kernels are provided. The 32 bit kernel only uses 32 bit shifts and multiplies,
+// which is what the lx106 does in hardware; the 64 bit kernel handles all 54 bits at once and is
+// faster on a host (capture analysis, unit tests). `secplus2_decode_wireline` and
+// `secplus2_encode_wireline` select the right one for the target, or set SECPLUS2_CODEC_WORD64.
+
+#ifndef SECPLUS2_CODEC_WORD64
+#if defined(__XTENSA__)
+#define SECPLUS2_CODEC_WORD64 0
+#else
+#define SECPLUS2_CODEC_WORD64 1
+#endif
+#endif
+
+// Indexed by the top (order) and bottom (invert) nibble of byte 0. Order entries give the part
+// carried by interleaved stream 0, 1, 2 in bits [1:0], [3:2], [5:4]; invert entries have bit n set
+// if stream n is inverted. 0xFF marks a nibble containing an invalid trit (0b11).
+static const uint8_t SECPLUS2_ORDER[16] = {
+    0x18, 0x12, 0x24, 0xFF,
+    0x09, 0x21, 0x06, 0xFF,
+    0x09, 0x06, 0x24, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF,
+};
+static const uint8_t SECPLUS2_INVERT[16] = {
+    0x03, 0x02, 0x04, 0xFF,
+    0x07, 0x05, 0x06, 0xFF,
+    0x01, 0x00, 0x05, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// Keep bits 0, 3, 6, ... of a 24 bit value and pack them into 8 bits, preserving order.
+static inline uint32_t secplus2_compact24(uint32_t x) {
+    x &= 0x249249;
+    x = (x | (x >> 2)) & 0x0C30C3;
+    x = (x | (x >> 4)) & 0x00F00F;
+    x = (x | (x >> 8)) & 0x0000FF;
+    return x;
+}
+
+// Inverse of secplus2_compact24.
+static inline uint32_t secplus2_spread24(uint32_t x) {
+    x &= 0x0000FF;
+    x = (x | (x << 8)) & 0x00F00F;
+    x = (x | (x << 4)) & 0x0C30C3;
+    x = (x | (x << 2)) & 0x249249;
+    return x;
+}
+
+// Same as above, for 18 of 54 bits.
+static inline uint64_t secplus2_compact54(uint64_t x) {
+    x &= 0x1249249249249249ULL;
+    x = (x | (x >> 2)) & 0x10C30C30C30C30C3ULL;
+    x = (x | (x >> 4)) & 0x100F00F00F00F00FULL;
+    x = (x | (x >> 8)) & 0x001F0000FF0000FFULL;
+    x = (x | (x >> 16)) & 0x001F00000000FFFFULL;
+    x = (x | (x >> 32)) & 0x00000000001FFFFFULL;
+    return x;
+}
+
+static inline uint64_t secplus2_spread54(uint64_t x) {
+    x &= 0x00000000001FFFFFULL;
+    x = (x | (x << 32)) & 0x001F00000000FFFFULL;
+    x = (x | (x << 16)) & 0x001F0000FF0000FFULL;
+    x = (x | (x << 8)) & 0x100F00F00F00F00FULL;
+    x = (x | (x << 4)) & 0x10C30C30C30C30C3ULL;
+    x = (x | (x << 2)) & 0x1249249249249249ULL;
+    return x;
+}
+
+// Split bytes 1-7 of a half into its three interleaved 18 bit streams.
+static inline void secplus2_deinterleave32(const uint8_t* in, uint32_t s[3]) {
+    uint32_t w = ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+    uint32_t v = ((uint32_t)in[4] << 16) | ((uint32_t)in[5] << 8) | in[6];
+    // streams are MSB first, stream 0 takes the first bit after the two zero bits
+    uint32_t a = (w >> 6) & 0xFFFFFF;
+    uint32_t b = ((w & 0x3F) << 18) | (v >> 6);
+    uint32_t c = v & 0x3F;
+    for (int i = 0; i < 3; i++) {
+        uint32_t shift = 2 - i;
+        s[i] = (secplus2_compact24(a >> shift) << 10) | (secplus2_compact24(b >> shift) << 2) |
+               secplus2_compact24(c >> shift);
+    }
+}
+
+static inline void secplus2_interleave32(const uint32_t s[3], uint8_t* out) {
+    uint32_t a = 0, b = 0, c = 0;
+    for (int i = 0; i < 3; i++) {
+        uint32_t shift = 2 - i;
+        a |= secplus2_spread24(s[i] >> 10) << shift;
+        b |= secplus2_spread24((s[i] >> 2) & 0xFF) << shift;
+        c |= secplus2_spread24(s[i] & 0x03) << shift;
+    }
+    uint32_t w = (a << 6) | (b >> 18);
+    uint32_t v = ((b & 0x3FFFF) << 6) | c;
+    out[0] = w >> 24;
+    out[1] = w >> 16;
+    out[2] = w >> 8;
+    out[3] = w;
+    out[4] = v >> 16;
+    out[5] = v >> 8;
+    out[6] = v;
+}
+
+static inline void secplus2_deinterleave64(const uint8_t* in, uint32_t s[3]) {
+    uint64_t x = 0;
+    for (int i = 0; i < 7; i++) {
+        x = (x << 8) | in[i];
+    }
+    s[0] = secplus2_compact54(x >> 2);
+    s[1] = secplus2_compact54(x >> 1);
+    s[2] = secplus2_compact54(x);
+}
+
+static inline void secplus2_interleave64(const uint32_t s[3], uint8_t* out) {
+    uint64_t x = (secplus2_spread54(s[0]) << 2) | (secplus2_spread54(s[1]) << 1) | secplus2_spread54(s[2]);
+    for (int i = 6; i >= 0; i--) {
+        out[i] = x;
+        x >>= 8;
+    }
+}
+
+// Value of four packed trits (MSB first), or -1 if any of them is 0b11.
+static inline int32_t secplus2_trits4(uint32_t packed) {
+    if (packed & (packed >> 1) & 0x55) {
+        return -1;
+    }
+    return (((((packed >> 6) & 3) * 3 + ((packed >> 4) & 3)) * 3 + ((packed >> 2) & 3)) * 3) + (packed & 3);
+}
+
+// Inverse of secplus2_trits4 for 0 <= value < 81. x / 3 == (x * 171) >> 9 for x < 256.
+static inline uint32_t secplus2_pack_trits4(uint32_t value) {
+    uint32_t packed = 0;
+    for (int i = 0; i < 4; i++) {
+        uint32_t q = (value * 171) >> 9;
+        packed |= (value - q * 3) << (2 * i);
+        value = q;
+    }
+    return packed;
+}
+
+static inline uint32_t secplus2_reverse28(uint32_t x) {
+    x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+    x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+    x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+    x = (x >> 16) | (x << 16);
+    return x >> 4;
+}
+
+template <bool WORD64>
+static inline int8_t secplus2_decode_half(const uint8_t* in, uint32_t* fixed, uint32_t* data, uint32_t* rolling_p2) {
+    uint8_t header = in[0];
+    uint8_t order = SECPLUS2_ORDER[header >> 4];
+    uint8_t invert = SECPLUS2_INVERT[header & 0x0F];
+    if (order == 0xFF || invert == 0xFF) {
+        return -1;
+    }
+
+    uint32_t s[3];
+    if (WORD64) {
+        secplus2_deinterleave64(&in[1], s);
+    } else {
+        secplus2_deinterleave32(&in[1], s);
+    }
+
+    uint32_t parts[3];
+    for (int i = 0; i < 3; i++) {
+        parts[(order >> (2 * i)) & 3] = (invert & (1 << i)) ? (s[i] ^ 0x3FFFF) : s[i];
+    }
+
+    // part 2 carries a copy of the header, which doubles as a cheap integrity check
+    if ((parts[2] & 0xFF) != header) {
+        return -1;
+    }
+
+    *fixed = ((parts[0] >> 8) << 10) | (parts[1] >> 8);
+    *data = ((parts[0] & 0xFF) << 8) | (parts[1] & 0xFF);
+    *rolling_p2 = parts[2] >> 8;
+    return 0;
+}
+
+template <bool WORD64>
+static inline void secplus2_encode_half(uint32_t fixed, uint32_t data, uint8_t header, uint32_t rolling_p2, uint8_t* out) {
+    uint8_t order = SECPLUS2_ORDER[header >> 4];
+    uint8_t invert = SECPLUS2_INVERT[header & 0x0F];
+
+    uint32_t parts[3];
+    parts[0] = ((fixed >> 10) << 8) | (data >> 8);
+    parts[1] = ((fixed & 0x3FF) << 8) | (data & 0xFF);
+    parts[2] = (rolling_p2 << 8) | header;
+
+    uint32_t s[3];
+    for (int i = 0; i < 3; i++) {
+        uint32_t p = parts[(order >> (2 * i)) & 3];
+        s[i] = (invert & (1 << i)) ? (p ^ 0x3FFFF) : p;
+    }
+
+    out[0] = header;
+    if (WORD64) {
+        secplus2_interleave64(s, &out[1]);
+    } else {
+        secplus2_interleave32(s, &out[1]);
+    }
+}
+
+template <bool WORD64>
+static inline int8_t secplus2_decode(const uint8_t in[SECPLUS2_CODE_LEN], uint32_t* rolling, uint64_t* fixed, uint32_t* data) {
+    if (in[0] != 0x55 || in[1] != 0x01 || in[2] != 0x00) {
+        return -1;
+    }
+
+    uint32_t fixed1, fixed2, data1, data2, p2_1, p2_2;
+    if (secplus2_decode_half<WORD64>(&in[3], &fixed1, &data1, &p2_1) < 0 ||
+        secplus2_decode_half<WORD64>(&in[11], &fixed2, &data2, &p2_2) < 0) {
+        return -1;
+    }
+
+    // the last trit of each part 2, then the other four of each, then the two headers
+    uint32_t top = p2_2 & 3, top1 = p2_1 & 3;
+    int32_t g[4] = {
+        secplus2_trits4(p2_2 >> 2),
+        secplus2_trits4(p2_1 >> 2),
+        secplus2_trits4(in[11]),
+        secplus2_trits4(in[3]),
+    };
+    if (top == 3 || top1 == 3 || g[0] < 0 || g[1] < 0 || g[2] < 0 || g[3] < 0) {
+        return -1;
+    }
+    uint32_t value = top * 3 + top1;
+    for (int i = 0; i < 4; i++) {
+        value = value * 81 + g[i];
+    }
+    if (value >> 28) {
+        return -1;
+    }
+
+    *rolling = secplus2_reverse28(value);
+    *fixed = ((uint64_t)fixed1 << 20) | fixed2;
+    *data = (data1 << 16) | data2;
+    return 0;
+}
+
+template <bool WORD64>
+static inline int8_t secplus2_encode(uint32_t rolling, uint64_t fixed, uint32_t data, uint8_t out[SECPLUS2_CODE_LEN]) {
+    if ((rolling >> 28) || (fixed >> 40)) {
+        return -1;
+    }
+
+    // 3^18 < 2^29, so one real division splits it into halves small enough for multiply-shift
+    // division by 81: x / 81 == (x * 6473) >> 19 for x < 6561, (x * 51782) >> 22 for x < 59049.
+    uint32_t value = secplus2_reverse28(rolling);
+    uint32_t hi = value / 6561;
+    uint32_t lo = value - hi * 6561;
+    uint32_t lo_q = (lo * 6473) >> 19;
+    uint32_t hi_q = (hi * 51782) >> 22;
+    uint32_t top = (hi_q * 6473) >> 19;
+
+    uint8_t header1 = secplus2_pack_trits4(lo - lo_q * 81);
+    uint8_t header2 = secplus2_pack_trits4(lo_q);
+    uint32_t p2_1 = (secplus2_pack_trits4(hi - hi_q * 81) << 2) | (top - ((top * 171) >> 9) * 3);
+    uint32_t p2_2 = (secplus2_pack_trits4(hi_q - top * 81) << 2) | ((top * 171) >> 9);
+
+    out[0] = 0x55;
+    out[1] = 0x01;
+    out[2] = 0x00;
+    secplus2_encode_half<WORD64>(fixed >> 20, data >> 16, header1, p2_1, &out[3]);
+    secplus2_encode_half<WORD64>(fixed & 0xFFFFF, data & 0xFFFF, header2, p2_2, &out[11]);
+    return 0;
+}
+
+static inline int8_t secplus2_decode_wireline(const uint8_t in[SECPLUS2_CODE_LEN], uint32_t* rolling, uint64_t* fixed, uint32_t* data) {
+    return secplus2_decode<SECPLUS2_CODEC_WORD64>(in, rolling, fixed, data);
+}
+
+static inline int8_t secplus2_encode_wireline(uint32_t rolling, uint64_t fixed, uint32_t data, uint8_t out[SECPLUS2_CODE_LEN]) {
+    return secplus2_encode<SECPLUS2_CODEC_WORD64>(rolling, fixed, data, out);
+}
+
+#endif // _SECPLUS2_CODEC_H
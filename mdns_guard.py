@@ -0,0 +1,17 @@
+#
+# With the MDNS_GUARD build flag, ratgdo answers mDNS for HomeKit itself (src/mdns.cpp) and the
+# ESP8266 core's LEAmDNS responder must never start. arduino_homekit_server starts it with
+# MDNS.begin(), so that call is linked to __wrap_...() in src/mdns.cpp, which declines to start it.
+#
+# GPLv3 License
+#
+Import("env")
+
+# esp8266::MDNSImplementation::MDNSResponder::begin(const char*, const IPAddress&, uint32_t)
+MDNS_BEGIN = "_ZN7esp826618MDNSImplementation13MDNSResponder5beginEPKcRK9IPAddressj"
+
+defines = env.ParseFlags(env.GetProjectOption("build_flags", [])).get("CPPDEFINES", [])
+names = [d if isinstance(d, str) else d[0] for d in defines]
+if "MDNS_GUARD" in names and "DISABLE_HOMEKIT" not in names:
+    print("MDNS_GUARD: keeping the core mDNS responder from starting")
+    env.Append(LINKFLAGS=["-Wl,--wrap=" + MDNS_BEGIN])
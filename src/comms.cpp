@@ -1,7 +1,6 @@
 
 #include "SoftwareSerial.h"
 #include "ratgdo.h"
-#include "homekit_debug.h"
 // #include "secplus.h"
 #include "homekit.h"
 #include "log.h"
@@ -12,6 +11,25 @@
 #include "cQueue.h"
 #include "utilities.h"
 #include "comms.h"
+#include "EarlyMotion.h"
+#include "CodeBudget.h"
+#include "CommandTrace.h"
+#include "WallPanelDetector.h"
+#include "TxBatch.h"
+#include "NotifyGate.h"
+#include "metrics.h"
+#ifdef SHADOW_DECODE
+#include "ShadowCandidate.h"
+#endif
+#ifdef EDGE_UART_RX
+#include "EdgeUart.h"
+#endif
+#ifdef VIRTUAL_OPENER
+#include "VirtualOpener.h"
+#endif
+#ifdef TIMER_UART_TX
+#include "TimerUart.h"
+#endif
 
 #include <Ticker.h>
 
@@ -20,11 +38,65 @@
 struct PacketAction {
     Packet pkt;
     bool inc_counter;
-    uint32_t delay;
+    uint32_t delay = 0;
+    uint16_t trace = 0; // CommandTrace ID, 0 if untraced
+    bool batch = false; // SECURITY+2.0: sent in the same bus claim as the next packet, see TxBatch.h
 };
 
 Queue_t pkt_q;
+CommandTrace command_trace;
 SoftwareSerial sw_serial;
+
+// Characters received and lost to framing, parity or overflow errors, reported on the status page
+uint32_t rx_bytes = 0;
+uint32_t rx_errors = 0;
+
+// Bus claims, collisions and batched packets, see TxBatch.h
+TxStats tx_stats;
+
+// Longest a transmit has kept interrupts masked
+uint32_t tx_masked_max_us = 0;
+
+// Fields we are flipping ourselves, not notified until the sequence is over
+NotifyGate notify_gate;
+
+#ifdef EDGE_UART_RX
+// The ISR only timestamps edges, bytes are rebuilt in the loop, see EdgeUart.h
+EdgeRing rx_edges;
+EdgeUartDecoder rx_decoder;
+
+void IRAM_ATTR isr_uart_rx() {
+    rx_edges.push(ESP.getCycleCount(), GPIP(UART_RX_PIN));
+}
+#endif
+
+#ifdef TIMER_UART_TX
+// Timer 1 sets each bit, interrupts stay enabled through a write, see TimerUart.h
+TimerUartTx tx_timer;
+static uint32_t tx_timer_ticks = 0;     // per bit, timer 1 counts at 80MHz
+
+void IRAM_ATTR isr_uart_tx() {
+    uint32_t start = ESP.getCycleCount();
+    bool done;
+    // inverted logic, a mark leaves the bus alone
+    if (tx_timer.tick(start, &done)) {
+        GPOC = 1 << UART_TX_PIN;
+    } else {
+        GPOS = 1 << UART_TX_PIN;
+    }
+    if (done) {
+        timer1_disable();
+    }
+    tx_timer.masked(ESP.getCycleCount() - start);
+}
+#endif
+
+#ifdef VIRTUAL_OPENER
+// No opener on the wire, the line is read and written through one in firmware, see VirtualOpener.h
+VirtualOpener virtual_opener;
+static bool virtual_rx = true;
+#endif
+
 extern long unsigned int led_on_time;
 
 extern struct GarageDoor garage_door;
@@ -36,6 +108,7 @@ Ticker TTCtimer = Ticker();
 uint8_t TTCdelay = 0;
 uint8_t TTCcountdown = 0;
 bool TTCwasLightOn = false;
+void ttc_cancel();
 
 /******************************* SECURITY 2.0 *********************************/
 
@@ -43,7 +116,8 @@ SecPlus2Reader reader;
 uint32_t id_code = 0;
 uint32_t rolling_code = 0;
 uint32_t last_saved_code = 0;
-#define MAX_CODES_WITHOUT_FLASH_WRITE 10
+EarlyMotion early_motion;
+CodeBudget code_budget;
 
 /******************************* SECURITY 1.0 *********************************/
 
@@ -52,12 +126,35 @@ typedef uint8_t RxPacket[RX_LENGTH * 4];
 unsigned long last_rx;
 unsigned long last_tx;
 
-bool wallplateBooting= false;
+WallPanelDetector wall_panel;
 bool wallPanelDetected = false;
 DoorState doorState = DoorState::Unknown;
 uint8_t lightState;
 uint8_t lockState;
 
+#ifdef SHADOW_DECODE
+/******************************* SHADOW DECODING *********************************/
+
+// Received bytes also go to a candidate parser and the two are compared, see ShadowDecode.h
+ShadowCompare shadow;
+ShadowState shadow_state;       // production's
+CandidateSecPlus1 shadow_sec1;
+CandidateSecPlus2 shadow_sec2;
+
+static void shadow_byte(uint8_t b) {
+    ShadowFrame frame;
+    ShadowState state;
+    uint32_t now = millis();
+    uint32_t start = ESP.getCycleCount();
+    bool decoded = (gdoSecurityType == 1) ? shadow_sec1.push(now, b, frame, state) : shadow_sec2.push(now, b, frame, state);
+    shadow.candidate_cycles += ESP.getCycleCount() - start;
+    shadow.bytes++;
+    if (decoded) {
+        shadow.candidate(now, frame, state);
+    }
+}
+#endif
+
 // keep this here incase at somepoint its needed
 // it is used for emulation of wall panel
 //byte secplus1States[19] = {0x35,0x35,0x35,0x35,0x33,0x33,0x53,0x53,0x38,0x3A,0x3A,0x3A,0x39,0x38,0x3A, 0x38,0x3A,0x39,0x3A};
@@ -90,13 +187,154 @@ void door_command(DoorAction action);
 void send_get_status();
 bool transmitSec1(byte toSend);
 bool transmitSec2(PacketAction& pkt_ac);
+uint8_t queue_take(PacketAction* acts);
+void queue_put(const PacketAction* acts, uint8_t count);
+bool queued(PacketCommand cmd);
+#ifdef TX_BATCH
+void transmitSec2Batch();
+#endif
+void early_door_motion(DoorState provisional);
+void queue_packet(PacketAction& pkt_ac);
+
+/********************************** UART RX *****************************************/
+
+int rx_available() {
+#if defined(VIRTUAL_OPENER)
+    virtual_opener.update(millis());
+    return virtual_opener.available();
+#elif defined(EDGE_UART_RX)
+    // read the clock first, so that every edge stamped before it is drained below
+    uint32_t now = ESP.getCycleCount();
+    uint32_t t;
+    bool level;
+    while (rx_edges.pop(&t, &level)) {
+        rx_decoder.edge(t, level);
+    }
+    rx_decoder.idle(now);
+    rx_bytes = rx_decoder.bytes;
+    rx_errors = rx_decoder.framing_errors + rx_decoder.parity_errors + rx_decoder.overruns + rx_edges.m_overruns;
+    return rx_decoder.available();
+#else
+    if (sw_serial.overflow()) {
+        rx_errors++;
+    }
+    return sw_serial.available();
+#endif
+}
+
+uint8_t rx_read() {
+#if defined(VIRTUAL_OPENER)
+    rx_bytes++;
+    return virtual_opener.read();
+#elif defined(EDGE_UART_RX)
+    return rx_decoder.read();
+#else
+    uint8_t b = sw_serial.read();
+    rx_bytes++;
+    if (gdoSecurityType == 1 && sw_serial.readParity() != SoftwareSerial::parityEven(b)) {
+        rx_errors++;
+    }
+    return b;
+#endif
+}
+
+void rx_enable(bool on) {
+#if defined(VIRTUAL_OPENER)
+    virtual_rx = on;
+#elif defined(EDGE_UART_RX)
+    if (on) {
+        rx_edges.clear();
+        rx_decoder.reset();
+        attachInterrupt(digitalPinToInterrupt(UART_RX_PIN), isr_uart_rx, CHANGE);
+    } else {
+        detachInterrupt(digitalPinToInterrupt(UART_RX_PIN));
+    }
+#else
+    sw_serial.enableRx(on);
+#endif
+}
+
+// SoftwareSerial keeps the TX side, the edge receiver takes over the RX pin
+void rx_begin(uint32_t baud, bool even_parity) {
+#if defined(VIRTUAL_OPENER)
+    virtual_opener.begin(even_parity ? 1 : 2, millis());
+    virtual_rx = true;
+#elif defined(EDGE_UART_RX)
+    sw_serial.begin(baud, even_parity ? SWSERIAL_8E1 : SWSERIAL_8N1, -1, UART_TX_PIN, true);
+    pinMode(UART_RX_PIN, INPUT);
+    rx_decoder.begin(ESP.getCpuFreqMHz() * 1000000 / baud, even_parity, true);
+    rx_enable(true);
+#else
+    sw_serial.begin(baud, even_parity ? SWSERIAL_8E1 : SWSERIAL_8N1, UART_RX_PIN, UART_TX_PIN, true);
+#endif
+}
+
+// Someone is asserting the line (inverted logic, high is busy)
+bool rx_line_busy() {
+#ifdef VIRTUAL_OPENER
+    return virtual_opener.sending(millis());
+#else
+    return digitalRead(UART_RX_PIN);
+#endif
+}
+
+void tx_begin(uint32_t baud, bool even_parity) {
+#if defined(TIMER_UART_TX) && !defined(VIRTUAL_OPENER)
+    pinMode(UART_TX_PIN, OUTPUT);
+    digitalWrite(UART_TX_PIN, LOW);
+    tx_timer.begin(ESP.getCpuFreqMHz() * 1000000 / baud, even_parity);
+    tx_timer_ticks = 80000000 / baud;
+    timer1_attachInterrupt(isr_uart_tx);
+#endif
+}
+
+void tx_write(const uint8_t* buf, size_t len) {
+#if defined(VIRTUAL_OPENER)
+    virtual_opener.write(millis(), buf, len, virtual_rx);
+#elif defined(TIMER_UART_TX)
+    uint32_t start = ESP.getCycleCount();
+    if (!tx_timer.start(buf, len, start)) {
+        RERROR("Could not send %d bytes", len);
+        return;
+    }
+    // the start bit now, the timer takes it from the next bit boundary
+    bool done;
+    tx_timer.tick(start, &done);
+    GPOS = 1 << UART_TX_PIN;
+    timer1_enable(TIM_DIV1, TIM_EDGE, TIM_LOOP);
+    timer1_write(tx_timer_ticks);
+
+    // callers expect the bytes to be on the line when this returns
+    uint32_t deadline = micros() + 2 * len * (tx_timer_ticks / 80) * 11 + 1000;
+    while (tx_timer.busy()) {
+        if ((int32_t)(micros() - deadline) > 0) {
+            timer1_disable();
+            tx_timer.abort();
+            digitalWrite(UART_TX_PIN, LOW);
+            RERROR("Transmit timed out");
+            break;
+        }
+    }
+    tx_masked_max_us = tx_timer.masked_max / ESP.getCpuFreqMHz();
+#else
+    uint32_t start = ESP.getCycleCount();
+    sw_serial.write(buf, len);
+    // with interrupt TX off (SECURITY+2.0) the whole write is masked
+    if (gdoSecurityType == 2) {
+        uint32_t us = (ESP.getCycleCount() - start) / ESP.getCpuFreqMHz();
+        if (us > tx_masked_max_us) {
+            tx_masked_max_us = us;
+        }
+    }
+#endif
+}
 
 /********************************** MAIN LOOP CODE *****************************************/
 
 void setup_comms() {
 
     // init queue
-    q_init(&pkt_q, sizeof(PacketAction), 8, FIFO,  false);
+    q_init(&pkt_q, sizeof(PacketAction), PKT_Q_SIZE, FIFO,  false);
 
     // read from flash, default of 2 (SECURITY+2.0) if file not exist
     gdoSecurityType = (uint8_t)read_int_from_file("gdo_security", 2);
@@ -105,10 +343,11 @@ void setup_comms() {
 
         RINFO("Setting up comms for Secuirty+1.0 protocol");
 
-        sw_serial.begin(1200, SWSERIAL_8E1, UART_RX_PIN, UART_TX_PIN, true);
+        rx_begin(1200, true);
+        tx_begin(1200, true);
 
+        wall_panel.begin(millis());
         wallPanelDetected = false;
-        wallplateBooting = false;
         doorState = DoorState::Unknown;
         lightState = 2;
         lockState  = 2;
@@ -117,9 +356,16 @@ void setup_comms() {
     else {
         RINFO("Setting up comms for Secuirty+2.0 protocol");
 
-        sw_serial.begin(9600, SWSERIAL_8N1, UART_RX_PIN, UART_TX_PIN, true);
+        rx_begin(9600, false);
+        tx_begin(9600, false);
+#ifndef VIRTUAL_OPENER
         sw_serial.enableIntTx(false);
+#ifndef EDGE_UART_RX
         sw_serial.enableAutoBaud(true); // found in ratgdo/espsoftwareserial branch autobaud
+#endif
+#endif
+
+        code_budget.begin(millis());
 
         // read from flash, default of 0 if file not exist
         id_code = read_int_from_file("id_code");
@@ -142,7 +388,7 @@ void setup_comms() {
         sync();
 
         // Get the initial state of the door
-        if (!digitalRead(UART_RX_PIN)) {
+        if (!rx_line_busy()) {
             send_get_status();
         }
     }
@@ -154,54 +400,71 @@ void save_rolling_code() {
 }
 
 void wallPlate_Emulation() {
-    
-	if (wallPanelDetected) return;
 
 	unsigned long currentMillis = millis();
 	static unsigned long lastRequestMillis = 0;
 	static bool emulateWallPanel = false;
-	static unsigned long serialDetected = 0;
 	static uint8_t stateIndex = 0;
 
-	if (!serialDetected) {
-		if (sw_serial.available()) {
-			serialDetected = currentMillis;
-		}
+	// decided from the traffic seen so far, see WallPanelDetector.h
+	WallPanel panel = wall_panel.update(currentMillis);
 
+	if (panel == WallPanel::Present) {
+		if (!wallPanelDetected) {
+			wallPanelDetected = true;
+			Serial.println(emulateWallPanel ? "Wall panel detected, stopping emulation." : "Wall panel detected.");
+			emulateWallPanel = false;
+		}
 		return;
 	}
 
-    // wait up to 15 seconds to look for an existing wallplate or it could be booting, so need to wait
-	if (currentMillis - serialDetected < 15000 || wallplateBooting == true) {
+	if (panel == WallPanel::Unknown) {
 		if (currentMillis - lastRequestMillis > 1000) {
 			Serial.println("Looking for security+ 1.0 wall panel...");
 			lastRequestMillis = currentMillis;
 		}
+		return;
+	}
 
-		if(!wallPanelDetected && (doorState != DoorState::Unknown || lightState != 2)){
-			wallPanelDetected = true;
-            wallplateBooting = false;
-			Serial.println("Wall panel detected.");
-			return;
-		}
-	}else{
-		if (!emulateWallPanel && !wallPanelDetected){
-			emulateWallPanel = true;
-			Serial.println("No wall panel detected. Switching to emulation mode.");
-		}
+	if (!emulateWallPanel) {
+		emulateWallPanel = true;
+		lastRequestMillis = 0;
+		Serial.println("No wall panel detected. Switching to emulation mode.");
+	}
 
-		if (emulateWallPanel && currentMillis - lastRequestMillis > 250){
-			lastRequestMillis = currentMillis;
-			
-            byte secplus1ToSend = byte(secplus1States[stateIndex]);
-			transmitSec1(secplus1ToSend);
-            stateIndex++;
-			if (stateIndex == sizeof(secplus1States)) stateIndex = sizeof(secplus1States) - 3;
-		}
+	if (currentMillis - lastRequestMillis > 250) {
+		lastRequestMillis = currentMillis;
+
+		byte secplus1ToSend = byte(secplus1States[stateIndex]);
+		transmitSec1(secplus1ToSend);
+		stateIndex++;
+		if (stateIndex == sizeof(secplus1States)) stateIndex = sizeof(secplus1States) - 3;
 	}
 }
 
+// Notify once for fields whose hold is over, if they changed
+void notify_reconcile(uint8_t fields) {
+    if (fields & (1 << NOTIFY_LIGHT)) {
+        if (notify_gate.end(NOTIFY_LIGHT, garage_door.light)) {
+            notify_homekit_light();
+        }
+        RINFO("Light notifications held: %d", notify_gate.last_held);
+    }
+    if (fields & (1 << NOTIFY_LOCK)) {
+        if (notify_gate.end(NOTIFY_LOCK, garage_door.current_lock)) {
+            notify_homekit_target_lock();
+            notify_homekit_current_lock();
+        }
+        RINFO("Lock notifications held: %d", notify_gate.last_held);
+    }
+}
+
 void comms_loop() {
+    uint8_t notify_due = notify_gate.due(millis());
+    if (notify_due) {
+        notify_reconcile(notify_due);
+    }
+
     // SECUIRTY1.0
     if (gdoSecurityType == 1) {
 
@@ -211,9 +474,14 @@ void comms_loop() {
         bool gotMessage = false;
 
         
-        if (sw_serial.available()) {
-            uint8_t ser_byte = sw_serial.read();
+        if (rx_available()) {
+            uint8_t ser_byte = rx_read();
             last_rx = millis();
+            wall_panel.rx(last_rx, ser_byte);
+#ifdef SHADOW_DECODE
+            shadow_byte(ser_byte);
+            uint32_t shadow_start = ESP.getCycleCount();
+#endif
 
             if (!reading_msg) {
                 // valid?
@@ -253,6 +521,9 @@ void comms_loop() {
                     byte_count = 0;
                 }
             }
+#ifdef SHADOW_DECODE
+            shadow.production_cycles += ESP.getCycleCount() - shadow_start;
+#endif
         }
 
         // got data?
@@ -263,17 +534,16 @@ void comms_loop() {
             // button press/release have no val, just a single byte
             uint8_t key = rx_packet[0];
             uint8_t val = rx_packet[1];   
+            metrics_rx(key);
+#ifdef SHADOW_DECODE
+            ShadowFrame shadow_frame = ShadowFrame::from_secplus1(key, val);
+#endif
 
             if (key == secplus1Codes::DoorButtonPress) { RINFO("0x30 RX (door press)"); }
             // wall panel is sending out 0x31 (Door Button Release) when it starts up
             // but also on release of door button
             else if (key == secplus1Codes::DoorButtonRelease) {
-                RINFO("0x31 RX (door release)"); 
-                
-                // Possible power up of 889LM
-                if ((DoorState)doorState == DoorState::Unknown) {
-                    wallplateBooting = true;
-                }
+                RINFO("0x31 RX (door release)");
             }
             else if (key == secplus1Codes::LightButtonPress) { RINFO("0x32 RX (light press)"); }
             else if (key == secplus1Codes::LightButtonRelease) { RINFO("0x33 RX (light release)"); }
@@ -325,6 +595,9 @@ void comms_loop() {
                             case 0x06: doorState = DoorState::Stopped; break;
                             default:   doorState = DoorState::Unknown; break;
                         }                       
+#ifdef SHADOW_DECODE
+                        shadow_state.door = (uint8_t)doorState;
+#endif
 
                         //RINFO("doorstate: %d", doorState);
                         
@@ -357,8 +630,7 @@ void comms_loop() {
                         if ((garage_door.current_state == CURR_CLOSING) && (TTCcountdown > 0)) {
                             // We are in a time-to-close delay timeout, cancel the timeout
                             RINFO("Canceling time-to-close delay timer");
-                            TTCtimer.detach();
-                            TTCcountdown = 0;
+                            ttc_cancel();
                         }
 
                         if (!garage_door.active) {
@@ -396,7 +668,9 @@ void comms_loop() {
                             }
                             RINFO("status DOOR: %s",l);
 
+                            command_trace.status(TRACE_ACKED, millis());
                             notify_homekit_current_door_state_change();
+                            command_trace.status(TRACE_NOTIFIED, millis());
                         }
 
                         static GarageDoorTargetState gd_TargetState;
@@ -425,6 +699,10 @@ void comms_loop() {
 
                         lightState = bitRead(val, 2);
                         lockState  = !bitRead(val, 3);
+#ifdef SHADOW_DECODE
+                        shadow_state.light = lightState;
+                        shadow_state.lock = lockState;
+#endif
 
                         // light status
                         static uint8_t lastLightState = 0xff;
@@ -434,7 +712,9 @@ void comms_loop() {
                             lastLightState = lightState;
                             
                             garage_door.light = (bool)lightState;
+                            command_trace.status(TRACE_ACKED, millis());
                             notify_homekit_light();
+                            command_trace.status(TRACE_NOTIFIED, millis());
                         }
 
                         // lock status
@@ -451,13 +731,18 @@ void comms_loop() {
                                 garage_door.current_lock = CURR_UNLOCKED;
                                 garage_door.target_lock = TGT_UNLOCKED;
                             }
+                            command_trace.status(TRACE_ACKED, millis());
                             notify_homekit_target_lock();
                             notify_homekit_current_lock();
+                            command_trace.status(TRACE_NOTIFIED, millis());
                         }
 
                         break;
                 }
             }
+#ifdef SHADOW_DECODE
+            shadow.production(millis(), shadow_frame, shadow_state);
+#endif
         }
 
         //
@@ -480,11 +765,14 @@ void comms_loop() {
             // OK to send after a complete message comes in and 20ms elapses but not more than 100ms
             if (okToSend) {
                 if (q_peek(&pkt_q, &pkt_ac)) {
+                    command_trace.dequeued(pkt_ac.trace, now);
                     if (process_PacketAction(pkt_ac)) {
+                        command_trace.sent(pkt_ac.trace, millis());
                         // get next delay "between" transmits
                         cmdDelay = pkt_ac.delay;
                         q_drop(&pkt_q);
                     } else {
+                        command_trace.retry(pkt_ac.trace);
                         cmdDelay = 0;
                         RERROR("transmit failed, will retry");
                     }
@@ -498,29 +786,76 @@ void comms_loop() {
     // SECUIRTY2.0+
     else {
         // no incoming data, check if we have command queued
-        if (!sw_serial.available())
+        if (!rx_available())
         {
             PacketAction pkt_ac;
 
             if (q_peek(&pkt_q, &pkt_ac)) {
-                if (process_PacketAction(pkt_ac)) {
+                // packets that use a rolling code draw from the budget, see CodeBudget.h
+                CodeDecision budget = CodeDecision::Send;
+                if (pkt_ac.inc_counter) {
+                    budget = code_budget.check(CodeBudget::classify(pkt_ac.pkt.m_pkt_cmd), millis());
+                }
+                if (budget == CodeDecision::Drop) {
+                    RINFO("Over rolling code budget, dropping %s", PacketCommand::to_string(pkt_ac.pkt.m_pkt_cmd));
                     q_drop(&pkt_q);
+                } else if (budget == CodeDecision::Defer) {
+                    // a door command doesn't wait behind it
+                    PacketAction next;
+                    for (uint8_t i = 1; q_peekIdx(&pkt_q, &next, i); i++) {
+                        if (CodeBudget::classify(next.pkt.m_pkt_cmd) == CodeClass::Critical) {
+                            PacketAction acts[PKT_Q_SIZE];
+                            uint8_t count = queue_take(acts);
+                            CodeBudget::promote_critical(acts, count);
+                            queue_put(acts, count);
+                            RINFO("Over rolling code budget, sending %s ahead of %s", PacketCommand::to_string(next.pkt.m_pkt_cmd), PacketCommand::to_string(pkt_ac.pkt.m_pkt_cmd));
+                            break;
+                        }
+                    }
                 } else {
-                    RERROR("transmit failed, will retry");
+                    command_trace.dequeued(pkt_ac.trace, millis());
+#ifdef TX_BATCH
+                    if (pkt_ac.batch) {
+                        transmitSec2Batch();
+                    } else
+#endif
+                    if (process_PacketAction(pkt_ac)) {
+                        command_trace.sent(pkt_ac.trace, millis());
+                        q_drop(&pkt_q);
+                    } else {
+                        command_trace.retry(pkt_ac.trace);
+                        RERROR("transmit failed, will retry");
+                    }
                 }
             }
         }
         else
         {               
             // spin on receiving data until the whole packet has arrived        
-            uint8_t ser_data = sw_serial.read();
+            uint8_t ser_data = rx_read();
+#ifdef SHADOW_DECODE
+            shadow_byte(ser_data);
+            uint32_t shadow_start = ESP.getCycleCount();
+            bool shadow_ready = reader.push_byte(ser_data);
+            Packet pkt;
+            if (shadow_ready) {
+                pkt = Packet(reader.fetch_buf());
+            }
+            shadow.production_cycles += ESP.getCycleCount() - shadow_start;
+            if (shadow_ready) {
+                shadow_state.apply(pkt);
+                shadow.production(millis(), ShadowFrame::from_packet(pkt), shadow_state);
+#else
             if (reader.push_byte(ser_data)) {
                 Packet pkt = Packet(reader.fetch_buf());
+#endif
                 pkt.print();
+                metrics_rx(pkt.m_pkt_cmd);
 
                 switch (pkt.m_pkt_cmd) {
                     case PacketCommand::Status:
                         {
+                            command_trace.status(TRACE_ACKED, millis());
                             GarageDoorCurrentState current_state = garage_door.current_state;
                             GarageDoorTargetState target_state = garage_door.target_state;
                             switch (pkt.m_data.value.status.door) {
@@ -548,12 +883,12 @@ void comms_loop() {
                                     RERROR("Got door state unknown");
                                     break;
                             }
+                            early_motion.status(pkt.m_data.value.status.door);
 
                             if ((current_state == CURR_CLOSING) && (TTCcountdown > 0)) {
                                 // We are in a time-to-close delay timeout, cancel the timeout
                                 RINFO("Canceling time-to-close delay timer");
-                                TTCtimer.detach();
-                                TTCcountdown = 0;
+                                ttc_cancel();
                             }
 
                             if (!garage_door.active) {
@@ -600,6 +935,7 @@ void comms_loop() {
                                 notify_homekit_current_lock();
                             }
 
+                            command_trace.status(TRACE_NOTIFIED, millis());
                             break;
                         }
 
@@ -682,6 +1018,25 @@ void comms_loop() {
                             break;
                         }
 
+                    case PacketCommand::MotorOn:
+                        {
+                            RINFO("Motor on");
+                            early_door_motion(early_motion.motor_on());
+                            break;
+                        }
+
+                    case PacketCommand::DoorAction:
+                        {
+                            // a wall button or remote, the door is about to move
+                            if (EarlyMotion::echo(millis(), last_tx, pkt.m_remote_id, id_code)) {
+                                break;
+                            }
+                            if (pkt.m_data.value.door_action.pressed) {
+                                early_door_motion(early_motion.door_action(pkt.m_data.value.door_action));
+                            }
+                            break;
+                        }
+
                     default:
                         RINFO("Support for %s packet unimplemented. Ignoring.", PacketCommand::to_string(pkt.m_pkt_cmd));
                         break;
@@ -701,56 +1056,156 @@ void comms_loop() {
 bool transmitSec1(byte toSend) {
 
     // safety
-    if (digitalRead(UART_RX_PIN) || sw_serial.available()) {
+    if (rx_line_busy() || rx_available()) {
         return false;
     }
     
     // if no wall panel, we can disable rx while we transmit
     if (!wallPanelDetected) {
-        sw_serial.enableRx(false);
+        rx_enable(false);
     }
 
-    sw_serial.write(toSend);
+    tx_write(&toSend, 1);
     last_tx = millis();
+    metrics_tx(toSend);
+    wall_panel.tx(last_tx, toSend);
 
     // if no wall panel, we need to enable rx, since we disabled above
     if (!wallPanelDetected) {
-        sw_serial.enableRx(true);
+        rx_enable(true);
     }
 
     return true;
 }
 
 // SECURITY+2.0
-bool transmitSec2(PacketAction& pkt_ac) {
+// The bus as TxBatch.h sees it
+struct Sec2Line {
+    bool claim() {
+        // inverted logic, so this pulls the bus low to assert it
+        digitalWrite(UART_TX_PIN, HIGH);
+        delayMicroseconds(1300);
+        digitalWrite(UART_TX_PIN, LOW);
+        delayMicroseconds(130);
+
+        // check to see if anyone else is continuing to assert the bus after we have released it
+        return !rx_line_busy();
+    }
 
-    // inverted logic, so this pulls the bus low to assert it
-    digitalWrite(UART_TX_PIN, HIGH);
-    delayMicroseconds(1300);
-    digitalWrite(UART_TX_PIN, LOW);
-    delayMicroseconds(130);
+    bool busy() {
+        return rx_line_busy();
+    }
 
-    // check to see if anyone else is continuing to assert the bus after we have released it
-    if (digitalRead(UART_RX_PIN)) {
-        RINFO("Collision detected, waiting to send packet");
-        return false;
+    void write(const uint8_t* buf, size_t len) {
+        tx_write(buf, len);
+        delayMicroseconds(100);
+    }
+
+    void wait_us(uint32_t us) {
+        delayMicroseconds(us);
+    }
+};
+
+bool transmitSec2(PacketAction& pkt_ac) {
+
+    uint8_t buf[1][SECPLUS2_CODE_LEN];
+    if (pkt_ac.pkt.encode(rolling_code, buf[0]) != 0) {
+        RERROR("Could not encode packet");
+        pkt_ac.pkt.print();
     } else {
-        uint8_t buf[SECPLUS2_CODE_LEN];
-        if (pkt_ac.pkt.encode(rolling_code, buf) != 0) {
+        Sec2Line line;
+        if (!tx_batch(line, tx_stats, buf, 1)) {
+            RINFO("Collision detected, waiting to send packet");
+            return false;
+        }
+        last_tx = millis();
+        metrics_tx(pkt_ac.pkt.m_pkt_cmd);
+    }
+
+    if (pkt_ac.inc_counter) {
+        rolling_code = (rolling_code + 1)  & 0xfffffff;
+        code_budget.spend(millis());
+    }
+
+    return true;
+}
+
+#ifdef TX_BATCH
+// SECURITY+2.0
+// Sends the packet at the head of the queue, and those queued after it as part of the same action,
+// in one bus claim. What went out is dropped from the queue, the rest is retried. The head has
+// already been checked against the code budget, the others are checked here, up front.
+void transmitSec2Batch() {
+
+    const uint8_t NO_SLOT = 0xFF;
+    PacketAction acts[TX_BATCH_MAX];
+    uint8_t slot[TX_BATCH_MAX];         // index in bufs, NO_SLOT if not to be sent
+    uint8_t bufs[TX_BATCH_MAX][SECPLUS2_CODE_LEN];
+    uint8_t n = 0;
+    uint8_t count = 0;
+    uint32_t rolling = rolling_code;
+
+    while (n < TX_BATCH_MAX && q_peekIdx(&pkt_q, &acts[n], n)) {
+        PacketAction& ac = acts[n];
+        CodeDecision budget = CodeDecision::Send;
+        if (n > 0 && ac.inc_counter) {
+            budget = code_budget.check(CodeBudget::classify(ac.pkt.m_pkt_cmd), millis());
+        }
+        if (budget == CodeDecision::Defer) {
+            break;
+        }
+
+        slot[n] = NO_SLOT;
+        if (budget == CodeDecision::Drop) {
+            RINFO("Over rolling code budget, dropping %s", PacketCommand::to_string(ac.pkt.m_pkt_cmd));
+        } else if (ac.pkt.encode(rolling, bufs[count]) != 0) {
             RERROR("Could not encode packet");
-            pkt_ac.pkt.print();
+            ac.pkt.print();
         } else {
-            sw_serial.write(buf, SECPLUS2_CODE_LEN);
-            delayMicroseconds(100);
+            slot[n] = count++;
+            if (ac.inc_counter) {
+                rolling = (rolling + 1) & 0xfffffff;
+            }
         }
+        n++;
 
-        if (pkt_ac.inc_counter) {
-            rolling_code = (rolling_code + 1)  & 0xfffffff;
+        if (!ac.batch) {
+            break;
         }
     }
 
-    return true;
+    // Turn off LED
+    digitalWrite(LED_BUILTIN, HIGH);
+    led_on_time = millis() + 500;
+
+    uint8_t sent = 0;
+    if (count) {
+        Sec2Line line;
+        sent = tx_batch(line, tx_stats, bufs, count);
+    }
+
+    uint32_t now = millis();
+    if (sent) {
+        last_tx = now;
+    }
+    for (uint8_t i = 0; i < n; i++) {
+        if (slot[i] != NO_SLOT && slot[i] >= sent) {
+            command_trace.retry(acts[i].trace);
+            RERROR("transmit failed after %d of %d packets, will retry", sent, count);
+            break;
+        }
+        if (slot[i] != NO_SLOT) {
+            command_trace.sent(acts[i].trace, now);
+            metrics_tx(acts[i].pkt.m_pkt_cmd);
+            if (acts[i].inc_counter) {
+                rolling_code = (rolling_code + 1) & 0xfffffff;
+                code_budget.spend(now);
+            }
+        }
+        q_drop(&pkt_q);
+    }
 }
+#endif // TX_BATCH
 
 bool process_PacketAction(PacketAction& pkt_ac) {
 
@@ -869,19 +1324,20 @@ void door_command(DoorAction action) {
 
     Packet pkt = Packet(PacketCommand::DoorAction, data, id_code);
     PacketAction pkt_ac = {pkt, false, 250}; // 250ms delay for SECURITY1.0
+    pkt_ac.batch = true;    // press, release and status, one bus claim with TX_BATCH
 
-    q_push(&pkt_q, &pkt_ac);
+    queue_packet(pkt_ac);
 
     // do button release
     pkt_ac.pkt.m_data.value.door_action.pressed = false;
     pkt_ac.inc_counter = true;
     pkt_ac.delay = 40;  // 40ms delay for SECURITY1.0
 
-    q_push(&pkt_q, &pkt_ac);
+    queue_packet(pkt_ac);
 
     // when observing wall panel 2 releases happen, so we do the same
     if (gdoSecurityType == 1) {
-        q_push(&pkt_q, &pkt_ac);
+        queue_packet(pkt_ac);
     }
 
     send_get_status();
@@ -894,8 +1350,7 @@ void open_door() {
         // We are in a time-to-close delay timeout.
         // Effect of open is to cancel the timeout (leaving door open)
         RINFO("Canceling time-to-close delay timer");
-        TTCtimer.detach();
-        TTCcountdown = 0;
+        ttc_cancel();
         // Reset light to state it was at before delay start.
         set_light(TTCwasLightOn);
     }
@@ -912,14 +1367,24 @@ void open_door() {
     door_command(DoorAction::Open);
 }
 
+// Stop the time-to-close delay. The light stays held until the opener has reported its last
+// flash, or the light being put back.
+void ttc_cancel() {
+    TTCtimer.detach();
+    TTCcountdown = 0;
+    notify_gate.release(NOTIFY_LIGHT, millis() + NOTIFY_SETTLE);
+}
+
 void TTCdelayLoop() {
     if (--TTCcountdown > 0) {
-        // If light is on, turn it off.  If off, turn it on.
+        // If light is on, turn it off.  If off, turn it on. The flashes aren't traced, they would
+        // push everything else out of the trace ring.
         set_light(!garage_door.light);
     }
     else {
         // End of delay period
-        TTCtimer.detach();
+        CommandTraceScope trace(command_trace, TraceOrigin::TTC, millis());
+        ttc_cancel();
         door_command(DoorAction::Close);
     }
     return;
@@ -945,8 +1410,7 @@ void close_door() {
             // We are in a time-to-close delay timeout.
             // Effect of second click is to cancel the timeout and close immediately
             RINFO("Canceling time-to-close delay timer");
-            TTCtimer.detach();
-            TTCcountdown = 0;
+            ttc_cancel();
             door_command(DoorAction::Close);
         }
         else {
@@ -955,11 +1419,69 @@ void close_door() {
             TTCcountdown = TTCdelay * 2;
             // Remember whether light was on or off
             TTCwasLightOn = garage_door.light;
+            // The flashing isn't news, HomeKit and SSE hear where the light ends up
+            notify_gate.hold(NOTIFY_LIGHT, garage_door.light);
             TTCtimer.attach_scheduled(0.5, TTCdelayLoop);
         }
     }
 }
 
+// Nothing waiting to go out to the opener
+bool comms_idle() {
+    return q_isEmpty(&pkt_q);
+}
+
+// The queue as an array, oldest first, for the changes cQueue can't make in place. It is emptied
+// by queue_take and must be refilled with queue_put.
+uint8_t queue_take(PacketAction* acts) {
+    uint8_t count = 0;
+    while (count < PKT_Q_SIZE && q_pop(&pkt_q, &acts[count])) {
+        count++;
+    }
+    return count;
+}
+
+void queue_put(const PacketAction* acts, uint8_t count) {
+    for (uint8_t i = 0; i < count; i++) {
+        q_push(&pkt_q, &acts[i]);
+    }
+}
+
+// True if a packet of `cmd` is waiting to go out
+bool queued(PacketCommand cmd) {
+    PacketAction pkt_ac;
+    for (uint8_t i = 0; q_peekIdx(&pkt_q, &pkt_ac, i); i++) {
+        if (pkt_ac.pkt.m_pkt_cmd == cmd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Queue a packet, tagged with the command being traced if there is one
+void queue_packet(PacketAction& pkt_ac) {
+    pkt_ac.trace = command_trace.current();
+    command_trace.queued(pkt_ac.trace, pkt_ac.pkt.m_pkt_cmd, millis());
+    if (q_push(&pkt_q, &pkt_ac)) {
+        return;
+    }
+
+    // Full. A door command takes the place of the newest packet that isn't one.
+    PacketAction acts[PKT_Q_SIZE];
+    uint8_t count = queue_take(acts);
+    uint8_t i = CodeBudget::evict(acts, count);
+    if (gdoSecurityType == 2 && CodeBudget::classify(pkt_ac.pkt.m_pkt_cmd) == CodeClass::Critical && i < count) {
+        RERROR("Transmit queue full, dropping %s for %s", PacketCommand::to_string(acts[i].pkt.m_pkt_cmd), PacketCommand::to_string(pkt_ac.pkt.m_pkt_cmd));
+        for (; i + 1 < count; i++) {
+            acts[i] = acts[i + 1];
+        }
+        acts[count - 1] = pkt_ac;
+    } else {
+        RERROR("Transmit queue full, dropping %s", PacketCommand::to_string(pkt_ac.pkt.m_pkt_cmd));
+    }
+    queue_put(acts, count);
+}
+
 void send_get_status() {
     // only used with SECURITY2.0
     if (gdoSecurityType == 2) {
@@ -968,8 +1490,44 @@ void send_get_status() {
         d.value.no_data = NoData();
         Packet pkt = Packet(PacketCommand::GetStatus, d, id_code);
         PacketAction pkt_ac = {pkt, true};
-        q_push(&pkt_q, &pkt_ac);
+        queue_packet(pkt_ac);
+    }
+}
+
+// The opener is about to move the door, see EarlyMotion.h. Ask for its status now rather than
+// wait for it to be broadcast, and optionally show where we think the door is going meanwhile.
+void early_door_motion(DoorState provisional) {
+    if (early_motion.query(millis())) {
+        send_get_status();
+    }
+
+#ifdef EARLY_MOTION_PROVISIONAL
+    if (!garage_door.active) {
+        return;
+    }
+    GarageDoorCurrentState current_state;
+    GarageDoorTargetState target_state;
+    if (provisional == DoorState::Opening) {
+        current_state = CURR_OPENING;
+        target_state = TGT_OPEN;
+    } else if (provisional == DoorState::Closing) {
+        current_state = CURR_CLOSING;
+        target_state = TGT_CLOSED;
+    } else {
+        return;
+    }
+    if ((target_state != garage_door.target_state) ||
+        (current_state != garage_door.current_state)) {
+        RINFO("provisional tgt %d curr %d", target_state, current_state);
+        garage_door.target_state = target_state;
+        garage_door.current_state = current_state;
+
+        notify_homekit_current_door_state_change();
+        notify_homekit_target_door_state_change();
     }
+#else
+    (void)provisional;
+#endif
 }
 
 void set_lock(uint8_t value) {
@@ -1001,22 +1559,24 @@ void set_lock(uint8_t value) {
         data.value.lock.pressed = true;
         Packet pkt = Packet(PacketCommand::Lock, data, id_code);
         PacketAction pkt_ac = {pkt, true, 3000}; // 3000ms delay for SECURITY1.0
+        notify_gate.hold(NOTIFY_LOCK, garage_door.current_lock, millis() + 3000 + 40 + 40);
 
-        q_push(&pkt_q, &pkt_ac);
+        queue_packet(pkt_ac);
 
         // button release
         pkt_ac.pkt.m_data.value.lock.pressed = false;   
         pkt_ac.delay = 40; // 40ms delay for SECURITY1.0
         // observed the wall plate does 2 releases, so we will too
-        q_push(&pkt_q, &pkt_ac);
-        q_push(&pkt_q, &pkt_ac);
+        queue_packet(pkt_ac);
+        queue_packet(pkt_ac);
     }
     // SECURITY2.0
     else {
         Packet pkt = Packet(PacketCommand::Lock, data, id_code);
         PacketAction pkt_ac = {pkt, true};
+        pkt_ac.batch = true;
 
-        q_push(&pkt_q, &pkt_ac);
+        queue_packet(pkt_ac);
         send_get_status();
     }
 }
@@ -1030,6 +1590,22 @@ void set_light(bool value) {
         data.value.light.light = LightState::Off;
     }
 
+    // a light command still waiting for a rolling code is changed, not joined by another, and
+    // dropped if the light is already that way
+    if (gdoSecurityType == 2 && queued(PacketCommand::Light)) {
+        PacketAction acts[PKT_Q_SIZE];
+        uint8_t count = queue_take(acts);
+        uint8_t before = count;
+        CodeBudget::merge_light(acts, count, data.value.light.light, garage_door.light);
+        queue_put(acts, count);
+        if (count < before) {
+            RINFO("Light already %s, queued light command dropped", value ? "On" : "Off");
+        } else {
+            RINFO("Light command already queued, now %s", value ? "On" : "Off");
+        }
+        return;
+    }
+
     // safety
     if (data.value.light.light == LightState::On  && garage_door.light == true)  { RINFO("Light already On"); return; }
     if (data.value.light.light == LightState::Off && garage_door.light == false) { RINFO("Light already Off"); return; }
@@ -1047,22 +1623,24 @@ void set_light(bool value) {
 
         Packet pkt = Packet(PacketCommand::Light, data, id_code);
         PacketAction pkt_ac = {pkt, true, 250}; // 250ms delay for SECURITY1.0
+        notify_gate.hold(NOTIFY_LIGHT, garage_door.light, millis() + 250 + 40 + 40);
 
-        q_push(&pkt_q, &pkt_ac);
+        queue_packet(pkt_ac);
 
         // button release
         pkt_ac.pkt.m_data.value.light.pressed = false;   
         pkt_ac.delay = 40; // 40ms delay for SECURITY1.0
         // observed the wall plate does 2 releases, so we will too
-        q_push(&pkt_q, &pkt_ac);
-        q_push(&pkt_q, &pkt_ac);
+        queue_packet(pkt_ac);
+        queue_packet(pkt_ac);
     }
     // SECURITY+2.0
     else {
         Packet pkt = Packet(PacketCommand::Light, data, id_code);
         PacketAction pkt_ac = {pkt, true};
+        pkt_ac.batch = true;
 
-        q_push(&pkt_q, &pkt_ac);
+        queue_packet(pkt_ac);
         send_get_status();
     }
 }
@@ -14,4 +14,9 @@ void set_lock(uint8_t value);
 void set_light(bool value);
 
 void save_rolling_code();
+bool comms_idle();
+
+// rolling code is written to flash every this many codes
+#define MAX_CODES_WITHOUT_FLASH_WRITE 10
+#define PKT_Q_SIZE 8                    // packets waiting to go out to the opener
 #endif // _COMMS_H
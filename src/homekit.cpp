@@ -8,6 +8,12 @@
 #include <ESP8266WiFi.h>
 #include "utilities.h"
 #include "homekit_decl.h"
+#include "CommandTrace.h"
+#include "NotifyGate.h"
+#include "mdns.h"
+
+extern CommandTrace command_trace;
+extern NotifyGate notify_gate;
 
 // Bring in config and characteristics defined in homekit_decl.c
 extern "C" homekit_server_config_t config;
@@ -47,6 +53,7 @@ extern "C" char serial_number[SERIAL_NAME_SIZE];
 void homekit_loop()
 {
     arduino_homekit_loop();
+    mdns_loop();
 }
 
 void setup_homekit()
@@ -73,9 +80,7 @@ void setup_homekit()
         RINFO("Motion Sensor not detected.  Disabling Service");
         config.accessories[0]->services[3] = NULL;
     }
-    // We can set current lock state to unknown as HomeKit has value for that.
-    // But we can't do the same for door state as HomeKit has no value for that.
-    garage_door.current_lock = CURR_UNKNOWN;
+    // current_lock starts out unknown, or as restored, see setup()
     arduino_homekit_setup(&config);
 }
 
@@ -98,6 +103,7 @@ homekit_value_t target_door_state_get()
 void target_door_state_set(const homekit_value_t value)
 {
     RINFO("set door state: %d", value.uint8_value);
+    CommandTraceScope trace(command_trace, TraceOrigin::HomeKit, millis());
 
     switch (value.uint8_value)
     {
@@ -142,6 +148,7 @@ homekit_value_t target_lock_state_get()
 void target_lock_state_set(const homekit_value_t value)
 {
     RINFO("set lock state: %d", value.uint8_value);
+    CommandTraceScope trace(command_trace, TraceOrigin::HomeKit, millis());
 
     set_lock(value.uint8_value);
 }
@@ -186,6 +193,7 @@ homekit_value_t light_state_get()
 void light_state_set(const homekit_value_t value)
 {
     RINFO("set light: %s", value.bool_value ? "On" : "Off");
+    CommandTraceScope trace(command_trace, TraceOrigin::HomeKit, millis());
 
     set_light(value.bool_value);
 }
@@ -202,7 +210,7 @@ void notify_homekit_obstruction()
 
 void notify_homekit_current_lock()
 {
-    if (arduino_homekit_get_running_server())
+    if (arduino_homekit_get_running_server() && notify_gate.pass(NOTIFY_LOCK))
     {
         homekit_characteristic_notify(
             &current_lock_state,
@@ -212,7 +220,7 @@ void notify_homekit_current_lock()
 
 void notify_homekit_target_lock()
 {
-    if (arduino_homekit_get_running_server())
+    if (arduino_homekit_get_running_server() && notify_gate.pass(NOTIFY_LOCK))
     {
         homekit_characteristic_notify(
             &target_lock_state,
@@ -222,7 +230,7 @@ void notify_homekit_target_lock()
 
 void notify_homekit_light()
 {
-    if (arduino_homekit_get_running_server())
+    if (arduino_homekit_get_running_server() && notify_gate.pass(NOTIFY_LIGHT))
     {
         homekit_characteristic_notify(
             &light_state,
@@ -234,7 +242,7 @@ void enable_service_homekit_motion()
 {
     uint32_t data = 1;
     write_int_to_file("has_motion", &data);
-    sync_and_restart();
+    sync_and_restart(REBOOT_SETTINGS);
 }
 
 void notify_homekit_motion()
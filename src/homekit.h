@@ -1,8 +1,13 @@
 // Copyright 2023 Brandon Matthews <thenewwazoo@optimaltour.us>
 // All rights reserved. GPLv3 License
 
+#ifndef _HOMEKIT_H
+#define _HOMEKIT_H
+
 void setup_homekit();
 
+#ifndef DISABLE_HOMEKIT
+
 void homekit_loop();
 
 void notify_homekit_target_door_state_change();
@@ -14,3 +19,28 @@ void notify_homekit_obstruction();
 void notify_homekit_light();
 void enable_service_homekit_motion();
 void notify_homekit_motion();
+
+#else
+
+// Built without HomeKit, see homekit_disabled.cpp
+inline void homekit_loop() {}
+
+inline void notify_homekit_target_door_state_change() {}
+inline void notify_homekit_current_door_state_change() {}
+inline void notify_homekit_active() {}
+inline void notify_homekit_target_lock() {}
+inline void notify_homekit_current_lock() {}
+inline void notify_homekit_obstruction() {}
+inline void notify_homekit_light() {}
+void enable_service_homekit_motion();
+inline void notify_homekit_motion() {}
+
+// stand-ins for the HomeKit library calls made elsewhere
+inline bool homekit_is_paired() { return false; }
+inline void homekit_storage_reset() {}
+inline void arduino_homekit_close() {}
+inline int arduino_homekit_connected_clients_count() { return 0; }
+
+#endif // DISABLE_HOMEKIT
+
+#endif // _HOMEKIT_H
@@ -0,0 +1,48 @@
+// GPLv3 License
+
+/* Setup for firmware built without HomeKit
+ *
+ * The nohomekit and headless environments in platformio.ini leave out
+ * homekit.cpp, homekit_decl.c and the HomeKit library. What they did beyond
+ * HomeKit itself, naming the device and reading the motion sensor setting,
+ * is done here instead. The notify functions are empty inlines in homekit.h.
+ */
+
+#ifdef DISABLE_HOMEKIT
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include "ratgdo.h"
+#include "homekit.h"
+#include "log.h"
+#include "utilities.h"
+
+extern struct GarageDoor garage_door;
+
+extern "C" char device_name[DEVICE_NAME_SIZE];
+extern "C" const char device_name_file[];
+extern "C" char serial_number[SERIAL_NAME_SIZE];
+
+char device_name[DEVICE_NAME_SIZE];
+char serial_number[SERIAL_NAME_SIZE];
+
+void setup_homekit()
+{
+    RINFO("Built without HomeKit");
+    snprintf(device_name, DEVICE_NAME_SIZE, "Garage Door %06X", ESP.getChipId());
+    read_string_from_file(device_name_file, device_name, device_name, DEVICE_NAME_SIZE);
+    String macAddress = WiFi.macAddress();
+    snprintf(serial_number, SERIAL_NAME_SIZE, "%s", macAddress.c_str());
+
+    garage_door.has_motion_sensor = (bool)read_int_from_file("has_motion");
+}
+
+void enable_service_homekit_motion()
+{
+    // no HomeKit service to add, so no need to restart
+    uint32_t data = 1;
+    write_int_to_file("has_motion", &data);
+    garage_door.has_motion_sensor = true;
+}
+
+#endif // DISABLE_HOMEKIT
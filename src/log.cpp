@@ -33,11 +33,37 @@ void print_packet(uint8_t pkt[SECPLUS2_CODE_LEN]) {}
 
 #ifdef LOG_MSG_BUFFER
 #define LINE_BUFFER_SIZE 256
+#ifdef LOG_TOKENIZED
+static_assert(1 + ((LOG_TOKEN_MAX_RECORD + 2) / 3) * 4 + 3 <= LINE_BUFFER_SIZE, "base64 token record must fit in lineBuffer");
+#endif
 char *lineBuffer = NULL;
 logBuffer *msgBuffer = NULL; // Buffer to save log messages as they occur
 File logMessageFile;
 
-void logToBuffer_P(const char *fmt, ...)
+void logLineToBuffer()
+{
+    // print line to the serial port
+    Serial.print(lineBuffer);
+    // copy the line into the message save buffer
+    size_t len = strlen(lineBuffer);
+    size_t available = sizeof(msgBuffer->buffer) - msgBuffer->head;
+    memcpy(&msgBuffer->buffer[msgBuffer->head], lineBuffer, min(available, len));
+    if (available < len)
+    {
+        // we wrapped on the available buffer space
+        msgBuffer->wrapped = 1;
+        msgBuffer->head = len - available;
+        memcpy(msgBuffer->buffer, &lineBuffer[available], msgBuffer->head);
+    }
+    else
+    {
+        msgBuffer->head += len;
+    }
+    // send it to subscribed browsers
+    SSEBroadcastState(lineBuffer, LOG_MESSAGE);
+}
+
+bool initLogBuffer()
 {
     if (!msgBuffer)
     {
@@ -56,32 +82,52 @@ void logToBuffer_P(const char *fmt, ...)
         logMessageFile = (LittleFS.exists(CRASH_LOG_MSG_FILE)) ? LittleFS.open(CRASH_LOG_MSG_FILE, "r+") : LittleFS.open(CRASH_LOG_MSG_FILE, "w+");
         Serial.printf_P(PSTR("Opened log message file, size: %d\n"), logMessageFile.size());
     }
+    return (msgBuffer && lineBuffer);
+}
+
+void logToBuffer_P(const char *fmt, ...)
+{
+    if (!initLogBuffer())
+        return;
 
     // parse the format string into lineBuffer
     va_list args;
     va_start(args, fmt);
     vsnprintf_P(lineBuffer, LINE_BUFFER_SIZE, fmt, args);
     va_end(args);
-    // print line to the serial port
-    Serial.print(lineBuffer);
-    // copy the line into the message save buffer
-    size_t len = strlen(lineBuffer);
-    size_t available = sizeof(msgBuffer->buffer) - msgBuffer->head;
-    memcpy(&msgBuffer->buffer[msgBuffer->head], lineBuffer, min(available, len));
-    if (available < len)
-    {
-        // we wrapped on the available buffer space
-        msgBuffer->wrapped = 1;
-        msgBuffer->head = len - available;
-        memcpy(msgBuffer->buffer, &lineBuffer[available], msgBuffer->head);
-    }
-    else
+    logLineToBuffer();
+}
+
+#ifdef LOG_TOKENIZED
+void logTokenToBuffer(const uint8_t *record, size_t len)
+{
+    static const char b64[] PROGMEM = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    if (!initLogBuffer())
+        return;
+
+    // base64 encode the record onto a line starting with '$' so it travels through the
+    // text based serial, message log and SSE paths.  Decode with detokenize.py
+    char *p = lineBuffer;
+    *p++ = LOG_TOKEN_PREFIX;
+    for (size_t i = 0; i < len; i += 3)
     {
-        msgBuffer->head += len;
+        uint32_t n = record[i] << 16;
+        if (i + 1 < len)
+            n |= record[i + 1] << 8;
+        if (i + 2 < len)
+            n |= record[i + 2];
+        *p++ = pgm_read_byte(&b64[(n >> 18) & 0x3F]);
+        *p++ = pgm_read_byte(&b64[(n >> 12) & 0x3F]);
+        *p++ = (i + 1 < len) ? pgm_read_byte(&b64[(n >> 6) & 0x3F]) : '=';
+        *p++ = (i + 2 < len) ? pgm_read_byte(&b64[n & 0x3F]) : '=';
     }
-    // send it to subscribed browsers
-    SSEBroadcastState(lineBuffer, LOG_MESSAGE);
+    *p++ = '\r';
+    *p++ = '\n';
+    *p = 0;
+    logLineToBuffer();
 }
+#endif // LOG_TOKENIZED
 
 #ifdef ENABLE_CRASH_LOG
 void crashCallback()
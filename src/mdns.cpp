@@ -0,0 +1,187 @@
+// GPLv3 License
+
+/* mDNS for HomeKit on busy networks
+ *
+ * Built with MDNS_GUARD, the _hap._tcp service is answered from MdnsGuard (see
+ * MdnsGuard.h), which replaces the core's LEAmDNS responder rather than limiting
+ * it. arduino_homekit_setup() starts LEAmDNS with MDNS.begin() when HomeKit
+ * starts and again when pairing changes; mdns_guard.py links that call to
+ * __wrap_...() below, which declines, so LEAmDNS never opens its socket. The
+ * same records are advertised from here, probed for first and renamed if
+ * another host has them.
+ *
+ * The TXT record and setup hash below mirror homekit_mdns_init() in the
+ * library's arduino_homekit_server.cpp at the commit pinned in platformio.ini.
+ * They are a copy, not shared code, so check them against the library when
+ * bumping it.
+ */
+
+#if defined(MDNS_GUARD) && !defined(DISABLE_HOMEKIT)
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <ESP8266mDNS.h>
+#include <WiFiUdp.h>
+#include <arduino_homekit_server.h>
+#include <homekit/characteristics.h>
+#include <bearssl/bearssl_hash.h>
+
+#include "ratgdo.h"
+#include "log.h"
+#include "mdns.h"
+#include "MdnsGuard.h"
+
+#define HAP_PORT 5556       // arduino_homekit_server listens here
+#define MDNS_REFRESH 1000   // ms between checks of what is advertised
+#define MDNS_PER_LOOP 4     // packets handled per loop, the rest wait in lwIP
+
+// Make device_name and the HomeKit config available
+extern "C" char device_name[DEVICE_NAME_SIZE];
+extern "C" homekit_server_config_t config;
+
+MdnsGuard mdns_guard;
+static WiFiUDP udp;
+static uint32_t joinedIP = 0; // address the group was joined on
+static uint32_t lastRefresh = 0;
+static uint32_t lastConflicts = 0;
+static uint8_t packet[MDNS_PACKET_SIZE];
+static bool coreChecked = false;
+
+// arduino_homekit_server starts LEAmDNS with this, MDNSResponder::begin(), see mdns_guard.py
+extern "C" bool __wrap__ZN7esp826618MDNSImplementation13MDNSResponder5beginEPKcRK9IPAddressj(void *, const char *hostname, const IPAddress &, uint32_t)
+{
+    RINFO("Not starting the core mDNS responder for %s, HomeKit is answered by ratgdo", hostname);
+    return false;
+}
+
+// Setup hash, base64 of the first 4 bytes of SHA-512(setup id + accessory id), for the Home app
+// to match the accessory to its setup code
+static void setup_hash(const char *setupId, const char *accessoryId, char *out)
+{
+    static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint8_t hash[64];
+    br_sha512_context ctx;
+    br_sha512_init(&ctx);
+    br_sha512_update(&ctx, setupId, strlen(setupId));
+    br_sha512_update(&ctx, accessoryId, strlen(accessoryId));
+    br_sha512_out(&ctx, hash);
+
+    uint32_t v = (hash[0] << 16) | (hash[1] << 8) | hash[2];
+    uint32_t w = hash[3] << 16;
+    out[0] = b64[(v >> 18) & 63];
+    out[1] = b64[(v >> 12) & 63];
+    out[2] = b64[(v >> 6) & 63];
+    out[3] = b64[v & 63];
+    out[4] = b64[(w >> 18) & 63];
+    out[5] = b64[(w >> 12) & 63];
+    out[6] = '=';
+    out[7] = '=';
+    out[8] = 0;
+}
+
+// What the library's responder would advertise, as homekit_mdns_init() builds it
+static void refresh(uint32_t now)
+{
+    homekit_server_t *server = arduino_homekit_get_running_server();
+    if (!server)
+        return;
+
+    MdnsService service;
+    strlcpy(service.instance, device_name, sizeof(service.instance));
+    // host name of letters, digits and '-'
+    uint8_t n = 0;
+    for (const char *c = device_name; *c && n < sizeof(service.host) - 1; c++)
+        service.host[n++] = isalnum(*c) ? *c : '-';
+    service.host[n] = 0;
+    service.ip = WiFi.localIP();
+    service.port = HAP_PORT;
+
+    // model and category as declared in homekit_decl.c
+    homekit_accessory_t *accessory = config.accessories[0];
+    homekit_service_t *info = homekit_service_by_type(accessory, HOMEKIT_SERVICE_ACCESSORY_INFORMATION);
+    homekit_characteristic_t *model = info ? homekit_service_characteristic_by_type(info, HOMEKIT_CHARACTERISTIC_MODEL) : NULL;
+
+    char value[16];
+    bool paired = homekit_is_paired();
+    service.add_txt("md", model && model->value.string_value ? model->value.string_value : device_name);
+    service.add_txt("pv", "1.0");
+    service.add_txt("id", server->accessory_id);
+    snprintf(value, sizeof(value), "%u", config.config_number);
+    service.add_txt("c#", value);
+    service.add_txt("s#", "1");
+    service.add_txt("ff", "0");
+    service.add_txt("sf", paired ? "0" : "1");
+    snprintf(value, sizeof(value), "%d", (int)accessory->category);
+    service.add_txt("ci", value);
+    if (config.setupId)
+    {
+        setup_hash(config.setupId, server->accessory_id, value);
+        service.add_txt("sh", value);
+    }
+
+    if (mdns_guard.set(now, service))
+        RINFO("mDNS advertising %s.local, config number %u, %s", service.host, config.config_number, paired ? "paired" : "not paired");
+}
+
+static void send(const MdnsReply &reply)
+{
+    if (reply.unicast)
+        udp.beginPacket(udp.remoteIP(), udp.remotePort());
+    else
+        udp.beginPacketMulticast(IPAddress(224, 0, 0, 251), MDNS_PORT, WiFi.localIP());
+    udp.write(reply.buf, reply.len);
+    udp.endPacket();
+}
+
+void mdns_loop()
+{
+    if (WiFi.status() != WL_CONNECTED)
+        return;
+
+    uint32_t now = millis();
+    if (now - lastRefresh >= MDNS_REFRESH)
+    {
+        lastRefresh = now;
+        uint32_t ip = WiFi.localIP();
+        if (ip != joinedIP)
+        {
+            udp.stop();
+            if (!udp.beginMulticast(WiFi.localIP(), IPAddress(224, 0, 0, 251), MDNS_PORT))
+            {
+                RERROR("mDNS could not join the multicast group");
+                return;
+            }
+            joinedIP = ip;
+        }
+        refresh(now);
+        // two responders would answer for the same names, so the build must keep LEAmDNS from starting
+        if (!coreChecked && arduino_homekit_get_running_server())
+        {
+            coreChecked = true;
+            if (MDNS.isRunning())
+                RERROR("Core mDNS responder is running alongside MDNS_GUARD, was the build linked with mdns_guard.py?");
+        }
+    }
+    if (!joinedIP)
+        return;
+
+    MdnsReply reply;
+    if (mdns_guard.probe(now, reply) || mdns_guard.announcement(now, reply))
+        send(reply);
+    for (uint8_t i = 0; i < MDNS_PER_LOOP; i++)
+    {
+        if (udp.parsePacket() <= 0)
+            break;
+        // anything past MDNS_PACKET_SIZE is known answers, which are only read as far as they go
+        int len = udp.read(packet, sizeof(packet));
+        if (len > 0 && mdns_guard.query(now, udp.remoteIP(), udp.remotePort(), packet, len, reply))
+            send(reply);
+    }
+    if (mdns_guard.conflicts != lastConflicts)
+    {
+        lastConflicts = mdns_guard.conflicts;
+        RINFO("mDNS name in use by another host, probing for %s / %s.local", mdns_guard.advertised().instance, mdns_guard.advertised().host);
+    }
+}
+
+#endif // MDNS_GUARD && !DISABLE_HOMEKIT
@@ -0,0 +1,17 @@
+// GPLv3 License
+
+#ifndef _MDNS_H
+#define _MDNS_H
+
+#if defined(MDNS_GUARD) && !defined(DISABLE_HOMEKIT)
+
+void mdns_loop();
+
+#else
+
+// Built without MDNS_GUARD, the core's responder answers for HomeKit
+inline void mdns_loop() {}
+
+#endif
+
+#endif // _MDNS_H
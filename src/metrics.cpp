@@ -0,0 +1,238 @@
+// GPLv3 License
+
+/* StatsD metrics
+ *
+ * Pushes the counters and gauges that status.json reports to a StatsD collector
+ * over UDP, every statsd_interval seconds while WiFi is up. The collector is
+ * given as an IP address, so a push never waits on DNS. See StatsD.h.
+ */
+
+#ifdef STATSD
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+
+#include "ratgdo.h"
+#include "log.h"
+#include "utilities.h"
+#include "metrics.h"
+#include "Packet.h"
+#include "TxBatch.h"
+#include "NotifyGate.h"
+#include "StatsD.h"
+#include "cQueue.h"
+#if defined(MDNS_GUARD) && !defined(DISABLE_HOMEKIT)
+#include "MdnsGuard.h"
+
+extern MdnsGuard mdns_guard;
+#endif
+
+#ifndef DISABLE_HOMEKIT
+#include <arduino_homekit_server.h>
+#else
+#include "homekit.h"
+#endif
+
+#define STATSD_INTERVAL 10 // seconds, by default
+
+// Counted elsewhere
+extern "C" char device_name[DEVICE_NAME_SIZE];
+extern uint8_t gdoSecurityType;
+extern uint32_t rx_bytes;
+extern uint32_t rx_errors;
+extern TxStats tx_stats;
+extern NotifyGate notify_gate;
+extern Queue_t pkt_q;
+extern uint32_t loopTimeMax;
+extern uint8_t subscriptionCount;
+
+const char statsd_server_file[] = "statsd_server";
+const char statsd_interval_file[] = "statsd_interval";
+
+struct UdpSink
+{
+    WiFiUDP udp;
+    IPAddress ip;
+    uint16_t port = STATSD_PORT;
+    uint32_t errors = 0;
+
+    void send(const char *buf, size_t len)
+    {
+        if (!udp.beginPacket(ip, port) || udp.write((const uint8_t *)buf, len) != len || !udp.endPacket())
+            errors++;
+    }
+};
+
+static UdpSink sink;
+static StatsdPacket<UdpSink> statsd(sink);
+static char server[24] = "";
+static uint32_t interval = STATSD_INTERVAL * 1000;
+static uint32_t lastPush = 0;
+
+static StatsdKeyedCounts rx_cmds;
+static StatsdKeyedCounts tx_cmds;
+static StatsdHistogram loop_hist;
+
+// values at the last push
+static struct
+{
+    uint32_t rx_bytes;
+    uint32_t rx_errors;
+    uint32_t claims;
+    uint32_t collisions;
+    uint32_t packets;
+    uint32_t batches;
+    uint32_t notify_held;
+    uint32_t mdns_queries;
+    uint32_t mdns_answered;
+    uint32_t mdns_suppressed;
+} last;
+
+static bool parse_server(const char *value, IPAddress &ip, uint16_t &port)
+{
+    char host[sizeof(server)];
+    if (strlcpy(host, value, sizeof(host)) >= sizeof(host))
+        return false;
+    port = STATSD_PORT;
+    char *colon = strchr(host, ':');
+    if (colon)
+    {
+        *colon = 0;
+        port = atoi(colon + 1);
+        if (!port)
+            return false;
+    }
+    return ip.fromString(host);
+}
+
+bool metrics_set_server(const char *value)
+{
+    IPAddress ip;
+    uint16_t port = STATSD_PORT;
+    if (!strcmp(value, "0"))
+        value = "";
+    else if (!parse_server(value, ip, port))
+        return false;
+    strlcpy(server, value, sizeof(server));
+    write_string_to_file(statsd_server_file, server);
+    sink.ip = ip;
+    sink.port = port;
+    RINFO("StatsD server: %s", server[0] ? server : "none");
+    return true;
+}
+
+void metrics_set_interval(uint32_t seconds)
+{
+    if (!seconds)
+        seconds = STATSD_INTERVAL;
+    interval = seconds * 1000;
+    write_int_to_file(statsd_interval_file, &seconds);
+}
+
+const char *metrics_server()
+{
+    return server;
+}
+
+uint32_t metrics_interval()
+{
+    return interval / 1000;
+}
+
+uint32_t metrics_packets()
+{
+    return statsd.packets;
+}
+
+uint32_t metrics_errors()
+{
+    return sink.errors;
+}
+
+void setup_metrics()
+{
+    read_string_from_file(statsd_server_file, "", server, sizeof(server));
+    if (server[0] && !parse_server(server, sink.ip, sink.port))
+    {
+        RERROR("StatsD server not valid: %s", server);
+        server[0] = 0;
+    }
+    interval = read_int_from_file(statsd_interval_file, STATSD_INTERVAL) * 1000;
+    if (!interval)
+        interval = STATSD_INTERVAL * 1000;
+}
+
+void metrics_rx(uint16_t cmd)
+{
+    rx_cmds.add(cmd);
+}
+
+void metrics_tx(uint16_t cmd)
+{
+    tx_cmds.add(cmd);
+}
+
+void metrics_loop_time(uint32_t elapsed)
+{
+    loop_hist.add(elapsed);
+}
+
+static void push_commands(const char *dir, StatsdKeyedCounts &cmds)
+{
+    char name[40];
+    for (uint8_t i = 0; i < cmds.used; i++)
+    {
+        if (gdoSecurityType == 2)
+        {
+            PacketCommand cmd = PacketCommand::from_word(cmds.keys[i]);
+            if (cmd != PacketCommand::Unknown)
+                snprintf(name, sizeof(name), "%s.cmd.%s", dir, PacketCommand::to_string(cmd));
+            else
+                snprintf(name, sizeof(name), "%s.cmd.cmd_%03X", dir, cmds.keys[i]);
+        }
+        else
+        {
+            snprintf(name, sizeof(name), "%s.cmd.sec1_%02X", dir, cmds.keys[i]);
+        }
+        statsd.count(name, cmds.counts[i], cmds.last[i]);
+    }
+    snprintf(name, sizeof(name), "%s.cmd.other", dir);
+    statsd.count(name, cmds.other, cmds.other_last);
+}
+
+void metrics_loop()
+{
+    if (!server[0] || millis() - lastPush < interval || WiFi.status() != WL_CONNECTED)
+        return;
+    lastPush = millis();
+
+    statsd.begin(device_name);
+    statsd.count("rx.bytes", rx_bytes, last.rx_bytes);
+    statsd.count("rx.errors", rx_errors, last.rx_errors);
+    statsd.count("tx.claims", tx_stats.claims, last.claims);
+    statsd.count("tx.collisions", tx_stats.collisions, last.collisions);
+    statsd.count("tx.packets", tx_stats.packets, last.packets);
+    statsd.count("tx.batches", tx_stats.batches, last.batches);
+    statsd.count("notify.held", notify_gate.held, last.notify_held);
+#if defined(MDNS_GUARD) && !defined(DISABLE_HOMEKIT)
+    statsd.count("mdns.queries", mdns_guard.queries, last.mdns_queries);
+    statsd.count("mdns.answered", mdns_guard.answered, last.mdns_answered);
+    statsd.count("mdns.suppressed", mdns_guard.suppressed(), last.mdns_suppressed);
+#endif
+    push_commands("rx", rx_cmds);
+    push_commands("tx", tx_cmds);
+
+    statsd.gauge("queue.depth", q_getCount(&pkt_q));
+    statsd.gauge("heap.free", ESP.getFreeHeap());
+    statsd.gauge("heap.max_block", ESP.getMaxFreeBlockSize());
+    statsd.gauge("wifi.rssi", WiFi.RSSI());
+    statsd.gauge("loop.p99", loop_hist.percentile(99));
+    statsd.gauge("loop.max", loopTimeMax);
+    statsd.gauge("sse.clients", subscriptionCount);
+    statsd.gauge("homekit.sessions", arduino_homekit_connected_clients_count());
+    statsd.flush();
+    loop_hist.reset();
+}
+
+#endif // STATSD
@@ -0,0 +1,38 @@
+// GPLv3 License
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdint.h>
+
+#ifdef STATSD
+
+void setup_metrics();
+void metrics_loop();
+
+// packets to and from the opener, by command
+void metrics_rx(uint16_t cmd);
+void metrics_tx(uint16_t cmd);
+void metrics_loop_time(uint32_t elapsed);
+
+// "ip[:port]", or "0" to stop pushing. False if it doesn't parse.
+bool metrics_set_server(const char *server);
+void metrics_set_interval(uint32_t seconds);
+
+const char *metrics_server();
+uint32_t metrics_interval();
+uint32_t metrics_packets();
+uint32_t metrics_errors();
+
+#else
+
+// Built without STATSD, nothing is counted
+inline void setup_metrics() {}
+inline void metrics_loop() {}
+inline void metrics_rx(uint16_t) {}
+inline void metrics_tx(uint16_t) {}
+inline void metrics_loop_time(uint32_t) {}
+
+#endif // STATSD
+
+#endif // _METRICS_H
@@ -8,6 +8,13 @@
 #include "comms.h"
 #include "log.h"
 #include "web.h"
+#include "utilities.h"
+#include "metrics.h"
+#ifdef VIRTUAL_OPENER
+#include "VirtualOpener.h"
+
+extern VirtualOpener virtual_opener;
+#endif
 
 /********************************* FWD DECLARATIONS *****************************************/
 
@@ -25,6 +32,12 @@ struct obstruction_sensor_t
 
 long unsigned int led_on_time = 0; // Stores time when LED should turn back on
 
+// Loop timing in microseconds, so the build profiles can be compared
+uint32_t loopTimeAvg = 0;      // moving average
+uint32_t loopTimeMax = 0;      // longest in the last minute or so
+static uint32_t loopTimeMaxNext = 0;
+static unsigned long loopTimeWindowStart = 0;
+
 extern bool flashCRC;
 
 struct GarageDoor garage_door;
@@ -61,6 +74,12 @@ void setup()
         RERROR("checkFlashCRC: false");
     }
 
+    // We can set current lock state to unknown as HomeKit has value for that.
+    // But we can't do the same for door state as HomeKit has no value for that.
+    // Either way, what was carried across a software restart is restored over it.
+    garage_door.current_lock = CURR_UNKNOWN;
+    bool warm = restore_warm_state();
+
     wifi_connect();
 
     setup_pins();
@@ -68,20 +87,47 @@ void setup()
     setup_comms();
 
     setup_homekit();
+    if (warm)
+        RINFO("Door state after restart: door %d, lock %d, light %d", garage_door.current_state, garage_door.current_lock, garage_door.light);
 
     setup_web();
 
-    RINFO("RATGDO setup completed");
+    setup_metrics();
+
+    RINFO("RATGDO setup completed, build profile: %s, sketch size: %u, free heap: %u", BUILD_PROFILE,
+          ESP.getSketchSize(), ESP.getFreeHeap());
+}
+
+void loop_timing(uint32_t elapsed)
+{
+    loopTimeAvg += ((int32_t)elapsed - (int32_t)loopTimeAvg) / 64;
+    if (elapsed > loopTimeMaxNext)
+        loopTimeMaxNext = elapsed;
+    if (loopTimeMaxNext > loopTimeMax)
+        loopTimeMax = loopTimeMaxNext;
+    // start a new window every minute, reporting the larger of this one and the last
+    if (millis() - loopTimeWindowStart > 60000)
+    {
+        loopTimeWindowStart = millis();
+        loopTimeMax = loopTimeMaxNext;
+        loopTimeMaxNext = 0;
+    }
+    metrics_loop_time(elapsed);
 }
 
 void loop()
 {
+    uint32_t loopStart = micros();
 
     improv_loop();
+    wifi_loop();
     comms_loop();
     homekit_loop();
     service_timer_loop();
     web_loop();
+    metrics_loop();
+
+    loop_timing(micros() - loopStart);
 }
 
 /*********************************** HELPER FUNCTIONS **************************************/
@@ -132,6 +178,18 @@ void obstruction_timer()
     unsigned long current_millis = millis();
     static unsigned long last_millis = 0;
 
+#ifdef VIRTUAL_OPENER
+    // the virtual opener's sensor, there are no pulses to count
+    if (virtual_opener.obstructed() != garage_door.obstructed)
+    {
+        garage_door.obstructed = virtual_opener.obstructed();
+        RINFO("Obstruction %s", garage_door.obstructed ? "Detected" : "Clear");
+        notify_homekit_obstruction();
+        digitalWrite(STATUS_OBST_PIN, garage_door.obstructed);
+    }
+    return;
+#endif
+
     // the obstruction sensor has 3 states: clear (HIGH with LOW pulse every 7ms), obstructed (HIGH), asleep (LOW)
     // the transitions between awake and asleep are tricky because the voltage drops slowly when falling asleep
     // and is high without pulses when waking up
@@ -9,6 +9,17 @@
 #define MODEL_NAME "ratgdo_v2.5"
 #define CHIP_FAMILY "ESP8266"
 
+// Build profile, see the environments in platformio.ini
+#if defined(DISABLE_HOMEKIT) && defined(DISABLE_WEB_UI)
+#define BUILD_PROFILE "minimal"
+#elif defined(DISABLE_HOMEKIT)
+#define BUILD_PROFILE "nohomekit"
+#elif defined(DISABLE_WEB_UI)
+#define BUILD_PROFILE "headless"
+#else
+#define BUILD_PROFILE "full"
+#endif
+
 /********************************** PIN DEFINITIONS *****************************************/
 
 #define UART_TX_PIN             D1  // red control terminal / GarageDoorOpener (UART1 TX)
@@ -5,11 +5,105 @@
 #include "log.h"
 #include "LittleFS.h"
 #include "comms.h"
+#include "ratgdo.h"
 #include <ESP8266WiFi.h>
 
-void sync_and_restart()
+extern struct GarageDoor garage_door;
+
+// State carried across a software restart in RTC user memory, so that HomeKit and the web page
+// show the door as it was while we wait for the first status from the opener. The start of RTC
+// user memory is used by eboot for OTA, so keep well clear of it.
+#define WARM_STATE_RTC_OFFSET 96    // in 4 byte blocks
+#define WARM_STATE_MAGIC 0x52474457 // "RGDW"
+
+struct WarmState
+{
+    uint32_t magic;
+    uint8_t reason;
+    uint8_t active;
+    uint8_t current_state;
+    uint8_t target_state;
+    uint8_t light;
+    uint8_t current_lock;
+    uint8_t target_lock;
+    uint8_t obstructed;
+    uint32_t crc;
+};
+
+static const char *reboot_reason = NULL;
+
+static uint32_t warm_state_crc(const WarmState *ws)
+{
+    // FNV-1a over everything before the crc
+    uint32_t hash = 0x811C9DC5;
+    const uint8_t *p = (const uint8_t *)ws;
+    for (size_t i = 0; i < offsetof(WarmState, crc); i++)
+    {
+        hash ^= p[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+static void save_warm_state(RebootReason reason)
+{
+    WarmState ws = {};
+    ws.magic = WARM_STATE_MAGIC;
+    ws.reason = reason;
+    ws.active = garage_door.active;
+    ws.current_state = garage_door.current_state;
+    ws.target_state = garage_door.target_state;
+    ws.light = garage_door.light;
+    ws.current_lock = garage_door.current_lock;
+    ws.target_lock = garage_door.target_lock;
+    ws.obstructed = garage_door.obstructed;
+    ws.crc = warm_state_crc(&ws);
+    ESP.rtcUserMemoryWrite(WARM_STATE_RTC_OFFSET, (uint32_t *)&ws, sizeof(ws));
+}
+
+// Called early in setup. Returns true if the door state was restored from before a restart.
+bool restore_warm_state()
+{
+    WarmState ws;
+    bool valid = ESP.rtcUserMemoryRead(WARM_STATE_RTC_OFFSET, (uint32_t *)&ws, sizeof(ws)) &&
+                 ws.magic == WARM_STATE_MAGIC && ws.crc == warm_state_crc(&ws);
+    // only good for one boot
+    uint32_t zero = 0;
+    ESP.rtcUserMemoryWrite(WARM_STATE_RTC_OFFSET, &zero, sizeof(zero));
+    if (!valid || ESP.getResetInfoPtr()->reason != REASON_SOFT_RESTART)
+    {
+        return false;
+    }
+
+    static const char *reasons[] = {"", "Request", "Settings", "Unpair", "Update", "Timer", "Heap"};
+    reboot_reason = (ws.reason < sizeof(reasons) / sizeof(reasons[0])) ? reasons[ws.reason] : "Unknown";
+    garage_door.active = ws.active;
+    garage_door.current_state = (GarageDoorCurrentState)ws.current_state;
+    garage_door.target_state = (GarageDoorTargetState)ws.target_state;
+    garage_door.light = ws.light;
+    garage_door.current_lock = (LockCurrentState)ws.current_lock;
+    garage_door.target_lock = (LockTargetState)ws.target_lock;
+    garage_door.obstructed = ws.obstructed;
+    RINFO("Restored door state after restart (%s)", reboot_reason);
+    return true;
+}
+
+// Why we last restarted: our own reason for a software restart, otherwise the SDK reset reason
+const char *last_reboot_reason()
+{
+    static String sdk_reason;
+    if (reboot_reason)
+        return reboot_reason;
+    if (!sdk_reason.length())
+        sdk_reason = ESP.getResetReason();
+    return sdk_reason.c_str();
+}
+
+void sync_and_restart(RebootReason reason)
 {
+    RINFO("Restarting, reason %d", reason);
     RINFO("checkFlashCRC: %s", ESP.checkFlashCRC() ? "true" : "false");
+    save_warm_state(reason);
     WiFi.mode(WIFI_OFF);
     WiFi.forceSleepBegin();
     save_rolling_code();
@@ -2,7 +2,18 @@
 #define _UTILITIES_H
 #include <stdint.h>
 
-void sync_and_restart();
+enum RebootReason : uint8_t {
+    REBOOT_REQUEST = 1,     // from the web page
+    REBOOT_SETTINGS,        // a setting that needs a restart changed
+    REBOOT_UNPAIR,
+    REBOOT_UPDATE,          // firmware updated
+    REBOOT_TIMER,           // rebootSeconds expired
+    REBOOT_HEAP,            // heap degraded, see HeapHealth.h
+};
+
+void sync_and_restart(RebootReason reason = REBOOT_REQUEST);
+bool restore_warm_state();
+const char *last_reboot_reason();
 uint32_t read_int_from_file(const char *filename, uint32_t defaultValue = 0);
 void write_int_to_file(const char *filename, uint32_t *value);
 
@@ -13,18 +13,53 @@
 #include <tuple>
 #include <unordered_map>
 
+#ifndef DISABLE_WEB_UI
 #include "www/build/webcontent.h"
+#else
+// Headless build, no web UI assets. Just the MIME types the remaining handlers use.
+#include <Arduino.h>
+const char type_txt[] PROGMEM = "text/plain";
+const char type_html[] PROGMEM = "text/html";
+const char type_json[] PROGMEM = "application/json";
+#endif
+#ifdef LOG_TOKENIZED
+// Token database for this firmware, written by build_log_tokens.py
+#include "www/build/logtokens.h"
+#endif
 
 #include "ratgdo.h"
 #include "comms.h"
 #include "log.h"
 #include "web.h"
 #include "utilities.h"
+#include "CodeBudget.h"
+#include "CommandTrace.h"
+#include "HeapHealth.h"
+#include "WifiRoam.h"
+#include "SSEFilter.h"
+#include "TxBatch.h"
+#include "NotifyGate.h"
+#ifdef SHADOW_DECODE
+#include "ShadowDecode.h"
+#endif
+#ifdef VIRTUAL_OPENER
+#include "VirtualOpener.h"
+#endif
+#ifdef TIMER_UART_TX
+#include "TimerUart.h"
+#endif
+#if defined(MDNS_GUARD) && !defined(DISABLE_HOMEKIT)
+#include "MdnsGuard.h"
+#endif
+#include "homekit.h"
+#include "metrics.h"
 
 #ifdef ENABLE_CRASH_LOG
 #include "EspSaveCrash.h"
 #endif
+#ifndef DISABLE_HOMEKIT
 #include <arduino_homekit_server.h>
+#endif
 #include <ESP8266WebServer.h>
 #include <Ticker.h>
 #include <eboot_command.h>
@@ -51,11 +86,23 @@ void handle_reboot();
 void handle_status();
 void handle_everything();
 void handle_setgdo();
+#ifndef DISABLE_WEB_UI
 void handle_logout();
 void handle_auth();
-void handle_subscribe();
 void handle_showlog();
 void handle_showrebootlog();
+#endif
+void handle_subscribe();
+void handle_showtraces();
+#ifdef LOG_TOKENIZED
+void handle_logtokens();
+#endif
+#ifdef SHADOW_DECODE
+void handle_showshadow();
+#endif
+#ifdef VIRTUAL_OPENER
+void handle_vopener();
+#endif
 #ifdef ENABLE_CRASH_LOG
 void handle_crashlog();
 void handle_clearcrashlog();
@@ -80,10 +127,22 @@ const BuiltInUriMap builtInUri = {
     {"/reset", {HTTP_POST, handle_reset}},
     {"/reboot", {HTTP_POST, handle_reboot}},
     {"/setgdo", {HTTP_POST, handle_setgdo}},
+#ifndef DISABLE_WEB_UI
     {"/logout", {HTTP_GET, handle_logout}},
     {"/auth", {HTTP_GET, handle_auth}},
     {"/showlog", {HTTP_GET, handle_showlog}},
     {"/showrebootlog", {HTTP_GET, handle_showrebootlog}},
+#endif
+    {"/showtraces", {HTTP_GET, handle_showtraces}},
+#ifdef LOG_TOKENIZED
+    {"/logtokens.json", {HTTP_GET, handle_logtokens}},
+#endif
+#ifdef SHADOW_DECODE
+    {"/showshadow", {HTTP_GET, handle_showshadow}},
+#endif
+#ifdef VIRTUAL_OPENER
+    {"/vopener", {HTTP_POST, handle_vopener}},
+#endif
     {"/checkflash", {HTTP_GET, handle_checkflash}},
 #ifdef ENABLE_CRASH_LOG
     {"/crashlog", {HTTP_GET, handle_crashlog}},
@@ -113,6 +172,52 @@ extern uint8_t gdoSecurityType;
 
 // For time-to-close control
 extern uint8_t TTCdelay;
+
+// GDO serial receive and transmit counters
+extern uint32_t rx_bytes;
+extern uint32_t rx_errors;
+extern TxStats tx_stats;
+extern uint32_t tx_masked_max_us;
+extern NotifyGate notify_gate;
+#ifdef TIMER_UART_TX
+extern TimerUartTx tx_timer;
+#endif
+
+// Outbound rolling code budget
+extern CodeBudget code_budget;
+
+// Command latency tracing
+extern CommandTrace command_trace;
+
+#ifdef SHADOW_DECODE
+// Candidate parser compared with production, in comms.cpp
+extern ShadowCompare shadow;
+#endif
+
+#ifdef VIRTUAL_OPENER
+// Stands in for the garage door opener, in comms.cpp
+extern VirtualOpener virtual_opener;
+#endif
+
+#if defined(MDNS_GUARD) && !defined(DISABLE_HOMEKIT)
+// HomeKit mDNS responder, in mdns.cpp
+extern MdnsGuard mdns_guard;
+#endif
+
+// Loop timing, in ratgdo.cpp
+extern uint32_t loopTimeAvg;
+extern uint32_t loopTimeMax;
+
+// WiFi roaming and link quality
+extern WifiRoam wifi_roam;
+extern uint8_t wifiTxPower;
+
+// Restart when the heap degrades, or the reboot timer expires, once the door is idle
+extern uint8_t TTCcountdown;
+HeapHealth heap_health;
+uint32_t restartPendingSince = 0;
+#define RESTART_IDLE_MS 60000                      // door must have been still this long
+#define RESTART_OPEN_DOOR_MS (6 * 60 * 60 * 1000)  // then allow restart with the door open, stopped or unknown
 const char TTCdelay_file[] = "TTC_delay";
 
 // userid/password
@@ -172,17 +277,50 @@ struct SSESubscription
     bool SSEconnected;
     int SSEfailCount;
     String clientUUID;
-    bool logViewer;
+    uint8_t events;   // SSEEvent mask
+    uint16_t fields;  // status fields wanted, see SSEFilter.h
+    uint32_t bytesSaved;
 };
 SSESubscription subscription[SSE_MAX_CHANNELS];
+// bytes of event data written, and kept off the socket by subscriber filters
+uint32_t sseBytesSent = 0;
+uint32_t sseBytesSaved = 0;
 // During firmware update note which subscribed client is updating
 SSESubscription *firmwareUpdateSub = NULL;
 
 uint8_t subscriptionCount = 0;
 
-#define JSON_BUFFER_SIZE 1024
+// status.json is about 2300 bytes at most, with every optional feature built in
+#define JSON_BUFFER_SIZE 3072
 char *json = NULL;
 
+// Dotted quad on the stack, rather than a String on the heap. ip_str() is a temporary, so its
+// string is good until the end of the statement it is used in.
+struct IPStr
+{
+    char s[16];
+    explicit IPStr(const IPAddress &ip) { snprintf(s, sizeof(s), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]); }
+    const char *c_str() const { return s; }
+};
+#define ip_str(ip) IPStr(ip).c_str()
+
+// Append "key": value to a JSON buffer of JSON_BUFFER_SIZE, whole or not at all
+static void json_add(char *s, const char *key, const char *value, bool quote)
+{
+    char k[32];
+    strncpy_P(k, key, sizeof(k) - 1);
+    k[sizeof(k) - 1] = 0;
+    size_t len = strlen(s);
+    size_t room = JSON_BUFFER_SIZE - len;
+    const char *q = quote ? "\"" : "";
+    int n = snprintf(s + len, room, "\"%s\": %s%s%s,\n", k, q, value, q);
+    if (n < 0 || (size_t)n >= room)
+    {
+        s[len] = 0;
+        RERROR("JSON buffer full, %s left out", k);
+    }
+}
+
 #define START_JSON(s)     \
     {                     \
         s[0] = 0;         \
@@ -193,29 +331,17 @@ char *json = NULL;
         s[strlen(s) - 2] = 0; \
         strcat(s, "\n}");     \
     }
-#define ADD_INT(s, k, v)                      \
-    {                                         \
-        strcat(s, "\"");                      \
-        strcat_P(s, PSTR(k));                 \
-        strcat(s, "\": ");                    \
-        strcat(s, std::to_string(v).c_str()); \
-        strcat(s, ",\n");                     \
+#define ADD_INT(s, k, v)                                        \
+    {                                                           \
+        json_add(s, PSTR(k), std::to_string(v).c_str(), false); \
     }
-#define ADD_STR(s, k, v)      \
-    {                         \
-        strcat(s, "\"");      \
-        strcat_P(s, PSTR(k)); \
-        strcat(s, "\": \"");  \
-        strcat(s, (v));       \
-        strcat(s, "\",\n");   \
+#define ADD_STR(s, k, v)                 \
+    {                                    \
+        json_add(s, PSTR(k), (v), true); \
     }
-#define ADD_BOOL(s, k, v)                  \
-    {                                      \
-        strcat(s, "\"");                   \
-        strcat_P(s, PSTR(k));              \
-        strcat(s, "\": ");                 \
-        strcat(s, (v) ? "true" : "false"); \
-        strcat(s, ",\n");                  \
+#define ADD_BOOL(s, k, v)                                    \
+    {                                                        \
+        json_add(s, PSTR(k), (v) ? "true" : "false", false); \
     }
 #define ADD_BOOL_C(s, k, v, ov) \
     {                           \
@@ -244,6 +370,34 @@ char *json = NULL;
                                            : (s == 2)   ? "Jammed"  \
                                                         : "Unknown"
 
+// Allocation failures since boot, if the heap keeps count
+static uint32_t heap_oom_count()
+{
+#if defined(UMM_STATS) || defined(UMM_STATS_FULL)
+    return umm_get_oom_count();
+#else
+    return 0;
+#endif
+}
+
+// A restart now would go unnoticed: door closed and still for a while, nothing queued for the
+// opener, no time-to-close countdown and no firmware upload in progress. If the door is left open
+// or stopped, or we have never heard its state from the opener, give up waiting for it to close
+// after RESTART_OPEN_DOOR_MS.
+static bool safe_to_restart(unsigned long upTime)
+{
+    bool door_left = garage_door.current_state == CURR_OPEN || garage_door.current_state == CURR_STOPPED || !garage_door.active;
+    bool door_still = (garage_door.active && garage_door.current_state == CURR_CLOSED) ||
+                      (door_left && upTime - restartPendingSince > RESTART_OPEN_DOOR_MS);
+    return door_still &&
+           (upTime - lastDoorUpdateAt > RESTART_IDLE_MS) &&
+           !garage_door.motion &&
+           TTCcountdown == 0 &&
+           comms_idle() &&
+           firmwareUpdateSub == NULL &&
+           !Update.isRunning();
+}
+
 void web_loop()
 {
     unsigned long upTime = millis();
@@ -260,8 +414,11 @@ void web_loop()
     // Conditional macros, only add if value has changed
     ADD_BOOL_C(json, "paired", homekit_is_paired(), last_reported_paired);
     ADD_STR_C(json, "garageDoorState", DOOR_STATE(garage_door.current_state), garage_door.current_state, last_reported_garage_door.current_state);
-    ADD_STR_C(json, "garageLockState", LOCK_STATE(garage_door.current_lock), garage_door.current_lock, last_reported_garage_door.current_lock);
-    ADD_BOOL_C(json, "garageLightOn", garage_door.light, last_reported_garage_door.light);
+    // fields we are flipping ourselves are reported once they settle, see NotifyGate.h
+    if (!notify_gate.holding(NOTIFY_LOCK))
+        ADD_STR_C(json, "garageLockState", LOCK_STATE(garage_door.current_lock), garage_door.current_lock, last_reported_garage_door.current_lock);
+    if (!notify_gate.holding(NOTIFY_LIGHT))
+        ADD_BOOL_C(json, "garageLightOn", garage_door.light, last_reported_garage_door.light);
     ADD_BOOL_C(json, "garageMotion", garage_door.motion, last_reported_garage_door.motion);
     ADD_BOOL_C(json, "garageObstructed", garage_door.obstructed, last_reported_garage_door.obstructed);
     if (strlen(json) > 2)
@@ -272,13 +429,31 @@ void web_loop()
         REMOVE_NL(json);
         SSEBroadcastState(json);
     }
+    RebootReason restartReason = (RebootReason)0;
     if ((rebootSeconds != 0) && (rebootSeconds < millis() / 1000))
+        restartReason = REBOOT_TIMER;
+    else if (heap_health.degraded())
+        restartReason = REBOOT_HEAP;
+    if (restartReason)
     {
-        // Reboot the system if we have reached time...
-        RINFO("Rebooting system as %i seconds expired", rebootSeconds);
-        server.stop();
-        sync_and_restart();
-        return;
+        if (!restartPendingSince)
+        {
+            RINFO("Restart pending (%s), waiting for door to be idle", (restartReason == REBOOT_TIMER) ? "timer" : HeapHealth::to_string(heap_health.state()));
+            restartPendingSince = upTime ? upTime : 1;
+        }
+        if (safe_to_restart(upTime))
+        {
+            RINFO("Restarting while idle, pending for %lu seconds", (upTime - restartPendingSince) / 1000);
+            server.stop();
+            sync_and_restart(restartReason);
+            return;
+        }
+    }
+    else if (restartPendingSince)
+    {
+        // heap recovered, or the timer was turned off, before we got to restart
+        RINFO("Restart no longer pending");
+        restartPendingSince = 0;
     }
     server.handleClient();
 
@@ -288,6 +463,12 @@ void web_loop()
         min_heap = free_heap;
         RINFO("Free HEAP dropped to %d", min_heap);
     }
+
+    HeapState heap_state = heap_health.state();
+    if (heap_health.sample(upTime, free_heap, ESP.getMaxFreeBlockSize(), heap_oom_count()) && heap_health.state() != heap_state)
+    {
+        RINFO("Heap health: %s, free %lu, max block %lu", HeapHealth::to_string(heap_health.state()), free_heap, ESP.getMaxFreeBlockSize());
+    }
 }
 
 void setup_web()
@@ -362,6 +543,7 @@ void handle_notfound()
     server.send_P(404, type_txt, response404);
 }
 
+#ifndef DISABLE_WEB_UI
 void handle_auth()
 {
     if (passwordReq && !server.authenticateDigest(www_username, www_credentials))
@@ -371,6 +553,7 @@ void handle_auth()
     server.send_P(200, type_txt, PSTR("Authenticated"));
     return;
 }
+#endif
 
 void handle_reset()
 {
@@ -383,7 +566,7 @@ void handle_reset()
     server.client().setNoDelay(true);
     server.send_P(200, type_txt, PSTR("Device has been un-paired from HomeKit. Rebooting...\n"));
     server.stop();
-    sync_and_restart();
+    sync_and_restart(REBOOT_UNPAIR);
     return;
 }
 
@@ -406,6 +589,7 @@ void handle_checkflash()
     return;
 }
 
+#ifndef DISABLE_WEB_UI
 void load_page(const char *page)
 {
     if (webcontent.count(page) == 0)
@@ -470,34 +654,34 @@ void load_page(const char *page)
             server.sendHeader(F("ETag"), crc32);
         if (method == HTTP_HEAD)
         {
-            RINFO("Client %s requesting: %s (HTTP_HEAD, type: %s)", server.client().remoteIP().toString().c_str(), page, type);
+            RINFO("Client %s requesting: %s (HTTP_HEAD, type: %s)", ip_str(server.client().remoteIP()), page, type);
             server.send_P(200, type, "", 0);
         }
         else
         {
-            RINFO("Client %s requesting: %s (HTTP_GET, type: %s, length: %i)", server.client().remoteIP().toString().c_str(), page, type, length);
+            RINFO("Client %s requesting: %s (HTTP_GET, type: %s, length: %i)", ip_str(server.client().remoteIP()), page, type, length);
             server.send_P(200, type, data, length);
         }
 #endif
     }
     else
     {
-        RINFO("Sending 304 not modified to client %s requesting: %s (method: %s, type: %s)", server.client().remoteIP().toString().c_str(), page, http_methods[method], type);
+        RINFO("Sending 304 not modified to client %s requesting: %s (method: %s, type: %s)", ip_str(server.client().remoteIP()), page, http_methods[method], type);
         server.send_P(304, type, "", 0);
     }
     return;
 }
+#endif
 
 void handle_everything()
 {
     HTTPMethod method = server.method();
-    String page = server.uri();
-    const char *uri = page.c_str();
+    const char *uri = server.uri().c_str();
 
     if (builtInUri.count(uri) > 0)
     {
         // requested page matches one of our built-in handlers
-        RINFO("Client %s requesting: %s (method: %s)", server.client().remoteIP().toString().c_str(), uri, http_methods[method]);
+        RINFO("Client %s requesting: %s (method: %s)", ip_str(server.client().remoteIP()), uri, http_methods[method]);
         if (method == builtInUri.at(uri).first)
             return builtInUri.at(uri).second();
         else
@@ -513,14 +697,16 @@ void handle_everything()
         else
             return handle_notfound();
     }
+#ifndef DISABLE_WEB_UI
     else if (method == HTTP_GET || method == HTTP_HEAD)
     {
         // HTTP_GET that does not match a built-in handler
-        if (page == "/")
+        if (!strcmp(uri, "/"))
             return load_page("/index.html");
         else
             return load_page(uri);
     }
+#endif
     // it is a HTTP_POST for unknown URI
     return handle_notfound();
 }
@@ -529,10 +715,14 @@ void handle_status()
 {
     unsigned long upTime = millis();
 #define paired homekit_is_paired()
+#ifndef DISABLE_HOMEKIT
 #define accessoryID (arduino_homekit_get_running_server() ? arduino_homekit_get_running_server()->accessory_id : "Inactive")
-#define IPaddr WiFi.localIP().toString().c_str()
-#define subnetMask WiFi.subnetMask().toString().c_str()
-#define gatewayIP WiFi.gatewayIP().toString().c_str()
+#else
+#define accessoryID "Disabled"
+#endif
+#define IPaddr ip_str(WiFi.localIP())
+#define subnetMask ip_str(WiFi.subnetMask())
+#define gatewayIP ip_str(WiFi.gatewayIP())
 #define macAddress WiFi.macAddress().c_str()
 #define wifiSSID WiFi.SSID().c_str()
 #define GDOSecurityType std::to_string(gdoSecurityType).c_str()
@@ -541,7 +731,7 @@ void handle_status()
     ADD_INT(json, "upTime", upTime);
     ADD_STR(json, "deviceName", device_name);
     ADD_BOOL(json, "paired", paired);
-    ADD_STR(json, "firmwareVersion", std::string(AUTO_VERSION).c_str());
+    ADD_STR(json, "firmwareVersion", AUTO_VERSION);
     ADD_STR(json, "accessoryID", accessoryID);
     ADD_STR(json, "localIP", IPaddr);
     ADD_STR(json, "subnetMask", subnetMask);
@@ -557,19 +747,77 @@ void handle_status()
     ADD_BOOL(json, "garageObstructed", garage_door.obstructed);
     ADD_BOOL(json, "passwordRequired", passwordReq);
     ADD_INT(json, "rebootSeconds", rebootSeconds);
+    ADD_STR(json, "lastRebootReason", last_reboot_reason());
+    ADD_STR(json, "heapHealth", HeapHealth::to_string(heap_health.state()));
     uint32_t free_heap = system_get_free_heap_size();
     if (free_heap < min_heap)
         min_heap = free_heap;
     ADD_INT(json, "freeHeap", free_heap);
     ADD_INT(json, "minHeap", min_heap);
+#ifdef SHADOW_DECODE
+    ADD_INT(json, "shadowFrames", shadow.frames);
+    ADD_INT(json, "shadowDisagreements", shadow.disagreements);
+    ADD_INT(json, "shadowProductionCycles", shadow.production_per_byte());
+    ADD_INT(json, "shadowCandidateCycles", shadow.candidate_per_byte());
+#endif
+#ifdef VIRTUAL_OPENER
+    ADD_INT(json, "vopenerPacketsRx", virtual_opener.packets_rx);
+    ADD_INT(json, "vopenerPacketsTx", virtual_opener.packets_tx);
+    ADD_INT(json, "vopenerOverruns", virtual_opener.overruns);
+#endif
     ADD_INT(json, "minStack", ESP.getFreeContStack());
     ADD_INT(json, "crashCount", crashCount);
     ADD_INT(json, "wifiPhyMode", wifiPhyMode);
     ADD_INT(json, "wifiPower", wifiPower);
+    ADD_STR(json, "wifiBSSID", WiFi.BSSIDstr().c_str());
+    ADD_STR(json, "wifiRSSIAverage", (std::to_string(wifi_roam.rssi()) + " dBm").c_str());
+    ADD_INT(json, "wifiTxPower", wifiTxPower);
+    ADD_INT(json, "wifiRoams", wifi_roam.roams);
+    ADD_INT(json, "wifiRoamFailures", wifi_roam.roam_failures);
+    ADD_INT(json, "wifiScans", wifi_roam.scans);
+    ADD_INT(json, "wifiLinkErrors", wifi_roam.link_errors);
+    ADD_INT(json, "sseBytesSent", sseBytesSent);
+    ADD_INT(json, "sseBytesSaved", sseBytesSaved);
     ADD_INT(json, "TTCseconds", TTCdelay);
+    ADD_INT(json, "rxBytes", rx_bytes);
+    ADD_INT(json, "rxErrors", rx_errors);
+    ADD_INT(json, "txClaims", tx_stats.claims);
+    ADD_INT(json, "txCollisions", tx_stats.collisions);
+    ADD_INT(json, "txPackets", tx_stats.packets);
+    ADD_INT(json, "txBatches", tx_stats.batches);
+    ADD_INT(json, "txMaskedMaxUs", tx_masked_max_us);
+#ifdef TIMER_UART_TX
+    ADD_INT(json, "txLateMaxUs", tx_timer.late_max / ESP.getCpuFreqMHz());
+    ADD_INT(json, "txMissedBits", tx_timer.missed);
+#endif
+    ADD_INT(json, "notifyHeld", notify_gate.held);
+    ADD_INT(json, "notifyHeldLast", notify_gate.last_held);
+    ADD_INT(json, "notifyReconciled", notify_gate.reconciled);
+#if defined(MDNS_GUARD) && !defined(DISABLE_HOMEKIT)
+    ADD_INT(json, "mdnsQueries", mdns_guard.queries);
+    ADD_INT(json, "mdnsAnswered", mdns_guard.answered);
+    ADD_INT(json, "mdnsSuppressed", mdns_guard.suppressed());
+    ADD_INT(json, "mdnsRebuilds", mdns_guard.rebuilds);
+#endif
+#ifdef STATSD
+    ADD_STR(json, "statsdServer", metrics_server());
+    ADD_INT(json, "statsdInterval", metrics_interval());
+    ADD_INT(json, "statsdPackets", metrics_packets());
+    ADD_INT(json, "statsdErrors", metrics_errors());
+#endif
+    if (gdoSecurityType == 2) {
+        ADD_INT(json, "rollingCodesPerHour", code_budget.codes_per_hour(millis()));
+        ADD_INT(json, "flashWritesPerDay", code_budget.flash_writes_per_day(millis(), MAX_CODES_WITHOUT_FLASH_WRITE));
+        ADD_INT(json, "rollingCodesDropped", code_budget.dropped);
+    }
     // We send milliseconds relative to current time... ie updated X milliseconds ago
     ADD_INT(json, "lastDoorUpdateAt", (upTime - lastDoorUpdateAt));
     ADD_BOOL(json, "checkFlashCRC", flashCRC);
+    ADD_STR(json, "buildProfile", BUILD_PROFILE);
+    ADD_INT(json, "sketchSize", ESP.getSketchSize());
+    ADD_INT(json, "freeSketchSpace", ESP.getFreeSketchSpace());
+    ADD_INT(json, "loopTimeAvg", loopTimeAvg);
+    ADD_INT(json, "loopTimeMax", loopTimeMax);
     END_JSON(json);
 
     // send JSON straight to serial port
@@ -582,11 +830,13 @@ void handle_status()
     return;
 }
 
+#ifndef DISABLE_WEB_UI
 void handle_logout()
 {
     RINFO("Handle logout");
     return server.requestAuthentication(DIGEST_AUTH, www_realm);
 }
+#endif
 
 void handle_setgdo()
 {
@@ -618,10 +868,12 @@ void handle_setgdo()
         // Check against each known setting
         if (!strcmp(key, "garageLightOn"))
         {
+            CommandTraceScope trace(command_trace, TraceOrigin::Web, millis());
             set_light(!strcmp(value, "1") ? true : false);
         }
         else if (!strcmp(key, "garageDoorState"))
         {
+            CommandTraceScope trace(command_trace, TraceOrigin::Web, millis());
             if (!strcmp(value, "1"))
                 open_door();
             else
@@ -629,6 +881,7 @@ void handle_setgdo()
         }
         else if (!strcmp(key, "garageLockState"))
         {
+            CommandTraceScope trace(command_trace, TraceOrigin::Web, millis());
             set_lock(!strcmp(value, "1") ? 1 : 0);
         }
         else if (!strcmp(key, "credentials"))
@@ -707,6 +960,16 @@ void handle_setgdo()
             TTCdelay = (uint8_t)seconds;
             write_int_to_file(TTCdelay_file, &seconds);
         }
+#ifdef STATSD
+        else if (!strcmp(key, "statsdServer"))
+        {
+            error = !metrics_set_server(value);
+        }
+        else if (!strcmp(key, "statsdInterval"))
+        {
+            metrics_set_interval(atoi(value));
+        }
+#endif
         else if (!strcmp(key, "updateUnderway"))
         {
             firmwareSize = 0;
@@ -771,7 +1034,7 @@ void handle_setgdo()
     {
         RINFO("SetGDO Restart required");
         server.stop();
-        sync_and_restart();
+        sync_and_restart(REBOOT_SETTINGS);
     }
     return;
 }
@@ -808,7 +1071,12 @@ void SSEheartbeat(SSESubscription *s)
         return;
     }
 
-    if (s->client.connected())
+    if (s->client.connected() && !(s->events & SSE_EVENT_HEARTBEAT))
+    {
+        // not wanted, but write something so we notice when the client goes away
+        s->client.print(F(":\n\n"));
+    }
+    else if (s->client.connected())
     {
         START_JSON(json);
         ADD_INT(json, "upTime", millis());
@@ -823,7 +1091,7 @@ void SSEheartbeat(SSESubscription *s)
     else
     {
         subscriptionCount--;
-        RINFO("Client %s not listening, remove SSE subscription. Total subscribed: %d", s->clientIP.toString().c_str(), subscriptionCount);
+        RINFO("Client %s not listening, remove SSE subscription. Bytes saved by filters: %lu, Total subscribed: %d", s->clientIP.toString().c_str(), (unsigned long)s->bytesSaved, subscriptionCount);
         s->heartbeatTimer.detach();
         s->client.flush();
         s->client.stop();
@@ -845,7 +1113,7 @@ void SSEHandler(uint8_t channel)
     SSESubscription &s = subscription[channel];
     if (s.clientUUID != server.arg(0))
     {
-        RINFO("Client %s with IP %s tries to listen for SSE but not subscribed", server.arg(0).c_str(), client.remoteIP().toString().c_str());
+        RINFO("Client %s with IP %s tries to listen for SSE but not subscribed", server.arg(0).c_str(), ip_str(client.remoteIP()));
         return handle_notfound();
     }
     client.setNoDelay(true);
@@ -862,21 +1130,20 @@ void SSEHandler(uint8_t channel)
     s.SSEfailCount = 0;
     s.heartbeatTimer.attach_scheduled(1.0, [channel, &s]
                                       { SSEheartbeat(&s); });
-    RINFO("Client %s listening for SSE events on channel %d", client.remoteIP().toString().c_str(), channel);
+    RINFO("Client %s listening for SSE events on channel %d", ip_str(client.remoteIP()), channel);
 }
 
 void handle_subscribe()
 {
     uint8_t channel;
     IPAddress clientIP = server.client().remoteIP(); // get IP address of client
-    String SSEurl = "/rest/events/";
 
     if (subscriptionCount == SSE_MAX_CHANNELS)
     {
-        RINFO("Client %s SSE Subscription declined, subscription count: %d", clientIP.toString().c_str(), subscriptionCount);
+        RINFO("Client %s SSE Subscription declined, subscription count: %d", ip_str(clientIP), subscriptionCount);
         for (channel = 0; channel < SSE_MAX_CHANNELS; channel++)
         {
-            RINFO("Client %d: %s at %s", channel, subscription[channel].clientUUID.c_str(), subscription[channel].clientIP.toString().c_str());
+            RINFO("Client %d: %s at %s", channel, subscription[channel].clientUUID.c_str(), ip_str(subscription[channel].clientIP));
         }
         return handle_notfound(); // We ran out of channels
     }
@@ -896,15 +1163,20 @@ void handle_subscribe()
         return;
     }
 
-    // find the UUID and whether client wants to receive log messages
+    // find the UUID and which events and status fields the client wants
     int id = 0;
-    bool logViewer = false;
+    uint8_t events = SSE_EVENT_STATUS | SSE_EVENT_HEARTBEAT | SSE_EVENT_UPLOAD;
+    uint16_t fields = SSE_FIELDS_ALL;
     for (int i = 0; i < server.args(); i++)
     {
         if (server.argName(i) == "id")
             id = i;
         else if (server.argName(i) == "log")
-            logViewer = true;
+            events |= SSE_EVENT_LOG;
+        else if (server.argName(i) == "events")
+            events = SSEFilter::parse_events(server.arg(i).c_str());
+        else if (server.argName(i) == "fields")
+            fields = SSEFilter::parse_fields(server.arg(i).c_str()) | SSE_FIELD_UPTIME;
     }
 
     // check if we already have a subscription for this UUID
@@ -915,7 +1187,7 @@ void handle_subscribe()
             if (subscription[channel].SSEconnected)
             {
                 // Already connected.  We need to close it down as client will be reconnecting
-                RINFO("SSE Subscribe - client %s with IP %s already connected on channel %d, remove subscription", server.arg(id).c_str(), clientIP.toString().c_str(), channel);
+                RINFO("SSE Subscribe - client %s with IP %s already connected on channel %d, remove subscription", server.arg(id).c_str(), ip_str(clientIP), channel);
                 subscription[channel].heartbeatTimer.detach();
                 subscription[channel].client.flush();
                 subscription[channel].client.stop();
@@ -923,7 +1195,7 @@ void handle_subscribe()
             else
             {
                 // Subscribed but not connected yet, so nothing to close down.
-                RINFO("SSE Subscribe - client %s with IP %s already subscribed but not connected on channel %d", server.arg(id).c_str(), clientIP.toString().c_str(), channel);
+                RINFO("SSE Subscribe - client %s with IP %s already subscribed but not connected on channel %d", server.arg(id).c_str(), ip_str(clientIP), channel);
             }
             break;
         }
@@ -937,11 +1209,12 @@ void handle_subscribe()
             if (!subscription[channel].clientIP)
                 break;
     }
-    subscription[channel] = {clientIP, server.client(), Ticker(), false, 0, server.arg(id), logViewer};
-    SSEurl += channel;
-    RINFO("SSE Subscription for client %s with IP %s: event bus location: %s, Total subscribed: %d", server.arg(id).c_str(), clientIP.toString().c_str(), SSEurl.c_str(), subscriptionCount);
+    subscription[channel] = {clientIP, server.client(), Ticker(), false, 0, server.arg(id), events, fields, 0};
+    char SSEurl[24];
+    snprintf(SSEurl, sizeof(SSEurl), "/rest/events/%u", channel);
+    RINFO("SSE Subscription for client %s with IP %s: event bus location: %s, events: 0x%02X, fields: 0x%04X, Total subscribed: %d", server.arg(id).c_str(), ip_str(clientIP), SSEurl, events, fields, subscriptionCount);
     server.sendHeader(F("Cache-Control"), F("no-cache, no-store"));
-    server.send_P(200, type_txt, SSEurl.c_str());
+    server.send_P(200, type_txt, SSEurl);
 }
 
 #ifdef ENABLE_CRASH_LOG
@@ -959,6 +1232,7 @@ void handle_crashlog()
 }
 #endif
 
+#ifndef DISABLE_WEB_UI
 void handle_showlog()
 {
     WiFiClient client = server.client();
@@ -980,6 +1254,87 @@ void handle_showrebootlog()
 #endif
     client.stop();
 }
+#endif
+
+#ifdef LOG_TOKENIZED
+void handle_logtokens()
+{
+    server.sendHeader(F("Content-Encoding"), F("gzip"));
+    server.send_P(200, type_json, (const char *)logtokens_json_gz, logtokens_json_gz_len);
+}
+#endif
+
+void handle_showtraces()
+{
+    WiFiClient client = server.client();
+    client.print(response200);
+    client.print("Hop latency ms (p50 p90 p99):\n");
+    for (uint8_t hop = 0; hop <= TRACE_HOPS; hop++)
+    {
+        client.printf("%-9s %5u %5u %5u\n", CommandTrace::hop_name(hop), command_trace.percentile(hop, 50),
+                      command_trace.percentile(hop, 90), command_trace.percentile(hop, 99));
+    }
+    client.print("\nRecent commands, ms after start:\n");
+    char buf[160];
+    const CommandTraceRecord *t;
+    for (uint8_t i = 0; (t = command_trace.recent(i)) != nullptr; i++)
+    {
+        CommandTrace::to_string(t, buf, sizeof(buf));
+        client.println(buf);
+    }
+    client.stop();
+}
+
+#ifdef SHADOW_DECODE
+void handle_showshadow()
+{
+    WiFiClient client = server.client();
+    client.print(response200);
+    client.printf("%u bytes, %u frames compared, %u disagreements\n", shadow.bytes, shadow.frames, shadow.disagreements);
+    client.printf("Cycles per byte: production %u, candidate %u\n", shadow.production_per_byte(), shadow.candidate_per_byte());
+    client.print("\nRecent disagreements:\n");
+    char buf[200];
+    const ShadowRecord *r;
+    for (uint8_t i = 0; (r = shadow.recent(i)) != nullptr; i++)
+    {
+        ShadowCompare::to_string(r, buf, sizeof(buf));
+        client.println(buf);
+    }
+    client.stop();
+}
+#endif
+
+#ifdef VIRTUAL_OPENER
+// The world outside the virtual opener: action=door|light|lock|motion|obstruct|clear
+void handle_vopener()
+{
+    if (passwordReq && !server.authenticateDigest(www_username, www_credentials))
+    {
+        return server.requestAuthentication(DIGEST_AUTH, www_realm);
+    }
+    String action = server.arg("action");
+    uint32_t now = millis();
+    if (action == "door")
+        virtual_opener.door_button(now);
+    else if (action == "light")
+        virtual_opener.light_button(now);
+    else if (action == "lock")
+        virtual_opener.lock_button(now);
+    else if (action == "motion")
+        virtual_opener.motion(now);
+    else if (action == "obstruct")
+        virtual_opener.obstruct(now, true);
+    else if (action == "clear")
+        virtual_opener.obstruct(now, false);
+    else
+    {
+        server.send_P(400, type_txt, response400invalid);
+        return;
+    }
+    RINFO("Virtual opener: %s", action.c_str());
+    server.send_P(200, type_txt, PSTR("Done\n"));
+}
+#endif
 
 #ifdef ENABLE_CRASH_LOG
 void handle_clearcrashlog()
@@ -1022,22 +1377,45 @@ void SSEBroadcastState(const char *data, BroadcastType type)
     if (subscriptionCount == 0)
         return;
 
+    uint8_t event = (type == LOG_MESSAGE) ? SSE_EVENT_LOG : SSE_EVENT_STATUS;
+    uint16_t present = (type == RATGDO_STATUS) ? SSEFilter::frame_fields(data) : 0;
+    size_t len = strlen(data);
+    char trimmed[256];
     for (uint8_t i = 0; i < SSE_MAX_CHANNELS; i++)
     {
-        if (subscription[i].SSEconnected && subscription[i].client.connected())
+        SSESubscription &s = subscription[i];
+        if (s.SSEconnected && s.client.connected())
         {
+            // filter before formatting anything for this subscriber
+            if (!(s.events & event) || (type == RATGDO_STATUS && !SSEFilter::wants(present, s.fields)))
+            {
+                s.bytesSaved += len;
+                sseBytesSaved += len;
+                continue;
+            }
             if (type == LOG_MESSAGE)
             {
-                if (subscription[i].logViewer)
-                {
-                    subscription[i].client.printf_P(PSTR("event: logger\ndata: %s\n\n"), data);
-                }
+                s.client.printf_P(PSTR("event: logger\ndata: %s\n\n"), data);
+                sseBytesSent += len;
             }
             else if (type == RATGDO_STATUS)
             {
-                String IPaddrstr = IPAddress(subscription[i].clientIP).toString();
-                RINFO("SSE send to client %s on channel %d, data: %s", IPaddrstr.c_str(), i, data);
-                subscription[i].client.printf_P(PSTR("event: message\ndata: %s\n\n"), data);
+                const char *frame = data;
+                size_t frameLen = len;
+                if (present & ~s.fields)
+                {
+                    size_t n = SSEFilter::trim(data, s.fields, trimmed, sizeof(trimmed));
+                    if (n)
+                    {
+                        frame = trimmed;
+                        frameLen = n;
+                        s.bytesSaved += len - n;
+                        sseBytesSaved += len - n;
+                    }
+                }
+                RINFO("SSE send to client %s on channel %d, data: %s", ip_str(s.clientIP), i, frame);
+                s.client.printf_P(PSTR("event: message\ndata: %s\n\n"), frame);
+                sseBytesSent += frameLen;
             }
         }
     }
@@ -1119,7 +1497,7 @@ void handle_update()
         // Legacy... no query string args, so automatically reboot...
         server.send_P(200, type_txt, PSTR("Upload Success. Rebooting...\n"));
         server.stop();
-        sync_and_restart();
+        sync_and_restart(REBOOT_UPDATE);
     }
 }
 
@@ -1201,7 +1579,7 @@ void handle_firmware_upload()
                 SSEheartbeat(firmwareUpdateSub); // keep SSE connection alive.
                 nextPrintPercent += 10;
                 // Report percentage to browser client if it is listening
-                if (firmwareUpdateSub && firmwareUpdateSub->client.connected())
+                if (firmwareUpdateSub && (firmwareUpdateSub->events & SSE_EVENT_UPLOAD) && firmwareUpdateSub->client.connected())
                 {
                     START_JSON(json);
                     ADD_INT(json, "uploadPercent", uploadPercent);
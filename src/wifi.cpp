@@ -19,11 +19,17 @@
 // #elif defined(ESP32)
 // #include <WiFi.h>
 // #endif
-#include "improv.h"
 #include <Arduino.h>
+#include <Updater.h>
 #include "ratgdo.h"
+#include "comms.h"
 #include "log.h"
 #include "utilities.h"
+#include "WifiRoam.h"
+#ifdef ADAPTIVE_TX_POWER
+#include <lwip/priv/tcp_priv.h>
+#endif
+#include "ImprovCodec.h"
 
 // support for changeing WiFi settings
 extern WiFiPhyMode_t wifiPhyMode;
@@ -34,29 +40,61 @@ unsigned long wifiConnectTimeout = 0;
 extern uint16_t wifiPower;
 extern "C" const char wifiPowerFile[];
 
+// background roaming and adaptive transmit power
+WifiRoam wifi_roam;
+uint8_t wifiTxPower = 20;           // dBm, as configured or set by ADAPTIVE_TX_POWER
+static bool roamScanning = false;
+static unsigned long roamStartedAt = 0;
+static bool roamPinned = false;     // station config is pinned to the BSSID we roamed to
+static char roamSSID[33];
+extern struct GarageDoor garage_door;
+
 #define MAX_ATTEMPTS_WIFI_CONNECTION 20
-uint8_t x_buffer[128];
-uint8_t x_position = 0;
+#define MAX_IMPROV_NETWORKS 32
+ImprovDecoder improv_rx;
 
-void set_error(improv::Error error);
-void send_response(std::vector<uint8_t> &response);
-void set_state(improv::State state);
+void set_error(ImprovError error);
+void set_state(ImprovState state);
+void send_local_url(ImprovCommand command);
 void get_available_wifi_networks();
-bool on_command_callback(improv::ImprovCommand cmd);
-void on_error_callback(improv::Error err);
+void on_improv_command();
 
 WiFiEventHandler connectedHandler;
 WiFiEventHandler disconnectedHandler;
 WiFiEventHandler gotIPHandler;
 WiFiEventHandler dhcpTimeoutHandler;
 
+// The raw scan results, so we don't need a String per SSID
+struct WiFiScanInfo : ESP8266WiFiScanClass {
+    static bss_info *at(int i) { return (bss_info *)_getScanInfoByIndex(i); }
+};
+
+// Let the SDK reconnect to any AP for the SSID again, not just the one we roamed to
+static void unpin_bssid() {
+  struct station_config conf;
+  wifi_station_get_config(&conf);
+  conf.bssid_set = 0;
+  wifi_station_set_config_current(&conf);
+  roamPinned = false;
+}
+
 void onConnected(const WiFiEventStationModeConnected& evt) {
-  RINFO("WiFi connected SSID: %s, Channel: %d", evt.ssid.c_str(), evt.channel);
+  RINFO("WiFi connected SSID: %s, BSSID: %02x:%02x:%02x:%02x:%02x:%02x, Channel: %d", evt.ssid.c_str(),
+        evt.bssid[0], evt.bssid[1], evt.bssid[2], evt.bssid[3], evt.bssid[4], evt.bssid[5], evt.channel);
+  wifi_roam.connected(millis(), wifiTxPower);
 }
 
 void onDisconnected(const WiFiEventStationModeDisconnected& evt) {
   RINFO("WiFi disconnected SSID: %s, BSSID: %02x:%02x:%02x:%02x:%02x:%02x, Reason: %d", evt.ssid.c_str(), 
         evt.bssid[0], evt.bssid[1], evt.bssid[2], evt.bssid[3], evt.bssid[4], evt.bssid[5], evt.reason);
+  if (roamStartedAt) {
+      // leaving the old AP while roaming
+      return;
+  }
+  wifi_roam.link_error();
+  if (roamPinned) {
+      unpin_bssid();
+  }
 }
 
 void onGotIP(const WiFiEventStationModeGotIP& evt) {
@@ -96,6 +134,7 @@ void wifi_connect() {
         RINFO("Setting WiFi power to %d", wifiPower);
         WiFi.setOutputPower((float)wifiPower);
     }
+    wifiTxPower = (wifiPower < 20) ? wifiPower : 20;
     WiFi.setAutoReconnect(true); // don't require explicit attempts to reconnect in the main loop
 
     // Set callbacks so we can monitor connection status
@@ -111,12 +150,16 @@ void wifi_connect() {
 
 void improv_loop() {
     if (Serial.available() > 0) {
-        uint8_t b = Serial.read();
-
-        if (parse_improv_serial_byte(x_position, b, x_buffer, on_command_callback, on_error_callback)) {
-            x_buffer[x_position++] = b;
-        } else {
-            x_position = 0;
+        switch (improv_rx.push_byte(Serial.read())) {
+            case ImprovResult::Command:
+                on_improv_command();
+                break;
+            case ImprovResult::Error:
+                RERROR("improv error: %02X", improv_rx.error());
+                set_error(improv_rx.error());
+                break;
+            default:
+                break;
         }
     }
 
@@ -142,11 +185,118 @@ void improv_loop() {
     }
 }
 
-bool connect_wifi(std::string ssid, std::string password) {
+#ifdef ADAPTIVE_TX_POWER
+// How the AP hears us, from our TCP connections: segments sent and not yet acked, and whether any
+// of them had to be retransmitted
+static void tcp_uplink(bool *traffic, bool *retransmitting) {
+    *traffic = false;
+    *retransmitting = false;
+    for (struct tcp_pcb *pcb = tcp_active_pcbs; pcb; pcb = pcb->next) {
+        if (pcb->unacked) {
+            *traffic = true;
+        }
+        if (pcb->nrtx) {
+            *retransmitting = true;
+        }
+    }
+}
+#endif
+
+// Only scan when nothing time critical is going on, a scan takes the radio off channel
+static bool wifi_idle() {
+    return comms_idle() &&
+           (garage_door.current_state == CURR_OPEN || garage_door.current_state == CURR_CLOSED ||
+            garage_door.current_state == CURR_STOPPED) &&
+           !Update.isRunning();
+}
+
+void wifi_loop() {
+    unsigned long now = millis();
+
+    if (roamStartedAt) {
+        if (WiFi.status() == WL_CONNECTED) {
+            RINFO("WiFi roamed to %s, RSSI %d dBm", WiFi.BSSIDstr().c_str(), WiFi.RSSI());
+            roamStartedAt = 0;
+        }
+        else if (now - roamStartedAt > ROAM_CONNECT_TIMEOUT) {
+            RERROR("WiFi roam did not connect, reconnecting to any AP");
+            wifi_roam.roam_failed();
+            roamStartedAt = 0;
+            unpin_bssid();
+            WiFi.begin();
+        }
+        return;
+    }
+
+    if (WiFi.status() != WL_CONNECTED || wifiSettingsChanged) {
+        return;
+    }
+
+    if (wifi_roam.sample(now, WiFi.RSSI())) {
+#ifdef ADAPTIVE_TX_POWER
+        bool traffic, retransmitting;
+        tcp_uplink(&traffic, &retransmitting);
+        wifi_roam.uplink(traffic, retransmitting);
+#endif
+    }
+#ifdef ADAPTIVE_TX_POWER
+    uint8_t power = wifi_roam.tx_power(now, (wifiPower < 20) ? wifiPower : 20);
+    if (power != wifiTxPower) {
+        RINFO("WiFi RSSI %d dBm, setting WiFi power to %d", wifi_roam.rssi(), power);
+        wifiTxPower = power;
+        // 20 is the maximum in the settings, the radio itself goes to 20.5
+        WiFi.setOutputPower((power >= 20) ? 20.5 : (float)power);
+    }
+#endif
+
+    if (roamScanning) {
+        int8_t n = WiFi.scanComplete();
+        if (n == WIFI_SCAN_RUNNING) {
+            return;
+        }
+        roamScanning = false;
+        if (n < 0) {
+            return;
+        }
+        uint8_t current[6];
+        memcpy(current, WiFi.BSSID(), sizeof(current));
+        size_t ssidLen = strlen(roamSSID);
+        for (int8_t i = 0; i < n; i++) {
+            bss_info *info = WiFiScanInfo::at(i);
+            if (info && strnlen((const char *)info->ssid, info->ssid_len) == ssidLen && !memcmp(info->ssid, roamSSID, ssidLen)) {
+                wifi_roam.scan_result(current, info->bssid, info->channel, info->rssi);
+            }
+        }
+        WiFi.scanDelete();
+
+        const RoamCandidate *target = wifi_roam.roam_target(now);
+        if (target) {
+            RINFO("WiFi roaming from %s (%d dBm) to %02x:%02x:%02x:%02x:%02x:%02x (%d dBm) on channel %d",
+                  WiFi.BSSIDstr().c_str(), wifi_roam.rssi(), target->bssid[0], target->bssid[1],
+                  target->bssid[2], target->bssid[3], target->bssid[4], target->bssid[5], target->rssi,
+                  target->channel);
+            wifi_roam.roam_started(now);
+            roamStartedAt = now;
+            roamPinned = true;
+            WiFi.begin(roamSSID, WiFi.psk().c_str(), target->channel, target->bssid);
+        }
+        return;
+    }
+
+    if (wifi_roam.scan_due(now) && wifi_idle()) {
+        // only our own SSID, so the scan is short
+        strlcpy(roamSSID, WiFi.SSID().c_str(), sizeof(roamSSID));
+        wifi_roam.scan_started(now);
+        roamScanning = true;
+        WiFi.scanNetworks(true, false, 0, (uint8_t *)roamSSID);
+    }
+}
+
+bool connect_wifi(const char *ssid, const char *password) {
     uint8_t count = 0;
 
     WiFi.persistent(true); // Set persist to store wifi credentials
-    WiFi.begin(ssid.c_str(), password.c_str());
+    WiFi.begin(ssid, password);
     WiFi.persistent(false);  // clear the persist flag so other settings do not get written to flash
 
     while (WiFi.status() != WL_CONNECTED) {
@@ -163,176 +313,130 @@ bool connect_wifi(std::string ssid, std::string password) {
     return true;
 }
 
-std::vector<std::string> get_local_url() {
-    return {
-        // TODO
-        // URL where user can finish onboarding or use device
-        // Recommended to use website hosted by device
-        String("http://" + WiFi.localIP().toString()).c_str()
-    };
+void send_frame(const ImprovEncoder &frame) {
+    if (frame.size()) {
+        Serial.write(frame.data(), frame.size());
+    }
 }
 
-void on_error_callback(improv::Error err) {
-    RERROR("improv error: %02X", err);
+// URL where user can finish onboarding or use device
+void send_local_url(ImprovCommand command) {
+    char url[24];
+    IPAddress ip = WiFi.localIP();
+    snprintf(url, sizeof(url), "http://%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+    ImprovEncoder frame;
+    frame.rpc_begin(command);
+    frame.rpc_string(url);
+    frame.rpc_end();
+    send_frame(frame);
 }
 
-bool on_command_callback(improv::ImprovCommand cmd) {
+void on_improv_command() {
 
-    switch (cmd.command) {
-        case improv::Command::GET_CURRENT_STATE:
+    switch (improv_rx.command()) {
+        case IMPROV_CMD_GET_CURRENT_STATE:
             {
                 if ((WiFi.status() == WL_CONNECTED)) {
-                    set_state(improv::State::STATE_PROVISIONED);
-                    std::vector<uint8_t> data = improv::build_rpc_response(improv::GET_CURRENT_STATE, get_local_url(), false);
-                    send_response(data);
+                    set_state(IMPROV_STATE_PROVISIONED);
+                    send_local_url(IMPROV_CMD_GET_CURRENT_STATE);
 
                 } else {
-                    set_state(improv::State::STATE_AUTHORIZED);
+                    set_state(IMPROV_STATE_AUTHORIZED);
                 }
 
                 break;
             }
 
-        case improv::Command::WIFI_SETTINGS:
+        case IMPROV_CMD_WIFI_SETTINGS:
             {
-                if (cmd.ssid.length() == 0) {
-                    set_error(improv::Error::ERROR_INVALID_RPC);
+                if (improv_rx.ssid()[0] == 0) {
+                    set_error(IMPROV_ERROR_INVALID_RPC);
                     break;
                 }
 
-                set_state(improv::STATE_PROVISIONING);
+                set_state(IMPROV_STATE_PROVISIONING);
 
-                if (connect_wifi(cmd.ssid, cmd.password)) {
-                    set_state(improv::STATE_PROVISIONED);
-                    std::vector<uint8_t> data = improv::build_rpc_response(improv::WIFI_SETTINGS, get_local_url(), false);
-                    send_response(data);
+                if (connect_wifi(improv_rx.ssid(), improv_rx.password())) {
+                    set_state(IMPROV_STATE_PROVISIONED);
+                    send_local_url(IMPROV_CMD_WIFI_SETTINGS);
 
                 } else {
-                    set_state(improv::STATE_STOPPED);
-                    set_error(improv::Error::ERROR_UNABLE_TO_CONNECT);
+                    set_state(IMPROV_STATE_STOPPED);
+                    set_error(IMPROV_ERROR_UNABLE_TO_CONNECT);
                 }
 
                 break;
             }
 
-        case improv::Command::GET_DEVICE_INFO:
+        case IMPROV_CMD_GET_DEVICE_INFO:
             {
-                std::vector<std::string> infos = {
-                    DEVICE_NAME,
-                    AUTO_VERSION,
-                    CHIP_FAMILY,
-                    MODEL_NAME
-                };
-                std::vector<uint8_t> data = improv::build_rpc_response(improv::GET_DEVICE_INFO, infos, false);
-                send_response(data);
+                ImprovEncoder frame;
+                frame.rpc_begin(IMPROV_CMD_GET_DEVICE_INFO);
+                frame.rpc_string(DEVICE_NAME);
+                frame.rpc_string(AUTO_VERSION);
+                frame.rpc_string(CHIP_FAMILY);
+                frame.rpc_string(MODEL_NAME);
+                frame.rpc_end();
+                send_frame(frame);
                 break;
             }
 
-        case improv::Command::GET_WIFI_NETWORKS:
+        case IMPROV_CMD_GET_WIFI_NETWORKS:
             {
                 get_available_wifi_networks();
                 break;
             }
 
         default: {
-                     set_error(improv::ERROR_UNKNOWN_RPC);
-                     return false;
+                     RERROR("improv error: %02X", IMPROV_ERROR_UNKNOWN_RPC);
+                     set_error(IMPROV_ERROR_UNKNOWN_RPC);
                  }
     }
-
-    return true;
 }
 
 void get_available_wifi_networks() {
     int networkNum = WiFi.scanNetworks();
 
-    int sortedIndicies[networkNum];
-    for (int i = 0; i < networkNum; i++) {
-        sortedIndicies[i] = i;
-    }
-
-    // sort networks by RSSI, strongest to weakest
-    for (int i = 0; i < networkNum; i++) {
-        for (int j = i + 1; j < networkNum; j++) {
-            if (WiFi.RSSI(sortedIndicies[j]) > WiFi.RSSI(sortedIndicies[i])) {
-                std::swap(sortedIndicies[i], sortedIndicies[j]);
-            }
-        }
-    }
-
-    // find duplicates (must be RSSI sorted)
-    String temp_ssid;
-    for (int i = 0; i < networkNum; i++) {
-        if (sortedIndicies[i] == -1) continue;       // skip duplicate
-        temp_ssid = WiFi.SSID(sortedIndicies[i]);
-        for (int j = i + 1; j < networkNum; j++) {
-            if (temp_ssid == WiFi.SSID(sortedIndicies[j])) {
-                sortedIndicies[j] = -1;              // set dupes to -1 to skip later
-            }
-        }
+    // point into the scan results, sorted strongest first with duplicate SSIDs removed
+    ImprovNetwork networks[MAX_IMPROV_NETWORKS];
+    uint8_t count = 0;
+    for (int i = 0; i < networkNum && count < MAX_IMPROV_NETWORKS; i++) {
+        bss_info *info = WiFiScanInfo::at(i);
+        if (!info) continue;
+        networks[count++] = {(const char *)info->ssid, (uint8_t)strnlen((const char *)info->ssid, info->ssid_len),
+                             info->rssi, info->authmode != AUTH_OPEN};
     }
-
-    for (int id = 0; id < networkNum; ++id) {
-        if (sortedIndicies[id] == -1) continue;      // skip duplicate
-        std::vector<uint8_t> data = improv::build_rpc_response(
-                improv::GET_WIFI_NETWORKS, {WiFi.SSID(sortedIndicies[id]), String(WiFi.RSSI(sortedIndicies[id])), (WiFi.encryptionType(sortedIndicies[id]) == ENC_TYPE_NONE ? "NO" : "YES")}, false);
-        send_response(data);
+    count = improv_sort_networks(networks, count);
+
+    ImprovEncoder frame;
+    for (uint8_t i = 0; i < count; i++) {
+        char rssi[8];
+        snprintf(rssi, sizeof(rssi), "%d", networks[i].rssi);
+        frame.rpc_begin(IMPROV_CMD_GET_WIFI_NETWORKS);
+        frame.rpc_string(networks[i].ssid, networks[i].ssid_len);
+        frame.rpc_string(rssi);
+        frame.rpc_string(networks[i].secure ? "YES" : "NO");
+        frame.rpc_end();
+        send_frame(frame);
         delay(1);
     }
     // final response
-    std::vector<uint8_t> data =
-        improv::build_rpc_response(improv::GET_WIFI_NETWORKS, std::vector<std::string>{}, false);
-    send_response(data);
+    frame.rpc_begin(IMPROV_CMD_GET_WIFI_NETWORKS);
+    frame.rpc_end();
+    send_frame(frame);
 
     // delete scan from memory
     WiFi.scanDelete();
 }
 
-void set_state(improv::State state) {
-
-    std::vector<uint8_t> data = {'I', 'M', 'P', 'R', 'O', 'V'};
-    data.resize(11);
-    data[6] = improv::IMPROV_SERIAL_VERSION;
-    data[7] = improv::TYPE_CURRENT_STATE;
-    data[8] = 1;
-    data[9] = state;
-
-    uint8_t checksum = 0x00;
-    for (uint8_t d : data)
-        checksum += d;
-    data[10] = checksum;
-
-    Serial.write(data.data(), data.size());
+void set_state(ImprovState state) {
+    ImprovEncoder frame;
+    frame.state(state);
+    send_frame(frame);
 }
 
-void send_response(std::vector<uint8_t> &response) {
-    std::vector<uint8_t> data = {'I', 'M', 'P', 'R', 'O', 'V'};
-    data.resize(9);
-    data[6] = improv::IMPROV_SERIAL_VERSION;
-    data[7] = improv::TYPE_RPC_RESPONSE;
-    data[8] = response.size();
-    data.insert(data.end(), response.begin(), response.end());
-
-    uint8_t checksum = 0x00;
-    for (uint8_t d : data)
-        checksum += d;
-    data.push_back(checksum);
-
-    Serial.write(data.data(), data.size());
-}
-
-void set_error(improv::Error error) {
-    std::vector<uint8_t> data = {'I', 'M', 'P', 'R', 'O', 'V'};
-    data.resize(11);
-    data[6] = improv::IMPROV_SERIAL_VERSION;
-    data[7] = improv::TYPE_ERROR_STATE;
-    data[8] = 1;
-    data[9] = error;
-
-    uint8_t checksum = 0x00;
-    for (uint8_t d : data)
-        checksum += d;
-    data[10] = checksum;
-
-    Serial.write(data.data(), data.size());
+void set_error(ImprovError error) {
+    ImprovEncoder frame;
+    frame.error(error);
+    send_frame(frame);
 }
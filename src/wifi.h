@@ -8,4 +8,6 @@ void improv_loop();
 
 void wifi_connect();
 
+void wifi_loop();
+
 #endif /* WIFI_INFO_H_ */
@@ -166,7 +166,7 @@ async function checkStatus() {
             setElementsFromStatus(msgJson);
         });
         evtSource.addEventListener("logger", (event) => {
-            console.log(event.data);
+            console.log(detokenize(event.data));
         });
         evtSource.addEventListener("uploadStatus", (event) => {
             //console.log(event.data);
@@ -187,6 +187,108 @@ async function checkStatus() {
     return;
 };
 
+// Firmware built with LOG_TOKENIZED sends log lines as '$' followed by a base64 record of
+// a token and the packed arguments.  The device serves the token database for its own firmware,
+// failing that the one published with the release is used.  A failed load is retried after
+// a while, not on every log line.
+var logTokens = {};
+async function loadLogTokens() {
+    if (logTokens.version === serverStatus.firmwareVersion) return;
+    if (logTokens.loading) return logTokens.loading;
+    if (logTokens.retryAt && Date.now() < logTokens.retryAt) return;
+    logTokens.loading = (async () => {
+        const urls = ["logtokens.json",
+            "https://ratgdo.github.io/homekit-ratgdo/firmware/homekit-ratgdo-" + serverStatus.firmwareVersion + ".tokens.json"];
+        for (const url of urls) {
+            try {
+                const response = await fetch(url);
+                if (!response.ok) continue;
+                logTokens.tokens = (await response.json()).tokens;
+                logTokens.version = serverStatus.firmwareVersion;
+                logTokens.retryAt = undefined;
+                return;
+            }
+            catch {
+            }
+        }
+        logTokens.retryAt = Date.now() + 30000;
+        console.warn("Unable to load log token database for " + serverStatus.firmwareVersion);
+    })();
+    try {
+        await logTokens.loading;
+    }
+    finally {
+        logTokens.loading = undefined;
+    }
+}
+
+function detokenize(line) {
+    if (!line.startsWith("$")) return line;
+    if (!logTokens.tokens) {
+        loadLogTokens();
+        return line;
+    }
+    try {
+        const rec = Uint8Array.from(atob(line.substring(1).trim()), c => c.charCodeAt(0));
+        const view = new DataView(rec.buffer);
+        let pos = 4;
+        const varint = () => {
+            let value = 0n, shift = 0n, b;
+            do {
+                b = rec[pos++];
+                value |= BigInt(b & 0x7f) << shift;
+                shift += 7n;
+            } while (b & 0x80);
+            return value;
+        };
+        const token = view.getUint32(0, true).toString(16).toUpperCase().padStart(8, "0");
+        const fmt = logTokens.tokens[token];
+        if (!fmt) return "[unknown log token " + token + "] " + line;
+        return fmt.replace(/%([-+ #0]*)(\d+)?(?:\.(\d+))?(hh|h|ll|l|z|j|t|L)?([diouxXeEfgGcsp%])/g,
+            (match, flags, width, precision, length, conv) => {
+                let str;
+                if (conv === "%") return "%";
+                if (conv === "s") {
+                    const n = Number(varint());
+                    str = new TextDecoder().decode(rec.subarray(pos, pos + n));
+                    pos += n;
+                } else if ("eEfgG".includes(conv)) {
+                    const f = view.getFloat32(pos, true);
+                    pos += 4;
+                    str = f.toFixed((precision !== undefined) ? Number(precision) : 6);
+                } else {
+                    const bits = (length === "ll" || length === "j") ? 64 : 32;
+                    let value = BigInt.asUintN(bits, varint());
+                    if ("di".includes(conv)) value = BigInt.asIntN(bits, value);
+                    str = (conv === "c") ? String.fromCharCode(Number(value))
+                        : (conv === "x" || conv === "p") ? value.toString(16)
+                            : (conv === "X") ? value.toString(16).toUpperCase()
+                                : (conv === "o") ? value.toString(8)
+                                    : value.toString();
+                }
+                flags = flags || "";
+                width = Number(width || 0);
+                if (flags.includes("-")) return str.padEnd(width);
+                if (flags.includes("0") && conv !== "s" && str.startsWith("-")) return "-" + str.substring(1).padStart(width - 1, "0");
+                return str.padStart(width, (flags.includes("0") && conv !== "s") ? "0" : " ");
+            }).trimEnd();
+    }
+    catch {
+        return line;
+    }
+}
+
+// Display one of the device logs (crashlog, showlog...) in a new window, detokenized.
+async function showLog(url) {
+    const win = window.open("", "_blank");
+    const response = await fetch(url);
+    const text = await response.text();
+    if (text.includes("\n$")) await loadLogTokens();
+    const pre = win.document.createElement("pre");
+    pre.textContent = text.split("\n").map(detokenize).join("\n");
+    win.document.body.appendChild(pre);
+}
+
 // Displays a series of dot-dot-dots into an element's innerHTML to give
 // user some reassurance of activity.  Used during firmware update.
 function dotDotDot(elem) {
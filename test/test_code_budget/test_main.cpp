@@ -0,0 +1,272 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <CodeBudget.h>
+
+CodeBudget budget;
+
+void setUp(void) {
+    budget = CodeBudget();
+    budget.begin(1000);
+}
+
+void tearDown(void) {
+}
+
+void test_code_budget_classify(void) {
+    TEST_ASSERT_EQUAL(CodeClass::Critical, CodeBudget::classify(PacketCommand::DoorAction));
+    TEST_ASSERT_EQUAL(CodeClass::Background, CodeBudget::classify(PacketCommand::GetStatus));
+    TEST_ASSERT_EQUAL(CodeClass::Background, CodeBudget::classify(PacketCommand::GetOpenings));
+    TEST_ASSERT_EQUAL(CodeClass::Command, CodeBudget::classify(PacketCommand::Light));
+    TEST_ASSERT_EQUAL(CodeClass::Command, CodeBudget::classify(PacketCommand::Lock));
+}
+
+void test_code_budget_burst(void) {
+    uint32_t now = 1000;
+    // status requests stop short of the reserve
+    for (int i = 0; i < CODE_BUDGET_CAPACITY - CODE_BUDGET_RESERVE; i++) {
+        TEST_ASSERT_EQUAL(CodeDecision::Send, budget.check(CodeClass::Background, now));
+        budget.spend(now);
+    }
+    TEST_ASSERT_EQUAL(CodeDecision::Drop, budget.check(CodeClass::Background, now));
+    TEST_ASSERT_EQUAL(1, budget.dropped);
+
+    // commands can use the reserve
+    for (int i = 0; i < CODE_BUDGET_RESERVE; i++) {
+        TEST_ASSERT_EQUAL(CodeDecision::Send, budget.check(CodeClass::Command, now));
+        budget.spend(now);
+    }
+    TEST_ASSERT_EQUAL(CodeDecision::Defer, budget.check(CodeClass::Command, now));
+
+    // door commands always go
+    TEST_ASSERT_EQUAL(CodeDecision::Send, budget.check(CodeClass::Critical, now));
+    budget.spend(now);
+    TEST_ASSERT_EQUAL(0, budget.tokens(now));
+
+    // deferred command goes once a token is back
+    TEST_ASSERT_EQUAL(CodeDecision::Defer, budget.check(CodeClass::Command, now + CODE_BUDGET_REFILL - 1));
+    TEST_ASSERT_EQUAL(CodeDecision::Send, budget.check(CodeClass::Command, now + CODE_BUDGET_REFILL));
+
+    // and the bucket refills to capacity
+    TEST_ASSERT_EQUAL(CODE_BUDGET_CAPACITY, budget.tokens(now + 3600000));
+}
+
+void test_code_budget_rate(void) {
+    // 30 codes a minute for an hour
+    uint32_t now = 1000;
+    for (int minute = 0; minute < 60; minute++) {
+        for (int i = 0; i < 30; i++) {
+            budget.spend(now);
+            now += 2000;
+        }
+    }
+    TEST_ASSERT_EQUAL(60 * 30, budget.used);
+    TEST_ASSERT_UINT32_WITHIN(20, 1800, budget.codes_per_hour(now));
+    // one flash write every 10 codes
+    TEST_ASSERT_UINT32_WITHIN(50, 4320, budget.flash_writes_per_day(now, 10));
+
+    // and decays once idle
+    TEST_ASSERT_EQUAL(0, budget.codes_per_hour(now + 2 * 3600000));
+}
+
+void test_code_budget_queue_order(void) {
+    struct Action {
+        Packet pkt;
+        bool batch;
+    };
+    PacketData d;
+    d.type = PacketDataType::NoData;
+    d.value.no_data = NoData();
+    Packet light = Packet(PacketCommand::Light, d, 1);
+    Packet status = Packet(PacketCommand::GetStatus, d, 1);
+    Packet door = Packet(PacketCommand::DoorAction, d, 1);
+
+    // light and its status, another light, then a door press, release and status
+    Action acts[] = {{light, true}, {status, false}, {light, true}, {door, true}, {door, true}, {status, false}, {light, false}};
+    TEST_ASSERT_TRUE(CodeBudget::promote_critical(acts, 7));
+    PacketCommand order[] = {PacketCommand::DoorAction, PacketCommand::DoorAction, PacketCommand::GetStatus,
+                             PacketCommand::Light, PacketCommand::GetStatus, PacketCommand::Light, PacketCommand::Light};
+    for (int i = 0; i < 7; i++) {
+        TEST_ASSERT_EQUAL(order[i], acts[i].pkt.m_pkt_cmd);
+    }
+    TEST_ASSERT_FALSE(acts[2].batch);
+    // already at the front
+    TEST_ASSERT_FALSE(CodeBudget::promote_critical(acts, 7));
+
+    // the newest packet that isn't a door command makes way
+    TEST_ASSERT_EQUAL(6, CodeBudget::evict(acts, 7));
+    TEST_ASSERT_EQUAL(2, CodeBudget::evict(acts, 3));
+    TEST_ASSERT_EQUAL(2, CodeBudget::evict(acts, 2));
+
+    // a light command still waiting is changed, or dropped if the light is already that way
+    uint8_t count = 7;
+    TEST_ASSERT_TRUE(CodeBudget::merge_light(acts, count, LightState::On, false));
+    TEST_ASSERT_EQUAL(7, count);
+    TEST_ASSERT_EQUAL(LightState::On, acts[3].pkt.m_data.value.light.light);
+    TEST_ASSERT_TRUE(CodeBudget::merge_light(acts, count, LightState::Off, false));
+    TEST_ASSERT_EQUAL(6, count);
+    TEST_ASSERT_EQUAL(PacketCommand::GetStatus, acts[3].pkt.m_pkt_cmd);
+    TEST_ASSERT_EQUAL(PacketCommand::Light, acts[4].pkt.m_pkt_cmd);
+    count = 3;
+    TEST_ASSERT_FALSE(CodeBudget::merge_light(acts, count, LightState::On, false));
+    TEST_ASSERT_EQUAL(3, count);
+}
+
+/*
+ * Host simulation of a 60s time-to-close started with the budget spent, queueing as comms.cpp
+ * does: the light flashed every 500ms, each flash followed by a status request, then the door
+ * press, release and status request.
+ */
+#define SIM_QUEUE_SIZE 8    // PKT_Q_SIZE
+#define SIM_TTC 60          // seconds
+#define SIM_STEP 20         // ms between loop passes
+
+struct SimAction {
+    Packet pkt;
+    bool batch;
+};
+
+struct Sim {
+    SimAction q[SIM_QUEUE_SIZE];
+    uint8_t count = 0;
+    uint32_t lost = 0;
+    bool light = false;         // as the opener has it
+    uint32_t flashes = 0;
+    uint32_t close_sent = 0;
+
+    void push(const SimAction& ac) {
+        if (count < SIM_QUEUE_SIZE) {
+            q[count++] = ac;
+            return;
+        }
+        uint8_t i = CodeBudget::evict(q, count);
+        if (CodeBudget::classify(ac.pkt.m_pkt_cmd) != CodeClass::Critical || i == count) {
+            lost++;
+            return;
+        }
+        for (; i + 1 < count; i++) {
+            q[i] = q[i + 1];
+        }
+        q[count - 1] = ac;
+    }
+
+    void pop(uint8_t n) {
+        for (uint8_t i = n; i < count; i++) {
+            q[i - n] = q[i];
+        }
+        count -= n;
+    }
+
+    void set_light(bool value) {
+        PacketData d;
+        d.type = PacketDataType::Light;
+        d.value.light.light = value ? LightState::On : LightState::Off;
+        if (CodeBudget::merge_light(q, count, d.value.light.light, light) || value == light) {
+            return;
+        }
+        push({Packet(PacketCommand::Light, d, 1), true});
+        get_status();
+    }
+
+    void get_status() {
+        PacketData d;
+        d.type = PacketDataType::NoData;
+        d.value.no_data = NoData();
+        push({Packet(PacketCommand::GetStatus, d, 1), false});
+    }
+
+    void close() {
+        PacketData d;
+        d.type = PacketDataType::DoorAction;
+        d.value.door_action.action = DoorAction::Close;
+        d.value.door_action.id = 1;
+        push({Packet(PacketCommand::DoorAction, d, 1), true});
+        push({Packet(PacketCommand::DoorAction, d, 1), true});
+        get_status();
+    }
+
+    void sent(const SimAction& ac, uint32_t now) {
+        if (ac.pkt.m_pkt_cmd == PacketCommand::Light) {
+            light = ac.pkt.m_data.value.light.light == LightState::On;
+            flashes++;
+        } else if (ac.pkt.m_pkt_cmd == PacketCommand::DoorAction && !close_sent) {
+            close_sent = now;
+        }
+    }
+
+    // One pass of the transmit side of comms_loop
+    void loop(CodeBudget& budget, uint32_t now) {
+        if (!count) {
+            return;
+        }
+        CodeDecision head = budget.check(CodeBudget::classify(q[0].pkt.m_pkt_cmd), now);
+        if (head == CodeDecision::Drop) {
+            pop(1);
+        } else if (head == CodeDecision::Defer) {
+            CodeBudget::promote_critical(q, count);
+        } else {
+            // as transmitSec2Batch
+            uint8_t n = 0;
+            while (n < count) {
+                CodeDecision next = n ? budget.check(CodeBudget::classify(q[n].pkt.m_pkt_cmd), now) : CodeDecision::Send;
+                if (next == CodeDecision::Defer) {
+                    break;
+                }
+                if (next == CodeDecision::Send) {
+                    sent(q[n], now);
+                    budget.spend(now);
+                }
+                if (!q[n++].batch) {
+                    break;
+                }
+            }
+            pop(n);
+        }
+    }
+};
+
+void test_code_budget_ttc(void) {
+    Sim sim;
+    uint32_t now = 1000;
+    // a motion storm has just used up the budget
+    for (int i = 0; i < CODE_BUDGET_CAPACITY; i++) {
+        budget.spend(now);
+    }
+
+    uint32_t ticks = SIM_TTC * 2;
+    uint32_t next_tick = now + 500;
+    uint32_t closing = 0;
+    for (; now < 1000 + (SIM_TTC + 5) * 1000; now += SIM_STEP) {
+        if (ticks && now >= next_tick) {
+            next_tick += 500;
+            if (--ticks) {
+                sim.set_light(!sim.light);
+            } else {
+                closing = now;
+                sim.close();
+            }
+        }
+        sim.loop(budget, now);
+    }
+
+    printf("\n%u flashes sent, door close sent %u ms after the countdown ended\n", sim.flashes, sim.close_sent - closing);
+    TEST_ASSERT_TRUE(closing > 0);
+    TEST_ASSERT_TRUE(sim.close_sent >= closing);
+    TEST_ASSERT_TRUE(sim.close_sent - closing <= SIM_STEP);
+    TEST_ASSERT_EQUAL(0, sim.lost);
+    // the flashes go on at the refill rate
+    TEST_ASSERT_TRUE(sim.flashes >= SIM_TTC * 1000 / CODE_BUDGET_REFILL / 2);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_code_budget_classify);
+    RUN_TEST(test_code_budget_burst);
+    RUN_TEST(test_code_budget_rate);
+    RUN_TEST(test_code_budget_queue_order);
+    RUN_TEST(test_code_budget_ttc);
+    UNITY_END();
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <string.h>
+#include <CommandTrace.h>
+
+CommandTrace trace;
+
+void setUp(void) {
+    trace = CommandTrace();
+}
+
+void tearDown(void) {
+}
+
+void test_command_trace_hops(void) {
+    uint16_t id;
+    {
+        CommandTraceScope scope(trace, TraceOrigin::HomeKit, 1000);
+        id = trace.current();
+        TEST_ASSERT_TRUE(id != 0);
+        trace.queued(trace.current(), 0x280, 1001);
+        trace.queued(trace.current(), 0x080, 1002);   // only the first packet counts
+    }
+    TEST_ASSERT_EQUAL(0, trace.current());
+
+    trace.dequeued(id, 1030);
+    trace.retry(id);
+    trace.dequeued(id, 1060);
+    trace.sent(id, 1062);
+    trace.status(TRACE_ACKED, 1400);
+    trace.status(TRACE_NOTIFIED, 1405);
+    // a later Status doesn't move an acked trace
+    trace.status(TRACE_ACKED, 3000);
+
+    const CommandTraceRecord* t = trace.recent(0);
+    TEST_ASSERT_NOT_NULL(t);
+    TEST_ASSERT_EQUAL(id, t->id);
+    TEST_ASSERT_EQUAL(0x280, t->cmd);
+    TEST_ASSERT_EQUAL(1, t->retries);
+    TEST_ASSERT_EQUAL(1, t->at[TRACE_QUEUED]);
+    TEST_ASSERT_EQUAL(30, t->at[TRACE_DEQUEUED]);
+    TEST_ASSERT_EQUAL(62, t->at[TRACE_SENT]);
+    TEST_ASSERT_EQUAL(400, t->at[TRACE_ACKED]);
+    TEST_ASSERT_EQUAL(405, t->at[TRACE_NOTIFIED]);
+    TEST_ASSERT_NULL(trace.recent(1));
+
+    char buf[160];
+    CommandTrace::to_string(t, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING("#1 HomeKit cmd 0x280 at 1000 retries 1: queued 1 dequeued 30 sent 62 acked 400 notified 405", buf);
+}
+
+void test_command_trace_unsent_not_acked(void) {
+    uint16_t id = trace.start(TraceOrigin::Web, 0);
+    trace.end();
+    trace.queued(id, 0x281, 0);
+    trace.status(TRACE_ACKED, 100);
+    trace.status(TRACE_NOTIFIED, 100);
+    TEST_ASSERT_EQUAL(CMD_TRACE_NONE, trace.recent(0)->at[TRACE_ACKED]);
+    TEST_ASSERT_EQUAL(CMD_TRACE_NONE, trace.recent(0)->at[TRACE_NOTIFIED]);
+    // untraced packets are ignored
+    trace.sent(0, 100);
+}
+
+void test_command_trace_percentiles(void) {
+    // opener hop of 100 traces: 90 around 300ms, 10 around 3000ms
+    uint32_t now = 0;
+    for (int i = 0; i < 100; i++) {
+        uint16_t id = trace.start(TraceOrigin::TTC, now);
+        trace.end();
+        trace.queued(id, 0x281, now);
+        trace.dequeued(id, now + 20);
+        trace.sent(id, now + 25);
+        trace.status(TRACE_ACKED, now + 25 + ((i % 10 == 9) ? 3000 : 300));
+        trace.status(TRACE_NOTIFIED, now + 25 + ((i % 10 == 9) ? 3000 : 300) + 2);
+        now += 10000;
+    }
+    TEST_ASSERT_EQUAL(511, trace.percentile(TRACE_ACKED, 50));
+    TEST_ASSERT_EQUAL(511, trace.percentile(TRACE_ACKED, 90));
+    TEST_ASSERT_EQUAL(4095, trace.percentile(TRACE_ACKED, 99));
+    TEST_ASSERT_EQUAL(31, trace.percentile(TRACE_DEQUEUED, 50));
+    TEST_ASSERT_EQUAL(3, trace.percentile(TRACE_NOTIFIED, 50));
+    TEST_ASSERT_EQUAL(4095, trace.percentile(TRACE_HOPS, 99));
+
+    // only the last CMD_TRACE_SIZE are kept
+    uint8_t n = 0;
+    while (trace.recent(n)) {
+        n++;
+    }
+    TEST_ASSERT_EQUAL(CMD_TRACE_SIZE, n);
+    TEST_ASSERT_EQUAL(100, trace.recent(0)->id);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_command_trace_hops);
+    RUN_TEST(test_command_trace_unsent_not_acked);
+    RUN_TEST(test_command_trace_percentiles);
+    UNITY_END();
+
+    return 0;
+}
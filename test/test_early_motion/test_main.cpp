@@ -0,0 +1,160 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <EarlyMotion.h>
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+static DoorActionCommandData press(DoorAction action, bool pressed = true) {
+    DoorActionCommandData d;
+    d.action = action;
+    d.pressed = pressed;
+    d.id = 1;
+    return d;
+}
+
+void test_early_motion_direction(void) {
+    EarlyMotion em;
+    TEST_ASSERT_EQUAL(DoorState::Unknown, em.motor_on());
+
+    em.status(DoorState::Closed);
+    TEST_ASSERT_EQUAL(DoorState::Opening, em.motor_on());
+    TEST_ASSERT_EQUAL(DoorState::Opening, em.door_action(press(DoorAction::Toggle)));
+    TEST_ASSERT_EQUAL(DoorState::Opening, em.door_action(press(DoorAction::Open)));
+    TEST_ASSERT_EQUAL(DoorState::Unknown, em.door_action(press(DoorAction::Close)));
+    TEST_ASSERT_EQUAL(DoorState::Unknown, em.door_action(press(DoorAction::Toggle, false)));
+
+    em.status(DoorState::Open);
+    TEST_ASSERT_EQUAL(DoorState::Closing, em.motor_on());
+    TEST_ASSERT_EQUAL(DoorState::Closing, em.door_action(press(DoorAction::Close)));
+    TEST_ASSERT_EQUAL(DoorState::Unknown, em.door_action(press(DoorAction::Stop)));
+
+    // stopped part way, the next press reverses the last direction of travel
+    em.status(DoorState::Closing);
+    TEST_ASSERT_EQUAL(DoorState::Unknown, em.motor_on());
+    em.status(DoorState::Stopped);
+    TEST_ASSERT_EQUAL(DoorState::Opening, em.motor_on());
+    TEST_ASSERT_EQUAL(DoorState::Closing, em.door_action(press(DoorAction::Close)));
+}
+
+void test_early_motion_query_holdoff(void) {
+    EarlyMotion em;
+    TEST_ASSERT_TRUE(em.query(1000));
+    TEST_ASSERT_FALSE(em.query(1100));
+    TEST_ASSERT_FALSE(em.query(1000 + EARLY_MOTION_QUERY_HOLDOFF - 1));
+    TEST_ASSERT_TRUE(em.query(1000 + EARLY_MOTION_QUERY_HOLDOFF));
+    // a Status answers the query
+    em.status(DoorState::Opening);
+    TEST_ASSERT_TRUE(em.query(1600));
+}
+
+void test_early_motion_echo(void) {
+    const uint32_t ours = 0x123539;
+    const uint32_t panel = 0x4d2c1f;
+    // our own command read back, by ID or by timing
+    TEST_ASSERT_TRUE(EarlyMotion::echo(5000, 1000, ours, ours));
+    TEST_ASSERT_TRUE(EarlyMotion::echo(1000 + EARLY_MOTION_ECHO_WINDOW - 1, 1000, panel, ours));
+    // a wall button press
+    TEST_ASSERT_FALSE(EarlyMotion::echo(1000 + EARLY_MOTION_ECHO_WINDOW, 1000, panel, ours));
+    TEST_ASSERT_FALSE(EarlyMotion::echo(5000, 1000, panel, ours));
+}
+
+/*
+ * Host simulation of a door started from the wall button or a remote. Opener timings are
+ * assumptions, in ms from the button press; adjust them to match captures from a real opener.
+ */
+#define SIM_MOTOR_ON 120       // MotorOn broadcast
+#define SIM_STATUS 900         // Opening status broadcast by the opener on its own
+#define SIM_TX 40              // our GetStatus, preamble pulse plus 19 bytes at 9600 baud
+#define SIM_REPLY 60           // opener answering a GetStatus
+
+struct SimResult {
+    uint32_t shown;            // HomeKit/UI first shows the door moving
+    uint32_t confirmed;        // state confirmed by a Status packet
+};
+
+enum SimEvent { SimDoorAction, SimMotorOn, SimStatus };
+
+static SimResult simulate(bool wall_button, bool early, bool provisional) {
+    EarlyMotion em;
+    em.status(DoorState::Closed);
+
+    // bus traffic from the opener and wall button, in time order
+    struct { uint32_t t; SimEvent e; } bus[4];
+    int n = 0;
+    if (wall_button) {
+        bus[n++] = {0, SimDoorAction};
+    }
+    bus[n++] = {SIM_MOTOR_ON, SimMotorOn};
+    bus[n++] = {SIM_STATUS, SimStatus};
+
+    SimResult r = {UINT32_MAX, UINT32_MAX};
+    uint32_t reply = UINT32_MAX;
+    for (int i = 0; i < n; i++) {
+        uint32_t t = bus[i].t;
+        if (reply < t) {
+            // the answer to our GetStatus arrives first
+            t = reply;
+            i--;
+            reply = UINT32_MAX;
+        } else if (bus[i].e != SimStatus) {
+            if (!early) {
+                continue;
+            }
+            DoorState guess = (bus[i].e == SimMotorOn) ? em.motor_on()
+                                                       : em.door_action(press(DoorAction::Toggle));
+            if (provisional && guess == DoorState::Opening && r.shown == UINT32_MAX) {
+                r.shown = t;
+            }
+            if (em.query(t)) {
+                reply = t + SIM_TX + SIM_REPLY;
+            }
+            continue;
+        }
+        em.status(DoorState::Opening);
+        if (r.confirmed == UINT32_MAX) {
+            r.confirmed = t;
+        }
+        if (r.shown == UINT32_MAX) {
+            r.shown = t;
+        }
+    }
+    return r;
+}
+
+static void report(const char* what, SimResult base, SimResult early, SimResult prov) {
+    printf("%-12s shown/confirmed ms: baseline %u/%u, early query %u/%u, provisional %u/%u\n", what,
+           base.shown, base.confirmed, early.shown, early.confirmed, prov.shown, prov.confirmed);
+}
+
+void test_early_motion_latency(void) {
+    for (int wall_button = 1; wall_button >= 0; wall_button--) {
+        SimResult base = simulate(wall_button, false, false);
+        SimResult early = simulate(wall_button, true, false);
+        SimResult prov = simulate(wall_button, true, true);
+        report(wall_button ? "wall button" : "remote", base, early, prov);
+
+        TEST_ASSERT_EQUAL(SIM_STATUS, base.confirmed);
+        uint32_t first = wall_button ? 0 : SIM_MOTOR_ON;
+        TEST_ASSERT_EQUAL(first + SIM_TX + SIM_REPLY, early.confirmed);
+        TEST_ASSERT_EQUAL(early.confirmed, early.shown);
+        TEST_ASSERT_EQUAL(first, prov.shown);
+        TEST_ASSERT_EQUAL(early.confirmed, prov.confirmed);
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_early_motion_direction);
+    RUN_TEST(test_early_motion_query_holdoff);
+    RUN_TEST(test_early_motion_echo);
+    RUN_TEST(test_early_motion_latency);
+    UNITY_END();
+
+    return 0;
+}
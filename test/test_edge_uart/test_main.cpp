@@ -0,0 +1,152 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <EdgeUart.h>
+
+// 9600 baud at 80MHz
+#define BIT_CYCLES (80000000 / 9600)
+
+EdgeUartDecoder decoder;
+
+static uint32_t lcg_state = 0x5EED;
+static uint32_t lcg(void) {
+    lcg_state = lcg_state * 1664525 + 1013904223;
+    return lcg_state >> 8;
+}
+
+void setUp(void) {
+    decoder = EdgeUartDecoder();
+    decoder.begin(BIT_CYCLES, false, true);
+}
+
+void tearDown(void) {
+}
+
+// Drive `len` characters onto an (inverted) line starting at `t`, delivering each edge to the
+// decoder `latency(is_start_edge)` cycles late. Returns the time the line went idle.
+template <typename Latency>
+uint32_t send(const uint8_t* buf, size_t len, uint32_t t, Latency latency,
+              uint32_t bit_cycles = BIT_CYCLES, bool even_parity = false, bool bad_parity = false) {
+    uint8_t frame_bits = even_parity ? 11 : 10;
+    bool level = true;
+    for (size_t i = 0; i < len; i++) {
+        uint16_t bits = (uint16_t)buf[i] << 1;
+        if (even_parity) {
+            bits |= (uint16_t)(__builtin_parity(buf[i]) ^ bad_parity) << 9;
+        }
+        bits |= 1 << (frame_bits - 1);
+        for (uint8_t n = 0; n < frame_bits; n++) {
+            bool bit = (bits >> n) & 1;
+            if (bit != level) {
+                level = bit;
+                decoder.edge(t + latency(n == 0), !level);
+            }
+            t += bit_cycles;
+        }
+    }
+    return t;
+}
+
+static uint32_t on_time(bool) { return 0; }
+
+void check_received(const uint8_t* expected, size_t len) {
+    TEST_ASSERT_EQUAL(len, decoder.available());
+    for (size_t i = 0; i < len; i++) {
+        TEST_ASSERT_EQUAL_HEX8(expected[i], decoder.read());
+    }
+    TEST_ASSERT_EQUAL(0, decoder.framing_errors);
+    TEST_ASSERT_EQUAL(0, decoder.parity_errors);
+}
+
+static const uint8_t packet[19] = {
+    0x55, 0x01, 0x00, 0xA5, 0x2F, 0xB3, 0xDB, 0xCE, 0x8F, 0x5B, 0x0C, 0x40, 0x34, 0xB9, 0x71, 0x96, 0x73, 0xFD, 0xBA };
+
+void test_edge_uart_clean(void) {
+    uint32_t t = send(packet, sizeof(packet), 1000, on_time);
+    decoder.idle(t);
+    check_received(packet, sizeof(packet));
+}
+
+// the cycle counter wraps every ~53 seconds at 80MHz
+void test_edge_uart_counter_wrap(void) {
+    uint32_t t = send(packet, sizeof(packet), 0xFFFFFFFF - 50 * BIT_CYCLES, on_time);
+    decoder.idle(t);
+    check_received(packet, sizeof(packet));
+}
+
+void test_edge_uart_random_latency(void) {
+    uint32_t t = send(packet, sizeof(packet), 1000, [](bool) { return lcg() % (BIT_CYCLES * 9 / 20); });
+    decoder.idle(t + BIT_CYCLES);
+    check_received(packet, sizeof(packet));
+}
+
+// Start edges serviced most of a bit late; mid-bit sampling from the start edge misreads these.
+// Needs characters with enough edges to outvote the start edge.
+void test_edge_uart_late_start(void) {
+    const uint8_t data[] = {0x55, 0xAA, 0x33, 0x5A, 0x69, 0x01};
+    uint32_t t = send(data, sizeof(data), 1000, [](bool start) { return start ? BIT_CYCLES * 8 / 10 : BIT_CYCLES / 10; });
+    decoder.idle(t + BIT_CYCLES);
+    check_received(data, sizeof(data));
+}
+
+void test_edge_uart_sec1_parity(void) {
+    const uint32_t bit_cycles = 80000000 / 1200;
+    decoder.begin(bit_cycles, true, true);
+
+    const uint8_t data[] = {0x38, 0x55, 0x3A, 0x01, 0x39, 0x00};
+    uint32_t t = send(data, sizeof(data), 1000, on_time, bit_cycles, true);
+    decoder.idle(t);
+    check_received(data, sizeof(data));
+
+    t = send(data, 1, t + bit_cycles * 5, on_time, bit_cycles, true, true);
+    decoder.idle(t);
+    TEST_ASSERT_EQUAL(0, decoder.available());
+    TEST_ASSERT_EQUAL(1, decoder.parity_errors);
+}
+
+void test_edge_uart_framing_error(void) {
+    // start bit then line held low (break) for longer than a character
+    decoder.edge(1000, true);
+    decoder.edge(1000 + BIT_CYCLES * 15, false);
+    decoder.idle(1000 + BIT_CYCLES * 30);
+    TEST_ASSERT_EQUAL(0, decoder.available());
+    TEST_ASSERT_EQUAL(1, decoder.framing_errors);
+
+    // and recovers on the next character
+    decoder.framing_errors = 0;
+    uint32_t t = send(packet, 4, 1000 + BIT_CYCLES * 40, on_time);
+    decoder.idle(t);
+    check_received(packet, 4);
+}
+
+void test_edge_ring(void) {
+    EdgeRing ring;
+    uint32_t t;
+    bool level;
+    TEST_ASSERT_FALSE(ring.pop(&t, &level));
+    for (uint32_t i = 0; i < EDGE_RING_SIZE; i++) {
+        ring.push(i * 100, i & 1);
+    }
+    // one slot is always kept free
+    TEST_ASSERT_EQUAL(1, ring.m_overruns);
+    for (uint32_t i = 0; i < EDGE_RING_SIZE - 1; i++) {
+        TEST_ASSERT_TRUE(ring.pop(&t, &level));
+        TEST_ASSERT_EQUAL(i * 100, t);
+        TEST_ASSERT_EQUAL(i & 1, level);
+    }
+    TEST_ASSERT_TRUE(ring.empty());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_edge_uart_clean);
+    RUN_TEST(test_edge_uart_counter_wrap);
+    RUN_TEST(test_edge_uart_random_latency);
+    RUN_TEST(test_edge_uart_late_start);
+    RUN_TEST(test_edge_uart_sec1_parity);
+    RUN_TEST(test_edge_uart_framing_error);
+    RUN_TEST(test_edge_ring);
+    UNITY_END();
+
+    return 0;
+}
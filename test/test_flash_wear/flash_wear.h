@@ -0,0 +1,327 @@
+#ifndef _FLASH_WEAR_H
+#define _FLASH_WEAR_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <lfs.h>
+
+// Flash wear simulation for the host benchmark.
+//
+// littlefs runs on a simulated NOR flash shaped like the ESP8266 filesystem partition
+// (eagle.flash.4m2m.ld) and configured as the ESP8266 core configures LittleFS. Every block
+// erase is counted, against the block and against whatever the firmware was doing at the time.
+// The firmware's file writes are replayed as utilities.cpp, comms.cpp, wifi.cpp and log.cpp do
+// them: open with "w" (truncate), write, close. A day of traffic is replayed from a profile, and
+// the erase rate of the worst block in each region gives years until it reaches the endurance of
+// the part.
+
+#define FLASH_BLOCK_SIZE 8192                   // _FS_block
+#define FLASH_FS_SIZE 0x1FA000                  // _FS_end - _FS_start
+#define FLASH_BLOCKS (FLASH_FS_SIZE / FLASH_BLOCK_SIZE)
+#define FLASH_ENDURANCE 100000                  // erase cycles, typical SPI NOR
+#define FLASH_REGIONS 8
+
+#define FLASH_CODES_PER_SAVE 10                 // MAX_CODES_WITHOUT_FLASH_WRITE
+#define FLASH_LOG_SIZE 2048                     // LOG_BUFFER_SIZE, written on reboot and crash
+
+// rolling codes used by each event, see comms.cpp
+#define CODES_PER_DOOR_CYCLE 4                  // open and close: release and GetStatus each
+#define CODES_PER_LIGHT 2                       // Light, then GetStatus on its answer
+#define CODES_PER_MOTION 1                      // GetStatus
+#define CODES_PER_POLL 1                        // GetStatus
+
+enum WearSource : uint8_t {
+    WEAR_BOOT,          // rolling code bumped and saved at boot
+    WEAR_ROLLING,       // rolling code saved every FLASH_CODES_PER_SAVE codes
+    WEAR_SETTINGS,      // setgdo writes
+    WEAR_WIFI,          // wifiPhyMode/wifiPower and the wifiSettingsChanged flag
+    WEAR_REBOOT_LOG,    // sync_and_restart()
+    WEAR_CRASH_LOG,     // crashCallback()
+    WEAR_SOURCES,
+};
+
+static const char* const wear_source_names[WEAR_SOURCES] = {
+    "boot", "rolling", "settings", "wifi", "reboot_log", "crash_log",
+};
+
+// Daily traffic
+struct TrafficProfile {
+    const char* name;
+    uint32_t door_cycles;
+    uint32_t light_toggles;
+    uint32_t motion_events;
+    uint32_t polls;             // GetStatus queries, e.g. early motion or automations
+    uint32_t reboots;           // planned, e.g. the reboot timer or heap health
+    uint32_t crashes;
+    uint32_t settings_writes;
+    uint32_t wifi_changes;
+
+    uint32_t codes() const {
+        return door_cycles * CODES_PER_DOOR_CYCLE + light_toggles * CODES_PER_LIGHT +
+               motion_events * CODES_PER_MOTION + polls * CODES_PER_POLL;
+    }
+
+    // "door=20,light=4,motion=100,polls=0,reboots=1,crashes=0,settings=0,wifi=0", unset keys
+    // keep their value
+    bool parse(const char* spec) {
+        static const char* const keys[] = {"door", "light", "motion", "polls", "reboots", "crashes", "settings", "wifi"};
+        uint32_t* values[] = {&door_cycles, &light_toggles, &motion_events, &polls, &reboots, &crashes, &settings_writes, &wifi_changes};
+        while (spec && *spec) {
+            const char* eq = strchr(spec, '=');
+            if (!eq) {
+                return false;
+            }
+            bool found = false;
+            for (uint8_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+                if (strlen(keys[i]) == (size_t)(eq - spec) && !strncmp(spec, keys[i], eq - spec)) {
+                    *values[i] = strtoul(eq + 1, nullptr, 10);
+                    found = true;
+                }
+            }
+            if (!found) {
+                return false;
+            }
+            spec = strchr(eq, ',');
+            spec = spec ? spec + 1 : nullptr;
+        }
+        return true;
+    }
+};
+
+class SimFlash {
+    private:
+        uint8_t m_data[FLASH_BLOCKS * FLASH_BLOCK_SIZE];
+        uint8_t m_read_buf[64];
+        uint8_t m_prog_buf[64];
+        uint8_t m_lookahead_buf[64];
+
+        static int read(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size) {
+            SimFlash* f = (SimFlash*)c->context;
+            memcpy(buffer, f->m_data + block * FLASH_BLOCK_SIZE + off, size);
+            return 0;
+        }
+
+        static int prog(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size) {
+            SimFlash* f = (SimFlash*)c->context;
+            uint8_t* p = f->m_data + block * FLASH_BLOCK_SIZE + off;
+            const uint8_t* s = (const uint8_t*)buffer;
+            for (lfs_size_t i = 0; i < size; i++) {
+                // NOR programming only clears bits
+                if (s[i] & ~p[i]) {
+                    f->prog_without_erase++;
+                }
+                p[i] &= s[i];
+            }
+            f->bytes_programmed += size;
+            return 0;
+        }
+
+        static int erase(const struct lfs_config* c, lfs_block_t block) {
+            SimFlash* f = (SimFlash*)c->context;
+            memset(f->m_data + block * FLASH_BLOCK_SIZE, 0xFF, FLASH_BLOCK_SIZE);
+            f->erases[block]++;
+            f->source_erases[f->source]++;
+            return 0;
+        }
+
+        static int sync(const struct lfs_config* c) {
+            return 0;
+        }
+
+    public:
+        lfs_t lfs;
+        struct lfs_config cfg;
+        uint32_t erases[FLASH_BLOCKS];
+        uint32_t source_erases[WEAR_SOURCES];
+        WearSource source = WEAR_BOOT;
+        uint64_t bytes_programmed = 0;
+        uint32_t prog_without_erase = 0;
+
+        SimFlash() {
+            memset(m_data, 0xFF, sizeof(m_data));
+            memset(&cfg, 0, sizeof(cfg));
+            cfg.context = this;
+            cfg.read = read;
+            cfg.prog = prog;
+            cfg.erase = erase;
+            cfg.sync = sync;
+            // as LittleFS.h in the ESP8266 core
+            cfg.read_size = 64;
+            cfg.prog_size = 64;
+            cfg.block_size = FLASH_BLOCK_SIZE;
+            cfg.block_count = FLASH_BLOCKS;
+            cfg.block_cycles = 16;
+            cfg.cache_size = 64;
+            cfg.lookahead_size = 64;
+            cfg.read_buffer = m_read_buf;
+            cfg.prog_buffer = m_prog_buf;
+            cfg.lookahead_buffer = m_lookahead_buf;
+            clear_counts();
+        }
+
+        void clear_counts() {
+            memset(erases, 0, sizeof(erases));
+            memset(source_erases, 0, sizeof(source_erases));
+            bytes_programmed = 0;
+        }
+
+        bool format_and_mount() {
+            return lfs_format(&lfs, &cfg) == 0 && lfs_mount(&lfs, &cfg) == 0;
+        }
+
+        bool remount() {
+            return lfs_unmount(&lfs) == 0 && lfs_mount(&lfs, &cfg) == 0;
+        }
+
+        // File.open(name, "w"), write, close
+        bool write_file(const char* name, const void* data, size_t len) {
+            lfs_file_t file;
+            if (lfs_file_open(&lfs, &file, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) < 0) {
+                return false;
+            }
+            bool ok = lfs_file_write(&lfs, &file, data, len) == (lfs_ssize_t)len;
+            return lfs_file_close(&lfs, &file) == 0 && ok;
+        }
+
+        // write_int_to_file()
+        bool write_int(const char* name, uint32_t value) {
+            char buf[12];
+            int len = snprintf(buf, sizeof(buf), "%lu", (unsigned long)value);
+            return write_file(name, buf, len);
+        }
+
+        // Highest erase count of the blocks in a region
+        uint32_t region_max(uint8_t region) const {
+            uint32_t first = region * FLASH_BLOCKS / FLASH_REGIONS;
+            uint32_t last = (region + 1) * FLASH_BLOCKS / FLASH_REGIONS;
+            uint32_t most = 0;
+            for (uint32_t b = first; b < last; b++) {
+                if (erases[b] > most) {
+                    most = erases[b];
+                }
+            }
+            return most;
+        }
+
+        uint32_t total_erases() const {
+            uint32_t n = 0;
+            for (uint32_t b = 0; b < FLASH_BLOCKS; b++) {
+                n += erases[b];
+            }
+            return n;
+        }
+};
+
+// Years until a block erased `count` times in `days` reaches the endurance
+static inline double wear_years(uint32_t count, uint32_t days) {
+    if (count == 0) {
+        return 1e9;
+    }
+    return (double)FLASH_ENDURANCE / ((double)count / days) / 365.0;
+}
+
+// Replays the firmware's flash writes for a profile
+class WearModel {
+    private:
+        SimFlash& m_flash;
+        uint32_t m_rolling = 1000;
+        uint32_t m_saved = 1000;
+        uint32_t m_setting = 0;
+        uint32_t m_phy_mode = 0;
+
+        bool save_rolling() {
+            m_saved = m_rolling;
+            return m_flash.write_int("rolling", m_rolling);
+        }
+
+        bool write_log(const char* name) {
+            static char log[FLASH_LOG_SIZE];
+            memset(log, 'x', sizeof(log));
+            return m_flash.write_file(name, log, sizeof(log));
+        }
+
+    public:
+        explicit WearModel(SimFlash& flash) : m_flash(flash) {}
+
+        // setup_comms(): the saved code may be behind, skip ahead and save
+        bool boot() {
+            m_flash.source = WEAR_BOOT;
+            m_rolling += FLASH_CODES_PER_SAVE;
+            return m_flash.remount() && save_rolling();
+        }
+
+        bool code() {
+            m_rolling++;
+            if (m_rolling >= m_saved + FLASH_CODES_PER_SAVE) {
+                m_flash.source = WEAR_ROLLING;
+                return save_rolling();
+            }
+            return true;
+        }
+
+        bool codes(uint32_t n) {
+            for (uint32_t i = 0; i < n; i++) {
+                if (!code()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // sync_and_restart()
+        bool reboot() {
+            m_flash.source = WEAR_REBOOT_LOG;
+            return save_rolling() && write_log("reboot_log") && boot();
+        }
+
+        // crashCallback() truncates and rewrites the open crash_log, the rolling code isn't saved
+        bool crash() {
+            m_flash.source = WEAR_CRASH_LOG;
+            return write_log("crash_log") && boot();
+        }
+
+        bool setting() {
+            static const char* const files[] = {"TTC_delay", "www_pw_required_file", "system_reboot_timer"};
+            m_flash.source = WEAR_SETTINGS;
+            m_setting++;
+            return m_flash.write_int(files[m_setting % 3], m_setting);
+        }
+
+        // setgdo writes the new mode and raises wifiSettingsChanged, wifi.cpp clears it 30s later
+        bool wifi_change() {
+            m_flash.source = WEAR_WIFI;
+            return m_flash.write_int("wifiPhyMode", m_phy_mode++ % 4) &&
+                   m_flash.write_int("wifiSettingsChanged", 1) &&
+                   m_flash.write_int("wifiSettingsChanged", 0);
+        }
+
+        // One day, events spread through it in step
+        bool day(const TrafficProfile& p) {
+            const uint32_t counts[] = {p.door_cycles, p.light_toggles, p.motion_events, p.polls, p.reboots, p.crashes, p.settings_writes, p.wifi_changes};
+            uint32_t most = 0;
+            for (uint32_t c : counts) {
+                most = c > most ? c : most;
+            }
+            for (uint32_t step = 0; step < most; step++) {
+                // event i happens counts[i] times in `most` steps
+                auto due = [&](uint8_t i) { return (uint64_t)(step + 1) * counts[i] / most != (uint64_t)step * counts[i] / most; };
+                bool ok = true;
+                ok &= !due(0) || codes(CODES_PER_DOOR_CYCLE);
+                ok &= !due(1) || codes(CODES_PER_LIGHT);
+                ok &= !due(2) || codes(CODES_PER_MOTION);
+                ok &= !due(3) || codes(CODES_PER_POLL);
+                ok &= !due(4) || reboot();
+                ok &= !due(5) || crash();
+                ok &= !due(6) || setting();
+                ok &= !due(7) || wifi_change();
+                if (!ok) {
+                    return false;
+                }
+            }
+            return true;
+        }
+};
+
+#endif // _FLASH_WEAR_H
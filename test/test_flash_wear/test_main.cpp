@@ -0,0 +1,131 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "flash_wear.h"
+
+// Flash wear benchmark. Replays the daily traffic of each profile for FLASH_WEAR_DAYS simulated
+// days and prints projected years to wear out per region. A profile of your own can be given as
+//   FLASH_WEAR_PROFILE="door=20,motion=100,reboots=1" pio test -e native -f test_flash_wear
+
+#ifndef FLASH_WEAR_DAYS
+#define FLASH_WEAR_DAYS 60
+#endif
+
+// anything that wears out the flash within this is a regression
+#define FLASH_WEAR_MIN_YEARS 10
+
+static const TrafficProfile profiles[] = {
+    // name        door light motion polls reboots crashes settings wifi
+    {"quiet",         2,    0,     5,    0,      0,      0,       0,   0},
+    {"typical",       8,    4,    40,   10,      0,      0,       0,   0},
+    {"busy",         30,   20,   300,  100,      0,      0,       1,   0},
+    {"daily_reboot",  8,    4,    40,   10,      1,      0,       0,   0},
+    {"crashing",      8,    4,    40,   10,      0,      6,       0,   1},
+};
+
+static SimFlash *flash;
+
+void setUp(void) {
+    flash = new SimFlash();
+    TEST_ASSERT_TRUE(flash->format_and_mount());
+}
+
+void tearDown(void) {
+    lfs_unmount(&flash->lfs);
+    delete flash;
+}
+
+// Returns the projected years of the worst block
+static double run_profile(const TrafficProfile &p) {
+    WearModel model(*flash);
+    TEST_ASSERT_TRUE(model.boot());
+    flash->clear_counts();
+    for (uint32_t day = 0; day < FLASH_WEAR_DAYS; day++) {
+        TEST_ASSERT_TRUE(model.day(p));
+    }
+    TEST_ASSERT_EQUAL(0, flash->prog_without_erase);
+
+    printf("\n%s: %u codes/day, %u erases in %u days, %.1f KB/day programmed\n", p.name, p.codes(),
+           flash->total_erases(), FLASH_WEAR_DAYS, flash->bytes_programmed / 1024.0 / FLASH_WEAR_DAYS);
+    printf("  erases/day by source:");
+    for (uint8_t s = 0; s < WEAR_SOURCES; s++) {
+        if (flash->source_erases[s]) {
+            printf(" %s %.2f", wear_source_names[s], (double)flash->source_erases[s] / FLASH_WEAR_DAYS);
+        }
+    }
+    printf("\n  years to wear out by region (worst block):");
+    double worst = 1e9;
+    for (uint8_t r = 0; r < FLASH_REGIONS; r++) {
+        double years = wear_years(flash->region_max(r), FLASH_WEAR_DAYS);
+        worst = years < worst ? years : worst;
+        if (years >= 1e6) {
+            printf(" -");
+        } else {
+            printf(" %.0f", years);
+        }
+    }
+    printf("\n");
+    return worst;
+}
+
+void test_flash_wear_erase_counting(void) {
+    flash->clear_counts();
+    flash->source = WEAR_SETTINGS;
+    // a large file needs fresh blocks
+    static char data[3 * FLASH_BLOCK_SIZE];
+    TEST_ASSERT_TRUE(flash->write_file("big", data, sizeof(data)));
+    TEST_ASSERT_GREATER_OR_EQUAL(3, flash->total_erases());
+    TEST_ASSERT_EQUAL(flash->total_erases(), flash->source_erases[WEAR_SETTINGS]);
+    TEST_ASSERT_EQUAL(0, flash->prog_without_erase);
+
+    // and it reads back after a remount
+    TEST_ASSERT_TRUE(flash->write_int("rolling", 12345));
+    TEST_ASSERT_TRUE(flash->remount());
+    lfs_file_t file;
+    char buf[12] = {0};
+    TEST_ASSERT_EQUAL(0, lfs_file_open(&flash->lfs, &file, "rolling", LFS_O_RDONLY));
+    TEST_ASSERT_EQUAL(5, lfs_file_read(&flash->lfs, &file, buf, sizeof(buf) - 1));
+    lfs_file_close(&flash->lfs, &file);
+    TEST_ASSERT_EQUAL_STRING("12345", buf);
+}
+
+void test_flash_wear_profile_parse(void) {
+    TrafficProfile p = profiles[1];
+    TEST_ASSERT_TRUE(p.parse("door=20,reboots=1"));
+    TEST_ASSERT_EQUAL(20, p.door_cycles);
+    TEST_ASSERT_EQUAL(1, p.reboots);
+    TEST_ASSERT_EQUAL(40, p.motion_events);
+    TEST_ASSERT_FALSE(p.parse("doors=1"));
+    TEST_ASSERT_EQUAL(20 * CODES_PER_DOOR_CYCLE + 4 * CODES_PER_LIGHT + 40 * CODES_PER_MOTION + 10 * CODES_PER_POLL, p.codes());
+}
+
+void test_flash_wear_profiles(void) {
+    for (const TrafficProfile &p : profiles) {
+        tearDown();
+        setUp();
+        TEST_ASSERT_GREATER_THAN(FLASH_WEAR_MIN_YEARS, run_profile(p));
+    }
+}
+
+void test_flash_wear_custom_profile(void) {
+    const char *spec = getenv("FLASH_WEAR_PROFILE");
+    if (!spec) {
+        return;
+    }
+    TrafficProfile p = {"custom", 0, 0, 0, 0, 0, 0, 0, 0};
+    TEST_ASSERT_TRUE(p.parse(spec));
+    run_profile(p);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_flash_wear_erase_counting);
+    RUN_TEST(test_flash_wear_profile_parse);
+    RUN_TEST(test_flash_wear_profiles);
+    RUN_TEST(test_flash_wear_custom_profile);
+    UNITY_END();
+
+    return 0;
+}
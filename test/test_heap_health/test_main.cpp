@@ -0,0 +1,89 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <HeapHealth.h>
+
+HeapHealth heap;
+
+void setUp(void) {
+    heap = HeapHealth();
+}
+
+void tearDown(void) {
+}
+
+// feed `n` samples at the sample interval, returns the time after the last
+static uint32_t feed(uint32_t now, int n, uint32_t free_heap, uint32_t max_block, uint32_t oom = 0) {
+    for (int i = 0; i < n; i++) {
+        TEST_ASSERT_TRUE(heap.sample(now, free_heap, max_block, oom));
+        now += HEAP_SAMPLE_INTERVAL;
+    }
+    return now;
+}
+
+void test_heap_health_ok(void) {
+    uint32_t now = feed(0, 100, 20000, 12000);
+    TEST_ASSERT_FALSE(heap.degraded());
+    // samples closer together than the interval are ignored
+    TEST_ASSERT_FALSE(heap.sample(now - 1, 20000, 100, 0));
+}
+
+void test_heap_health_fragmented(void) {
+    uint32_t now = feed(0, 3, 20000, 12000);
+    // plenty free, but the largest block is a small share of it
+    now = feed(now, HEAP_BAD_SAMPLES - 1, 20000, 5000);
+    TEST_ASSERT_FALSE(heap.degraded());
+    // a good sample resets the count
+    now = feed(now, 1, 20000, 12000);
+    now = feed(now, HEAP_BAD_SAMPLES - 1, 20000, 5000);
+    TEST_ASSERT_FALSE(heap.degraded());
+    now = feed(now, 1, 20000, 5000);
+    TEST_ASSERT_EQUAL(HeapState::Fragmented, heap.state());
+
+    // small block even with little free heap
+    heap = HeapHealth();
+    feed(0, HEAP_BAD_SAMPLES, 8000, HEAP_MIN_BLOCK - 1);
+    TEST_ASSERT_EQUAL(HeapState::Fragmented, heap.state());
+}
+
+void test_heap_health_low(void) {
+    feed(0, HEAP_BAD_SAMPLES, HEAP_MIN_FREE - 1, HEAP_MIN_FREE - 1);
+    TEST_ASSERT_EQUAL(HeapState::Low, heap.state());
+}
+
+void test_heap_health_oom(void) {
+    // count at boot is the baseline
+    uint32_t now = feed(0, 2, 20000, 12000, 3);
+    TEST_ASSERT_FALSE(heap.degraded());
+    feed(now, 1, 20000, 12000, 4);
+    TEST_ASSERT_EQUAL(HeapState::OutOfMemory, heap.state());
+}
+
+void test_heap_health_falling(void) {
+    // low water mark drops 2000 bytes an hour: 20000, 18000, 16000 ... reaching HEAP_MIN_FREE in
+    // 7 hours, only counts once it is within HEAP_TREND_HOURS
+    const uint32_t per_hour = 3600000 / HEAP_SAMPLE_INTERVAL;
+    uint32_t now = 0;
+    uint32_t free_heap = 20000;
+    int hour = 0;
+    while (!heap.degraded() && hour < 10) {
+        now = feed(now, per_hour, free_heap, free_heap / 2);
+        free_heap -= 2000;
+        hour++;
+    }
+    TEST_ASSERT_EQUAL(HeapState::Falling, heap.state());
+    TEST_ASSERT_TRUE(free_heap + 2000 <= HEAP_MIN_FREE + 2000 * HEAP_TREND_HOURS);
+    TEST_ASSERT_TRUE(free_heap + 2000 > HEAP_MIN_FREE);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_heap_health_ok);
+    RUN_TEST(test_heap_health_fragmented);
+    RUN_TEST(test_heap_health_low);
+    RUN_TEST(test_heap_health_oom);
+    RUN_TEST(test_heap_health_falling);
+    UNITY_END();
+
+    return 0;
+}
@@ -0,0 +1,361 @@
+#ifndef _HEAP_REPLAY_H
+#define _HEAP_REPLAY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <queue>
+#include <vector>
+#include <sys/mman.h>
+
+extern "C" {
+#include <umm_malloc.h>
+#include <umm_malloc_cfg.h>
+}
+
+// Heap fragmentation replay.
+//
+// An allocation trace is replayed through umm_malloc, the ESP8266 core's own copy built for the
+// host with the core's configuration (see umm_core.py), on a heap the size of the device's. Each allocation has a time, a size, a lifetime and a tag for where it
+// comes from. Traces are text, one allocation per line:
+//
+//   <time ms>,<size>,<lifetime ms>,<tag>
+//
+// A lifetime of 0 means the allocation is never freed. Lines starting with # are comments.
+// Traces can also be synthesized from a mix of web requests, SSE events and HomeKit sessions.
+//
+// A strategy moves tags off the heap, as an arena, a pool or the IRAM heap would. The replay
+// reports failed allocations, free heap, the largest free block and umm's fragmentation metric
+// over time, and the peak number of bytes that went elsewhere, so the other store can be sized.
+
+#ifndef HEAP_REPLAY_SIZE
+#define HEAP_REPLAY_SIZE 52000          // DRAM heap of the full build, _heap_start to 0x3FFFC000
+#endif
+#define HEAP_REPLAY_MAX_TAGS 16
+
+struct TraceAlloc {
+    uint32_t time;
+    uint32_t size;
+    uint32_t lifetime;
+    uint8_t tag;
+};
+
+class HeapTrace {
+    public:
+        std::vector<TraceAlloc> allocs;
+        const char* tags[HEAP_REPLAY_MAX_TAGS];
+        uint8_t tag_count = 0;
+
+        ~HeapTrace() {
+            for (uint8_t i = 0; i < tag_count; i++) {
+                free((void*)tags[i]);
+            }
+        }
+
+        // Index of a tag, added if it is new. HEAP_REPLAY_MAX_TAGS if the table is full.
+        uint8_t tag(const char* name, size_t len) {
+            for (uint8_t i = 0; i < tag_count; i++) {
+                if (strlen(tags[i]) == len && !strncmp(tags[i], name, len)) {
+                    return i;
+                }
+            }
+            if (tag_count == HEAP_REPLAY_MAX_TAGS) {
+                return HEAP_REPLAY_MAX_TAGS;
+            }
+            char* copy = (char*)malloc(len + 1);
+            memcpy(copy, name, len);
+            copy[len] = 0;
+            tags[tag_count] = copy;
+            return tag_count++;
+        }
+
+        uint8_t tag(const char* name) { return tag(name, strlen(name)); }
+
+        // Bit for a tag in a strategy's mask, 0 if the trace has no such tag
+        uint32_t tag_bit(const char* name) const {
+            for (uint8_t i = 0; i < tag_count; i++) {
+                if (!strcmp(tags[i], name)) {
+                    return 1u << i;
+                }
+            }
+            return 0;
+        }
+
+        void add(uint32_t time, uint32_t size, uint32_t lifetime, const char* tag_name) {
+            allocs.push_back({time, size, lifetime, tag(tag_name)});
+        }
+
+        bool parse_line(const char* line) {
+            while (*line == ' ' || *line == '\t') {
+                line++;
+            }
+            if (*line == '#' || *line == '\n' || *line == '\r' || !*line) {
+                return true;
+            }
+            char* end;
+            uint32_t v[3];
+            for (uint8_t i = 0; i < 3; i++) {
+                v[i] = strtoul(line, &end, 10);
+                if (end == line || *end != ',') {
+                    return false;
+                }
+                line = end + 1;
+            }
+            size_t len = strcspn(line, ",\r\n");
+            uint8_t t = tag(line, len);
+            if (!len || t == HEAP_REPLAY_MAX_TAGS) {
+                return false;
+            }
+            allocs.push_back({v[0], v[1], v[2], t});
+            return true;
+        }
+
+        // Returns the number of the first bad line, or 0
+        uint32_t load(FILE* f) {
+            char line[128];
+            uint32_t n = 0;
+            while (fgets(line, sizeof(line), f)) {
+                n++;
+                if (!parse_line(line)) {
+                    return n;
+                }
+            }
+            sort();
+            return 0;
+        }
+
+        void sort() {
+            std::stable_sort(allocs.begin(), allocs.end(), [](const TraceAlloc& a, const TraceAlloc& b) { return a.time < b.time; });
+        }
+
+        uint32_t duration() const {
+            return allocs.empty() ? 0 : allocs.back().time;
+        }
+};
+
+// Tags served somewhere other than the heap
+struct HeapStrategy {
+    const char* name;
+    uint32_t off_heap;      // tag bits
+};
+
+struct HeapSample {
+    uint32_t time;
+    uint32_t free;
+    uint32_t max_block;
+    int fragmentation;      // umm_fragmentation_metric(), 0 is one free block
+};
+
+struct HeapReplayResult {
+    uint32_t allocs = 0;
+    uint32_t failures = 0;
+    uint32_t first_failure = 0;         // time
+    uint8_t first_failure_tag = 0;
+    uint32_t first_failure_size = 0;
+    uint32_t min_free = 0xFFFFFFFF;
+    uint32_t min_max_block = 0xFFFFFFFF;
+    int max_fragmentation = 0;
+    uint32_t end_free = 0;
+    uint32_t off_heap_peak = 0;         // bytes live elsewhere at once
+    uint32_t failures_by_tag[HEAP_REPLAY_MAX_TAGS] = {};
+    std::vector<HeapSample> samples;
+};
+
+class HeapReplay {
+    private:
+        uint8_t* m_heap;        // in the low 4GB, see umm_host_port.h
+        uint32_t m_size;
+
+        struct Live {
+            uint32_t until;
+            void* ptr;          // nullptr when off heap
+            uint32_t size;
+            bool operator>(const Live& other) const { return until > other.until; }
+        };
+
+        HeapSample sample(uint32_t now) {
+            umm_info(NULL, false);
+            return {now, (uint32_t)umm_free_heap_size(), (uint32_t)umm_max_block_size(), umm_fragmentation_metric()};
+        }
+
+        void note(HeapReplayResult& r, const HeapSample& s) {
+            r.min_free = std::min(r.min_free, s.free);
+            r.min_max_block = std::min(r.min_max_block, s.max_block);
+            r.max_fragmentation = std::max(r.max_fragmentation, s.fragmentation);
+        }
+
+    public:
+        explicit HeapReplay(uint32_t size = HEAP_REPLAY_SIZE) : m_size(size > HEAP_REPLAY_SIZE ? HEAP_REPLAY_SIZE : size) {
+            m_heap = (uint8_t*)mmap(NULL, HEAP_REPLAY_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+            if (m_heap == MAP_FAILED) {
+                perror("heap replay mmap");
+                abort();
+            }
+        }
+
+        ~HeapReplay() {
+            munmap(m_heap, HEAP_REPLAY_SIZE);
+        }
+
+        HeapReplay(const HeapReplay&) = delete;
+        HeapReplay& operator=(const HeapReplay&) = delete;
+
+        HeapReplayResult run(const HeapTrace& trace, const HeapStrategy& strategy, uint32_t sample_interval) {
+            HeapReplayResult r;
+            umm_host_heap = m_heap;
+            umm_host_heap_size = m_size;
+            umm_init();
+            std::priority_queue<Live, std::vector<Live>, std::greater<Live>> live;
+            uint32_t off_heap = 0;
+            uint32_t next_sample = 0;
+
+            auto free_until = [&](uint32_t now) {
+                while (!live.empty() && live.top().until <= now) {
+                    if (live.top().ptr) {
+                        umm_free(live.top().ptr);
+                    } else {
+                        off_heap -= live.top().size;
+                    }
+                    live.pop();
+                }
+            };
+
+            for (const TraceAlloc& a : trace.allocs) {
+                free_until(a.time);
+                while (next_sample <= a.time) {
+                    HeapSample s = sample(next_sample);
+                    r.samples.push_back(s);
+                    note(r, s);
+                    next_sample += sample_interval;
+                }
+                r.allocs++;
+                uint32_t until = a.lifetime ? a.time + a.lifetime : 0xFFFFFFFF;
+                if (strategy.off_heap & (1u << a.tag)) {
+                    off_heap += a.size;
+                    r.off_heap_peak = std::max(r.off_heap_peak, off_heap);
+                    live.push({until, nullptr, a.size});
+                    continue;
+                }
+                void* p = umm_malloc(a.size);
+                if (!p) {
+                    if (!r.failures) {
+                        r.first_failure = a.time;
+                        r.first_failure_tag = a.tag;
+                        r.first_failure_size = a.size;
+                    }
+                    r.failures++;
+                    r.failures_by_tag[a.tag]++;
+                    continue;
+                }
+                // touch it, as the firmware would
+                memset(p, 0xA5, a.size);
+                live.push({until, p, a.size});
+            }
+            // everything with a lifetime runs out
+            free_until(0xFFFFFFFE);
+            HeapSample s = sample(trace.duration());
+            note(r, s);
+            r.end_free = s.free;
+            return r;
+        }
+};
+
+// Traffic to synthesize a trace from
+struct TrafficMix {
+    const char* name;
+    uint32_t requests_per_min;      // status polls, page loads, setgdo
+    uint32_t sse_clients;
+    uint32_t sse_events_per_min;    // to each client
+    uint32_t hap_sessions;          // controllers connected at once
+    uint32_t hap_reconnects_per_hour;
+    uint32_t hap_events_per_min;    // to each session
+};
+
+// Allocation shapes, from reading ESP8266WebServer, the SSE code in web.cpp and the HomeKit
+// server. Estimates, to be checked against recorded traces.
+class TraceSynth {
+    private:
+        uint32_t m_seed;
+
+        uint32_t rnd() {
+            m_seed = m_seed * 1103515245 + 12345;
+            return (m_seed >> 8) & 0xFFFFFF;
+        }
+
+        // uniform in [lo, hi]
+        uint32_t between(uint32_t lo, uint32_t hi) {
+            return lo + rnd() % (hi - lo + 1);
+        }
+
+        static void boot(HeapTrace& t) {
+            t.add(0, 2048, 0, "boot");      // status json
+            t.add(0, 2048, 0, "boot");      // message log
+            t.add(0, 256, 0, "boot");       // log line
+            t.add(0, 512, 0, "boot");       // web arena
+            t.add(0, 3200, 0, "boot");      // HomeKit server and accessory database
+            t.add(0, 1200, 0, "boot");      // lwIP and WiFi
+        }
+
+        void request(HeapTrace& t, uint32_t now) {
+            uint32_t life = between(20, 80);
+            t.add(now, 96, life, "web");                    // client context
+            t.add(now, between(16, 40), life, "web");       // URI
+            t.add(now, between(24, 64), life, "web");       // args
+            t.add(now, between(24, 48), life, "web");       // collected headers
+            t.add(now + 2, between(200, 700), life - 2, "web");  // response content
+        }
+
+        void hap_connect(HeapTrace& t, uint32_t now, uint32_t session_life) {
+            // pair verify: curve25519, chacha20-poly1305 and TLV temporaries
+            t.add(now, 2048, between(120, 250), "hap");
+            t.add(now + 1, 1024, between(100, 200), "hap");
+            t.add(now + 2, 512, between(100, 200), "hap");
+            // session state, for as long as the controller stays connected
+            t.add(now + 5, 1400, session_life, "hap_session");
+            t.add(now + 5, 128, session_life, "hap_session");
+        }
+
+        void hap_event(HeapTrace& t, uint32_t now) {
+            t.add(now, between(300, 1100), between(8, 25), "hap");   // encrypted frame
+            t.add(now, 256, between(8, 25), "hap");                  // JSON body
+        }
+
+    public:
+        explicit TraceSynth(uint32_t seed = 1) : m_seed(seed) {}
+
+        void synthesize(HeapTrace& t, const TrafficMix& mix, uint32_t duration) {
+            boot(t);
+            uint32_t session_mean = mix.hap_reconnects_per_hour ? 3600000 / mix.hap_reconnects_per_hour : duration;
+            // sessions come and go, each replaced when it ends
+            for (uint32_t s = 0; s < mix.hap_sessions; s++) {
+                uint32_t now = between(1000, 10000);
+                while (now < duration) {
+                    uint32_t life = between(session_mean / 2, session_mean * 3 / 2);
+                    hap_connect(t, now, life);
+                    now += life + between(500, 5000);
+                }
+            }
+            // spread over each minute with some jitter
+            for (uint32_t minute = 0; minute * 60000 < duration; minute++) {
+                uint32_t base = minute * 60000;
+                for (uint32_t i = 0; i < mix.requests_per_min; i++) {
+                    request(t, base + between(0, 59900));
+                }
+                for (uint32_t c = 0; c < mix.sse_clients; c++) {
+                    for (uint32_t i = 0; i < mix.sse_events_per_min; i++) {
+                        t.add(base + between(0, 59990), between(80, 260), between(2, 10), "sse");
+                    }
+                }
+                for (uint32_t s = 0; s < mix.hap_sessions; s++) {
+                    for (uint32_t i = 0; i < mix.hap_events_per_min; i++) {
+                        hap_event(t, base + between(0, 59970));
+                    }
+                }
+            }
+            t.sort();
+        }
+};
+
+#endif // _HEAP_REPLAY_H
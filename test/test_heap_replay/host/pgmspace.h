@@ -0,0 +1,2 @@
+// Host stand-in for the core header, see umm_host.h
+#include "umm_host.h"
@@ -0,0 +1,40 @@
+#ifndef _UMM_HOST_H
+#define _UMM_HOST_H
+
+// What the ESP8266 core's umm_malloc needs from the core and SDK headers, for the host. There are
+// no interrupts to mask and nothing lives in flash.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+#define PROGMEM
+#define PSTR(s) (s)
+#define PGM_P const char*
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define printf_P printf
+
+#define ets_printf printf
+#define ets_uart_printf printf
+#define os_printf printf
+#define DBGLOG_FUNCTION printf
+
+#define DEFAULT_CRITICAL_SECTION_INTLEVEL 3
+#define xt_rsil(level) ((uint32_t)(level) & 0)
+#define xt_wsr_ps(state) ((void)(state))
+
+#define panic() abort()
+#define __panic_func(file, line, func) abort()
+
+static inline uint32_t esp_get_cycle_count(void) { return 0; }
+static inline uint32_t system_get_time(void) { return 0; }
+
+#endif // _UMM_HOST_H
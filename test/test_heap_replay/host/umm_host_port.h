@@ -0,0 +1,24 @@
+#ifndef _UMM_HOST_PORT_H
+#define _UMM_HOST_PORT_H
+
+// Host port of the core's umm_malloc, read after its umm_malloc_cfgport.h. The UMM_* options are
+// the core's; only the heap moves, from _heap_start to the buffer HeapReplay sets before umm_init().
+// The core keeps heap addresses in 32 bits, so the buffer is mapped in the low 4GB.
+
+#include "umm_host.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern void* umm_host_heap;
+extern size_t umm_host_heap_size;
+#ifdef __cplusplus
+}
+#endif
+
+#undef UMM_MALLOC_CFG_HEAP_ADDR
+#undef UMM_MALLOC_CFG_HEAP_SIZE
+#define UMM_MALLOC_CFG_HEAP_ADDR ((uintptr_t)umm_host_heap)
+#define UMM_MALLOC_CFG_HEAP_SIZE (umm_host_heap_size)
+
+#endif // _UMM_HOST_PORT_H
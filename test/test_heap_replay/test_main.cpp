@@ -0,0 +1,149 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "heap_replay.h"
+
+// Heap fragmentation replay. Replays synthesized traffic for HEAP_REPLAY_HOURS through umm_malloc
+// with and without moving allocations off the heap, and prints how the heap fared. A trace
+// recorded elsewhere can be replayed instead with
+//   HEAP_REPLAY_TRACE=trace.csv pio test -e native_heap_replay -v
+
+#ifndef HEAP_REPLAY_HOURS
+#define HEAP_REPLAY_HOURS 24
+#endif
+#define HEAP_REPLAY_SAMPLE 60000        // ms
+
+static const TrafficMix mixes[] = {
+    // name          requests sse_clients sse_events hap_sessions reconnects hap_events
+    {"idle",                2,          0,         0,           1,         1,         1},
+    {"typical",            12,          1,        30,           2,         4,         4},
+    {"dashboard",          60,          2,        60,           4,        12,        10},
+};
+
+// Where umm_init() puts the heap, see host/umm_host_port.h
+void* umm_host_heap;
+size_t umm_host_heap_size;
+
+static HeapReplay replay;
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+static void print_result(const HeapTrace &trace, const char *mix, const HeapStrategy &strategy, const HeapReplayResult &r) {
+    printf("\n%s/%s: %u allocations, %u failed", mix, strategy.name, r.allocs, r.failures);
+    if (r.failures) {
+        printf(" (first at %us, %u bytes for %s)", r.first_failure / 1000, r.first_failure_size, trace.tags[r.first_failure_tag]);
+    }
+    printf("\n  free min %u, max block min %u, fragmentation max %d%%, off heap peak %u\n",
+           r.min_free, r.min_max_block, r.max_fragmentation, r.off_heap_peak);
+    // max free block over time, a dozen points
+    printf("  max block:");
+    size_t step = r.samples.size() / 12 + 1;
+    for (size_t i = 0; i < r.samples.size(); i += step) {
+        printf(" %u", r.samples[i].max_block);
+    }
+    printf("\n");
+}
+
+void test_heap_replay_trace_parse(void) {
+    HeapTrace trace;
+    TEST_ASSERT_TRUE(trace.parse_line("# time,size,lifetime,tag\n"));
+    TEST_ASSERT_TRUE(trace.parse_line("\n"));
+    TEST_ASSERT_TRUE(trace.parse_line("200,64,30,web\n"));
+    TEST_ASSERT_TRUE(trace.parse_line("100,1400,0,hap_session\r\n"));
+    TEST_ASSERT_FALSE(trace.parse_line("100,64,web\n"));
+    TEST_ASSERT_FALSE(trace.parse_line("100,64,5,\n"));
+    trace.sort();
+    TEST_ASSERT_EQUAL(2, trace.allocs.size());
+    TEST_ASSERT_EQUAL(100, trace.allocs[0].time);
+    TEST_ASSERT_EQUAL(0, trace.allocs[0].lifetime);
+    TEST_ASSERT_EQUAL_STRING("hap_session", trace.tags[trace.allocs[0].tag]);
+    TEST_ASSERT_EQUAL(1u << trace.allocs[1].tag, trace.tag_bit("web"));
+    TEST_ASSERT_EQUAL(0, trace.tag_bit("sse"));
+}
+
+void test_heap_replay_frees_everything(void) {
+    HeapTrace trace;
+    TraceSynth(7).synthesize(trace, mixes[1], 10 * 60000);
+    HeapStrategy baseline = {"baseline", 0};
+    HeapReplayResult r = replay.run(trace, baseline, HEAP_REPLAY_SAMPLE);
+    TEST_ASSERT_EQUAL(0, r.failures);
+    TEST_ASSERT_EQUAL(trace.allocs.size(), r.allocs);
+
+    // only what lives forever is left, the same as after boot alone
+    HeapTrace boot;
+    for (const TraceAlloc &a : trace.allocs) {
+        if (!a.lifetime) {
+            boot.add(a.time, a.size, 0, trace.tags[a.tag]);
+        }
+    }
+    TEST_ASSERT_EQUAL(replay.run(boot, baseline, HEAP_REPLAY_SAMPLE).end_free, r.end_free);
+    TEST_ASSERT_LESS_THAN(r.min_free + 1, r.min_max_block);
+}
+
+void test_heap_replay_failures(void) {
+    HeapTrace trace;
+    TraceSynth(7).synthesize(trace, mixes[2], 10 * 60000);
+    HeapReplay small(12000);
+    HeapStrategy baseline = {"baseline", 0};
+    HeapReplayResult r = small.run(trace, baseline, HEAP_REPLAY_SAMPLE);
+    TEST_ASSERT_GREATER_THAN(0, r.failures);
+    TEST_ASSERT_GREATER_THAN(0, r.failures_by_tag[r.first_failure_tag]);
+
+    // moving a tag off the heap keeps it out of umm entirely
+    HeapStrategy arena = {"web_arena", trace.tag_bit("web")};
+    r = small.run(trace, arena, HEAP_REPLAY_SAMPLE);
+    TEST_ASSERT_EQUAL(0, r.failures_by_tag[trace.tag("web")]);
+    TEST_ASSERT_GREATER_THAN(0, r.off_heap_peak);
+}
+
+void test_heap_replay_mixes(void) {
+    for (const TrafficMix &mix : mixes) {
+        HeapTrace trace;
+        TraceSynth(1).synthesize(trace, mix, HEAP_REPLAY_HOURS * 3600000);
+        const HeapStrategy strategies[] = {
+            {"baseline", 0},
+            {"web_arena", trace.tag_bit("web")},
+            {"hap_pool", trace.tag_bit("hap")},
+            {"sse_iram", trace.tag_bit("sse")},
+        };
+        for (const HeapStrategy &strategy : strategies) {
+            print_result(trace, mix.name, strategy, replay.run(trace, strategy, HEAP_REPLAY_SAMPLE));
+        }
+    }
+}
+
+void test_heap_replay_recorded(void) {
+    const char *path = getenv("HEAP_REPLAY_TRACE");
+    if (!path) {
+        return;
+    }
+    FILE *f = fopen(path, "r");
+    TEST_ASSERT_NOT_NULL(f);
+    HeapTrace trace;
+    uint32_t bad = trace.load(f);
+    fclose(f);
+    if (bad) {
+        printf("%s:%u: not <time>,<size>,<lifetime>,<tag>\n", path, bad);
+    }
+    TEST_ASSERT_EQUAL(0, bad);
+    HeapStrategy baseline = {"baseline", 0};
+    print_result(trace, path, baseline, replay.run(trace, baseline, HEAP_REPLAY_SAMPLE));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_heap_replay_trace_parse);
+    RUN_TEST(test_heap_replay_frees_everything);
+    RUN_TEST(test_heap_replay_failures);
+    RUN_TEST(test_heap_replay_mixes);
+    RUN_TEST(test_heap_replay_recorded);
+    UNITY_END();
+
+    return 0;
+}
@@ -0,0 +1,32 @@
+#
+# Builds the ESP8266 core's umm_malloc for the host, for test_heap_replay. The sources come from
+# the framework package the firmware is built with, so the replay runs the same allocator with the
+# same UMM_* configuration. They are copied to the build directory and umm_malloc_cfgport.h is
+# followed by host/umm_host_port.h, which puts the heap where the replay wants it. Everything else
+# the core headers expect is stubbed out in host/.
+#
+import os
+import shutil
+
+Import("env")
+
+if env.get("PIOTEST_RUNNING_NAME", os.environ.get("PIOTEST_RUNNING_NAME")) == "test_heap_replay":
+    framework = env.PioPlatform().get_package_dir("framework-arduinoespressif8266")
+    if not framework:
+        raise SystemExit("test_heap_replay needs the framework-arduinoespressif8266 package")
+
+    here = os.path.join(env.subst("$PROJECT_DIR"), "test", "test_heap_replay")
+    src = os.path.join(framework, "cores", "esp8266", "umm_malloc")
+    dst = os.path.join(env.subst("$BUILD_DIR"), "umm_core")
+    shutil.rmtree(dst, ignore_errors=True)
+    shutil.copytree(src, dst)
+    with open(os.path.join(dst, "umm_malloc_cfgport.h"), "a") as f:
+        f.write('\n#include "umm_host_port.h"\n')
+
+    include = [os.path.join(here, "host"), dst]
+    env.Append(CPPPATH=include)
+
+    # the core's sources are written for a 32 bit target, see umm_host_port.h
+    umm = env.Clone()
+    umm.Append(CPPPATH=include, CXXFLAGS=["-fpermissive", "-w"], CFLAGS=["-w"])
+    env.Append(PIOBUILDFILES=umm.CollectBuildFiles(os.path.join("$BUILD_DIR", "umm_core_obj"), dst))
@@ -0,0 +1,198 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <string.h>
+#include <ImprovCodec.h>
+
+ImprovDecoder decoder;
+
+void setUp(void) {
+    decoder = ImprovDecoder();
+}
+
+void tearDown(void) {
+}
+
+static uint8_t checksum(const uint8_t *data, size_t len) {
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+static ImprovResult feed(const uint8_t *data, size_t len) {
+    ImprovResult result = ImprovResult::None;
+    for (size_t i = 0; i < len; i++) {
+        result = decoder.push_byte(data[i]);
+        if (result != ImprovResult::None && i != len - 1) {
+            TEST_FAIL_MESSAGE("frame ended early");
+        }
+    }
+    return result;
+}
+
+void test_improv_encode_state(void) {
+    // IMPROV, version 1, current state, length 1, provisioned
+    uint8_t expected[] = {'I', 'M', 'P', 'R', 'O', 'V', 0x01, 0x01, 0x01, 0x04, 0x00};
+    expected[10] = checksum(expected, 10);
+    ImprovEncoder frame;
+    frame.state(IMPROV_STATE_PROVISIONED);
+    TEST_ASSERT_EQUAL(sizeof(expected), frame.size());
+    TEST_ASSERT_EQUAL_MEMORY(expected, frame.data(), sizeof(expected));
+
+    uint8_t error[] = {'I', 'M', 'P', 'R', 'O', 'V', 0x01, 0x02, 0x01, 0x03, 0x00};
+    error[10] = checksum(error, 10);
+    frame.error(IMPROV_ERROR_UNABLE_TO_CONNECT);
+    TEST_ASSERT_EQUAL_MEMORY(error, frame.data(), sizeof(error));
+}
+
+void test_improv_encode_rpc(void) {
+    // each string is a length byte then its bytes: 3 + 1 + 5 = 9, plus command and length
+    uint8_t expected[] = {'I', 'M', 'P', 'R', 'O', 'V', 0x01, 0x04, 0x0B,
+                          0x03, 0x09, 0x02, 'a', 'b', 0x00, 0x04, '1', '.', '6', '0', 0x00};
+    expected[20] = checksum(expected, 20);
+    ImprovEncoder frame;
+    frame.rpc_begin(IMPROV_CMD_GET_DEVICE_INFO);
+    frame.rpc_string("ab");
+    frame.rpc_string("");
+    frame.rpc_string("1.60");
+    frame.rpc_end();
+    TEST_ASSERT_EQUAL(sizeof(expected), frame.size());
+    TEST_ASSERT_EQUAL_MEMORY(expected, frame.data(), sizeof(expected));
+
+    // empty response ends the network list
+    uint8_t empty[] = {'I', 'M', 'P', 'R', 'O', 'V', 0x01, 0x04, 0x02, 0x04, 0x00, 0x00};
+    empty[11] = checksum(empty, 11);
+    frame.rpc_begin(IMPROV_CMD_GET_WIFI_NETWORKS);
+    frame.rpc_end();
+    TEST_ASSERT_EQUAL_MEMORY(empty, frame.data(), sizeof(empty));
+
+    // too long for one frame
+    char big[200];
+    memset(big, 'x', sizeof(big));
+    frame.rpc_begin(IMPROV_CMD_GET_WIFI_NETWORKS);
+    frame.rpc_string(big, sizeof(big));
+    frame.rpc_string(big, sizeof(big));
+    frame.rpc_end();
+    TEST_ASSERT_EQUAL(0, frame.size());
+}
+
+void test_improv_decode_wifi_settings(void) {
+    // noise, a false start, then the frame
+    uint8_t frame[] = {'x', 'I', 'M', 'I', 'M', 'P', 'R', 'O', 'V', 0x01, 0x03, 0x0D,
+                       0x01, 0x0B, 0x04, 'h', 'o', 'm', 'e', 0x05, 's', 'e', 'c', 'r', 't', 0x00};
+    frame[sizeof(frame) - 1] = checksum(frame + 3, sizeof(frame) - 4);
+    TEST_ASSERT_EQUAL(ImprovResult::Command, feed(frame, sizeof(frame)));
+    TEST_ASSERT_EQUAL(IMPROV_CMD_WIFI_SETTINGS, decoder.command());
+    TEST_ASSERT_EQUAL_STRING("home", decoder.ssid());
+    TEST_ASSERT_EQUAL_STRING("secrt", decoder.password());
+
+    // a frame straight after the last one isn't lost
+    uint8_t state[] = {'I', 'M', 'P', 'R', 'O', 'V', 0x01, 0x03, 0x02, 0x02, 0x00, 0x00};
+    state[11] = checksum(state, 11);
+    TEST_ASSERT_EQUAL(ImprovResult::Command, feed(state, sizeof(state)));
+    TEST_ASSERT_EQUAL(IMPROV_CMD_GET_CURRENT_STATE, decoder.command());
+}
+
+void test_improv_decode_errors(void) {
+    uint8_t state[] = {'I', 'M', 'P', 'R', 'O', 'V', 0x01, 0x03, 0x02, 0x02, 0x00, 0x00};
+    state[11] = checksum(state, 11) + 1;
+    TEST_ASSERT_EQUAL(ImprovResult::Error, feed(state, sizeof(state)));
+    TEST_ASSERT_EQUAL(IMPROV_ERROR_INVALID_RPC, decoder.error());
+
+    // RPC length disagrees with the frame length
+    uint8_t bad_len[] = {'I', 'M', 'P', 'R', 'O', 'V', 0x01, 0x03, 0x02, 0x02, 0x05, 0x00};
+    bad_len[11] = checksum(bad_len, 11);
+    TEST_ASSERT_EQUAL(ImprovResult::Error, feed(bad_len, sizeof(bad_len)));
+    TEST_ASSERT_EQUAL(IMPROV_ERROR_UNKNOWN_RPC, decoder.error());
+
+    // SSID runs past the end
+    uint8_t bad_ssid[] = {'I', 'M', 'P', 'R', 'O', 'V', 0x01, 0x03, 0x05, 0x01, 0x03, 0x09, 'a', 'b', 0x00};
+    bad_ssid[14] = checksum(bad_ssid, 14);
+    TEST_ASSERT_EQUAL(ImprovResult::Error, feed(bad_ssid, sizeof(bad_ssid)));
+    TEST_ASSERT_EQUAL(IMPROV_ERROR_UNKNOWN_RPC, decoder.error());
+
+    // other frame types and versions are ignored
+    uint8_t other[] = {'I', 'M', 'P', 'R', 'O', 'V', 0x01, 0x01, 0x01, 0x04, 0x00};
+    other[10] = checksum(other, 10);
+    TEST_ASSERT_EQUAL(ImprovResult::None, feed(other, sizeof(other)));
+    uint8_t v2[] = {'I', 'M', 'P', 'R', 'O', 'V', 0x02, 0x03, 0x02, 0x02, 0x00, 0x00};
+    v2[11] = checksum(v2, 11);
+    TEST_ASSERT_EQUAL(ImprovResult::None, feed(v2, sizeof(v2)));
+
+    // and decoding carries on
+    state[11] -= 1;
+    TEST_ASSERT_EQUAL(ImprovResult::Command, feed(state, sizeof(state)));
+    TEST_ASSERT_EQUAL(IMPROV_ERROR_NONE, decoder.error());
+}
+
+void test_improv_decode_bad_checksum(void) {
+    // a WiFi settings frame with one bit flipped in the password
+    uint8_t frame[] = {'I', 'M', 'P', 'R', 'O', 'V', 0x01, 0x03, 0x0A, 0x01, 0x08, 0x03, 'n', 'e', 't',
+                       0x03, 'p', 'w', 'd', 0x00};
+    frame[19] = checksum(frame, 19);
+    frame[17] ^= 0x01;
+    TEST_ASSERT_EQUAL(ImprovResult::Error, feed(frame, sizeof(frame)));
+    TEST_ASSERT_EQUAL(IMPROV_ERROR_INVALID_RPC, decoder.error());
+
+    // the corrupted frame leaves nothing behind for the next one
+    frame[17] ^= 0x01;
+    TEST_ASSERT_EQUAL(ImprovResult::Command, feed(frame, sizeof(frame)));
+    TEST_ASSERT_EQUAL(IMPROV_CMD_WIFI_SETTINGS, decoder.command());
+    TEST_ASSERT_EQUAL_STRING("net", decoder.ssid());
+    TEST_ASSERT_EQUAL_STRING("pwd", decoder.password());
+}
+
+void test_improv_round_trip(void) {
+    // a maximal RPC frame through the encoder's framing and the decoder
+    ImprovEncoder frame;
+    char ssid[IMPROV_MAX_SSID];
+    memset(ssid, 's', sizeof(ssid));
+    frame.rpc_begin(IMPROV_CMD_WIFI_SETTINGS);
+    frame.rpc_string(ssid, sizeof(ssid));
+    frame.rpc_string("pw");
+    frame.rpc_end();
+    // responses and commands share the layout, only the type differs
+    uint8_t buf[IMPROV_MAX_FRAME];
+    memcpy(buf, frame.data(), frame.size());
+    buf[7] = IMPROV_TYPE_RPC;
+    buf[frame.size() - 1] = checksum(buf, frame.size() - 1);
+    TEST_ASSERT_EQUAL(ImprovResult::Command, feed(buf, frame.size()));
+    TEST_ASSERT_EQUAL(IMPROV_MAX_SSID, strlen(decoder.ssid()));
+    TEST_ASSERT_EQUAL_STRING("pw", decoder.password());
+}
+
+void test_improv_sort_networks(void) {
+    ImprovNetwork nets[] = {
+        {"home", 4, -70, true},
+        {"cafe", 4, -80, false},
+        {"home", 4, -50, true},
+        {"neighbour", 9, -60, true},
+        {"home2", 5, -90, true},
+        {"cafe", 4, -40, false},
+    };
+    uint8_t n = improv_sort_networks(nets, sizeof(nets) / sizeof(nets[0]));
+    TEST_ASSERT_EQUAL(4, n);
+    TEST_ASSERT_EQUAL(-40, nets[0].rssi);
+    TEST_ASSERT_EQUAL_MEMORY("cafe", nets[0].ssid, 4);
+    TEST_ASSERT_EQUAL(-50, nets[1].rssi);
+    TEST_ASSERT_EQUAL_MEMORY("home", nets[1].ssid, 4);
+    TEST_ASSERT_EQUAL(-60, nets[2].rssi);
+    TEST_ASSERT_EQUAL(-90, nets[3].rssi);
+    TEST_ASSERT_EQUAL(5, nets[3].ssid_len);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_improv_encode_state);
+    RUN_TEST(test_improv_encode_rpc);
+    RUN_TEST(test_improv_decode_wifi_settings);
+    RUN_TEST(test_improv_decode_errors);
+    RUN_TEST(test_improv_decode_bad_checksum);
+    RUN_TEST(test_improv_round_trip);
+    RUN_TEST(test_improv_sort_networks);
+    UNITY_END();
+
+    return 0;
+}
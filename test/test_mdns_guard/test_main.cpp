@@ -0,0 +1,633 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <MdnsGuard.h>
+
+#define HAP_PORT 5556
+#define QUERIER 0x0A01A8C0          // 192.168.1.10
+#define LEGACY_PORT 50000
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+// A query as a querier would send it
+struct Query {
+    uint8_t buf[MDNS_PACKET_SIZE];
+    size_t len = 12;
+    uint16_t questions = 0;
+    uint16_t answers = 0;
+    uint16_t authority = 0;
+
+    Query(uint16_t id = 0) {
+        memset(buf, 0, sizeof(buf));
+        buf[0] = id >> 8;
+        buf[1] = id;
+    }
+
+    void put16(uint16_t v) {
+        buf[len++] = v >> 8;
+        buf[len++] = v;
+    }
+
+    // "a.b.c", returns where it starts
+    size_t name(const char* dotted) {
+        size_t at = len;
+        while (*dotted) {
+            const char* dot = strchr(dotted, '.');
+            size_t n = dot ? (size_t)(dot - dotted) : strlen(dotted);
+            buf[len++] = n;
+            memcpy(buf + len, dotted, n);
+            len += n;
+            dotted += n + (dot ? 1 : 0);
+        }
+        buf[len++] = 0;
+        return at;
+    }
+
+    void label_then(const char* label, size_t ptr) {
+        buf[len++] = strlen(label);
+        memcpy(buf + len, label, strlen(label));
+        len += strlen(label);
+        put16(0xC000 | ptr);
+    }
+
+    void question(const char* dotted, uint16_t type, uint16_t cls = MDNS_CLASS_IN) {
+        name(dotted);
+        put16(type);
+        put16(cls);
+        questions++;
+    }
+
+    void known_ptr(const char* owner, const char* target, uint32_t ttl) {
+        name(owner);
+        put16(MDNS_TYPE_PTR);
+        put16(MDNS_CLASS_IN);
+        put16(ttl >> 16);
+        put16(ttl);
+        size_t rdlen = len;
+        put16(0);
+        size_t start = len;
+        name(target);
+        buf[rdlen] = (len - start) >> 8;
+        buf[rdlen + 1] = len - start;
+        answers++;
+    }
+
+    // A record of another host's, in the answers or, as a probe has them, in the authority section
+    void record(const char* owner, uint16_t type, const void* rdata, uint16_t rdlen, bool probe = false) {
+        name(owner);
+        put16(type);
+        put16(MDNS_CLASS_IN | (probe ? 0 : MDNS_CACHE_FLUSH));
+        put16(0);
+        put16(MDNS_TTL_HOST);
+        put16(rdlen);
+        memcpy(buf + len, rdata, rdlen);
+        len += rdlen;
+        if (probe) {
+            authority++;
+        } else {
+            answers++;
+        }
+    }
+
+    const uint8_t* done() {
+        buf[4] = questions >> 8;
+        buf[5] = questions;
+        buf[6] = answers >> 8;
+        buf[7] = answers;
+        buf[8] = authority >> 8;
+        buf[9] = authority;
+        return buf;
+    }
+};
+
+static MdnsService service(const char* name, uint32_t ip, uint16_t config, bool paired) {
+    MdnsService s;
+    snprintf(s.instance, sizeof(s.instance), "%s", name);
+    snprintf(s.host, sizeof(s.host), "%s", name);
+    for (char* c = s.host; *c; c++) {
+        if (*c == ' ') {
+            *c = '-';
+        }
+    }
+    s.ip = ip;
+    s.port = HAP_PORT;
+    char v[12];
+    s.add_txt("md", "ratgdo");
+    s.add_txt("pv", "1.0");
+    s.add_txt("id", "12:34:56:78:9A:BC");
+    snprintf(v, sizeof(v), "%u", config);
+    s.add_txt("c#", v);
+    s.add_txt("s#", "1");
+    s.add_txt("ff", "0");
+    s.add_txt("sf", paired ? "0" : "1");
+    s.add_txt("ci", "4");
+    s.add_txt("sh", "k1Ug8g==");
+    return s;
+}
+
+static bool ask(MdnsGuard& guard, uint32_t now, uint32_t ip, uint16_t port, Query& q, MdnsReply& r) {
+    const uint8_t* pkt = q.done();
+    return guard.query(now, ip, port, pkt, q.len, r);
+}
+
+static uint16_t get16(const uint8_t* p) {
+    return (p[0] << 8) | p[1];
+}
+
+// Probes until the names are ours, returns when announcing starts
+static uint32_t settle(MdnsGuard& guard, uint32_t now) {
+    MdnsReply r;
+    while (true) {
+        guard.probe(now, r);
+        if (!guard.probing()) {
+            return now;
+        }
+        now += MDNS_PROBE_INTERVAL;
+    }
+}
+
+void test_mdns_guard_response(void) {
+    MdnsGuard guard;
+    TEST_ASSERT_TRUE(guard.set(0, service("Garage Door 1A2B3C", 0x3201A8C0, 7, false)));
+    uint16_t len;
+    const uint8_t* pkt = guard.response(&len);
+    TEST_ASSERT_TRUE(len < 300);
+    TEST_ASSERT_EQUAL_HEX(0x8400, get16(pkt + 2));
+    TEST_ASSERT_EQUAL(0, get16(pkt + 4));
+    TEST_ASSERT_EQUAL(4, get16(pkt + 6));
+
+    // read back, compression and all
+    uint8_t name[MDNS_NAME_WIRE];
+    uint8_t target[MDNS_NAME_WIRE];
+    uint8_t expect[MDNS_NAME_WIRE];
+    size_t off = 12;
+    uint16_t types[4];
+    for (uint8_t i = 0; i < 4; i++) {
+        TEST_ASSERT_TRUE(MdnsGuard::read_name(pkt, len, off, name));
+        types[i] = get16(pkt + off);
+        uint16_t cls = get16(pkt + off + 2);
+        uint32_t ttl = ((uint32_t)get16(pkt + off + 4) << 16) | get16(pkt + off + 6);
+        uint16_t rdlen = get16(pkt + off + 8);
+        size_t rdata = off + 10;
+        off = rdata + rdlen;
+        TEST_ASSERT_TRUE(off <= len);
+        switch (types[i]) {
+            case MDNS_TYPE_PTR: {
+                Query e;
+                e.name("_hap._tcp.local");
+                TEST_ASSERT_TRUE(MdnsGuard::same_name(name, e.buf + 12));
+                TEST_ASSERT_EQUAL(MDNS_CLASS_IN, cls);
+                TEST_ASSERT_EQUAL(MDNS_TTL_SERVICE, ttl);
+                TEST_ASSERT_TRUE(MdnsGuard::read_name(pkt, len, rdata, target));
+                size_t at = 12;
+                Query t;
+                t.name("garage door 1a2b3c._hap._tcp.local");
+                TEST_ASSERT_TRUE(MdnsGuard::read_name(t.buf, t.len, at, expect));
+                TEST_ASSERT_TRUE(MdnsGuard::same_name(target, expect));
+                break;
+            }
+            case MDNS_TYPE_SRV:
+                TEST_ASSERT_EQUAL(MDNS_CLASS_IN | MDNS_CACHE_FLUSH, cls);
+                TEST_ASSERT_EQUAL(MDNS_TTL_HOST, ttl);
+                TEST_ASSERT_EQUAL(HAP_PORT, get16(pkt + rdata + 4));
+                rdata += 6;
+                TEST_ASSERT_TRUE(MdnsGuard::read_name(pkt, len, rdata, target));
+                TEST_ASSERT_EQUAL_MEMORY("\x12garage-door-1a2b3c\x05local", target, 26);
+                break;
+            case MDNS_TYPE_TXT:
+                TEST_ASSERT_EQUAL(MDNS_TTL_SERVICE, ttl);
+                TEST_ASSERT_EQUAL_MEMORY("\x09md=ratgdo\x06pv=1.0", pkt + rdata, 17);
+                TEST_ASSERT_EQUAL(service("", 0, 7, false).txt_len, rdlen);
+                break;
+            case MDNS_TYPE_A:
+                TEST_ASSERT_EQUAL(4, rdlen);
+                TEST_ASSERT_EQUAL_HEX8(192, pkt[rdata]);
+                TEST_ASSERT_EQUAL_HEX8(50, pkt[rdata + 3]);
+                break;
+        }
+    }
+    TEST_ASSERT_EQUAL(len, off);
+    TEST_ASSERT_EQUAL(MDNS_TYPE_PTR, types[0]);
+    TEST_ASSERT_EQUAL(MDNS_TYPE_SRV, types[1]);
+    TEST_ASSERT_EQUAL(MDNS_TYPE_TXT, types[2]);
+    TEST_ASSERT_EQUAL(MDNS_TYPE_A, types[3]);
+
+    // probed for, then announced twice, a second apart
+    MdnsReply r;
+    TEST_ASSERT_FALSE(guard.announcement(0, r));
+    uint32_t at = settle(guard, 0);
+    TEST_ASSERT_EQUAL(MDNS_PROBES * MDNS_PROBE_INTERVAL, at);
+    TEST_ASSERT_EQUAL(MDNS_PROBES, guard.probes);
+    TEST_ASSERT_TRUE(guard.announcement(at, r));
+    TEST_ASSERT_FALSE(r.unicast);
+    TEST_ASSERT_FALSE(guard.announcement(at + 999, r));
+    TEST_ASSERT_TRUE(guard.announcement(at + 1000, r));
+    TEST_ASSERT_FALSE(guard.announcement(at + 5000, r));
+
+    // rebuilt only when something changed
+    TEST_ASSERT_FALSE(guard.set(6000, service("Garage Door 1A2B3C", 0x3201A8C0, 7, false)));
+    TEST_ASSERT_TRUE(guard.set(6000, service("Garage Door 1A2B3C", 0x3201A8C0, 7, true)));
+    TEST_ASSERT_TRUE(guard.set(6000, service("Garage Door 1A2B3C", 0x3301A8C0, 7, true)));
+    TEST_ASSERT_TRUE(guard.set(6000, service("Garage Door 1A2B3C", 0x3301A8C0, 8, true)));
+    TEST_ASSERT_TRUE(guard.set(6000, service("Garage", 0x3301A8C0, 8, true)));
+    TEST_ASSERT_FALSE(guard.set(7000, service("Garage", 0x3301A8C0, 8, true)));
+    TEST_ASSERT_EQUAL(5, guard.rebuilds);
+    TEST_ASSERT_FALSE(guard.announcement(7000, r));
+    TEST_ASSERT_TRUE(guard.announcement(settle(guard, 7000), r));
+}
+
+void test_mdns_guard_questions(void) {
+    MdnsGuard guard;
+    MdnsReply r;
+
+    // nothing to say until there is a service
+    Query early;
+    early.question("_hap._tcp.local", MDNS_TYPE_PTR);
+    TEST_ASSERT_FALSE(ask(guard, 0, QUERIER, MDNS_PORT, early, r));
+    guard.set(0, service("Garage Door 1A2B3C", 0x3201A8C0, 7, false));
+    settle(guard, 0);
+
+    // about someone else
+    Query other;
+    other.question("_airplay._tcp.local", MDNS_TYPE_PTR);
+    other.question("Garage Door 1A2B3C._hap._tcp.local", MDNS_TYPE_A);
+    TEST_ASSERT_FALSE(ask(guard, 10000, QUERIER, MDNS_PORT, other, r));
+
+    // a response, and a truncated query
+    Query resp;
+    resp.question("_hap._tcp.local", MDNS_TYPE_PTR);
+    resp.buf[2] = 0x84;
+    TEST_ASSERT_FALSE(ask(guard, 10000, QUERIER, MDNS_PORT, resp, r));
+    Query cut;
+    cut.question("_hap._tcp.local", MDNS_TYPE_PTR);
+    cut.len -= 3;
+    TEST_ASSERT_FALSE(ask(guard, 10000, QUERIER, MDNS_PORT, cut, r));
+
+    // a compression loop
+    Query loop;
+    loop.put16(0xC00C);
+    loop.put16(MDNS_TYPE_PTR);
+    loop.put16(MDNS_CLASS_IN);
+    loop.questions = 1;
+    TEST_ASSERT_FALSE(ask(guard, 10000, QUERIER, MDNS_PORT, loop, r));
+    TEST_ASSERT_EQUAL(5, guard.ignored);
+
+    // in a mixed case and compressed, after another service's question
+    Query mixed;
+    size_t first = mixed.name("_airplay._tcp.local");
+    mixed.put16(MDNS_TYPE_PTR);
+    mixed.put16(MDNS_CLASS_IN);
+    mixed.label_then("_HAP", first + 9);
+    mixed.put16(MDNS_TYPE_PTR);
+    mixed.put16(MDNS_CLASS_IN);
+    mixed.questions = 2;
+    TEST_ASSERT_TRUE(ask(guard, 10000, QUERIER, MDNS_PORT, mixed, r));
+    TEST_ASSERT_FALSE(r.unicast);
+
+    // the host, by A
+    Query host;
+    host.question("garage-door-1a2b3c.local", MDNS_TYPE_A);
+    TEST_ASSERT_TRUE(ask(guard, 20000, QUERIER, MDNS_PORT, host, r));
+
+    // the instance, by SRV
+    Query srv;
+    srv.question("Garage Door 1A2B3C._hap._tcp.local", MDNS_TYPE_SRV);
+    TEST_ASSERT_TRUE(ask(guard, 30000, QUERIER, MDNS_PORT, srv, r));
+    TEST_ASSERT_EQUAL(3, guard.answered);
+}
+
+void test_mdns_guard_suppression(void) {
+    MdnsGuard guard;
+    MdnsReply r;
+    guard.set(0, service("Garage Door 1A2B3C", 0x3201A8C0, 7, false));
+    settle(guard, 0);
+
+    // every querier saw the answer to the first
+    Query q;
+    q.question("_hap._tcp.local", MDNS_TYPE_PTR);
+    TEST_ASSERT_TRUE(ask(guard, 10000, QUERIER, MDNS_PORT, q, r));
+    TEST_ASSERT_FALSE(ask(guard, 10200, QUERIER + 1, MDNS_PORT, q, r));
+    TEST_ASSERT_FALSE(ask(guard, 10999, QUERIER + 2, MDNS_PORT, q, r));
+    TEST_ASSERT_TRUE(ask(guard, 11000, QUERIER + 2, MDNS_PORT, q, r));
+    TEST_ASSERT_EQUAL(2, guard.duplicates);
+
+    // asked for a unicast answer, which the others didn't see
+    Query qu;
+    qu.question("_hap._tcp.local", MDNS_TYPE_PTR, MDNS_CLASS_IN | MDNS_UNICAST_RESPONSE);
+    TEST_ASSERT_TRUE(ask(guard, 11100, QUERIER + 3, MDNS_PORT, qu, r));
+    TEST_ASSERT_TRUE(r.unicast);
+
+    // a legacy resolver gets its id back
+    Query legacy(0xBEEF);
+    legacy.question("_hap._tcp.local", MDNS_TYPE_PTR);
+    TEST_ASSERT_TRUE(ask(guard, 11200, QUERIER + 4, LEGACY_PORT, legacy, r));
+    TEST_ASSERT_TRUE(r.unicast);
+    TEST_ASSERT_EQUAL_HEX(0xBEEF, get16(r.buf));
+    uint16_t len;
+    TEST_ASSERT_EQUAL_HEX(0, get16(guard.response(&len)));
+
+    // known answers
+    Query fresh;
+    fresh.question("_hap._tcp.local", MDNS_TYPE_PTR);
+    fresh.known_ptr("_hap._tcp.local", "Garage Door 1A2B3C._hap._tcp.local", MDNS_TTL_SERVICE - 10);
+    TEST_ASSERT_FALSE(ask(guard, 20000, QUERIER, MDNS_PORT, fresh, r));
+    TEST_ASSERT_EQUAL(1, guard.known);
+    Query stale;
+    stale.question("_hap._tcp.local", MDNS_TYPE_PTR);
+    stale.known_ptr("_hap._tcp.local", "Garage Door 1A2B3C._hap._tcp.local", MDNS_TTL_SERVICE / 2 - 1);
+    TEST_ASSERT_TRUE(ask(guard, 20000, QUERIER, MDNS_PORT, stale, r));
+    Query others;
+    others.question("_hap._tcp.local", MDNS_TYPE_PTR);
+    others.known_ptr("_hap._tcp.local", "Hallway Light._hap._tcp.local", MDNS_TTL_SERVICE);
+    TEST_ASSERT_TRUE(ask(guard, 30000, QUERIER, MDNS_PORT, others, r));
+
+    // one querier asking over and over, a burst and then one every MDNS_QUERIER_REFILL
+    uint32_t limited = guard.limited;
+    uint32_t answered = 0;
+    for (uint32_t t = 40000; t < 50000; t += 100) {
+        if (ask(guard, t, QUERIER + 9, MDNS_PORT, qu, r)) {
+            answered++;
+        }
+    }
+    TEST_ASSERT_EQUAL(MDNS_QUERIER_BURST + 10000 / MDNS_QUERIER_REFILL - 1, answered);
+    TEST_ASSERT_EQUAL(100 - answered, guard.limited - limited);
+    // without holding up anyone else
+    TEST_ASSERT_TRUE(ask(guard, 50000, QUERIER + 10, MDNS_PORT, qu, r));
+
+    // more queriers than entries, the least recently seen is forgotten
+    for (uint32_t i = 0; i < MDNS_QUERIERS * 2; i++) {
+        TEST_ASSERT_TRUE(ask(guard, 60000 + i, QUERIER + 100 + i, MDNS_PORT, qu, r));
+    }
+}
+
+void test_mdns_guard_probing(void) {
+    MdnsGuard guard;
+    MdnsReply r;
+    guard.set(0, service("Garage Door 1A2B3C", 0x3201A8C0, 7, false));
+    TEST_ASSERT_TRUE(guard.probing());
+
+    // the probe, read back
+    TEST_ASSERT_TRUE(guard.probe(0, r));
+    TEST_ASSERT_FALSE(r.unicast);
+    TEST_ASSERT_EQUAL(0, get16(r.buf + 2));
+    TEST_ASSERT_EQUAL(2, get16(r.buf + 4));
+    TEST_ASSERT_EQUAL(0, get16(r.buf + 6));
+    TEST_ASSERT_EQUAL(3, get16(r.buf + 8));
+    uint8_t name[MDNS_NAME_WIRE];
+    uint8_t expect[MDNS_NAME_WIRE];
+    size_t off = 12;
+    size_t at = 12;
+    Query e;
+    e.name("garage door 1a2b3c._hap._tcp.local");
+    e.name("garage-door-1a2b3c.local");
+    TEST_ASSERT_TRUE(MdnsGuard::read_name(r.buf, r.len, off, name));
+    TEST_ASSERT_TRUE(MdnsGuard::read_name(e.buf, e.len, at, expect));
+    TEST_ASSERT_TRUE(MdnsGuard::same_name(name, expect));
+    TEST_ASSERT_EQUAL(MDNS_TYPE_ANY, get16(r.buf + off));
+    TEST_ASSERT_EQUAL(MDNS_CLASS_IN | MDNS_UNICAST_RESPONSE, get16(r.buf + off + 2));
+    off += 4;
+    TEST_ASSERT_TRUE(MdnsGuard::read_name(r.buf, r.len, off, name));
+    TEST_ASSERT_TRUE(MdnsGuard::read_name(e.buf, e.len, at, expect));
+    TEST_ASSERT_TRUE(MdnsGuard::same_name(name, expect));
+    off += 4;
+    const uint16_t types[] = {MDNS_TYPE_SRV, MDNS_TYPE_TXT, MDNS_TYPE_A};
+    for (uint8_t i = 0; i < 3; i++) {
+        TEST_ASSERT_TRUE(MdnsGuard::read_name(r.buf, r.len, off, name));
+        TEST_ASSERT_EQUAL(types[i], get16(r.buf + off));
+        TEST_ASSERT_EQUAL(MDNS_CLASS_IN, get16(r.buf + off + 2));
+        off += 10 + get16(r.buf + off + 8);
+    }
+    TEST_ASSERT_EQUAL(r.len, off);
+
+    // nothing answered or announced while probing
+    Query q;
+    q.question("_hap._tcp.local", MDNS_TYPE_PTR);
+    TEST_ASSERT_FALSE(ask(guard, 100, QUERIER, MDNS_PORT, q, r));
+    TEST_ASSERT_EQUAL(1, guard.held);
+    TEST_ASSERT_FALSE(guard.announcement(100, r));
+
+    // our own records looped back, and another host with the same ones, aren't conflicts
+    const uint8_t ours[] = {192, 168, 1, 50};
+    Query echo;
+    echo.buf[2] = 0x84;
+    echo.record("garage-door-1a2b3c.local", MDNS_TYPE_A, ours, 4);
+    TEST_ASSERT_FALSE(ask(guard, 150, 0x3201A8C0, MDNS_PORT, echo, r));
+    TEST_ASSERT_FALSE(ask(guard, 150, QUERIER, MDNS_PORT, echo, r));
+    TEST_ASSERT_EQUAL(0, guard.conflicts);
+
+    // the host name taken, in mixed case
+    const uint8_t theirs[] = {192, 168, 1, 99};
+    Query taken;
+    taken.buf[2] = 0x84;
+    taken.record("Garage-Door-1A2B3C.local", MDNS_TYPE_A, theirs, 4);
+    TEST_ASSERT_FALSE(ask(guard, 200, QUERIER, MDNS_PORT, taken, r));
+    TEST_ASSERT_EQUAL(1, guard.conflicts);
+    TEST_ASSERT_EQUAL_STRING("Garage-Door-1A2B3C-2", guard.advertised().host);
+    TEST_ASSERT_EQUAL_STRING("Garage Door 1A2B3C", guard.advertised().instance);
+    TEST_ASSERT_TRUE(guard.probe(200, r));
+
+    // then the instance, by SRV
+    const uint8_t srv[] = "\0\0\0\0\x15\xB4\x05other\x05local";
+    Query instance;
+    instance.buf[2] = 0x84;
+    instance.record("Garage Door 1A2B3C._hap._tcp.local", MDNS_TYPE_SRV, srv, sizeof(srv));
+    TEST_ASSERT_FALSE(ask(guard, 300, QUERIER, MDNS_PORT, instance, r));
+    TEST_ASSERT_EQUAL_STRING("Garage Door 1A2B3C (2)", guard.advertised().instance);
+    TEST_ASSERT_EQUAL_STRING("Garage-Door-1A2B3C-2", guard.advertised().host);
+
+    // the old names are no longer ours to answer for, the new ones are once probed
+    uint32_t now = settle(guard, 300);
+    TEST_ASSERT_TRUE(guard.announcement(now, r));
+    Query old;
+    old.question("garage-door-1a2b3c.local", MDNS_TYPE_A);
+    TEST_ASSERT_FALSE(ask(guard, now + 2000, QUERIER, MDNS_PORT, old, r));
+    Query renamed;
+    renamed.question("Garage-Door-1A2B3C-2.local", MDNS_TYPE_A);
+    TEST_ASSERT_TRUE(ask(guard, now + 2000, QUERIER, MDNS_PORT, renamed, r));
+
+    // a conflict once the names are ours sends them back to probing, not renamed
+    Query later;
+    later.buf[2] = 0x84;
+    later.record("Garage-Door-1A2B3C-2.local", MDNS_TYPE_A, theirs, 4);
+    TEST_ASSERT_FALSE(ask(guard, 10000, QUERIER, MDNS_PORT, later, r));
+    TEST_ASSERT_TRUE(guard.probing());
+    TEST_ASSERT_EQUAL_STRING("Garage-Door-1A2B3C-2", guard.advertised().host);
+    TEST_ASSERT_TRUE(guard.announcement(settle(guard, 10000), r));
+
+    // a new name starts over without a suffix, a new TXT record is announced without probing
+    guard.set(20000, service("Garage", 0x3201A8C0, 7, false));
+    TEST_ASSERT_EQUAL_STRING("Garage", guard.advertised().host);
+    now = settle(guard, 20000);
+    TEST_ASSERT_TRUE(guard.announcement(now, r));
+    guard.set(now + 100, service("Garage", 0x3201A8C0, 8, false));
+    TEST_ASSERT_FALSE(guard.probing());
+    TEST_ASSERT_TRUE(guard.announcement(now + 100, r));
+
+    // a name too long for a suffix is cut short
+    char longname[MDNS_LABEL_SIZE];
+    memset(longname, 'x', sizeof(longname) - 1);
+    longname[sizeof(longname) - 1] = 0;
+    guard.set(30000, service(longname, 0x3201A8C0, 7, false));
+    const uint8_t txt[] = "\x09md=ratgdo";
+    Query full;
+    full.buf[2] = 0x84;
+    char owner[MDNS_LABEL_SIZE + 16];
+    snprintf(owner, sizeof(owner), "%s._hap._tcp.local", longname);
+    full.record(owner, MDNS_TYPE_TXT, txt, sizeof(txt) - 1);
+    TEST_ASSERT_FALSE(ask(guard, 30000, QUERIER, MDNS_PORT, full, r));
+    TEST_ASSERT_EQUAL(MDNS_LABEL_SIZE - 1, strlen(guard.advertised().instance));
+    TEST_ASSERT_EQUAL_STRING(" (2)", guard.advertised().instance + MDNS_LABEL_SIZE - 5);
+}
+
+void test_mdns_guard_tie_break(void) {
+    MdnsGuard guard;
+    MdnsReply r;
+    guard.set(0, service("Garage Door 1A2B3C", 0x3201A8C0, 7, false));
+    TEST_ASSERT_TRUE(guard.probe(0, r));
+
+    // another host probing for the host name at the same time, with an earlier address: we win
+    const uint8_t earlier[] = {192, 168, 1, 20};
+    Query lose;
+    lose.question("garage-door-1a2b3c.local", MDNS_TYPE_ANY, MDNS_CLASS_IN | MDNS_UNICAST_RESPONSE);
+    lose.record("garage-door-1a2b3c.local", MDNS_TYPE_A, earlier, 4, true);
+    TEST_ASSERT_FALSE(ask(guard, 100, QUERIER, MDNS_PORT, lose, r));
+    TEST_ASSERT_TRUE(guard.probe(250, r));
+
+    // with a later one it wins, and we probe again a second later, with the same name
+    const uint8_t later[] = {192, 168, 1, 200};
+    Query win;
+    win.question("garage-door-1a2b3c.local", MDNS_TYPE_ANY, MDNS_CLASS_IN | MDNS_UNICAST_RESPONSE);
+    win.record("garage-door-1a2b3c.local", MDNS_TYPE_A, later, 4, true);
+    TEST_ASSERT_FALSE(ask(guard, 300, QUERIER, MDNS_PORT, win, r));
+    TEST_ASSERT_FALSE(guard.probe(1299, r));
+    TEST_ASSERT_TRUE(guard.probe(1300, r));
+    TEST_ASSERT_EQUAL(0, guard.conflicts);
+    TEST_ASSERT_EQUAL_STRING("Garage-Door-1A2B3C", guard.advertised().host);
+
+    // a burst of conflicts slows probing down
+    char owner[MDNS_NAME_WIRE];
+    uint32_t now = 2000;
+    for (uint8_t i = 0; i < MDNS_CONFLICT_BURST; i++, now += 100) {
+        Query q;
+        q.buf[2] = 0x84;
+        snprintf(owner, sizeof(owner), "%s.local", guard.advertised().host);
+        q.record(owner, MDNS_TYPE_A, later, 4);
+        TEST_ASSERT_FALSE(ask(guard, now, QUERIER, MDNS_PORT, q, r));
+    }
+    TEST_ASSERT_EQUAL(MDNS_CONFLICT_BURST, guard.conflicts);
+    TEST_ASSERT_EQUAL_STRING("Garage-Door-1A2B3C-16", guard.advertised().host);
+    TEST_ASSERT_FALSE(guard.probe(now - 100 + MDNS_CONFLICT_WAIT - 1, r));
+    TEST_ASSERT_TRUE(guard.probe(now - 100 + MDNS_CONFLICT_WAIT, r));
+}
+
+// A household of devices browsing for HomeKit accessories among the rest of Bonjour, for a minute.
+// Apple devices list what they already know, a third of the devices (other controllers, apps)
+// don't. Answers from a responder that answers everything but known answers, and from the guard.
+void test_mdns_guard_busy_network(void) {
+    const uint32_t run = 60000;
+    const uint32_t devices = 30;
+    const uint32_t other_per_s = 150;
+    const char* others[] = {"_airplay._tcp.local", "_raop._tcp.local", "_companion-link._tcp.local",
+                            "_googlecast._tcp.local", "_ipp._tcp.local", "_spotify-connect._tcp.local"};
+
+    MdnsGuard guard;
+    MdnsReply r;
+    guard.set(0, service("Garage Door 1A2B3C", 0x3201A8C0, 7, true));
+    srand(1);
+
+    uint32_t next[devices];
+    uint32_t heard[devices];        // last time each device saw our PTR, for its known answers
+    for (uint32_t d = 0; d < devices; d++) {
+        next[d] = rand() % 4000;
+        heard[d] = 0xFFFFFFFF;
+    }
+    uint32_t about_us = 0;
+    uint32_t not_known = 0;
+    uint32_t bytes = 0;
+    uint32_t unanswered = 0;
+    uint32_t last_multicast = 0xFFFFFFFF;
+    for (uint32_t now = 0; now < run; now++) {
+        MdnsReply a;
+        if (guard.probe(now, a)) {
+            bytes += a.len;
+        }
+        if (guard.announcement(now, a)) {
+            bytes += a.len;
+            last_multicast = now;
+            for (uint32_t d = 0; d < devices; d++) {
+                heard[d] = now;
+            }
+        }
+        // the rest of Bonjour
+        if (now % (1000 / other_per_s) == 0) {
+            Query q;
+            q.question(others[rand() % 6], MDNS_TYPE_PTR);
+            TEST_ASSERT_FALSE(ask(guard, now, QUERIER + 1000, MDNS_PORT, q, r));
+        }
+        for (uint32_t d = 0; d < devices; d++) {
+            if (now < next[d]) {
+                continue;
+            }
+            // a half to five seconds between queries, and a fifth of them asking for unicast
+            next[d] = now + 500 + rand() % 4500;
+            bool qu = rand() % 5 == 0;
+            Query q;
+            q.question(others[d % 6], MDNS_TYPE_PTR);
+            q.question("_hap._tcp.local", MDNS_TYPE_PTR, MDNS_CLASS_IN | (qu ? MDNS_UNICAST_RESPONSE : 0));
+            bool lists = d % 3 && heard[d] != 0xFFFFFFFF;
+            if (!lists) {
+                not_known++;
+            }
+            if (lists) {
+                q.known_ptr("_hap._tcp.local", "Garage Door 1A2B3C._hap._tcp.local",
+                            MDNS_TTL_SERVICE - (now - heard[d]) / 1000);
+            }
+            about_us++;
+            if (ask(guard, now, QUERIER + d, MDNS_PORT, q, r)) {
+                bytes += r.len;
+                if (r.unicast) {
+                    heard[d] = now;
+                } else {
+                    last_multicast = now;
+                    for (uint32_t e = 0; e < devices; e++) {
+                        heard[e] = now;
+                    }
+                }
+            } else if (!lists && now - last_multicast >= MDNS_REPEAT && now - heard[d] >= MDNS_QUERIER_REFILL) {
+                // a querier that never got the answer
+                unanswered++;
+            }
+        }
+    }
+
+    uint16_t len;
+    guard.response(&len);
+    printf("\n%u queries in %u s, %u about HomeKit, from %u devices\n", guard.queries, run / 1000, about_us, devices);
+    printf("  every query:      %u answers, %u bytes\n", about_us, about_us * len);
+    printf("  but known:        %u answers, %u bytes\n", not_known, not_known * len);
+    printf("  with the guard:   %u answers, %u bytes, suppressed %u known, %u duplicate, %u limited\n",
+           guard.answered, bytes, guard.known, guard.duplicates, guard.limited);
+    TEST_ASSERT_EQUAL(0, unanswered);
+    TEST_ASSERT_EQUAL(about_us, guard.answered + guard.suppressed());
+    TEST_ASSERT_EQUAL(guard.queries - about_us, guard.ignored);
+    TEST_ASSERT_TRUE(guard.answered * 2 < not_known);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_mdns_guard_response);
+    RUN_TEST(test_mdns_guard_questions);
+    RUN_TEST(test_mdns_guard_suppression);
+    RUN_TEST(test_mdns_guard_probing);
+    RUN_TEST(test_mdns_guard_tie_break);
+    RUN_TEST(test_mdns_guard_busy_network);
+    UNITY_END();
+
+    return 0;
+}
@@ -0,0 +1,148 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <NotifyGate.h>
+
+#define OPENER_REPLY 120        // ms from a light command to the opener's status
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+struct Notifier {
+    NotifyGate gate;
+    bool light = false;
+    uint32_t sent = 0;          // light notifications that went out
+    bool last_sent = false;
+
+    void notify_light() {
+        if (gate.pass(NOTIFY_LIGHT)) {
+            sent++;
+            last_sent = light;
+        }
+    }
+
+    // the opener reports the light
+    void status(bool l) {
+        if (l != light) {
+            light = l;
+            notify_light();
+        }
+    }
+
+    void loop(uint32_t now) {
+        if (gate.due(now) & (1 << NOTIFY_LIGHT)) {
+            if (gate.end(NOTIFY_LIGHT, light)) {
+                notify_light();
+            }
+        }
+    }
+};
+
+// A time-to-close delay of `delay` seconds, as close_door() and TTCdelayLoop() run it. Returns
+// the light notifications sent.
+static uint32_t ttc_cycle(Notifier &n, uint8_t delay, bool gated) {
+    uint32_t now = 1000;
+    uint8_t countdown = delay * 2;
+    if (gated) {
+        n.gate.hold(NOTIFY_LIGHT, n.light);
+    }
+    uint32_t sent = n.sent;
+    for (;;) {
+        now += 500;
+        if (--countdown > 0) {
+            bool l = !n.light;
+            for (uint32_t t = 0; t < 500; t += 10) {
+                if (t == OPENER_REPLY) {
+                    n.status(l);
+                }
+                n.loop(now + t);
+            }
+        } else {
+            if (gated) {
+                n.gate.release(NOTIFY_LIGHT, now + NOTIFY_SETTLE);
+            }
+            break;
+        }
+    }
+    for (uint32_t t = 0; t <= NOTIFY_SETTLE; t += 10) {
+        n.loop(now + t);
+    }
+    TEST_ASSERT_FALSE(n.gate.holding(NOTIFY_LIGHT));
+    return n.sent - sent;
+}
+
+void test_notify_gate_hold(void) {
+    NotifyGate gate;
+    TEST_ASSERT_TRUE(gate.pass(NOTIFY_LIGHT));
+
+    // held until released, then until the release time
+    gate.hold(NOTIFY_LIGHT, false);
+    TEST_ASSERT_TRUE(gate.holding(NOTIFY_LIGHT));
+    TEST_ASSERT_FALSE(gate.pass(NOTIFY_LIGHT));
+    TEST_ASSERT_FALSE(gate.pass(NOTIFY_LIGHT));
+    TEST_ASSERT_TRUE(gate.pass(NOTIFY_LOCK));
+    TEST_ASSERT_EQUAL(0, gate.due(100000));
+    gate.release(NOTIFY_LIGHT, 2000);
+    TEST_ASSERT_EQUAL(0, gate.due(1999));
+    TEST_ASSERT_EQUAL(1 << NOTIFY_LIGHT, gate.due(2000));
+
+    // back where it started, nothing to tell
+    TEST_ASSERT_FALSE(gate.end(NOTIFY_LIGHT, false));
+    TEST_ASSERT_EQUAL(2, gate.last_held);
+    TEST_ASSERT_EQUAL(2, gate.held);
+    TEST_ASSERT_EQUAL(0, gate.reconciled);
+    TEST_ASSERT_TRUE(gate.pass(NOTIFY_LIGHT));
+    TEST_ASSERT_FALSE(gate.end(NOTIFY_LIGHT, true));
+
+    // a hold only gets longer
+    gate.hold(NOTIFY_LOCK, 1, 3000);
+    gate.hold(NOTIFY_LOCK, 0, 2000);
+    TEST_ASSERT_EQUAL(0, gate.due(2500));
+    gate.hold(NOTIFY_LOCK, 0, 4000);
+    TEST_ASSERT_EQUAL(0, gate.due(3500));
+    gate.hold(NOTIFY_LOCK, 0);
+    TEST_ASSERT_EQUAL(0, gate.due(10000));
+    gate.release(NOTIFY_LOCK, 11000);
+    TEST_ASSERT_EQUAL(1 << NOTIFY_LOCK, gate.due(11000));
+    // changed, from the value at the start of the hold
+    TEST_ASSERT_TRUE(gate.end(NOTIFY_LOCK, 0));
+    TEST_ASSERT_EQUAL(1, gate.reconciled);
+
+    // across millis() wrapping
+    gate.hold(NOTIFY_LIGHT, 0, 0xFFFFFF00 + 0x200);
+    TEST_ASSERT_EQUAL(0, gate.due(0xFFFFFF00));
+    TEST_ASSERT_EQUAL(1 << NOTIFY_LIGHT, gate.due(0x100));
+}
+
+void test_notify_gate_ttc(void) {
+    printf("\nTime-to-close light notifications per cycle:\n");
+    const uint8_t delays[] = {5, 10, 30, 60};
+    for (uint8_t i = 0; i < sizeof(delays); i++) {
+        Notifier plain;
+        Notifier gated;
+        uint32_t before = ttc_cycle(plain, delays[i], false);
+        uint32_t after = ttc_cycle(gated, delays[i], true);
+
+        // the light ends up where the flashing left it, and that is notified once
+        TEST_ASSERT_EQUAL(plain.light, gated.light);
+        TEST_ASSERT_EQUAL(gated.light, gated.last_sent);
+        TEST_ASSERT_EQUAL(delays[i] * 2 - 1, before);
+        TEST_ASSERT_EQUAL(gated.light ? 1 : 0, after);
+        TEST_ASSERT_EQUAL(before, gated.gate.last_held);
+        printf("  %2u s delay: %3u without holding, %u with, %u saved\n", delays[i], before, after,
+               gated.gate.last_held - after);
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_notify_gate_hold);
+    RUN_TEST(test_notify_gate_ttc);
+    UNITY_END();
+
+    return 0;
+}
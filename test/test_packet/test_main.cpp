@@ -1,8 +1,20 @@
 
 #include <unity.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <Packet.h>
 
+#if defined(ARDUINO)
+#include <Arduino.h>
+static inline uint32_t cycles(void) { return ESP.getCycleCount(); }
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t cycles(void) { return __rdtsc(); }
+#else
+#include <time.h>
+static inline uint64_t cycles(void) { return clock(); }
+#endif
+
 void setUp(void) {
 }
 
@@ -20,6 +32,153 @@ void tearDown(void) {
  *     printf("cmd %X\n", cmd);
  */
 
+// The hand-written mask-and-shift codecs the layouts replaced, for comparison
+namespace ref {
+
+struct Status {
+    uint8_t door, parity;
+    bool unknown1, obstruction, lock, light, unknown2;
+};
+
+static inline Status status_decode(uint32_t d) {
+    Status s;
+    s.door = (d >> 8) & 0b1111;
+    s.parity = (d >> 12) & 0b1111;
+    s.unknown1 = (d >> 21) & 1;
+    s.obstruction = (d >> 22) & 1;
+    s.lock = (d >> 24) & 1;
+    s.light = (d >> 25) & 1;
+    s.unknown2 = (d >> 30) & 1;
+    return s;
+}
+
+static inline uint32_t status_encode(const Status &s) {
+    uint32_t d = 0;
+    d |= s.door << 8;
+    d |= s.parity << 12;
+    d |= s.unknown1 << 21;
+    d |= s.obstruction << 22;
+    d |= s.lock << 24;
+    d |= s.light << 25;
+    d |= s.unknown2 << 30;
+    return d;
+}
+
+static inline uint32_t door_action(uint32_t d) {
+    uint8_t action = (d >> 8) & 0b11;
+    uint8_t parity = (d >> 12) & 0b1111;
+    bool pressed = (d >> 16) & 1;
+    uint8_t id = (d >> 24) & 0b11;
+    return action << 8 | parity << 12 | pressed << 16 | (id & 0b11) << 24;
+}
+
+static inline uint32_t light(uint32_t d) {
+    return ((d >> 8) & 0b11) << 8 | ((d >> 12) & 0b1111) << 12;
+}
+
+static inline uint32_t openings(uint32_t d, uint16_t *count) {
+    uint8_t lo = (d >> 24) & 0xFF;
+    uint8_t hi = (d >> 16) & 0xFF;
+    uint8_t parity = (d >> 12) & 0b1111;
+    *count = hi << 8 | lo;
+    return (uint32_t)(*count & 0xFF) << 24 | (*count >> 8) << 16 | parity << 12;
+}
+
+}
+
+static uint32_t next_word(uint32_t *x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 17;
+    *x ^= *x << 5;
+    return *x;
+}
+
+void test_packet_data_layouts(void) {
+    uint32_t x = 0x12345678;
+    for (int i = 0; i < 10000; i++) {
+        uint32_t d = next_word(&x);
+
+        StatusCommandData status(d);
+        ref::Status rs = ref::status_decode(d);
+        TEST_ASSERT_EQUAL(rs.door, static_cast<uint8_t>(status.door));
+        TEST_ASSERT_EQUAL(rs.parity, status.parity);
+        TEST_ASSERT_EQUAL(rs.obstruction, status.obstruction);
+        TEST_ASSERT_EQUAL(rs.lock, status.lock);
+        TEST_ASSERT_EQUAL(rs.light, status.light);
+        TEST_ASSERT_EQUAL_HEX(ref::status_encode(rs), status.to_data());
+        TEST_ASSERT_EQUAL_HEX(d & StatusCommandData::Layout::mask, status.to_data());
+
+        TEST_ASSERT_EQUAL_HEX(ref::door_action(d), DoorActionCommandData(d).to_data());
+        TEST_ASSERT_EQUAL_HEX(ref::light(d), LightCommandData(d).to_data());
+        TEST_ASSERT_EQUAL_HEX(ref::light(d), LockCommandData(d).to_data());
+        uint16_t count;
+        TEST_ASSERT_EQUAL_HEX(ref::openings(d, &count), OpeningsCommandData(d).to_data());
+        TEST_ASSERT_EQUAL(count, OpeningsCommandData(d).count);
+
+        // compact holds the same fields in fewer bits
+        uint32_t packed = StatusCommandData::Layout::compact(status);
+        TEST_ASSERT_TRUE(packed < (1 << 13));
+        StatusCommandData expanded;
+        StatusCommandData::Layout::expand(expanded, packed);
+        TEST_ASSERT_TRUE(expanded == status);
+        OpeningsCommandData openings(d);
+        OpeningsCommandData openings_expanded;
+        OpeningsCommandData::Layout::expand(openings_expanded, OpeningsCommandData::Layout::compact(openings));
+        TEST_ASSERT_EQUAL(count, openings_expanded.count);
+    }
+
+    StatusCommandData a(0);
+    StatusCommandData b(0);
+    TEST_ASSERT_TRUE(a == b);
+    TEST_ASSERT_EQUAL_HEX(0, StatusCommandData::Layout::diff(a, b));
+    b.light = true;
+    b.door = DoorState::Opening;
+    TEST_ASSERT_FALSE(a == b);
+    // door and light, the first and sixth fields
+    TEST_ASSERT_EQUAL_HEX(0b100001, StatusCommandData::Layout::diff(a, b));
+    TEST_ASSERT_EQUAL_HEX(0x02000400, b.to_data());
+
+    // every bit a field covers
+    static_assert(BitField<8, 4, DoorState>::mask == 0xF00, "mask");
+    static_assert(StatusCommandData::Layout::mask == 0x4360FF00, "status mask");
+    static_assert(OpeningsCommandData::Layout::mask == 0xFFFFF000, "openings mask");
+}
+
+// Not a pass/fail test, prints the cost of a decode and encode of each payload
+void test_packet_data_benchmark(void) {
+    const int iterations = 20000;
+    static uint32_t words[256];
+    uint32_t x = 0xCAFEF00D;
+    for (int i = 0; i < 256; i++) {
+        words[i] = next_word(&x);
+    }
+    volatile uint32_t sink = 0;
+    uint16_t count;
+
+    uint64_t start = cycles();
+    for (int i = 0; i < iterations; i++) {
+        uint32_t d = words[i & 0xFF];
+        sink += ref::status_encode(ref::status_decode(d));
+        sink += ref::door_action(d);
+        sink += ref::light(d);
+        sink += ref::openings(d, &count);
+    }
+    uint64_t hand = cycles() - start;
+
+    start = cycles();
+    for (int i = 0; i < iterations; i++) {
+        uint32_t d = words[i & 0xFF];
+        sink += StatusCommandData(d).to_data();
+        sink += DoorActionCommandData(d).to_data();
+        sink += LightCommandData(d).to_data();
+        sink += OpeningsCommandData(d).to_data();
+    }
+    uint64_t layout = cycles() - start;
+
+    printf("cycles per status, door action, light and openings decode+encode: hand-written %.1f, layout %.1f\n",
+           (double)hand / iterations, (double)layout / iterations);
+}
+
 void test_packet_status_recd(void) {
     uint8_t test_data[SECPLUS2_CODE_LEN] = {
         0x55, 0x01, 0x00, 0xA5, 0x2F, 0xB3, 0xDB, 0xCE, 0x8F, 0x5B, 0x0C, 0x40, 0x34, 0xB9, 0x71, 0x96, 0x73, 0xFD, 0xBA };
@@ -171,6 +330,8 @@ int main(int argc, char **argv) {
     UNITY_BEGIN();
     RUN_TEST(test_packet_status_recd);
     RUN_TEST(test_packet_door_action_xmit);
+    RUN_TEST(test_packet_data_layouts);
+    RUN_TEST(test_packet_data_benchmark);
     // RUN_TEST(test_packet_get_openings);
     RUN_TEST(print_some_packets);
     UNITY_END();
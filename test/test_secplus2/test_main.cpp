@@ -0,0 +1,231 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <secplus.h>
+#include <secplus2_codec.h>
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+static inline uint32_t cycles(void) { return ESP.getCycleCount(); }
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t cycles(void) { return __rdtsc(); }
+#else
+#include <time.h>
+static inline uint64_t cycles(void) { return clock(); }
+#endif
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+// every distinct packet in test_packet
+static const uint8_t vectors[][SECPLUS2_CODE_LEN] = {
+    {0x55, 0x01, 0x00, 0xA5, 0x2F, 0xB3, 0xDB, 0xCE, 0x8F, 0x5B, 0x0C, 0x40, 0x34, 0xB9, 0x71, 0x96, 0x73, 0xFD, 0xBA},
+    {0x55, 0x01, 0x00, 0xA0, 0x37, 0xDF, 0x77, 0xB6, 0xFB, 0xED, 0xB0, 0x88, 0x22, 0x91, 0x05, 0x21, 0x72, 0x4D, 0x2C},
+    {0x55, 0x01, 0x00, 0x94, 0x3F, 0xFD, 0xE7, 0xDF, 0x7F, 0xBE, 0xFF, 0x52, 0x0C, 0x26, 0xDA, 0x4E, 0xA9, 0x8A, 0x67},
+    {0x55, 0x01, 0x00, 0x99, 0x02, 0x11, 0x40, 0x8E, 0x8D, 0x48, 0x0C, 0x65, 0x29, 0x85, 0xC7, 0x7D, 0xC0, 0xCA, 0x2B},
+    {0x55, 0x01, 0x00, 0x54, 0x17, 0x21, 0xEE, 0xAB, 0xE1, 0xEF, 0xAF, 0x06, 0x19, 0x2F, 0xC6, 0x53, 0xCD, 0xB6, 0x4E},
+    {0x55, 0x01, 0x00, 0x00, 0x36, 0xDB, 0x2D, 0xB6, 0xDB, 0x6D, 0xB6, 0x00, 0x36, 0xFD, 0xBC, 0xB6, 0xE9, 0x6F, 0xBB},
+    {0x55, 0x01, 0x00, 0xAA, 0x2C, 0xB2, 0x59, 0x6D, 0x96, 0x59, 0x61, 0xA0, 0x36, 0x94, 0x0C, 0xB7, 0x3B, 0xAD, 0xB6},
+    {0x55, 0x01, 0x00, 0x55, 0x2D, 0x96, 0xCB, 0x2C, 0xB2, 0xCB, 0x2C, 0x50, 0x37, 0x68, 0x0D, 0x36, 0x1C, 0x5D, 0xB4},
+    {0x55, 0x01, 0x00, 0x54, 0x37, 0xFB, 0xEF, 0xBE, 0xFB, 0xEF, 0xBD, 0x41, 0x02, 0xDB, 0xF4, 0xD0, 0xE1, 0x34, 0x90},
+    {0x55, 0x01, 0x00, 0x22, 0x09, 0x20, 0x99, 0x49, 0x24, 0x12, 0x41, 0x20, 0x3E, 0x94, 0x0C, 0xB6, 0x1B, 0xCD, 0xA6},
+    {0x55, 0x01, 0x00, 0x21, 0x1A, 0x49, 0x2F, 0x92, 0x49, 0xA4, 0x93, 0x11, 0x32, 0xEC, 0x94, 0x16, 0x29, 0x74, 0x9E},
+    {0x55, 0x01, 0x00, 0x99, 0x30, 0x3D, 0x6A, 0x07, 0x80, 0x48, 0x04, 0x42, 0x0D, 0x64, 0x73, 0x43, 0x88, 0x03, 0x5D},
+    {0x55, 0x01, 0x00, 0x44, 0x1D, 0x89, 0xBD, 0xEA, 0xF7, 0xFF, 0x7A, 0xA2, 0x03, 0x26, 0xA2, 0xE9, 0xC4, 0x12, 0x61},
+    {0x55, 0x01, 0x00, 0x44, 0x1D, 0x89, 0xBD, 0xEA, 0xF7, 0xFF, 0x7E, 0xA2, 0x03, 0x26, 0xA2, 0xE9, 0xC4, 0x52, 0x61},
+    {0x55, 0x01, 0x00, 0x09, 0x08, 0xF4, 0x80, 0x71, 0x14, 0x84, 0x22, 0x59, 0x08, 0x01, 0x60, 0x61, 0xCC, 0x32, 0x85},
+    {0x55, 0x01, 0x00, 0x09, 0x08, 0xF4, 0x88, 0x71, 0x00, 0x04, 0x02, 0x59, 0x08, 0x01, 0x60, 0x61, 0xCD, 0x13, 0x01},
+    {0x55, 0x01, 0x00, 0x42, 0x29, 0x1A, 0xD0, 0x5C, 0x2C, 0x92, 0x59, 0x94, 0x1D, 0xEF, 0x1E, 0x73, 0x1B, 0x2E, 0x7D},
+    {0x55, 0x01, 0x00, 0x89, 0x30, 0x36, 0x62, 0x85, 0x40, 0x04, 0x07, 0x41, 0x06, 0x48, 0xE5, 0x1A, 0xE1, 0x24, 0x98},
+    {0x55, 0x01, 0x00, 0x89, 0x30, 0x36, 0x62, 0x85, 0x40, 0x04, 0x03, 0x41, 0x06, 0x48, 0xE5, 0x1A, 0xE1, 0x34, 0x98},
+    {0x55, 0x01, 0x00, 0x88, 0x04, 0xE4, 0x2B, 0xA1, 0xD2, 0x4D, 0x24, 0x22, 0x03, 0x22, 0x30, 0xE8, 0xF6, 0x52, 0xC3},
+    {0x55, 0x01, 0x00, 0x52, 0x28, 0xFE, 0x83, 0x5D, 0x3A, 0x82, 0x51, 0xA8, 0x2C, 0x90, 0x3B, 0x35, 0x62, 0xCA, 0x22},
+    {0x55, 0x01, 0x00, 0x52, 0x28, 0xFE, 0x87, 0x5D, 0x20, 0x82, 0x41, 0xA8, 0x2C, 0x90, 0x3B, 0x35, 0x60, 0xCB, 0xA4},
+    {0x55, 0x01, 0x00, 0xA9, 0x10, 0xD9, 0x82, 0xAA, 0x39, 0x82, 0x21, 0x56, 0x1B, 0x68, 0xC4, 0xFB, 0xA8, 0x86, 0x87},
+    {0x55, 0x01, 0x00, 0x88, 0x26, 0x93, 0x4B, 0x34, 0xD2, 0x4D, 0x21, 0x80, 0x34, 0x49, 0xBD, 0xF6, 0x3B, 0x6D, 0xBE},
+    {0x55, 0x01, 0x00, 0x88, 0x26, 0x93, 0x4B, 0x34, 0xD2, 0x4D, 0x25, 0x80, 0x34, 0x49, 0xBD, 0xF6, 0x3B, 0x7D, 0xBE},
+};
+static const size_t num_vectors = sizeof(vectors) / sizeof(vectors[0]);
+
+// small deterministic PRNG so failures are reproducible
+static uint32_t lcg_state = 0x1234567;
+static uint32_t lcg(void) {
+    lcg_state = lcg_state * 1664525 + 1013904223;
+    return lcg_state;
+}
+
+template <bool WORD64>
+void check_vectors(void) {
+    for (size_t i = 0; i < num_vectors; i++) {
+        uint32_t ref_rolling = 0, rolling = 0;
+        uint64_t ref_fixed = 0, fixed = 0;
+        uint32_t ref_data = 0, data = 0;
+
+        TEST_ASSERT_EQUAL(0, decode_wireline(vectors[i], &ref_rolling, &ref_fixed, &ref_data));
+        TEST_ASSERT_EQUAL(0, secplus2_decode<WORD64>(vectors[i], &rolling, &fixed, &data));
+        TEST_ASSERT_EQUAL_HEX32(ref_rolling, rolling);
+        TEST_ASSERT_EQUAL_HEX64(ref_fixed, fixed);
+        TEST_ASSERT_EQUAL_HEX32(ref_data, data);
+
+        uint8_t out[SECPLUS2_CODE_LEN];
+        TEST_ASSERT_EQUAL(0, secplus2_encode<WORD64>(rolling, fixed, data, out));
+        TEST_ASSERT_EQUAL_MEMORY(vectors[i], out, SECPLUS2_CODE_LEN);
+    }
+}
+
+void test_codec_vectors_32(void) { check_vectors<false>(); }
+void test_codec_vectors_64(void) { check_vectors<true>(); }
+
+void test_codec_known_values(void) {
+    uint32_t rolling = 0;
+    uint64_t fixed = 0;
+    uint32_t data = 0;
+
+    // test_packet_status_recd
+    TEST_ASSERT_EQUAL(0, secplus2_decode_wireline(vectors[0], &rolling, &fixed, &data));
+    TEST_ASSERT_EQUAL_HEX32(0x17702, rolling);
+    TEST_ASSERT_EQUAL_HEX32(0x52402A, fixed & 0xFFFFFF);
+    TEST_ASSERT_EQUAL_HEX32(0x081, ((fixed >> 24) & 0xF00) | (data & 0xFF));
+
+    // test_packet_door_action_xmit
+    uint8_t out[SECPLUS2_CODE_LEN];
+    TEST_ASSERT_EQUAL(0, secplus2_encode_wireline(0x48, 0x200000539, 0x01018280, out));
+    TEST_ASSERT_EQUAL_MEMORY(vectors[1], out, SECPLUS2_CODE_LEN);
+}
+
+// random values through both kernels and the reference, in both directions
+void test_codec_random_roundtrip(void) {
+    for (int i = 0; i < 20000; i++) {
+        uint32_t rolling = lcg() & 0x0FFFFFFF;
+        uint64_t fixed = (((uint64_t)lcg() << 32) | lcg()) & 0xFFFFFFFFFF;
+        uint32_t data = lcg();
+
+        uint8_t ref[SECPLUS2_CODE_LEN], out32[SECPLUS2_CODE_LEN], out64[SECPLUS2_CODE_LEN];
+        TEST_ASSERT_EQUAL(0, encode_wireline(rolling, fixed, data, ref));
+        TEST_ASSERT_EQUAL(0, secplus2_encode<false>(rolling, fixed, data, out32));
+        TEST_ASSERT_EQUAL(0, secplus2_encode<true>(rolling, fixed, data, out64));
+        TEST_ASSERT_EQUAL_MEMORY(ref, out32, SECPLUS2_CODE_LEN);
+        TEST_ASSERT_EQUAL_MEMORY(ref, out64, SECPLUS2_CODE_LEN);
+
+        uint32_t r_rolling = 0, r_data = 0;
+        uint64_t r_fixed = 0;
+        TEST_ASSERT_EQUAL(0, secplus2_decode<false>(ref, &r_rolling, &r_fixed, &r_data));
+        TEST_ASSERT_EQUAL_HEX32(rolling, r_rolling);
+        TEST_ASSERT_EQUAL_HEX64(fixed, r_fixed);
+        TEST_ASSERT_EQUAL_HEX32(data, r_data);
+        TEST_ASSERT_EQUAL(0, secplus2_decode<true>(ref, &r_rolling, &r_fixed, &r_data));
+        TEST_ASSERT_EQUAL_HEX32(rolling, r_rolling);
+        TEST_ASSERT_EQUAL_HEX64(fixed, r_fixed);
+        TEST_ASSERT_EQUAL_HEX32(data, r_data);
+    }
+}
+
+// rolling code extremes
+void test_codec_rolling_edges(void) {
+    const uint32_t values[] = {0, 1, 2, 3, 0x7FFFFFF, 0x8000000, 0xFFFFFFE, 0xFFFFFFF};
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        uint8_t out[SECPLUS2_CODE_LEN];
+        uint32_t rolling = 0, data = 0;
+        uint64_t fixed = 0;
+        TEST_ASSERT_EQUAL(0, secplus2_encode_wireline(values[i], 0, 0, out));
+        TEST_ASSERT_EQUAL(0, secplus2_decode_wireline(out, &rolling, &fixed, &data));
+        TEST_ASSERT_EQUAL_HEX32(values[i], rolling);
+    }
+}
+
+void test_codec_rejects_invalid(void) {
+    uint8_t out[SECPLUS2_CODE_LEN];
+    uint32_t rolling = 0, data = 0;
+    uint64_t fixed = 0;
+
+    TEST_ASSERT_EQUAL(-1, secplus2_encode_wireline(0x10000000, 0, 0, out));
+    TEST_ASSERT_EQUAL(-1, secplus2_encode_wireline(0, 0x10000000000, 0, out));
+
+    uint8_t bad[SECPLUS2_CODE_LEN];
+    memcpy(bad, vectors[0], SECPLUS2_CODE_LEN);
+    bad[1] = 0x02;  // preamble
+    TEST_ASSERT_EQUAL(-1, secplus2_decode_wireline(bad, &rolling, &fixed, &data));
+
+    memcpy(bad, vectors[0], SECPLUS2_CODE_LEN);
+    bad[3] |= 0xC0;  // invalid trit in the order nibble
+    TEST_ASSERT_EQUAL(-1, secplus2_decode_wireline(bad, &rolling, &fixed, &data));
+
+    memcpy(bad, vectors[0], SECPLUS2_CODE_LEN);
+    bad[3] ^= 0x01;  // header no longer matches the copy in part 2
+    TEST_ASSERT_EQUAL(-1, secplus2_decode_wireline(bad, &rolling, &fixed, &data));
+}
+
+// Not a pass/fail test, prints the average cost of each implementation.
+void test_codec_benchmark(void) {
+    const int iterations = 2000;
+    uint32_t rolling = 0, data = 0;
+    uint64_t fixed = 0;
+    uint8_t out[SECPLUS2_CODE_LEN];
+    volatile uint32_t sink = 0;
+
+    uint64_t start = cycles();
+    for (int i = 0; i < iterations; i++) {
+        decode_wireline(vectors[i % num_vectors], &rolling, &fixed, &data);
+        sink += rolling;
+    }
+    uint64_t ref_decode = cycles() - start;
+
+    start = cycles();
+    for (int i = 0; i < iterations; i++) {
+        secplus2_decode<false>(vectors[i % num_vectors], &rolling, &fixed, &data);
+        sink += rolling;
+    }
+    uint64_t decode32 = cycles() - start;
+
+    start = cycles();
+    for (int i = 0; i < iterations; i++) {
+        secplus2_decode<true>(vectors[i % num_vectors], &rolling, &fixed, &data);
+        sink += rolling;
+    }
+    uint64_t decode64 = cycles() - start;
+
+    start = cycles();
+    for (int i = 0; i < iterations; i++) {
+        encode_wireline(i, 0x200000539, 0x01018280, out);
+        sink += out[10];
+    }
+    uint64_t ref_encode = cycles() - start;
+
+    start = cycles();
+    for (int i = 0; i < iterations; i++) {
+        secplus2_encode<false>(i, 0x200000539, 0x01018280, out);
+        sink += out[10];
+    }
+    uint64_t encode32 = cycles() - start;
+
+    start = cycles();
+    for (int i = 0; i < iterations; i++) {
+        secplus2_encode<true>(i, 0x200000539, 0x01018280, out);
+        sink += out[10];
+    }
+    uint64_t encode64 = cycles() - start;
+
+    printf("cycles/packet  decode: ref %u, w32 %u, w64 %u  encode: ref %u, w32 %u, w64 %u\n",
+           (unsigned)(ref_decode / iterations), (unsigned)(decode32 / iterations), (unsigned)(decode64 / iterations),
+           (unsigned)(ref_encode / iterations), (unsigned)(encode32 / iterations), (unsigned)(encode64 / iterations));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_codec_vectors_32);
+    RUN_TEST(test_codec_vectors_64);
+    RUN_TEST(test_codec_known_values);
+    RUN_TEST(test_codec_random_roundtrip);
+    RUN_TEST(test_codec_rolling_edges);
+    RUN_TEST(test_codec_rejects_invalid);
+    RUN_TEST(test_codec_benchmark);
+    UNITY_END();
+
+    return 0;
+}
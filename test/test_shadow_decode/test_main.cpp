@@ -0,0 +1,183 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <string.h>
+#include <ShadowDecode.h>
+#include <ShadowCandidate.h>
+
+// Status: door closed, obstructed, light on, unlocked. From test_packet.
+static const uint8_t status_pkt[SECPLUS2_CODE_LEN] = {
+    0x55, 0x01, 0x00, 0xA5, 0x2F, 0xB3, 0xDB, 0xCE, 0x8F, 0x5B, 0x0C, 0x40, 0x34, 0xB9, 0x71, 0x96, 0x73, 0xFD, 0xBA };
+
+static ShadowState state(uint8_t door, uint8_t light, uint8_t lock) {
+    ShadowState s;
+    s.door = door;
+    s.light = light;
+    s.lock = lock;
+    return s;
+}
+
+// Feeds bytes to a Security+1.0 candidate at the given times, returns how many frames it decoded
+static uint8_t sec1_feed(CandidateSecPlus1 &c, const uint8_t *bytes, const uint32_t *times, uint8_t n,
+                         ShadowFrame &frame, ShadowState &st) {
+    uint8_t decoded = 0;
+    for (uint8_t i = 0; i < n; i++) {
+        if (c.push(times[i], bytes[i], frame, st)) {
+            decoded++;
+        }
+    }
+    return decoded;
+}
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+void test_shadow_secplus2_agrees(void) {
+    ShadowCompare shadow;
+    CandidateSecPlus2 production;
+    CandidateSecPlus2 candidate;
+    ShadowFrame frame;
+    ShadowState st;
+
+    // line noise first, then two copies of the packet
+    const uint8_t noise[] = {0x00, 0x55, 0x01, 0x12};
+    for (uint8_t b : noise) {
+        TEST_ASSERT_FALSE(production.push(0, b, frame, st));
+        TEST_ASSERT_FALSE(candidate.push(0, b, frame, st));
+    }
+    for (uint8_t copy = 0; copy < 2; copy++) {
+        for (uint8_t i = 0; i < SECPLUS2_CODE_LEN; i++) {
+            if (production.push(i, status_pkt[i], frame, st)) {
+                shadow.production(i, frame, st);
+            }
+            if (candidate.push(i, status_pkt[i], frame, st)) {
+                shadow.candidate(i, frame, st);
+            }
+        }
+    }
+    TEST_ASSERT_EQUAL(2, shadow.frames);
+    TEST_ASSERT_EQUAL(0, shadow.disagreements);
+    TEST_ASSERT_NULL(shadow.recent(0));
+
+    TEST_ASSERT_EQUAL_HEX(0x52402A, frame.remote);
+    TEST_ASSERT_EQUAL_HEX(0x17702, frame.rolling);
+    TEST_ASSERT_EQUAL((uint8_t)DoorState::Closed, st.door);
+    TEST_ASSERT_EQUAL(1, st.light);
+    TEST_ASSERT_EQUAL(0, st.lock);
+    TEST_ASSERT_EQUAL(1, st.obstruction);
+}
+
+void test_shadow_mismatches(void) {
+    ShadowCompare shadow;
+    ShadowState closed = state((uint8_t)DoorState::Closed, 0, 0);
+    ShadowState open = state((uint8_t)DoorState::Open, 0, 0);
+
+    shadow.production(100, ShadowFrame::from_secplus1(0x38, 0x55), closed);
+    shadow.candidate(101, ShadowFrame::from_secplus1(0x38, 0x05), closed);
+    shadow.candidate(200, ShadowFrame::from_secplus1(0x38, 0x52), open);
+    shadow.production(201, ShadowFrame::from_secplus1(0x38, 0x52), closed);
+    TEST_ASSERT_EQUAL(2, shadow.frames);
+    TEST_ASSERT_EQUAL(2, shadow.disagreements);
+
+    const ShadowRecord *r = shadow.recent(0);
+    TEST_ASSERT_NOT_NULL(r);
+    TEST_ASSERT_EQUAL(ShadowMismatch::State, r->kind);
+    TEST_ASSERT_EQUAL(201, r->time);
+    TEST_ASSERT_EQUAL((uint8_t)DoorState::Closed, r->production_state.door);
+    TEST_ASSERT_EQUAL((uint8_t)DoorState::Open, r->candidate_state.door);
+
+    r = shadow.recent(1);
+    TEST_ASSERT_EQUAL(ShadowMismatch::Frame, r->kind);
+    TEST_ASSERT_EQUAL(0x55, r->production.data);
+    TEST_ASSERT_EQUAL(0x05, r->candidate.data);
+    TEST_ASSERT_NULL(shadow.recent(2));
+
+    char buf[200];
+    ShadowCompare::to_string(r, buf, sizeof(buf));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "101 frame: production 038 00000055"));
+}
+
+void test_shadow_one_side_only(void) {
+    ShadowCompare shadow;
+    ShadowState s;
+
+    // the candidate misses everything, production gets ahead by more than can be held
+    for (uint8_t i = 0; i < SHADOW_PENDING + 2; i++) {
+        shadow.production(i, ShadowFrame::from_secplus1(0x30 + i, 0), s);
+    }
+    TEST_ASSERT_EQUAL(0, shadow.frames);
+    TEST_ASSERT_EQUAL(2, shadow.disagreements);
+    TEST_ASSERT_EQUAL(ShadowMismatch::ProductionOnly, shadow.recent(0)->kind);
+    TEST_ASSERT_EQUAL(0x31, shadow.recent(0)->production.cmd);
+    TEST_ASSERT_EQUAL(0x30, shadow.recent(1)->production.cmd);
+
+    // the oldest still held is matched next
+    shadow.candidate(10, ShadowFrame::from_secplus1(0x32, 0), s);
+    TEST_ASSERT_EQUAL(1, shadow.frames);
+    TEST_ASSERT_EQUAL(2, shadow.disagreements);
+
+    // and the ring keeps only the most recent
+    ShadowCompare other;
+    for (uint8_t i = 0; i < SHADOW_RING_SIZE + SHADOW_PENDING + 3; i++) {
+        other.candidate(i, ShadowFrame::from_secplus1(0x30, i), s);
+    }
+    TEST_ASSERT_EQUAL(SHADOW_RING_SIZE + 3, other.disagreements);
+    TEST_ASSERT_EQUAL(ShadowMismatch::CandidateOnly, other.recent(0)->kind);
+    TEST_ASSERT_EQUAL(SHADOW_RING_SIZE + 2, other.recent(0)->candidate.data);
+    TEST_ASSERT_EQUAL(3, other.recent(SHADOW_RING_SIZE - 1)->candidate.data);
+    TEST_ASSERT_NULL(other.recent(SHADOW_RING_SIZE));
+}
+
+void test_shadow_secplus1_candidate(void) {
+    CandidateSecPlus1 c;
+    ShadowFrame frame;
+    ShadowState st;
+
+    // a button press is one byte, anything outside 0x30-0x3A is ignored
+    const uint8_t press[] = {0x12, 0x30};
+    const uint32_t press_t[] = {0, 10};
+    TEST_ASSERT_EQUAL(1, sec1_feed(c, press, press_t, 2, frame, st));
+    TEST_ASSERT_EQUAL(0x30, frame.cmd);
+    TEST_ASSERT_EQUAL(SHADOW_UNKNOWN, st.door);
+
+    // a door state is believed the second time it is seen
+    const uint8_t door[] = {0x38, 0x55, 0x38, 0x55};
+    const uint32_t door_t[] = {100, 110, 600, 610};
+    TEST_ASSERT_EQUAL(1, sec1_feed(c, door, door_t, 2, frame, st));
+    TEST_ASSERT_EQUAL(SHADOW_UNKNOWN, st.door);
+    TEST_ASSERT_EQUAL(1, sec1_feed(c, door + 2, door_t + 2, 2, frame, st));
+    TEST_ASSERT_EQUAL(0x38, frame.cmd);
+    TEST_ASSERT_EQUAL(0x55, frame.data);
+    TEST_ASSERT_EQUAL((uint8_t)DoorState::Closed, st.door);
+
+    // light on, unlocked; a collision is not believed
+    const uint8_t light[] = {0x3A, 0x54, 0x3A, 0x08};
+    const uint32_t light_t[] = {700, 710, 800, 810};
+    TEST_ASSERT_EQUAL(2, sec1_feed(c, light, light_t, 4, frame, st));
+    TEST_ASSERT_EQUAL(1, st.light);
+    TEST_ASSERT_EQUAL(1, st.lock);
+
+    // an answer that never comes, the next poll starts a new message
+    const uint8_t lost[] = {0x38, 0x3A, 0x50};
+    const uint32_t lost_t[] = {900, 1200, 1210};
+    TEST_ASSERT_EQUAL(1, sec1_feed(c, lost, lost_t, 3, frame, st));
+    TEST_ASSERT_EQUAL(0x3A, frame.cmd);
+    TEST_ASSERT_EQUAL(0x50, frame.data);
+    TEST_ASSERT_EQUAL(0, st.light);
+    TEST_ASSERT_EQUAL(1, st.lock);
+    TEST_ASSERT_EQUAL((uint8_t)DoorState::Closed, st.door);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_shadow_secplus2_agrees);
+    RUN_TEST(test_shadow_mismatches);
+    RUN_TEST(test_shadow_one_side_only);
+    RUN_TEST(test_shadow_secplus1_candidate);
+    UNITY_END();
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <string.h>
+#include <SSEFilter.h>
+
+// as built by web_loop(), after REMOVE_NL
+static const char *delta = "{ \"garageDoorState\": \"Opening\", \"garageLightOn\": true, \"upTime\": 123456 }";
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+void test_sse_filter_parse(void) {
+    TEST_ASSERT_EQUAL(SSE_EVENT_STATUS | SSE_EVENT_LOG, SSEFilter::parse_events("status,log"));
+    TEST_ASSERT_EQUAL(SSE_EVENT_ALL, SSEFilter::parse_events("all"));
+    TEST_ASSERT_EQUAL(SSE_EVENT_HEARTBEAT, SSEFilter::parse_events(",bogus,heartbeat,"));
+    TEST_ASSERT_EQUAL(0, SSEFilter::parse_events(""));
+
+    uint16_t fields = SSEFilter::parse_fields("garageDoorState,garageObstructed,nonsense");
+    TEST_ASSERT_EQUAL(SSEFilter::field_bit("garageDoorState", 15) | SSEFilter::field_bit("garageObstructed", 16), fields);
+    TEST_ASSERT_EQUAL(SSE_FIELD_UPTIME, SSEFilter::field_bit("upTime", 6));
+    TEST_ASSERT_EQUAL(SSE_FIELD_OTHER, SSEFilter::field_bit("freeHeap", 8));
+}
+
+void test_sse_filter_wants(void) {
+    uint16_t present = SSEFilter::frame_fields(delta);
+    uint16_t door = SSEFilter::parse_fields("garageDoorState") | SSE_FIELD_UPTIME;
+    uint16_t motion = SSEFilter::parse_fields("garageMotion") | SSE_FIELD_UPTIME;
+    TEST_ASSERT_TRUE(SSEFilter::wants(present, SSE_FIELDS_ALL));
+    TEST_ASSERT_TRUE(SSEFilter::wants(present, door));
+    // upTime alone isn't worth a frame
+    TEST_ASSERT_FALSE(SSEFilter::wants(present, motion));
+}
+
+void test_sse_filter_trim(void) {
+    char out[128];
+    uint16_t door = SSEFilter::parse_fields("garageDoorState") | SSE_FIELD_UPTIME;
+    size_t n = SSEFilter::trim(delta, door, out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("{\"garageDoorState\": \"Opening\", \"upTime\": 123456 }", out);
+    TEST_ASSERT_EQUAL(strlen(out), n);
+
+    // commas and braces inside strings, and escaped quotes, are not separators
+    const char *tricky = "{ \"paired\": false, \"garageLockState\": \"a,\\\"b}\", \"upTime\": 1 }";
+    n = SSEFilter::trim(tricky, SSEFilter::parse_fields("garageLockState"), out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("{\"garageLockState\": \"a,\\\"b}\"}", out);
+
+    // too long for the buffer
+    TEST_ASSERT_EQUAL(0, SSEFilter::trim(delta, SSE_FIELDS_ALL, out, 20));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_sse_filter_parse);
+    RUN_TEST(test_sse_filter_wants);
+    RUN_TEST(test_sse_filter_trim);
+    UNITY_END();
+
+    return 0;
+}
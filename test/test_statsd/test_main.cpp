@@ -0,0 +1,210 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <StatsD.h>
+
+// Sends datagrams to a listener on 127.0.0.1, as WiFiUDP does on the device
+struct UdpSink {
+    int fd = -1;
+    sockaddr_in addr = {};
+    uint32_t errors = 0;
+
+    void send(const char* buf, size_t len) {
+        if (sendto(fd, buf, len, 0, (const sockaddr*)&addr, sizeof(addr)) != (ssize_t)len) {
+            errors++;
+        }
+    }
+};
+
+struct Listener {
+    int fd = -1;
+    sockaddr_in addr = {};
+
+    void open() {
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        TEST_ASSERT_TRUE(fd >= 0);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        TEST_ASSERT_EQUAL(0, bind(fd, (const sockaddr*)&addr, sizeof(addr)));
+        socklen_t len = sizeof(addr);
+        TEST_ASSERT_EQUAL(0, getsockname(fd, (sockaddr*)&addr, &len));
+        timeval tv = {0, 200000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+
+    // The next datagram, NUL terminated, or -1 if none came
+    int recv(char* buf, size_t size) {
+        ssize_t n = ::recv(fd, buf, size - 1, 0);
+        if (n < 0) {
+            return -1;
+        }
+        buf[n] = 0;
+        return (int)n;
+    }
+
+    void close() {
+        ::close(fd);
+    }
+};
+
+static Listener listener;
+static UdpSink sink;
+
+void setUp(void) {
+    listener.open();
+    sink.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sink.addr = listener.addr;
+    sink.errors = 0;
+}
+
+void tearDown(void) {
+    close(sink.fd);
+    listener.close();
+}
+
+void test_statsd_lines(void) {
+    StatsdPacket<UdpSink> statsd(sink);
+    char buf[STATSD_PACKET_SIZE * 2];
+    uint32_t collisions = 5;
+    uint32_t last = 0;
+
+    statsd.begin("Garage Door.1:x|y");
+    statsd.count("tx.collisions", collisions, last);
+    statsd.gauge("heap.free", 24816);
+    statsd.gauge("wifi.rssi", -61);
+    statsd.flush();
+    TEST_ASSERT_EQUAL(1, statsd.packets);
+    TEST_ASSERT_TRUE(listener.recv(buf, sizeof(buf)) > 0);
+    TEST_ASSERT_EQUAL_STRING(
+        "ratgdo.Garage_Door_1_x_y.tx.collisions:5|c\n"
+        "ratgdo.Garage_Door_1_x_y.heap.free:24816|g\n"
+        "ratgdo.Garage_Door_1_x_y.wifi.rssi:-61|g\n", buf);
+
+    // only the increase is sent, and nothing without one
+    collisions = 7;
+    statsd.count("tx.collisions", collisions, last);
+    statsd.count("tx.collisions", collisions, last);
+    statsd.flush();
+    TEST_ASSERT_TRUE(listener.recv(buf, sizeof(buf)) > 0);
+    TEST_ASSERT_EQUAL_STRING("ratgdo.Garage_Door_1_x_y.tx.collisions:2|c\n", buf);
+
+    // nothing to send, no datagram
+    statsd.count("tx.collisions", collisions, last);
+    statsd.flush();
+    TEST_ASSERT_EQUAL(2, statsd.packets);
+    TEST_ASSERT_EQUAL(-1, listener.recv(buf, sizeof(buf)));
+
+    // a long name is cut short, still ending in '.'
+    statsd.begin("a-very-long-device-name-that-does-not-fit-in-the-prefix");
+    statsd.gauge("g", 1);
+    statsd.flush();
+    TEST_ASSERT_TRUE(listener.recv(buf, sizeof(buf)) > 0);
+    TEST_ASSERT_EQUAL(STATSD_PREFIX_SIZE - 1, strstr(buf, "g:1|g") - buf);
+    TEST_ASSERT_EQUAL('.', buf[STATSD_PREFIX_SIZE - 2]);
+    TEST_ASSERT_EQUAL(0, sink.errors);
+}
+
+void test_statsd_split(void) {
+    StatsdPacket<UdpSink> statsd(sink);
+    char buf[STATSD_PACKET_SIZE * 2];
+    char name[32];
+
+    // more than fits in a datagram, each line whole and no datagram over the limit
+    statsd.begin("garage");
+    const uint32_t n = 60;
+    for (uint32_t i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "rx.cmd.metric_%u", i);
+        statsd.gauge(name, i * 1000);
+    }
+    statsd.flush();
+
+    uint32_t lines = 0;
+    uint32_t datagrams = 0;
+    int len;
+    while ((len = listener.recv(buf, sizeof(buf))) > 0) {
+        TEST_ASSERT_TRUE(len <= STATSD_PACKET_SIZE);
+        TEST_ASSERT_EQUAL('\n', buf[len - 1]);
+        for (char* l = buf; *l; l = strchr(l, '\n') + 1) {
+            unsigned idx;
+            int value;
+            TEST_ASSERT_EQUAL(2, sscanf(l, "ratgdo.garage.rx.cmd.metric_%u:%d|g", &idx, &value));
+            TEST_ASSERT_EQUAL(lines, idx);
+            TEST_ASSERT_EQUAL(idx * 1000, value);
+            lines++;
+        }
+        datagrams++;
+    }
+    TEST_ASSERT_EQUAL(n, lines);
+    TEST_ASSERT_EQUAL(n, statsd.lines);
+    TEST_ASSERT_EQUAL(datagrams, statsd.packets);
+    TEST_ASSERT_TRUE(datagrams > 1);
+    printf("\n%u lines in %u datagrams\n", lines, datagrams);
+
+    // a line that can't be sent is dropped, not cut
+    char longname[STATSD_LINE_SIZE];
+    memset(longname, 'x', sizeof(longname) - 1);
+    longname[sizeof(longname) - 1] = 0;
+    statsd.gauge(longname, 1);
+    statsd.flush();
+    TEST_ASSERT_EQUAL(1, statsd.dropped);
+    TEST_ASSERT_EQUAL(-1, listener.recv(buf, sizeof(buf)));
+}
+
+void test_statsd_keyed_counts(void) {
+    StatsdKeyedCounts counts;
+    for (uint16_t key = 0; key < STATSD_KEYS + 3; key++) {
+        counts.add(0x100 + key);
+    }
+    counts.add(0x100);
+    TEST_ASSERT_EQUAL(STATSD_KEYS, counts.used);
+    TEST_ASSERT_EQUAL(2, counts.counts[0]);
+    TEST_ASSERT_EQUAL(1, counts.counts[STATSD_KEYS - 1]);
+    TEST_ASSERT_EQUAL(3, counts.other);
+}
+
+void test_statsd_histogram(void) {
+    StatsdHistogram hist;
+    TEST_ASSERT_EQUAL(0, hist.percentile(99));
+
+    // every value falls in a bucket that holds it
+    for (uint32_t v = 0; v < 100000; v++) {
+        uint8_t b = StatsdHistogram::bucket(v);
+        TEST_ASSERT_TRUE(v <= StatsdHistogram::upper(b));
+        TEST_ASSERT_TRUE(b == 0 || v > StatsdHistogram::upper(b - 1));
+    }
+
+    // loops of about 100us, with the odd 5ms one
+    for (uint32_t i = 0; i < 995; i++) {
+        hist.add(90 + i % 20);
+    }
+    for (uint32_t i = 0; i < 5; i++) {
+        hist.add(5000);
+    }
+    TEST_ASSERT_EQUAL(1000, hist.samples);
+    TEST_ASSERT_EQUAL(127, hist.percentile(99));
+    TEST_ASSERT_EQUAL(6143, hist.percentile(100));
+    TEST_ASSERT_EQUAL(95, hist.percentile(10));
+
+    hist.reset();
+    TEST_ASSERT_EQUAL(0, hist.samples);
+    TEST_ASSERT_EQUAL(0, hist.percentile(99));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_statsd_lines);
+    RUN_TEST(test_statsd_split);
+    RUN_TEST(test_statsd_keyed_counts);
+    RUN_TEST(test_statsd_histogram);
+    UNITY_END();
+
+    return 0;
+}
@@ -0,0 +1,213 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <TimerUart.h>
+#include <EdgeUart.h>
+#include <TxBatch.h>
+
+// 9600 and 1200 baud at 80MHz
+#define BIT_CYCLES_9600 (80000000 / 9600)
+#define BIT_CYCLES_1200 (80000000 / 1200)
+
+// Obstruction sensor model, as obstruction_timer() in ratgdo.cpp counts it
+#define OBST_PULSE_US 7000          // a low pulse every 7ms while clear
+#define OBST_CHECK_US 50000         // counted per 50ms
+#define OBST_LOWER_LIMIT 3          // more than this is clear
+#define OBST_RUN_US 400000
+#define TIMER_ISR_US 5              // timer ISR with the core's dispatch, interrupts masked
+
+struct Mask {
+    uint32_t start;     // us
+    uint32_t end;
+};
+
+// Sends `buf` by calling tick() at each bit boundary, `late(n)` cycles after it, and feeds the
+// (inverted) line to an edge decoder. Returns the number of ticks until done.
+template <typename Late>
+static uint32_t send(TimerUartTx &tx, EdgeUartDecoder &rx, const uint8_t *buf, size_t len,
+                     uint32_t bit_cycles, Late late) {
+    uint32_t t0 = 1000;
+    TEST_ASSERT_TRUE(tx.start(buf, len, t0));
+    bool pin = false;   // idle, inverted
+    bool done = false;
+    uint32_t n = 0;
+    uint32_t now = t0;
+    while (!done && n < 1000) {
+        now = t0 + n * bit_cycles + late(n);
+        bool mark = tx.tick(now, &done);
+        if (mark == pin) {
+            // the pin changes
+            pin = !mark;
+            rx.edge(now, pin);
+        }
+        n++;
+    }
+    rx.idle(now + 20 * bit_cycles);
+    return n;
+}
+
+// How many of the obstruction sensor's pulses land in each window with interrupts masked over
+// `masks`. Edges while masked are latched, several of them are serviced as one.
+static void count_pulses(const Mask *masks, uint32_t n, uint32_t phase, uint32_t *min_count, uint32_t *lost) {
+    uint32_t windows[OBST_RUN_US / OBST_CHECK_US] = {0};
+    int32_t pending_mask = -1;
+    for (uint32_t t = phase; t < OBST_RUN_US; t += OBST_PULSE_US) {
+        uint32_t serviced = t;
+        int32_t in_mask = -1;
+        for (uint32_t m = 0; m < n; m++) {
+            if (t >= masks[m].start && t < masks[m].end) {
+                in_mask = m;
+                serviced = masks[m].end;
+            }
+        }
+        if (in_mask >= 0 && in_mask == pending_mask) {
+            (*lost)++;
+            continue;
+        }
+        pending_mask = in_mask;
+        if (serviced < OBST_RUN_US) {
+            windows[serviced / OBST_CHECK_US]++;
+        }
+    }
+    // the first window is partly before the first pulse
+    for (uint32_t w = 1; w < OBST_RUN_US / OBST_CHECK_US; w++) {
+        if (windows[w] < *min_count) {
+            *min_count = windows[w];
+        }
+    }
+}
+
+// Masked intervals of a Security+2.0 door command, three packets in one claim from `start`:
+// the whole of each write with SoftwareSerial, one ISR per bit with the timer
+static uint32_t door_command_masks(Mask *masks, bool timer, uint32_t start) {
+    const uint32_t bit_us = 1000000 / 9600;
+    const uint32_t packet_us = SECPLUS2_CODE_LEN * 10 * 1000000 / 9600;
+    uint32_t n = 0;
+    uint32_t t = start;
+    for (uint8_t p = 0; p < TX_BATCH_MAX; p++) {
+        if (timer) {
+            for (uint32_t b = 1; b <= SECPLUS2_CODE_LEN * 10; b++) {
+                masks[n++] = {t + b * bit_us, t + b * bit_us + TIMER_ISR_US};
+            }
+        } else {
+            masks[n++] = {t, t + packet_us};
+        }
+        t += packet_us + 100 + TX_BATCH_GAP;
+    }
+    return n;
+}
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+void test_timer_uart_frames(void) {
+    TimerUartTx tx;
+    EdgeUartDecoder rx;
+    const uint8_t pkt[SECPLUS2_CODE_LEN] = {
+        0x55, 0x01, 0x00, 0xA5, 0x2F, 0xB3, 0xDB, 0xCE, 0x8F, 0x5B, 0x0C, 0x40, 0x34, 0xB9, 0x71, 0x96, 0x73, 0xFD, 0xBA };
+
+    // 8N1, ten bits a character and one more tick to end the last stop bit
+    tx.begin(BIT_CYCLES_9600, false);
+    rx.begin(BIT_CYCLES_9600, false, true);
+    uint32_t ticks = send(tx, rx, pkt, sizeof(pkt), BIT_CYCLES_9600, [](uint32_t) { return 0u; });
+    TEST_ASSERT_EQUAL(sizeof(pkt) * 10 + 1, ticks);
+    TEST_ASSERT_FALSE(tx.busy());
+    TEST_ASSERT_EQUAL(sizeof(pkt), rx.available());
+    for (uint8_t i = 0; i < sizeof(pkt); i++) {
+        TEST_ASSERT_EQUAL_HEX(pkt[i], rx.read());
+    }
+    TEST_ASSERT_EQUAL(0, rx.framing_errors);
+
+    // 8E1, a Security+1.0 poll
+    const uint8_t poll[] = {0x38, 0x3A};
+    tx.begin(BIT_CYCLES_1200, true);
+    rx.begin(BIT_CYCLES_1200, true, true);
+    ticks = send(tx, rx, poll, sizeof(poll), BIT_CYCLES_1200, [](uint32_t) { return 0u; });
+    TEST_ASSERT_EQUAL(sizeof(poll) * 11 + 1, ticks);
+    TEST_ASSERT_EQUAL(2, rx.available());
+    TEST_ASSERT_EQUAL_HEX(0x38, rx.read());
+    TEST_ASSERT_EQUAL_HEX(0x3A, rx.read());
+    TEST_ASSERT_EQUAL(0, rx.parity_errors);
+
+    // too long, or while busy
+    uint8_t big[TIMER_UART_TX_SIZE + 1] = {0};
+    TEST_ASSERT_FALSE(tx.start(big, sizeof(big), 0));
+    TEST_ASSERT_TRUE(tx.start(big, 1, 0));
+    TEST_ASSERT_FALSE(tx.start(big, 1, 0));
+}
+
+void test_timer_uart_late(void) {
+    TimerUartTx tx;
+    EdgeUartDecoder rx;
+    const uint8_t data[] = {0x55, 0x01, 0x00, 0xFF, 0x00};
+    tx.begin(BIT_CYCLES_9600, false);
+    rx.begin(BIT_CYCLES_9600, false, true);
+
+    // ISRs up to a quarter bit late still make good characters, and the bits after them keep time
+    uint32_t ticks = send(tx, rx, data, sizeof(data), BIT_CYCLES_9600,
+                          [](uint32_t n) { return (n * 7919u) % (BIT_CYCLES_9600 / 4); });
+    TEST_ASSERT_EQUAL(sizeof(data) * 10 + 1, ticks);
+    TEST_ASSERT_EQUAL(sizeof(data), rx.available());
+    for (uint8_t i = 0; i < sizeof(data); i++) {
+        TEST_ASSERT_EQUAL_HEX(data[i], rx.read());
+    }
+    TEST_ASSERT_TRUE(tx.late_max > BIT_CYCLES_9600 / 8);
+    TEST_ASSERT_TRUE(tx.late_max < BIT_CYCLES_9600 / 4);
+    TEST_ASSERT_EQUAL(0, tx.missed);
+
+    // an interrupt held off for more than a bit is counted
+    bool done;
+    tx.late_max = 0;
+    TEST_ASSERT_TRUE(tx.start(data, 1, 0));
+    tx.tick(0, &done);
+    tx.tick(BIT_CYCLES_9600 * 2 + 10, &done);
+    TEST_ASSERT_EQUAL(1, tx.missed);
+    TEST_ASSERT_EQUAL(10, tx.late_max);
+}
+
+void test_timer_uart_obstruction(void) {
+    static Mask masks[TX_BATCH_MAX * SECPLUS2_CODE_LEN * 10];
+    const char *names[2] = {"SoftwareSerial", "timer"};
+    uint32_t min_count[2];
+    uint32_t lost[2];
+
+    printf("\nObstruction pulses per %ums with a door command sent, %u expected, clear above %u:\n",
+           OBST_CHECK_US / 1000, OBST_CHECK_US / OBST_PULSE_US, OBST_LOWER_LIMIT);
+    for (uint8_t timer = 0; timer < 2; timer++) {
+        min_count[timer] = UINT32_MAX;
+        lost[timer] = 0;
+        uint32_t longest = 0;
+        uint32_t runs = 0;
+        // every phase of the pulses against the command
+        for (uint32_t phase = 0; phase < OBST_PULSE_US; phase += 250) {
+            uint32_t n = door_command_masks(masks, timer, 100000);
+            count_pulses(masks, n, phase, &min_count[timer], &lost[timer]);
+            for (uint32_t m = 0; m < n; m++) {
+                if (masks[m].end - masks[m].start > longest) {
+                    longest = masks[m].end - masks[m].start;
+                }
+            }
+            runs++;
+        }
+        printf("  %-14s longest masked %5u us, min %u pulses in a window, %.2f pulses lost per command\n",
+               names[timer], longest, min_count[timer], (double)lost[timer] / runs);
+    }
+
+    TEST_ASSERT_EQUAL(0, lost[1]);
+    TEST_ASSERT_EQUAL(OBST_CHECK_US / OBST_PULSE_US, min_count[1]);
+    TEST_ASSERT_TRUE(lost[0] > 0);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_timer_uart_frames);
+    RUN_TEST(test_timer_uart_late);
+    RUN_TEST(test_timer_uart_obstruction);
+    UNITY_END();
+
+    return 0;
+}
@@ -0,0 +1,223 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <TxBatch.h>
+#include <VirtualOpener.h>
+
+// A door command sent to the virtual opener, batched and one packet per pass of comms_loop as
+// before. The opener starts a Motion packet at each offset in turn, and collisions and the time
+// until the last packet is on the line are compared.
+
+#define COMMS_PASS_US 200       // a pass of comms_loop, one byte read per pass
+#define MOTION_OFFSETS 150      // ms after the command starts, one run for each
+
+// The line to the virtual opener, with the time kept in microseconds
+struct TestLine {
+    VirtualOpener &v;
+    uint64_t us = 0;
+    uint64_t last_end = 0;      // our last packet off the line
+    uint64_t motion_at = UINT64_MAX;
+
+    TestLine(VirtualOpener &v) : v(v) {}
+
+    uint32_t ms() { return us / 1000; }
+
+    // the opener speaks when it has something to say
+    void tick() {
+        if (us >= motion_at) {
+            motion_at = UINT64_MAX;
+            v.motion(ms());
+        }
+    }
+
+    bool claim() {
+        us += 1430;
+        tick();
+        return !v.sending(ms());
+    }
+
+    bool busy() {
+        tick();
+        return v.sending(ms());
+    }
+
+    void write(const uint8_t *buf, size_t len) {
+        v.write(ms(), buf, len);
+        us += len * VOPENER_SEC2_BYTE_US + 100;
+        last_end = us;
+        tick();
+    }
+
+    void wait_us(uint32_t t) {
+        us += t;
+        tick();
+    }
+};
+
+struct FlowResult {
+    uint32_t done_us;
+    TxStats stats;
+};
+
+static void encode(uint8_t *buf, PacketCommand cmd, PacketData data, uint32_t rolling) {
+    Packet pkt = Packet(cmd, data, 0x539);
+    TEST_ASSERT_EQUAL(0, pkt.encode(rolling, buf));
+}
+
+// Press, release and GetStatus, as door_command() queues them
+static void door_command(uint8_t bufs[TX_BATCH_MAX][SECPLUS2_CODE_LEN]) {
+    PacketData data;
+    data.type = PacketDataType::DoorAction;
+    data.value.door_action = DoorActionCommandData(0);
+    data.value.door_action.action = DoorAction::Toggle;
+    data.value.door_action.pressed = true;
+    data.value.door_action.id = 1;
+    encode(bufs[0], PacketCommand::DoorAction, data, 100);
+    data.value.door_action.pressed = false;
+    encode(bufs[1], PacketCommand::DoorAction, data, 100);
+
+    data.type = PacketDataType::NoData;
+    data.value.no_data = NoData(0);
+    encode(bufs[2], PacketCommand::GetStatus, data, 101);
+}
+
+// Runs comms_loop until the command is out, `batched` or one packet per pass
+static FlowResult run_flow(bool batched, uint64_t motion_at) {
+    VirtualOpener v;
+    v.begin(2, 0);
+    TestLine line(v);
+    line.motion_at = motion_at;
+    FlowResult r = {};
+    uint8_t bufs[TX_BATCH_MAX][SECPLUS2_CODE_LEN];
+    door_command(bufs);
+
+    uint8_t next = 0;
+    while (next < TX_BATCH_MAX && line.us < 1000000) {
+        v.update(line.ms());
+        if (v.available()) {
+            v.read();
+        } else {
+            next += tx_batch(line, r.stats, bufs + next, batched ? TX_BATCH_MAX - next : 1);
+        }
+        line.us += COMMS_PASS_US;
+        line.tick();
+    }
+
+    TEST_ASSERT_EQUAL(TX_BATCH_MAX, next);
+    TEST_ASSERT_EQUAL(3, v.packets_rx);
+    TEST_ASSERT_EQUAL(DoorState::Opening, v.door());
+    TEST_ASSERT_EQUAL(0, v.overruns);
+    r.done_us = line.last_end;
+    return r;
+}
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+void test_tx_batch_one_claim(void) {
+    VirtualOpener v;
+    v.begin(2, 0);
+    TestLine line(v);
+    TxStats stats;
+    uint8_t bufs[TX_BATCH_MAX][SECPLUS2_CODE_LEN];
+    door_command(bufs);
+
+    TEST_ASSERT_EQUAL(3, tx_batch(line, stats, bufs, TX_BATCH_MAX));
+    TEST_ASSERT_EQUAL(1, stats.claims);
+    TEST_ASSERT_EQUAL(0, stats.collisions);
+    TEST_ASSERT_EQUAL(3, stats.packets);
+    TEST_ASSERT_EQUAL(1, stats.batches);
+    TEST_ASSERT_EQUAL(3, v.packets_rx);
+    TEST_ASSERT_EQUAL(DoorState::Opening, v.door());
+
+    // three packets and two gaps, after the wake pulse
+    uint32_t expected = 1430 + 3 * (SECPLUS2_CODE_LEN * VOPENER_SEC2_BYTE_US + 100) + 2 * TX_BATCH_GAP;
+    TEST_ASSERT_EQUAL(expected, line.last_end);
+
+    // a single packet is not a batch
+    TEST_ASSERT_EQUAL(1, tx_batch(line, stats, bufs + 2, 1));
+    TEST_ASSERT_EQUAL(2, stats.claims);
+    TEST_ASSERT_EQUAL(1, stats.batches);
+}
+
+void test_tx_batch_collision(void) {
+    VirtualOpener v;
+    v.begin(2, 0);
+    TestLine line(v);
+    TxStats stats;
+    uint8_t bufs[TX_BATCH_MAX][SECPLUS2_CODE_LEN];
+    door_command(bufs);
+
+    // the opener is talking, nothing goes out
+    v.motion(0);
+    TEST_ASSERT_EQUAL(0, tx_batch(line, stats, bufs, TX_BATCH_MAX));
+    TEST_ASSERT_EQUAL(1, stats.collisions);
+    TEST_ASSERT_EQUAL(0, v.packets_rx);
+
+    // the opener starts during the first packet and takes the gap, the rest is left
+    line.us = 100000;
+    line.motion_at = 110000;
+    TEST_ASSERT_EQUAL(1, tx_batch(line, stats, bufs, TX_BATCH_MAX));
+    TEST_ASSERT_EQUAL(2, stats.collisions);
+    TEST_ASSERT_EQUAL(1, v.packets_rx);
+    TEST_ASSERT_EQUAL(0, stats.batches);
+
+    // and goes out once the line is free
+    line.us = 200000;
+    v.update(line.ms());
+    TEST_ASSERT_EQUAL(2, tx_batch(line, stats, bufs + 1, TX_BATCH_MAX - 1));
+    TEST_ASSERT_EQUAL(3, v.packets_rx);
+    TEST_ASSERT_EQUAL(DoorState::Opening, v.door());
+}
+
+void test_tx_batch_compare(void) {
+    FlowResult quiet_single = run_flow(false, UINT64_MAX);
+    FlowResult quiet_batch = run_flow(true, UINT64_MAX);
+    TEST_ASSERT_EQUAL(3, quiet_single.stats.claims);
+    TEST_ASSERT_EQUAL(1, quiet_batch.stats.claims);
+    TEST_ASSERT_TRUE(quiet_batch.done_us < quiet_single.done_us);
+
+    printf("\nDoor command, quiet line: one per pass %.1f ms, %u claims; batched %.1f ms, %u claim\n",
+           quiet_single.done_us / 1000.0, quiet_single.stats.claims,
+           quiet_batch.done_us / 1000.0, quiet_batch.stats.claims);
+
+    // the opener starts a Motion packet somewhere in the first MOTION_OFFSETS ms
+    uint32_t claims[2] = {0, 0};
+    uint32_t collisions[2] = {0, 0};
+    uint64_t total_us[2] = {0, 0};
+    uint32_t worst_us[2] = {0, 0};
+    for (uint32_t offset = 0; offset < MOTION_OFFSETS; offset++) {
+        for (uint8_t batched = 0; batched < 2; batched++) {
+            FlowResult r = run_flow(batched, (uint64_t)offset * 1000);
+            claims[batched] += r.stats.claims;
+            collisions[batched] += r.stats.collisions;
+            total_us[batched] += r.done_us;
+            if (r.done_us > worst_us[batched]) {
+                worst_us[batched] = r.done_us;
+            }
+        }
+    }
+    const char *names[2] = {"one per pass", "batched"};
+    printf("Door command, opener talking at 0-%u ms:\n", MOTION_OFFSETS - 1);
+    for (uint8_t batched = 0; batched < 2; batched++) {
+        printf("  %-12s %.2f claims, %.2f collisions, %.1f ms mean, %.1f ms worst\n", names[batched],
+               (double)claims[batched] / MOTION_OFFSETS, (double)collisions[batched] / MOTION_OFFSETS,
+               total_us[batched] / 1000.0 / MOTION_OFFSETS, worst_us[batched] / 1000.0);
+    }
+    TEST_ASSERT_TRUE(claims[1] < claims[0]);
+    TEST_ASSERT_TRUE(total_us[1] < total_us[0]);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_tx_batch_one_claim);
+    RUN_TEST(test_tx_batch_collision);
+    RUN_TEST(test_tx_batch_compare);
+    UNITY_END();
+
+    return 0;
+}
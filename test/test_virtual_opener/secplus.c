@@ -0,0 +1 @@
+../../lib/secplus/src/secplus.c
\ No newline at end of file
@@ -0,0 +1,211 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <VirtualOpener.h>
+
+// Reads whatever the opener has put on the line by `now`, returns the last Security+2.0 packet seen
+static bool drain(VirtualOpener &v, SecPlus2Reader &reader, uint32_t now, Packet &last, int *count = nullptr) {
+    bool got = false;
+    v.update(now);
+    while (v.available()) {
+        if (reader.push_byte(v.read())) {
+            last = Packet(reader.fetch_buf());
+            got = true;
+            if (count) {
+                (*count)++;
+            }
+        }
+    }
+    return got;
+}
+
+static void send(VirtualOpener &v, uint32_t now, PacketCommand cmd, PacketData data, uint32_t rolling) {
+    uint8_t buf[SECPLUS2_CODE_LEN];
+    Packet pkt = Packet(cmd, data, 0x539);
+    TEST_ASSERT_EQUAL(0, pkt.encode(rolling, buf));
+    v.write(now, buf, SECPLUS2_CODE_LEN);
+}
+
+static void send_door(VirtualOpener &v, uint32_t now, DoorAction action, uint32_t rolling) {
+    PacketData data;
+    data.type = PacketDataType::DoorAction;
+    data.value.door_action = DoorActionCommandData(0);
+    data.value.door_action.action = action;
+    data.value.door_action.pressed = true;
+    data.value.door_action.id = 1;
+    send(v, now, PacketCommand::DoorAction, data, rolling);
+}
+
+static void send_no_data(VirtualOpener &v, uint32_t now, PacketCommand cmd, uint32_t rolling) {
+    PacketData data;
+    data.type = PacketDataType::NoData;
+    data.value.no_data = NoData(0);
+    send(v, now, cmd, data, rolling);
+}
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+void test_vopener_status_reply(void) {
+    VirtualOpener v;
+    SecPlus2Reader reader;
+    Packet pkt;
+    v.begin(2, 1000);
+
+    send_no_data(v, 1000, PacketCommand::GetStatus, 1);
+    TEST_ASSERT_EQUAL(1, v.packets_rx);
+    TEST_ASSERT_FALSE(v.sending(1000));
+
+    // our own packet is heard back first, one byte time per byte
+    TEST_ASSERT_EQUAL(0, v.available());
+    TEST_ASSERT_TRUE(drain(v, reader, 1030, pkt));
+    TEST_ASSERT_EQUAL(PacketCommand::GetStatus, pkt.m_pkt_cmd);
+
+    // then the answer, the reply delay after the end of ours, and its own time on the line
+    TEST_ASSERT_FALSE(drain(v, reader, 1020 + VOPENER_REPLY, pkt));
+    TEST_ASSERT_TRUE(v.sending(1020 + VOPENER_REPLY));
+    TEST_ASSERT_TRUE(drain(v, reader, 1020 + VOPENER_REPLY + 20, pkt));
+    TEST_ASSERT_EQUAL(PacketCommand::Status, pkt.m_pkt_cmd);
+    TEST_ASSERT_FALSE(v.sending(1020 + VOPENER_REPLY + 20));
+    TEST_ASSERT_EQUAL(VOPENER_REMOTE_ID, pkt.m_remote_id);
+    TEST_ASSERT_EQUAL(DoorState::Closed, pkt.m_data.value.status.door);
+    TEST_ASSERT_FALSE(pkt.m_data.value.status.light);
+    TEST_ASSERT_FALSE(pkt.m_data.value.status.obstruction);
+    TEST_ASSERT_EQUAL(1, v.packets_tx);
+
+    // rolling codes move on from one packet to the next
+    uint32_t first = pkt.m_rolling;
+    send_no_data(v, 2000, PacketCommand::GetOpenings, 2);
+    drain(v, reader, 2100, pkt);
+    TEST_ASSERT_EQUAL(PacketCommand::Openings, pkt.m_pkt_cmd);
+    TEST_ASSERT_EQUAL(0, pkt.m_data.value.openings.count);
+    TEST_ASSERT_EQUAL(first + 1, pkt.m_rolling);
+}
+
+void test_vopener_door_travel(void) {
+    VirtualOpener v;
+    SecPlus2Reader reader;
+    Packet pkt;
+    int count = 0;
+    v.begin(2, 0);
+
+    send_door(v, 0, DoorAction::Open, 1);
+    TEST_ASSERT_EQUAL(DoorState::Opening, v.door());
+    TEST_ASSERT_TRUE(v.light());
+    drain(v, reader, 150, pkt, &count);
+    // our own press, MotorOn, then the status
+    TEST_ASSERT_EQUAL(3, count);
+    TEST_ASSERT_EQUAL(PacketCommand::Status, pkt.m_pkt_cmd);
+    TEST_ASSERT_EQUAL(DoorState::Opening, pkt.m_data.value.status.door);
+    TEST_ASSERT_TRUE(pkt.m_data.value.status.light);
+
+    // stopped half way, then a toggle carries on the other way
+    drain(v, reader, VOPENER_TRAVEL / 2, pkt);
+    send_door(v, VOPENER_TRAVEL / 2, DoorAction::Stop, 2);
+    drain(v, reader, VOPENER_TRAVEL / 2 + 100, pkt);
+    TEST_ASSERT_EQUAL(DoorState::Stopped, pkt.m_data.value.status.door);
+    send_door(v, VOPENER_TRAVEL, DoorAction::Toggle, 3);
+    TEST_ASSERT_EQUAL(DoorState::Closing, v.door());
+    drain(v, reader, VOPENER_TRAVEL + VOPENER_TRAVEL / 2 - 100, pkt);
+    TEST_ASSERT_EQUAL(DoorState::Closing, v.door());
+    drain(v, reader, VOPENER_TRAVEL + VOPENER_TRAVEL / 2 + 100, pkt);
+    TEST_ASSERT_EQUAL(DoorState::Closed, v.door());
+    TEST_ASSERT_EQUAL(DoorState::Closed, pkt.m_data.value.status.door);
+
+    // the light goes off on its own
+    TEST_ASSERT_TRUE(v.light());
+    drain(v, reader, VOPENER_TRAVEL + VOPENER_LIGHT_TIMEOUT + 100, pkt);
+    TEST_ASSERT_FALSE(v.light());
+    TEST_ASSERT_FALSE(pkt.m_data.value.status.light);
+    TEST_ASSERT_EQUAL(0, v.overruns);
+}
+
+void test_vopener_obstruction(void) {
+    VirtualOpener v;
+    SecPlus2Reader reader;
+    Packet pkt;
+    v.begin(2, 0);
+
+    v.door_button(0);
+    drain(v, reader, VOPENER_TRAVEL + 100, pkt);
+    TEST_ASSERT_EQUAL(DoorState::Open, v.door());
+
+    // won't close while obstructed
+    v.obstruct(20000, true);
+    drain(v, reader, 20100, pkt);
+    TEST_ASSERT_TRUE(pkt.m_data.value.status.obstruction);
+    send_door(v, 20100, DoorAction::Close, 1);
+    TEST_ASSERT_EQUAL(DoorState::Open, v.door());
+    drain(v, reader, 20200, pkt);
+
+    // and reverses if obstructed while closing
+    v.obstruct(21000, false);
+    send_door(v, 21000, DoorAction::Close, 2);
+    TEST_ASSERT_EQUAL(DoorState::Closing, v.door());
+    v.obstruct(23000, true);
+    TEST_ASSERT_EQUAL(DoorState::Opening, v.door());
+    TEST_ASSERT_TRUE(v.obstructed());
+    drain(v, reader, 23000 + 2100, pkt);
+    TEST_ASSERT_EQUAL(DoorState::Open, v.door());
+    TEST_ASSERT_EQUAL(DoorState::Open, pkt.m_data.value.status.door);
+    TEST_ASSERT_EQUAL(0, v.overruns);
+}
+
+void test_vopener_secplus1(void) {
+    VirtualOpener v;
+    v.begin(1, 0);
+
+    uint8_t poll = 0x38;
+    v.write(0, &poll, 1);
+    // the poll comes back, then the answer, ~9ms per byte at 1200 baud
+    v.update(9);
+    TEST_ASSERT_EQUAL(0, v.available());
+    v.update(10);
+    TEST_ASSERT_EQUAL(1, v.available());
+    TEST_ASSERT_EQUAL_HEX(0x38, v.read());
+    v.update(10 + VOPENER_SEC1_REPLY + 10);
+    TEST_ASSERT_EQUAL_HEX(0x55, v.read());
+
+    // a door press, the door moves
+    uint8_t press[] = {0x30, 0x31};
+    v.write(100, press, 2);
+    v.update(200);
+    TEST_ASSERT_EQUAL(DoorState::Opening, v.door());
+    while (v.available()) {
+        v.read();
+    }
+    v.write(200, &poll, 1);
+    v.update(300);
+    TEST_ASSERT_EQUAL(2, v.available());
+    v.read();
+    TEST_ASSERT_EQUAL_HEX(0x01, v.read());
+
+    // light on with the door, unlocked
+    uint8_t light_lock = 0x3A;
+    v.write(300, &light_lock, 1);
+    v.update(400);
+    v.read();
+    TEST_ASSERT_EQUAL_HEX(0x5C, v.read());
+    uint8_t lock = 0x34;
+    v.write(400, &lock, 1);
+    v.write(500, &light_lock, 1);
+    v.update(600);
+    v.read();
+    v.read();
+    TEST_ASSERT_EQUAL_HEX(0x54, v.read());
+    TEST_ASSERT_EQUAL(0, v.available());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_vopener_status_reply);
+    RUN_TEST(test_vopener_door_travel);
+    RUN_TEST(test_vopener_obstruction);
+    RUN_TEST(test_vopener_secplus1);
+    UNITY_END();
+
+    return 0;
+}
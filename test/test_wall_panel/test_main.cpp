@@ -0,0 +1,241 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <WallPanelDetector.h>
+
+// A Security+1.0 line simulated a millisecond at a time: the opener answering polls, an optional
+// 889LM wall panel, and the ratgdo side running the detector and emulation as comms.cpp does.
+
+#define NEVER 0xFFFFFFFF
+
+static const uint8_t emulated[] = {0x35, 0x35, 0x33, 0x33, 0x38, 0x3A, 0x39};
+static const uint8_t panel_polls[] = {0x38, 0x3A, 0x39};
+
+struct Sim {
+    struct Byte {
+        uint32_t at;
+        uint8_t b;
+    };
+    Byte line[64];
+    uint8_t n = 0;
+
+    uint32_t panel_boot = NEVER;        // releases at boot, polls 3s later
+    uint32_t panel_polling = NEVER;     // polls without releases, panel already up
+
+    WallPanelDetector detector;
+    bool emulating = false;
+    uint32_t last_request = 0;
+    uint8_t index = 0;
+    uint32_t sent = 0;
+    uint32_t sent_after_detect = 0;
+    uint32_t detected_at = NEVER;
+
+    uint8_t request = 0;
+    uint8_t prev_door = 0xFF;
+    uint32_t known_at = NEVER;
+
+    void put(uint32_t at, uint8_t b) {
+        line[n++] = {at, b};
+    }
+
+    void panel(uint32_t now) {
+        if (panel_boot != NEVER && now >= panel_boot && now < panel_boot + 400 && (now - panel_boot) % 100 == 0) {
+            put(now, emulated[(now - panel_boot) / 100]);
+        }
+        uint32_t start = panel_polling != NEVER ? panel_polling : (panel_boot != NEVER ? panel_boot + 3000 : NEVER);
+        if (start != NEVER && now >= start && (now - start) % 250 == 0) {
+            put(now, panel_polls[((now - start) / 250) % 3]);
+        }
+    }
+
+    // everything on the line is heard by everyone, the opener answers polls 20ms later
+    void deliver(uint32_t now) {
+        uint8_t kept = 0;
+        for (uint8_t i = 0; i < n; i++) {
+            if (line[i].at != now) {
+                line[kept++] = line[i];
+                continue;
+            }
+            uint8_t b = line[i].b;
+            detector.rx(now, b);
+            if (request) {
+                if (request == 0x38 && known_at == NEVER) {
+                    // two matching answers, as comms_loop requires
+                    if (prev_door == b) {
+                        known_at = now;
+                    }
+                    prev_door = b;
+                }
+                request = 0;
+            } else if (b >= 0x38 && b <= 0x3A) {
+                request = b;
+            }
+        }
+        n = kept;
+    }
+
+    void opener(uint32_t now, uint8_t b) {
+        if (b == 0x38) {
+            put(now + 20, 0x55);        // closed
+        } else if (b == 0x3A) {
+            put(now + 20, 0x52);
+        } else if (b == 0x39) {
+            put(now + 20, 0x00);
+        }
+    }
+
+    void ratgdo(uint32_t now) {
+        WallPanel state = detector.update(now);
+        if (state == WallPanel::Present) {
+            if (detected_at == NEVER) {
+                detected_at = now;
+            }
+            emulating = false;
+            return;
+        }
+        if (state == WallPanel::Unknown) {
+            return;
+        }
+        if (!emulating) {
+            emulating = true;
+            last_request = 0;
+        }
+        if (now - last_request > 250) {
+            last_request = now;
+            uint8_t b = emulated[index++];
+            if (index == sizeof(emulated)) {
+                index = sizeof(emulated) - 3;
+            }
+            detector.tx(now, b);
+            put(now + 1, b);
+            sent++;
+        }
+    }
+
+    void run(uint32_t until) {
+        detector.begin(0);
+        for (uint32_t now = 1; now <= until; now++) {
+            uint8_t before = n;
+            panel(now);
+            for (uint8_t i = before; i < n; i++) {
+                opener(now, line[i].b);
+            }
+            uint32_t count = sent;
+            ratgdo(now);
+            if (sent != count) {
+                opener(now + 1, line[n - 1].b);
+                if (detected_at != NEVER) {
+                    sent_after_detect++;
+                }
+            }
+            deliver(now);
+        }
+    }
+};
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+void test_wall_panel_signature(void) {
+    WallPanelDetector d;
+    d.begin(0);
+
+    // lone opener bytes and a single stray poll are not a panel
+    d.rx(100, 0x55);
+    d.rx(200, 0x38);
+    d.rx(220, 0x55);
+    TEST_ASSERT_EQUAL(WallPanel::Unknown, d.update(300));
+    TEST_ASSERT_EQUAL(WallPanel::Unknown, d.update(1100));
+    TEST_ASSERT_EQUAL(WallPanel::Absent, d.update(1200));
+
+    // our own polls read back, and their answers, don't count
+    for (uint32_t t = 1300; t < 3000; t += 250) {
+        d.tx(t, 0x3A);
+        d.rx(t + 1, 0x3A);
+        d.rx(t + 20, 0x39);
+    }
+    TEST_ASSERT_EQUAL(WallPanel::Absent, d.update(3000));
+    TEST_ASSERT_EQUAL(1, d.panel_polls);
+
+    // a panel turning up later reverses the decision
+    d.rx(3100, 0x38);
+    d.rx(3120, 0x55);
+    d.rx(3350, 0x3A);
+    TEST_ASSERT_EQUAL(WallPanel::Present, d.update(3400));
+}
+
+void test_wall_panel_booting(void) {
+    WallPanelDetector d;
+    d.begin(0);
+    d.rx(10, 0x35);
+    d.rx(110, 0x35);
+    TEST_ASSERT_EQUAL(WallPanel::Unknown, d.update(5000));
+    d.rx(3000, 0x38);
+    d.rx(3250, 0x3A);
+    TEST_ASSERT_EQUAL(WallPanel::Present, d.update(3300));
+
+    // releases but never any polls, emulate after all
+    d.begin(0);
+    d.rx(10, 0x31);
+    TEST_ASSERT_EQUAL(WallPanel::Unknown, d.update(WALLPANEL_BOOT_WAIT));
+    TEST_ASSERT_EQUAL(WallPanel::Absent, d.update(WALLPANEL_BOOT_WAIT + 10));
+}
+
+void test_wall_panel_sim_no_panel(void) {
+    Sim sim;
+    sim.run(20000);
+    TEST_ASSERT_EQUAL(NEVER, sim.detected_at);
+    TEST_ASSERT_NOT_EQUAL(NEVER, sim.known_at);
+    printf("no panel: door state known after %u ms (was over 15000 ms)\n", sim.known_at);
+    // the release sequence, then two door polls
+    TEST_ASSERT_LESS_THAN(WALLPANEL_QUIET + 2000, sim.known_at);
+}
+
+void test_wall_panel_sim_panel(void) {
+    Sim sim;
+    sim.panel_polling = 100;
+    sim.run(20000);
+    printf("panel: detected after %u ms, door state known after %u ms\n", sim.detected_at, sim.known_at);
+    TEST_ASSERT_EQUAL(0, sim.sent);
+    // second poll
+    TEST_ASSERT_LESS_OR_EQUAL(400, sim.detected_at);
+    // the panel's second door poll
+    TEST_ASSERT_LESS_OR_EQUAL(900, sim.known_at);
+}
+
+void test_wall_panel_sim_panel_booting(void) {
+    Sim sim;
+    sim.panel_boot = 50;
+    sim.run(20000);
+    printf("booting panel: detected after %u ms, door state known after %u ms\n", sim.detected_at, sim.known_at);
+    TEST_ASSERT_EQUAL(0, sim.sent);
+    TEST_ASSERT_LESS_OR_EQUAL(3050 + 300, sim.detected_at);
+}
+
+void test_wall_panel_sim_panel_later(void) {
+    Sim sim;
+    sim.panel_boot = 20000;
+    sim.run(40000);
+    printf("late panel: emulation stopped %u ms after the panel's first poll\n", sim.detected_at - 23000);
+    TEST_ASSERT_LESS_THAN(3000, sim.known_at);
+    TEST_ASSERT_GREATER_THAN(0, sim.sent);
+    TEST_ASSERT_LESS_OR_EQUAL(23000 + 1000, sim.detected_at);
+    TEST_ASSERT_EQUAL(0, sim.sent_after_detect);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_wall_panel_signature);
+    RUN_TEST(test_wall_panel_booting);
+    RUN_TEST(test_wall_panel_sim_no_panel);
+    RUN_TEST(test_wall_panel_sim_panel);
+    RUN_TEST(test_wall_panel_sim_panel_booting);
+    RUN_TEST(test_wall_panel_sim_panel_later);
+    UNITY_END();
+
+    return 0;
+}
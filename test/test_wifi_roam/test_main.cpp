@@ -0,0 +1,136 @@
+
+#include <unity.h>
+#include <stdint.h>
+#include <WifiRoam.h>
+
+WifiRoam roam;
+
+static const uint8_t AP_NEAR[6] = {0x02, 0, 0, 0, 0, 0x01};
+static const uint8_t AP_FAR[6] = {0x02, 0, 0, 0, 0, 0x02};
+static const uint8_t AP_OTHER[6] = {0x02, 0, 0, 0, 0, 0x03};
+
+void setUp(void) {
+    roam = WifiRoam();
+}
+
+void tearDown(void) {
+}
+
+// feed the same RSSI once a second for `seconds`, returns the time after. With `traffic` our TCP
+// segments are being acked, or with `retransmitting` resent.
+static uint32_t hold(uint32_t now, uint32_t seconds, int32_t rssi, bool traffic = false, bool retransmitting = false) {
+    for (uint32_t i = 0; i < seconds; i++) {
+        roam.sample(now, rssi);
+        roam.uplink(traffic, retransmitting);
+        now += ROAM_SAMPLE_INTERVAL;
+    }
+    return now;
+}
+
+void test_wifi_roam_scan_schedule(void) {
+    roam.connected(0, 20);
+    TEST_ASSERT_FALSE(roam.scan_due(0));
+    uint32_t now = hold(0, ROAM_FIRST_SCAN / 1000, -60);
+    TEST_ASSERT_TRUE(roam.scan_due(now));
+    roam.scan_started(now);
+    TEST_ASSERT_FALSE(roam.scan_due(now + ROAM_SCAN_INTERVAL_WEAK));
+    TEST_ASSERT_TRUE(roam.scan_due(now + ROAM_SCAN_INTERVAL));
+
+    // weak links are scanned more often
+    now = hold(now, 60, -80);
+    TEST_ASSERT_TRUE(roam.weak());
+    TEST_ASSERT_TRUE(roam.scan_due(now - 60 * ROAM_SAMPLE_INTERVAL + ROAM_SCAN_INTERVAL_WEAK));
+    TEST_ASSERT_EQUAL(1, roam.scans);
+}
+
+void test_wifi_roam_target(void) {
+    roam.connected(0, 20);
+    uint32_t now = hold(0, 200, -78);
+
+    // not enough better
+    roam.scan_started(now);
+    roam.scan_result(AP_FAR, AP_FAR, 6, -78);
+    roam.scan_result(AP_FAR, AP_OTHER, 1, -72);
+    TEST_ASSERT_NULL(roam.roam_target(now));
+
+    // compared with the current AP as heard in the same scan, not the average
+    roam.scan_started(now);
+    roam.scan_result(AP_FAR, AP_OTHER, 1, -72);
+    roam.scan_result(AP_FAR, AP_NEAR, 11, -55);
+    roam.scan_result(AP_FAR, AP_FAR, 6, -70);
+    const RoamCandidate *target = roam.roam_target(now);
+    TEST_ASSERT_NOT_NULL(target);
+    TEST_ASSERT_EQUAL_MEMORY(AP_NEAR, target->bssid, 6);
+    TEST_ASSERT_EQUAL(11, target->channel);
+    TEST_ASSERT_EQUAL(-55, target->rssi);
+    roam.roam_started(now);
+    TEST_ASSERT_EQUAL(1, roam.roams);
+
+    // no ping-pong
+    roam.connected(now + 1000, 20);
+    roam.scan_started(now + 300000);
+    roam.scan_result(AP_NEAR, AP_FAR, 6, -40);
+    roam.scan_result(AP_NEAR, AP_NEAR, 11, -60);
+    TEST_ASSERT_NULL(roam.roam_target(now + 300000));
+    TEST_ASSERT_NOT_NULL(roam.roam_target(now + ROAM_HOLDOFF));
+}
+
+void test_wifi_roam_tx_power(void) {
+    roam.connected(0, 20);
+    uint32_t now = 0;
+    // a strong RSSI alone says nothing about how well the AP hears us
+    uint8_t power = 20;
+    for (int i = 0; i < 20; i++) {
+        now = hold(now, WIFI_TX_INTERVAL / 1000, -45);
+        power = roam.tx_power(now, 20);
+    }
+    TEST_ASSERT_EQUAL(20, power);
+
+    // strong and acked without retransmissions, step down, but not past the floor
+    for (int i = 0; i < 20; i++) {
+        now = hold(now, WIFI_TX_INTERVAL / 1000, -45, true);
+        power = roam.tx_power(now, 20);
+    }
+    TEST_ASSERT_EQUAL(WIFI_TX_MIN, power);
+
+    // a retransmission raises it quickly, and it stays up for a while however clean the link is
+    now = hold(now, WIFI_TX_INTERVAL / 1000 - 1, -45, true);
+    now = hold(now, 1, -45, true, true);
+    TEST_ASSERT_EQUAL(WIFI_TX_MIN + 4, roam.tx_power(now, 20));
+    TEST_ASSERT_EQUAL(1, roam.uplink_retries);
+    uint32_t raised = now;
+    while (now + WIFI_TX_INTERVAL - raised < WIFI_TX_HOLD) {
+        now = hold(now, WIFI_TX_INTERVAL / 1000, -45, true);
+        TEST_ASSERT_EQUAL(WIFI_TX_MIN + 4, roam.tx_power(now, 20));
+    }
+    now = hold(now, WIFI_TX_INTERVAL / 1000, -45, true);
+    TEST_ASSERT_EQUAL(WIFI_TX_MIN + 3, roam.tx_power(now, 20));
+
+    // so does a disconnect, up to the configured power
+    roam.link_error();
+    now = hold(now, WIFI_TX_INTERVAL / 1000, -45, true);
+    TEST_ASSERT_EQUAL(20, roam.tx_power(now, 20));
+
+    // middling signal holds it
+    now = hold(now, 120, -63, true);
+    power = roam.tx_power(now, 20);
+    now = hold(now, WIFI_TX_INTERVAL / 1000, -63, true);
+    TEST_ASSERT_EQUAL(power, roam.tx_power(now, 20));
+
+    // weak signal raises it, but never past the configured power
+    for (int i = 0; i < 10; i++) {
+        now = hold(now, WIFI_TX_INTERVAL / 1000, -75, true);
+        power = roam.tx_power(now, 17);
+    }
+    TEST_ASSERT_EQUAL(17, power);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_wifi_roam_scan_schedule);
+    RUN_TEST(test_wifi_roam_target);
+    RUN_TEST(test_wifi_roam_tx_power);
+    UNITY_END();
+
+    return 0;
+}